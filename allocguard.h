@@ -0,0 +1,69 @@
+#ifndef ALLOCGUARD_H
+#define ALLOCGUARD_H
+
+// ==================
+// Allocation Guard (debug builds)
+// ==================
+// Compile with -DVOICEMASK_ALLOC_GUARD to interpose malloc/calloc/realloc/free.
+// A thread that has called alloc_guard_arm() aborts on any heap call until it
+// calls alloc_guard_disarm(), which proves the processing loop is
+// allocation-free. Without the flag both macros compile to nothing.
+//
+// Relies on glibc's __libc_* entry points, so the guard is Linux/glibc only.
+// Include it from exactly one translation unit per program.
+
+#ifdef VOICEMASK_ALLOC_GUARD
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread bool alloc_guard_armed = false;
+
+static void alloc_guard_violation(const char *fn) {
+    static const char prefix[] = "[ALLOC GUARD] heap call from guarded thread: ";
+    alloc_guard_armed = false;
+    ssize_t n = write(STDERR_FILENO, prefix, sizeof(prefix) - 1);
+    n = write(STDERR_FILENO, fn, strlen(fn));
+    n = write(STDERR_FILENO, "\n", 1);
+    (void)n;
+    abort();
+}
+
+void *malloc(size_t size) {
+    if (alloc_guard_armed) alloc_guard_violation("malloc");
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (alloc_guard_armed) alloc_guard_violation("calloc");
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (alloc_guard_armed) alloc_guard_violation("realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if (alloc_guard_armed && ptr) alloc_guard_violation("free");
+    __libc_free(ptr);
+}
+
+#define alloc_guard_arm()    (alloc_guard_armed = true)
+#define alloc_guard_disarm() (alloc_guard_armed = false)
+
+#else
+
+#define alloc_guard_arm()    ((void)0)
+#define alloc_guard_disarm() ((void)0)
+
+#endif // VOICEMASK_ALLOC_GUARD
+
+#endif // ALLOCGUARD_H
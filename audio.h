@@ -0,0 +1,310 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <portaudio.h>
+#include <sndfile.h>
+
+// ==================
+// Audio Backends
+// ==================
+// The realtime engine opens, starts, polls and stops its stream through this
+// interface instead of calling PortAudio directly. Every backend drives the
+// same PaStreamCallback with interleaved float buffers of `frames_per_buffer`
+// frames, so the callback cannot tell which one it runs under.
+//
+//   portaudio  the default sound card.
+//   file       reads input from an audio file and writes the output to a WAV
+//              file. A clock thread calls the callback once per buffer, paced
+//              to the wall clock at `speed` times realtime, or as fast as
+//              possible (speed 0, expect ring overflows). The output
+//              contains what the callback produced while the input played.
+//   null       the file backend without files: silence in, output discarded.
+//
+// Every function returns false on failure with a message in `error`.
+
+typedef struct {
+    int sample_rate;
+    int channels;                  // same count for input and output
+    unsigned long frames_per_buffer;
+    PaStreamCallback *callback;
+    void *user_data;
+} AudioStreamConfig;
+
+typedef struct AudioBackend AudioBackend;
+
+struct AudioBackend {
+    const char *name;
+    bool (*open)(AudioBackend *backend, const AudioStreamConfig *config);
+    bool (*start)(AudioBackend *backend);
+    bool (*is_active)(AudioBackend *backend);  // false once the callback returned paComplete or input ended
+    bool (*stop)(AudioBackend *backend);       // waits for the callback to return
+    void (*close)(AudioBackend *backend);
+    char error[256];
+};
+
+// ------------------
+// PortAudio
+// ------------------
+typedef struct {
+    AudioBackend base;
+    PaStream *stream;
+} AudioPortAudioBackend;
+
+static inline bool audio_pa_check(AudioBackend *backend, PaError err) {
+    if (err == paNoError) return true;
+    snprintf(backend->error, sizeof(backend->error), "%s", Pa_GetErrorText(err));
+    return false;
+}
+
+static inline bool audio_pa_open(AudioBackend *backend, const AudioStreamConfig *config) {
+    AudioPortAudioBackend *pa = (AudioPortAudioBackend*)backend;
+    return audio_pa_check(backend, Pa_OpenDefaultStream(&pa->stream, config->channels, config->channels, paFloat32,
+                                                        config->sample_rate, config->frames_per_buffer,
+                                                        config->callback, config->user_data));
+}
+
+static inline bool audio_pa_start(AudioBackend *backend) {
+    return audio_pa_check(backend, Pa_StartStream(((AudioPortAudioBackend*)backend)->stream));
+}
+
+static inline bool audio_pa_is_active(AudioBackend *backend) {
+    return Pa_IsStreamActive(((AudioPortAudioBackend*)backend)->stream) == 1;
+}
+
+static inline bool audio_pa_stop(AudioBackend *backend) {
+    PaError err = Pa_StopStream(((AudioPortAudioBackend*)backend)->stream);
+    return err == paStreamIsStopped || audio_pa_check(backend, err);
+}
+
+static inline void audio_pa_close(AudioBackend *backend) {
+    AudioPortAudioBackend *pa = (AudioPortAudioBackend*)backend;
+    if (!pa->stream) return;
+    Pa_AbortStream(pa->stream);
+    Pa_CloseStream(pa->stream);
+    pa->stream = NULL;
+}
+
+// Pa_Initialize() must have been called.
+static inline void audio_portaudio_backend_init(AudioPortAudioBackend *pa) {
+    memset(pa, 0, sizeof(*pa));
+    pa->base.name = "portaudio";
+    pa->base.open = audio_pa_open;
+    pa->base.start = audio_pa_start;
+    pa->base.is_active = audio_pa_is_active;
+    pa->base.stop = audio_pa_stop;
+    pa->base.close = audio_pa_close;
+}
+
+// ------------------
+// File / Null
+// ------------------
+typedef struct {
+    AudioBackend base;
+    const char *in_path;       // NULL: silence
+    const char *out_path;      // NULL: output is discarded
+    double duration;           // seconds of stream time; 0 = until the input ends (forever without input)
+    double speed;              // wall-clock pacing: 1 = realtime, 2 = twice as fast, 0 = unpaced
+
+    AudioStreamConfig config;
+    SNDFILE *in;
+    SNDFILE *out;
+    int in_channels;
+    float *in_frames;          // one buffer in the input file's channel layout
+    float *in_block;           // one buffer in the stream's channel layout
+    float *out_block;
+    pthread_t thread;
+    bool started;
+    atomic_bool running;
+    atomic_bool stop_requested;
+    long long frames_done;     // stream frames delivered to the callback
+    double wall_seconds;       // wall-clock time the clock thread ran
+} AudioFileBackend;
+
+static inline double audio_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline bool audio_file_open(AudioBackend *backend, const AudioStreamConfig *config) {
+    AudioFileBackend *fb = (AudioFileBackend*)backend;
+    size_t block = config->frames_per_buffer * config->channels;
+    fb->config = *config;
+    fb->in_channels = config->channels;
+
+    if (fb->in_path) {
+        SF_INFO info;
+        memset(&info, 0, sizeof(info));
+        fb->in = sf_open(fb->in_path, SFM_READ, &info);
+        if (!fb->in) {
+            snprintf(backend->error, sizeof(backend->error), "'%s': %s", fb->in_path, sf_strerror(NULL));
+            return false;
+        }
+        if (info.samplerate != config->sample_rate) {
+            snprintf(backend->error, sizeof(backend->error), "'%s' is %d Hz, the stream runs at %d Hz",
+                     fb->in_path, info.samplerate, config->sample_rate);
+            return false;
+        }
+        fb->in_channels = info.channels;
+    }
+    if (fb->out_path) {
+        SF_INFO info;
+        memset(&info, 0, sizeof(info));
+        info.samplerate = config->sample_rate;
+        info.channels = config->channels;
+        info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+        fb->out = sf_open(fb->out_path, SFM_WRITE, &info);
+        if (!fb->out) {
+            snprintf(backend->error, sizeof(backend->error), "'%s': %s", fb->out_path, sf_strerror(NULL));
+            return false;
+        }
+    }
+
+    fb->in_frames = (float*) calloc(config->frames_per_buffer * fb->in_channels, sizeof(float));
+    fb->in_block = (float*) calloc(block, sizeof(float));
+    fb->out_block = (float*) calloc(block, sizeof(float));
+    if (!fb->in_frames || !fb->in_block || !fb->out_block) {
+        snprintf(backend->error, sizeof(backend->error), "out of memory");
+        return false;
+    }
+    return true;
+}
+
+// Fills in_block from the input file; extra stream channels repeat the last
+// file channel, extra file channels are dropped. Returns the frames read.
+static inline long audio_file_fill(AudioFileBackend *fb) {
+    unsigned long frames = fb->config.frames_per_buffer;
+    int channels = fb->config.channels;
+    if (!fb->in) {
+        memset(fb->in_block, 0, frames * channels * sizeof(float));
+        return (long)frames;
+    }
+    sf_count_t got = sf_readf_float(fb->in, fb->in_frames, (sf_count_t)frames);
+    if (got < 0) got = 0;
+    for (sf_count_t i = 0; i < got; ++i) {
+        for (int ch = 0; ch < channels; ++ch) {
+            int src = ch < fb->in_channels ? ch : fb->in_channels - 1;
+            fb->in_block[i * channels + ch] = fb->in_frames[i * fb->in_channels + src];
+        }
+    }
+    memset(fb->in_block + got * channels, 0, (frames - got) * channels * sizeof(float));
+    return (long)got;
+}
+
+static void *audio_file_clock(void *arg) {
+    AudioFileBackend *fb = (AudioFileBackend*)arg;
+    const AudioStreamConfig *cfg = &fb->config;
+    const double period = (double)cfg->frames_per_buffer / cfg->sample_rate;
+    const long long limit = fb->duration > 0.0 ? (long long)(fb->duration * cfg->sample_rate) : -1;
+    const double start = audio_now();
+    struct timespec origin;
+    clock_gettime(CLOCK_MONOTONIC, &origin);
+
+    while (!atomic_load(&fb->stop_requested)) {
+        if (limit >= 0 && fb->frames_done >= limit) break;
+        long got = audio_file_fill(fb);
+        if (got == 0) break; // input ended
+
+        PaStreamCallbackTimeInfo time_info;
+        time_info.inputBufferAdcTime = (double)fb->frames_done / cfg->sample_rate;
+        time_info.currentTime = time_info.inputBufferAdcTime;
+        time_info.outputBufferDacTime = time_info.currentTime + period;
+        int result = cfg->callback(fb->in_block, fb->out_block, cfg->frames_per_buffer, &time_info, 0, cfg->user_data);
+
+        if (fb->out && sf_writef_float(fb->out, fb->out_block, got) != got) {
+            snprintf(fb->base.error, sizeof(fb->base.error), "'%s': %s", fb->out_path, sf_strerror(fb->out));
+            break;
+        }
+        fb->frames_done += (long long)cfg->frames_per_buffer;
+        if (result != paContinue) break;
+
+        if (fb->speed > 0.0) {
+            // Deadlines come from the frame count, so pacing does not drift.
+            double t = (double)fb->frames_done / cfg->sample_rate / fb->speed;
+            struct timespec next = origin;
+            next.tv_sec += (time_t)t;
+            next.tv_nsec += (long)((t - (double)(time_t)t) * 1e9);
+            if (next.tv_nsec >= 1000000000L) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0 &&
+                   !atomic_load(&fb->stop_requested)) {
+            }
+        }
+    }
+
+    fb->wall_seconds = audio_now() - start;
+    atomic_store(&fb->running, false);
+    return NULL;
+}
+
+static inline bool audio_file_start(AudioBackend *backend) {
+    AudioFileBackend *fb = (AudioFileBackend*)backend;
+    atomic_store(&fb->stop_requested, false);
+    atomic_store(&fb->running, true);
+    if (pthread_create(&fb->thread, NULL, audio_file_clock, fb) != 0) {
+        atomic_store(&fb->running, false);
+        snprintf(backend->error, sizeof(backend->error), "could not start the clock thread");
+        return false;
+    }
+    fb->started = true;
+    return true;
+}
+
+static inline bool audio_file_is_active(AudioBackend *backend) {
+    return atomic_load(&((AudioFileBackend*)backend)->running);
+}
+
+static inline bool audio_file_stop(AudioBackend *backend) {
+    AudioFileBackend *fb = (AudioFileBackend*)backend;
+    if (fb->started) {
+        atomic_store(&fb->stop_requested, true);
+        pthread_join(fb->thread, NULL);
+        fb->started = false;
+    }
+    return backend->error[0] == '\0';
+}
+
+static inline void audio_file_close(AudioBackend *backend) {
+    AudioFileBackend *fb = (AudioFileBackend*)backend;
+    audio_file_stop(backend);
+    if (fb->in) sf_close(fb->in);
+    if (fb->out) sf_close(fb->out);
+    free(fb->in_frames);
+    free(fb->in_block);
+    free(fb->out_block);
+    fb->in = fb->out = NULL;
+    fb->in_frames = fb->in_block = fb->out_block = NULL;
+}
+
+static inline void audio_file_backend_init(AudioFileBackend *fb, const char *in_path, const char *out_path,
+                                           double duration, double speed) {
+    memset(fb, 0, sizeof(*fb));
+    fb->base.name = "file";
+    fb->base.open = audio_file_open;
+    fb->base.start = audio_file_start;
+    fb->base.is_active = audio_file_is_active;
+    fb->base.stop = audio_file_stop;
+    fb->base.close = audio_file_close;
+    fb->in_path = in_path;
+    fb->out_path = out_path;
+    fb->duration = duration;
+    fb->speed = speed;
+    atomic_init(&fb->running, false);
+    atomic_init(&fb->stop_requested, false);
+}
+
+static inline void audio_null_backend_init(AudioFileBackend *fb, double duration, double speed) {
+    audio_file_backend_init(fb, NULL, NULL, duration, speed);
+    fb->base.name = "null";
+}
+
+#endif // AUDIO_H
@@ -0,0 +1,585 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "dsp.h"
+#include "ringbuf.h"
+#include "pcmconv.h"
+
+// ==================
+// Microbenchmarks
+// ==================
+// Times every DSP kernel, the output sample conversions and the ring buffer per block, over block sizes from
+// 64 to 8192 frames, and reports ns/sample, samples/s and p50/p99/p99.9 block
+// latency. ns/sample is taken from the median block, so a few preempted
+// blocks do not move it; kernels that do their work in bursts (the phase
+// vocoder transforms once per hop, so most small blocks only copy) report
+// the mean over all blocks instead. The pitch+noise kernels also run on one
+// BENCH_LARGE_BLOCK buffer (4 MiB), the offline case where the block no
+// longer fits in cache.
+//
+// --json writes the results in a line-per-result format that --baseline reads
+// back: every kernel/block pair also present in the baseline is compared, and
+// the program exits with status 1 if any is more than --threshold percent
+// slower.
+//
+// Compile: gcc -O2 bench.c -o bench -lm -lpthread
+// Usage:   ./bench [--filter NAME] [--min-time SEC] [--json FILE]
+//                  [--baseline FILE] [--threshold PCT]
+
+#define BENCH_SAMPLE_RATE 44100
+#define BENCH_MAX_ITERS   200000
+#define BENCH_MIN_ITERS   64
+#define BENCH_RING_FRAMES (1 << 17)
+
+static const long bench_blocks[] = { 64, 128, 256, 512, 1024, 2048, 4096, 8192 };
+#define BENCH_NUM_BLOCKS (int)(sizeof(bench_blocks) / sizeof(bench_blocks[0]))
+#define BENCH_MAX_BLOCK  8192
+#define BENCH_LARGE_BLOCK (1L << 20)
+
+typedef struct {
+    char kernel[64];
+    long block;
+    long iterations;
+    double ns_per_sample;
+    double samples_per_sec;
+    double p50_ns;
+    double p99_ns;
+    double p999_ns;
+} BenchResult;
+
+typedef struct {
+    BenchResult *items;
+    int count;
+    int capacity;
+} BenchResults;
+
+typedef void (*bench_fn)(void *ctx, const float *in, float *out, long n);
+
+static double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int bench_cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double bench_percentile(const double *sorted, long n, double q) {
+    long i = (long)(q * (double)(n - 1) + 0.5);
+    return sorted[i < n ? i : n - 1];
+}
+
+static BenchResult *bench_add(BenchResults *results) {
+    if (results->count == results->capacity) {
+        int cap = results->capacity ? results->capacity * 2 : 64;
+        BenchResult *items = (BenchResult*) realloc(results->items, cap * sizeof(BenchResult));
+        if (!items) return NULL;
+        results->items = items;
+        results->capacity = cap;
+    }
+    BenchResult *r = &results->items[results->count++];
+    memset(r, 0, sizeof(*r));
+    return r;
+}
+
+// Turns per-block timings into a result; sorts `times` in place. `bursty`
+// takes ns/sample from the mean block rather than the median.
+static void bench_summarize(BenchResult *r, const char *kernel, long block, double *times, long iters,
+                            double total_ns, bool bursty) {
+    double sum = 0.0;
+    for (long i = 0; i < iters; ++i) sum += times[i];
+    qsort(times, iters, sizeof(double), bench_cmp_double);
+    snprintf(r->kernel, sizeof(r->kernel), "%s", kernel);
+    r->block = block;
+    r->iterations = iters;
+    r->p50_ns = bench_percentile(times, iters, 0.50);
+    r->p99_ns = bench_percentile(times, iters, 0.99);
+    r->p999_ns = bench_percentile(times, iters, 0.999);
+    r->ns_per_sample = (bursty ? sum / iters : r->p50_ns) / block;
+    r->samples_per_sec = total_ns > 0.0 ? (double)block * iters / (total_ns * 1e-9) : 0.0;
+}
+
+static void bench_print(const BenchResult *r) {
+    printf("%-18s %7ld %10.2f %12.1f %10.0f %10.0f %10.0f\n", r->kernel, r->block, r->ns_per_sample,
+           r->samples_per_sec / 1e6, r->p50_ns, r->p99_ns, r->p999_ns);
+    fflush(stdout);
+}
+
+// Calls `fn` on blocks of each of the `n_blocks` sizes until `min_time`
+// seconds and BENCH_MIN_ITERS blocks have passed.
+static bool bench_kernel_sizes(BenchResults *results, const char *kernel, bench_fn fn, void *ctx,
+                               const float *in, float *out, double *times, double min_time,
+                               const long *blocks, int n_blocks, bool bursty) {
+    for (int b = 0; b < n_blocks; ++b) {
+        long block = blocks[b];
+        for (int w = 0; w < 8; ++w) fn(ctx, in, out, block); // warm caches and state
+
+        long iters = 0;
+        double start = bench_now_ns(), total = 0.0;
+        while (iters < BENCH_MAX_ITERS && (iters < BENCH_MIN_ITERS || total < min_time * 1e9)) {
+            double t0 = bench_now_ns();
+            fn(ctx, in, out, block);
+            double t1 = bench_now_ns();
+            times[iters++] = t1 - t0;
+            total = t1 - start;
+        }
+
+        BenchResult *r = bench_add(results);
+        if (!r) return false;
+        bench_summarize(r, kernel, block, times, iters, total, bursty);
+        bench_print(r);
+    }
+    return true;
+}
+
+static bool bench_kernel(BenchResults *results, const char *kernel, bench_fn fn, void *ctx,
+                         const float *in, float *out, double *times, double min_time) {
+    return bench_kernel_sizes(results, kernel, fn, ctx, in, out, times, min_time, bench_blocks, BENCH_NUM_BLOCKS, false);
+}
+
+static bool bench_kernel_bursty(BenchResults *results, const char *kernel, bench_fn fn, void *ctx,
+                                const float *in, float *out, double *times, double min_time) {
+    return bench_kernel_sizes(results, kernel, fn, ctx, in, out, times, min_time, bench_blocks, BENCH_NUM_BLOCKS, true);
+}
+
+// ------------------
+// Kernels
+// ------------------
+static void bench_pitch(void *ctx, const float *in, float *out, long n) {
+    pitch_shifter_process((PitchShifter*)ctx, in, out, n);
+}
+
+static void bench_vocoder(void *ctx, const float *in, float *out, long n) {
+    phase_vocoder_process((PhaseVocoder*)ctx, in, out, n);
+}
+
+typedef struct {
+    NoiseRng rng;
+    noise_kernel_fn kernel;
+} BenchNoise;
+
+static void bench_noise(void *ctx, const float *in, float *out, long n) {
+    BenchNoise *noise = (BenchNoise*)ctx;
+    noise->kernel(&noise->rng, in, out, n, NOISE_UNIFORM, DSP_NOISE_AMPLITUDE);
+}
+
+// The granular shifter followed by noise: as two passes over the block
+// (16 bytes of block traffic per frame) or fused (8 bytes per frame).
+typedef struct {
+    PitchShifter ps;
+    BenchNoise noise;
+    noise_mix_fn mix;
+} BenchPitchNoise;
+
+static void bench_pitch_noise_passes(void *ctx, const float *in, float *out, long n) {
+    BenchPitchNoise *pn = (BenchPitchNoise*)ctx;
+    pitch_shifter_process(&pn->ps, in, out, n);
+    pn->noise.kernel(&pn->noise.rng, out, out, n, NOISE_UNIFORM, DSP_NOISE_AMPLITUDE);
+}
+
+static void bench_pitch_noise_fused(void *ctx, const float *in, float *out, long n) {
+    BenchPitchNoise *pn = (BenchPitchNoise*)ctx;
+    dsp_pitch_noise_process(&pn->ps, &pn->noise.rng, pn->mix, NOISE_UNIFORM, DSP_NOISE_AMPLITUDE, in, out, n);
+}
+
+// Energy and zero crossings of the block, as vad_is_speech() sees them.
+static void bench_vad(void *ctx, const float *in, float *out, long n) {
+    float energy;
+    long crossings;
+    (*(vad_stats_fn*)ctx)(in, n, &energy, &crossings);
+    out[0] = energy + (float)crossings;
+}
+
+static void bench_dsp(void *ctx, const float *in, float *out, long n) {
+    dsp_process((DspContext*)ctx, in, out, n);
+}
+
+// `out` has room for n floats, which covers n PCM16/PCM24 samples.
+static void bench_pcm(void *ctx, const float *in, float *out, long n) {
+    (*(pcm_convert_fn*)ctx)(in, (unsigned char*)out, n);
+}
+
+// ------------------
+// Ring buffer under contention
+// ------------------
+// One side is timed per block while a second thread drives the other side as
+// fast as it can. The timed side waits (untimed) when the ring is full/empty,
+// so every timed call moves a whole block.
+typedef struct {
+    RealtimeBuffer rb;
+    long block;
+    bool timed_writer;   // true: time rb_write, the helper reads
+    atomic_bool stop;
+    float scratch[BENCH_MAX_BLOCK];
+} BenchRing;
+
+static void *bench_ring_helper(void *arg) {
+    BenchRing *ring = (BenchRing*)arg;
+    while (!atomic_load_explicit(&ring->stop, memory_order_relaxed)) {
+        long n = ring->block;
+        if (ring->timed_writer) {
+            if (rb_available(&ring->rb) >= (size_t)n) rb_read(&ring->rb, ring->scratch, n);
+            else sched_yield();
+        } else {
+            if (rb_free_space(&ring->rb) >= (size_t)n) rb_write(&ring->rb, ring->scratch, n);
+            else sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static bool bench_ring(BenchResults *results, bool timed_writer, float *buf, double *times, double min_time) {
+    const char *kernel = timed_writer ? "ring/write" : "ring/read";
+    BenchRing *ring = (BenchRing*) calloc(1, sizeof(BenchRing));
+    if (!ring || !rb_init(&ring->rb, BENCH_RING_FRAMES)) {
+        free(ring);
+        return false;
+    }
+    ring->timed_writer = timed_writer;
+
+    bool ok = true;
+    for (int b = 0; b < BENCH_NUM_BLOCKS && ok; ++b) {
+        long block = bench_blocks[b];
+        pthread_t helper;
+        ring->block = block;
+        atomic_store(&ring->stop, false);
+        if (pthread_create(&helper, NULL, bench_ring_helper, ring) != 0) {
+            ok = false;
+            break;
+        }
+
+        long iters = 0;
+        double start = bench_now_ns(), total = 0.0;
+        while (iters < BENCH_MAX_ITERS && (iters < BENCH_MIN_ITERS || total < min_time * 1e9)) {
+            if (timed_writer) {
+                while (rb_free_space(&ring->rb) < (size_t)block) sched_yield();
+            } else {
+                while (rb_available(&ring->rb) < (size_t)block) sched_yield();
+            }
+            double t0 = bench_now_ns();
+            if (timed_writer) rb_write(&ring->rb, buf, block);
+            else rb_read(&ring->rb, buf, block);
+            double t1 = bench_now_ns();
+            times[iters++] = t1 - t0;
+            total = t1 - start;
+        }
+        atomic_store(&ring->stop, true);
+        pthread_join(helper, NULL);
+
+        BenchResult *r = bench_add(results);
+        if (!r) {
+            ok = false;
+            break;
+        }
+        bench_summarize(r, kernel, block, times, iters, total, false);
+        bench_print(r);
+    }
+    rb_destroy(&ring->rb);
+    free(ring);
+    return ok;
+}
+
+// ------------------
+// JSON / baseline
+// ------------------
+static bool bench_write_json(const char *path, const BenchResults *results) {
+    FILE *f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "{\n  \"sample_rate\": %d,\n  \"results\": [\n", BENCH_SAMPLE_RATE);
+    for (int i = 0; i < results->count; ++i) {
+        const BenchResult *r = &results->items[i];
+        fprintf(f, "    {\"kernel\": \"%s\", \"block\": %ld, \"iterations\": %ld, \"ns_per_sample\": %.4f, "
+                   "\"samples_per_sec\": %.0f, \"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f}%s\n",
+                r->kernel, r->block, r->iterations, r->ns_per_sample, r->samples_per_sec,
+                r->p50_ns, r->p99_ns, r->p999_ns, i + 1 < results->count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+// Reads a file written by bench_write_json().
+static bool bench_read_json(const char *path, BenchResults *results) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        BenchResult r;
+        memset(&r, 0, sizeof(r));
+        const char *p = strstr(line, "{\"kernel\"");
+        if (!p) continue;
+        if (sscanf(p, "{\"kernel\": \"%63[^\"]\", \"block\": %ld, \"iterations\": %ld, \"ns_per_sample\": %lf",
+                   r.kernel, &r.block, &r.iterations, &r.ns_per_sample) != 4) continue;
+        BenchResult *slot = bench_add(results);
+        if (!slot) break;
+        *slot = r;
+    }
+    fclose(f);
+    return results->count > 0;
+}
+
+// Returns the number of regressions beyond `threshold` percent.
+static int bench_compare(const BenchResults *current, const BenchResults *baseline, double threshold) {
+    int regressions = 0, compared = 0;
+    printf("\n%-18s %7s %12s %12s %9s\n", "kernel", "block", "base ns/smp", "now ns/smp", "change");
+    for (int i = 0; i < current->count; ++i) {
+        const BenchResult *cur = &current->items[i];
+        for (int j = 0; j < baseline->count; ++j) {
+            const BenchResult *base = &baseline->items[j];
+            if (base->block != cur->block || strcmp(base->kernel, cur->kernel) != 0 || base->ns_per_sample <= 0.0) continue;
+            double change = 100.0 * (cur->ns_per_sample / base->ns_per_sample - 1.0);
+            bool regressed = change > threshold;
+            printf("%-18s %7ld %12.3f %12.3f %+8.1f%%%s\n", cur->kernel, cur->block, base->ns_per_sample,
+                   cur->ns_per_sample, change, regressed ? "  REGRESSION" : "");
+            regressions += regressed;
+            compared++;
+            break;
+        }
+    }
+    printf("%d compared, %d regression(s) over %.1f%%\n", compared, regressions, threshold);
+    return regressions;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  -f, --filter NAME      only run kernels whose name contains NAME\n");
+    printf("  -t, --min-time SEC     minimum time per kernel and block size (default 0.2)\n");
+    printf("  -j, --json FILE        write results as JSON\n");
+    printf("  -b, --baseline FILE    compare with a JSON file from --json; exit 1 on regression\n");
+    printf("  -r, --threshold PCT    allowed slowdown against the baseline (default 10)\n");
+    printf("  -h, --help             show this help\n");
+}
+
+static bool bench_selected(const char *filter, const char *kernel) {
+    return !filter || strstr(kernel, filter) != NULL;
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"filter", required_argument, NULL, 'f'},
+        {"min-time", required_argument, NULL, 't'},
+        {"json", required_argument, NULL, 'j'},
+        {"baseline", required_argument, NULL, 'b'},
+        {"threshold", required_argument, NULL, 'r'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    const char *filter = NULL, *json = NULL, *baseline_path = NULL;
+    double min_time = 0.2, threshold = 10.0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "f:t:j:b:r:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'f': filter = optarg; break;
+        case 't': min_time = strtod(optarg, NULL); break;
+        case 'j': json = optarg; break;
+        case 'b': baseline_path = optarg; break;
+        case 'r': threshold = strtod(optarg, NULL); break;
+        case 'h': print_usage(argv[0]); return 0;
+        default: print_usage(argv[0]); return 2;
+        }
+    }
+
+    BenchResults baseline = { NULL, 0, 0 };
+    if (baseline_path && !bench_read_json(baseline_path, &baseline)) {
+        fprintf(stderr, "could not read baseline '%s'\n", baseline_path);
+        return 2;
+    }
+
+    float *in = (float*) malloc(BENCH_MAX_BLOCK * sizeof(float));
+    float *out = (float*) malloc(BENCH_MAX_BLOCK * sizeof(float));
+    double *times = (double*) malloc(BENCH_MAX_ITERS * sizeof(double));
+    if (!in || !out || !times) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < BENCH_MAX_BLOCK; ++i) in[i] = 0.5f * sinf(2.0f * (float)M_PI * 220.0f * i / BENCH_SAMPLE_RATE);
+
+    BenchResults results = { NULL, 0, 0 };
+    bool ok = true;
+    printf("%-18s %7s %10s %12s %10s %10s %10s\n", "kernel", "block", "ns/sample", "Msamples/s", "p50 ns", "p99 ns", "p99.9 ns");
+
+    static const ResampleQuality qualities[] = { RESAMPLE_LINEAR, RESAMPLE_CUBIC, RESAMPLE_SINC };
+    for (int q = 0; q < 3 && ok; ++q) {
+        char name[64];
+        snprintf(name, sizeof(name), "pitch/%s", resample_quality_name(qualities[q]));
+        if (!bench_selected(filter, name)) continue;
+        PitchShifter ps;
+        if (!pitch_shifter_init(&ps, BENCH_SAMPLE_RATE, -4)) {
+            ok = false;
+            break;
+        }
+        pitch_shifter_set_quality(&ps, qualities[q]);
+        ok = bench_kernel(&results, name, bench_pitch, &ps, in, out, times, min_time);
+        pitch_shifter_free(&ps);
+    }
+
+    // The formant stage on top of the same vocoder: its cost is the difference.
+    for (int formants = 0; formants < 2 && ok; ++formants) {
+        const char *name = formants ? "pitch/formant" : "pitch/vocoder";
+        if (!bench_selected(filter, name)) continue;
+        PhaseVocoder pv;
+        if (!phase_vocoder_init(&pv, BENCH_SAMPLE_RATE, -4)) {
+            ok = false;
+            break;
+        }
+        if (formants && !phase_vocoder_set_formants(&pv, BENCH_SAMPLE_RATE, 2.0f)) ok = false;
+        if (ok) ok = bench_kernel_bursty(&results, name, bench_vocoder, &pv, in, out, times, min_time);
+        phase_vocoder_free(&pv);
+    }
+
+    BenchNoise noise;
+    noise_rng_seed(&noise.rng, 1);
+    struct { const char *name; noise_kernel_fn fn; bool supported; } kernels[] = {
+        { "noise/scalar", noise_add_clip_scalar, true },
+#ifdef NOISE_X86
+        { "noise/sse2", noise_add_clip_sse2, __builtin_cpu_supports("sse2") },
+        { "noise/avx2", noise_add_clip_avx2, __builtin_cpu_supports("avx2") },
+#endif
+    };
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]) && ok; ++k) {
+        if (!kernels[k].supported || !bench_selected(filter, kernels[k].name)) continue;
+        noise.kernel = kernels[k].fn;
+        ok = bench_kernel(&results, kernels[k].name, bench_noise, &noise, in, out, times, min_time);
+    }
+
+    struct { const char *name; bench_fn fn; noise_mix_fn mix; bool supported; } pitch_noise[] = {
+        { "pitch+noise/passes", bench_pitch_noise_passes, NULL, true },
+        { "pitch+noise/scalar", bench_pitch_noise_fused, noise_mix_clip_scalar, true },
+#ifdef NOISE_X86
+        { "pitch+noise/sse2", bench_pitch_noise_fused, noise_mix_clip_sse2, __builtin_cpu_supports("sse2") },
+        { "pitch+noise/avx2", bench_pitch_noise_fused, noise_mix_clip_avx2, __builtin_cpu_supports("avx2") },
+#endif
+    };
+    float *large_in = NULL, *large_out = NULL;
+    for (size_t k = 0; k < sizeof(pitch_noise) / sizeof(pitch_noise[0]) && ok; ++k) {
+        if (!pitch_noise[k].supported || !bench_selected(filter, pitch_noise[k].name)) continue;
+        if (!large_in) {
+            large_in = (float*) malloc(BENCH_LARGE_BLOCK * sizeof(float));
+            large_out = (float*) malloc(BENCH_LARGE_BLOCK * sizeof(float));
+            if (!large_in || !large_out) {
+                ok = false;
+                break;
+            }
+            for (long i = 0; i < BENCH_LARGE_BLOCK; ++i) large_in[i] = in[i % BENCH_MAX_BLOCK];
+        }
+        BenchPitchNoise *pn = (BenchPitchNoise*) calloc(1, sizeof(BenchPitchNoise));
+        if (!pn || !pitch_shifter_init(&pn->ps, BENCH_SAMPLE_RATE, -4)) {
+            free(pn);
+            ok = false;
+            break;
+        }
+        noise_rng_seed(&pn->noise.rng, 1);
+        pn->noise.kernel = noise_select_kernel(NULL);
+        pn->mix = pitch_noise[k].mix;
+        static const long large[] = { BENCH_LARGE_BLOCK };
+        ok = bench_kernel(&results, pitch_noise[k].name, pitch_noise[k].fn, pn, in, out, times, min_time) &&
+             bench_kernel_sizes(&results, pitch_noise[k].name, pitch_noise[k].fn, pn, large_in, large_out,
+                                times, min_time, large, 1, false);
+        pitch_shifter_free(&pn->ps);
+        free(pn);
+    }
+    free(large_in);
+    free(large_out);
+
+    struct { const char *name; vad_stats_fn fn; bool supported; } vad_kernels[] = {
+        { "vad/scalar", vad_stats_scalar, true },
+#ifdef NOISE_X86
+        { "vad/sse2", vad_stats_sse2, __builtin_cpu_supports("sse2") },
+        { "vad/avx2", vad_stats_avx2, __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") },
+#endif
+    };
+    for (size_t k = 0; k < sizeof(vad_kernels) / sizeof(vad_kernels[0]) && ok; ++k) {
+        if (!vad_kernels[k].supported || !bench_selected(filter, vad_kernels[k].name)) continue;
+        ok = bench_kernel(&results, vad_kernels[k].name, bench_vad, &vad_kernels[k].fn, in, out, times, min_time);
+    }
+
+    struct { const char *name; pcm_convert_fn fn; bool supported; } converters[] = {
+        { "pcm16/scalar", pcm_s16_scalar, true },
+        { "pcm24/scalar", pcm_s24_scalar, true },
+#ifdef NOISE_X86
+        { "pcm16/sse2", pcm_s16_sse2, __builtin_cpu_supports("sse2") },
+        { "pcm16/avx2", pcm_s16_avx2, __builtin_cpu_supports("avx2") },
+        { "pcm24/ssse3", pcm_s24_ssse3, __builtin_cpu_supports("ssse3") },
+        { "pcm24/avx2", pcm_s24_avx2, __builtin_cpu_supports("avx2") },
+#endif
+    };
+    for (size_t k = 0; k < sizeof(converters) / sizeof(converters[0]) && ok; ++k) {
+        if (!converters[k].supported || !bench_selected(filter, converters[k].name)) continue;
+        ok = bench_kernel(&results, converters[k].name, bench_pcm, &converters[k].fn, in, out, times, min_time);
+    }
+
+    if (ok && bench_selected(filter, "dsp/chain")) {
+        DspContext *dsp = (DspContext*) calloc(1, sizeof(DspContext));
+        if (!dsp || !dsp_init(dsp, BENCH_SAMPLE_RATE, -4, BENCH_MAX_BLOCK)) {
+            ok = false;
+        } else {
+            ok = bench_kernel(&results, "dsp/chain", bench_dsp, dsp, in, out, times, min_time);
+            dsp_free(dsp);
+        }
+        free(dsp);
+    }
+
+    // The same sample-wise stages once in fused order (filter+gain+clip, then
+    // noise: two passes) and once in an order that fuses nothing (four passes).
+    static const struct { const char *name; const char *spec; } chains[] = {
+        { "dsp/chain-fused", "highpass:80, gain:-3, clip:0.9, noise" },
+        { "dsp/chain-unfused", "clip:0.9, gain:-3, highpass:80, noise" },
+    };
+    for (size_t c = 0; c < sizeof(chains) / sizeof(chains[0]) && ok; ++c) {
+        if (!bench_selected(filter, chains[c].name)) continue;
+        DspChain chain;
+        char error[128];
+        DspContext *dsp = (DspContext*) calloc(1, sizeof(DspContext));
+        if (!dsp || !dsp_chain_parse(chains[c].spec, &chain, error, sizeof(error)) ||
+            !dsp_init(dsp, BENCH_SAMPLE_RATE, -4, BENCH_MAX_BLOCK)) {
+            ok = false;
+        } else {
+            dsp_set_chain(dsp, &chain);
+            ok = bench_kernel(&results, chains[c].name, bench_dsp, dsp, in, out, times, min_time);
+            dsp_free(dsp);
+        }
+        free(dsp);
+    }
+
+    // The default chain with the detector on, fed silence: after the hangover
+    // every block is comfort noise, the cost a muted speaker still pays.
+    if (ok && bench_selected(filter, "dsp/chain-silent")) {
+        static const VadConfig vad = { VAD_NOISE, VAD_THRESHOLD_DB, false };
+        DspContext *dsp = (DspContext*) calloc(1, sizeof(DspContext));
+        float *silence = (float*) calloc(BENCH_MAX_BLOCK, sizeof(float));
+        if (!dsp || !silence || !dsp_init(dsp, BENCH_SAMPLE_RATE, -4, BENCH_MAX_BLOCK)) {
+            ok = false;
+        } else {
+            ok = dsp_set_vad(dsp, &vad) &&
+                 bench_kernel(&results, "dsp/chain-silent", bench_dsp, dsp, silence, out, times, min_time);
+            dsp_free(dsp);
+        }
+        free(silence);
+        free(dsp);
+    }
+
+    if (ok && bench_selected(filter, "ring/write")) ok = bench_ring(&results, true, out, times, min_time);
+    if (ok && bench_selected(filter, "ring/read")) ok = bench_ring(&results, false, out, times, min_time);
+
+    int status = ok ? 0 : 1;
+    if (!ok) fprintf(stderr, "benchmark setup failed\n");
+    if (ok && json && !bench_write_json(json, &results)) {
+        fprintf(stderr, "could not write '%s'\n", json);
+        status = 1;
+    }
+    if (ok && baseline_path && bench_compare(&results, &baseline, threshold) > 0) status = 1;
+
+    free(results.items);
+    free(baseline.items);
+    free(in);
+    free(out);
+    free(times);
+    return status;
+}
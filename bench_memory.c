@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "offline.h"
+
+// ==================
+// Memory Benchmark
+// ==================
+// Pushes synthetic audio of increasing length through offline_process_stream()
+// and reports the peak resident set size of each run. Every duration runs in
+// its own child process so the peaks do not mask each other. With streaming
+// the peak should stay flat; a whole-buffer implementation would need
+// duration * sample rate * channels * 4 bytes.
+//
+// Compile: gcc -O2 bench_memory.c -o bench_memory -lsndfile -lm
+// Usage:   ./bench_memory [minutes ...]      (default: 1 60 600)
+
+#define BENCH_SAMPLE_RATE 44100
+#define BENCH_CHANNELS    1
+
+typedef struct {
+    long long remaining;
+    double phase;
+} SineReader;
+
+static sf_count_t sine_read(void *ctx, float *frames, sf_count_t max_frames) {
+    SineReader *reader = (SineReader*)ctx;
+    sf_count_t n = reader->remaining < max_frames ? reader->remaining : max_frames;
+    for (sf_count_t i = 0; i < n; ++i) {
+        float s = 0.5f * (float)sin(reader->phase);
+        for (int ch = 0; ch < BENCH_CHANNELS; ++ch) frames[i * BENCH_CHANNELS + ch] = s;
+        reader->phase += 2.0 * M_PI * 220.0 / BENCH_SAMPLE_RATE;
+        if (reader->phase > 2.0 * M_PI) reader->phase -= 2.0 * M_PI;
+    }
+    reader->remaining -= n;
+    return n;
+}
+
+static bool discard_write(void *ctx, const float *frames, sf_count_t n) {
+    (void)ctx;
+    (void)frames;
+    (void)n;
+    return true;
+}
+
+static int run_once(double minutes) {
+    OfflineConfig config = { 4, NOISE_UNIFORM, DSP_NOISE_AMPLITUDE, RESAMPLE_LINEAR, 0.0, PCM_FORMAT_KEEP, false,
+                             PITCH_ENGINE_GRANULAR, 0.0f, DSP_CHAIN_DEFAULT };
+    SineReader reader = { (long long)(minutes * 60.0 * BENCH_SAMPLE_RATE), 0.0 };
+    long long frames = 0;
+    OfflineStatus status = offline_process_stream(&config, BENCH_SAMPLE_RATE, BENCH_CHANNELS,
+                                                  sine_read, &reader, discard_write, NULL, &frames);
+    return status == OFFLINE_OK ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    static const double default_minutes[] = { 1.0, 60.0, 600.0 };
+    int count = argc > 1 ? argc - 1 : (int)(sizeof(default_minutes) / sizeof(default_minutes[0]));
+
+    printf("%10s %12s %14s %18s\n", "minutes", "seconds", "peak RSS (MB)", "whole buffer (MB)");
+    for (int i = 0; i < count; ++i) {
+        double minutes = argc > 1 ? atof(argv[i + 1]) : default_minutes[i];
+        if (minutes <= 0.0) {
+            fprintf(stderr, "invalid duration: %s\n", argv[i + 1]);
+            return 1;
+        }
+
+        double start = offline_now();
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) _exit(run_once(minutes));
+
+        int wstatus;
+        struct rusage usage;
+        if (wait4(pid, &wstatus, 0, &usage) < 0 || !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+            fprintf(stderr, "run for %.0f minutes failed\n", minutes);
+            return 1;
+        }
+        double whole = minutes * 60.0 * BENCH_SAMPLE_RATE * BENCH_CHANNELS * sizeof(float) / (1024.0 * 1024.0);
+        printf("%10.0f %12.1f %14.1f %18.1f\n", minutes, offline_now() - start,
+               usage.ru_maxrss / 1024.0, whole);
+    }
+    return 0;
+}
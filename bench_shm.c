@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "shmpcm.h"
+
+// ==================
+// Shared Memory Benchmark
+// ==================
+// Compares the shared memory rings of shmpcm.h with a Unix socketpair for
+// exchanging audio blocks with another process. A forked child stands in for
+// voicemask and applies a gain to every block; the parent stands in for the
+// recorder. With shared memory the parent writes its samples straight into
+// the ingest ring, the child reads them there and writes the result straight
+// into the egress ring, and the parent reads it back in place. The socket
+// version moves the same blocks with send()/recv().
+//
+// Two measurements per block size and transport:
+//   stream     the parent keeps up to BENCH_INFLIGHT blocks queued; frames
+//              per second, MB/s (one direction) and context switches
+//   ping-pong  one block at a time; round trip p50/p99
+//
+// Compile: gcc -O2 bench_shm.c -o bench_shm -lm -lrt
+// Usage:   ./bench_shm [-c channels] [-t seconds] [block ...]   (default: 64 256 1024 4096)
+
+#define BENCH_SAMPLE_RATE 48000
+#define BENCH_INFLIGHT    16
+#define BENCH_MAX_SAMPLES (1 << 20)
+#define BENCH_GAIN        0.5f
+
+typedef struct {
+    double frames_per_second;
+    double mb_per_second;
+    double switches_per_block;
+    double p50_us, p99_us;
+} BenchResult;
+
+static int bench_channels = 2;
+static double bench_seconds = 1.0;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long context_switches(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void percentiles(double *samples, long n, BenchResult *result) {
+    if (n == 0) return;
+    qsort(samples, (size_t)n, sizeof(double), compare_double);
+    result->p50_us = samples[n / 2] * 1e6;
+    result->p99_us = samples[n * 99 / 100] * 1e6;
+}
+
+static void fill(float *frames, uint64_t samples, uint64_t *counter) {
+    for (uint64_t i = 0; i < samples; ++i) frames[i] = (float)((*counter)++ & 1023) * (1.0f / 1024.0f);
+}
+
+static void gain(const float *in, float *out, uint64_t samples) {
+    for (uint64_t i = 0; i < samples; ++i) out[i] = in[i] * BENCH_GAIN;
+}
+
+// ------------------
+// Shared memory
+// ------------------
+static void shm_child(const char *name) {
+    ShmPcm pcm;
+    char error[256];
+    if (!shm_pcm_open(&pcm, name, error, sizeof(error))) {
+        fprintf(stderr, "child: %s\n", error);
+        _exit(1);
+    }
+    const uint64_t channels = pcm.ingest->channels;
+    for (;;) {
+        if (shm_ring_wait_readable(pcm.ingest, 1, 1000) == SHM_CLOSED) break;
+        if (shm_ring_wait_writable(pcm.egress, 1, 1000) != SHM_READY) continue;
+        const float *in;
+        float *out;
+        uint64_t n = shm_ring_read_span(&pcm, pcm.ingest, &in);
+        uint64_t room = shm_ring_write_span(&pcm, pcm.egress, &out);
+        if (n > room) n = room;
+        if (n == 0) continue;
+        gain(in, out, n * channels);
+        shm_ring_release(pcm.ingest, n);
+        shm_ring_commit(pcm.egress, n);
+    }
+    shm_ring_close(pcm.egress);
+    shm_pcm_close(&pcm);
+    _exit(0);
+}
+
+static bool shm_run(uint64_t block, bool ping_pong, BenchResult *result) {
+    ShmPcm pcm;
+    char name[64], error[256];
+    snprintf(name, sizeof(name), "/voicemask-bench-%d", (int)getpid());
+    if (!shm_pcm_create(&pcm, name, BENCH_SAMPLE_RATE, bench_channels, block * BENCH_INFLIGHT, error, sizeof(error))) {
+        fprintf(stderr, "%s\n", error);
+        return false;
+    }
+    pid_t child = fork();
+    if (child == 0) shm_child(name);
+
+    double *samples = ping_pong ? (double*) malloc(BENCH_MAX_SAMPLES * sizeof(double)) : NULL;
+    long num_samples = 0;
+    uint64_t counter = 0, sent = 0, received = 0, blocks = 0;
+    volatile float sink = 0.0f;
+    long switches = context_switches();
+    double start = now_seconds(), stop = start + bench_seconds;
+    bool closed = false;
+
+    while (!closed) {
+        bool progress = false;
+        bool sending = now_seconds() < stop;
+        if (!sending && !atomic_load(&pcm.ingest->closed)) shm_ring_close(pcm.ingest);
+        if (sending && (!ping_pong || sent == received) && shm_ring_free(pcm.ingest) >= block) {
+            // Written in place; a block may wrap, so it can take two spans.
+            double t0 = now_seconds();
+            for (uint64_t left = block; left > 0;) {
+                float *span;
+                uint64_t n = shm_ring_write_span(&pcm, pcm.ingest, &span);
+                if (n > left) n = left;
+                fill(span, n * bench_channels, &counter);
+                shm_ring_commit(pcm.ingest, n);
+                left -= n;
+            }
+            sent += block;
+            progress = true;
+            if (ping_pong) {
+                while (received < sent) {
+                    if (shm_ring_wait_readable(pcm.egress, 1, 1000) != SHM_READY) break;
+                    const float *span;
+                    uint64_t n = shm_ring_read_span(&pcm, pcm.egress, &span);
+                    sink += span[0];
+                    shm_ring_release(pcm.egress, n);
+                    received += n;
+                }
+                if (num_samples < BENCH_MAX_SAMPLES) samples[num_samples++] = now_seconds() - t0;
+                blocks++;
+                continue;
+            }
+            blocks++;
+        }
+        const float *span;
+        uint64_t n = shm_ring_read_span(&pcm, pcm.egress, &span);
+        if (n > 0) {
+            sink += span[0];
+            shm_ring_release(pcm.egress, n);
+            received += n;
+            progress = true;
+        }
+        if (!progress && shm_ring_wait_readable(pcm.egress, 1, 10) == SHM_CLOSED) closed = true;
+    }
+    double elapsed = now_seconds() - start;
+    switches = context_switches() - switches;
+    waitpid(child, NULL, 0);
+    shm_pcm_close(&pcm);
+    (void)sink;
+
+    result->frames_per_second = received / elapsed;
+    result->mb_per_second = received * bench_channels * sizeof(float) / elapsed / 1e6;
+    result->switches_per_block = blocks ? (double)switches / blocks : 0.0;
+    if (ping_pong) percentiles(samples, num_samples, result);
+    free(samples);
+    return true;
+}
+
+// ------------------
+// Socketpair
+// ------------------
+static bool recv_all(int fd, void *buf, size_t bytes) {
+    char *p = (char*)buf;
+    while (bytes > 0) {
+        ssize_t n = recv(fd, p, bytes, 0);
+        if (n <= 0) return false;
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+static bool send_all(int fd, const void *buf, size_t bytes) {
+    const char *p = (const char*)buf;
+    while (bytes > 0) {
+        ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+static void socket_child(int fd, uint64_t block) {
+    size_t bytes = block * bench_channels * sizeof(float);
+    float *buf = (float*) malloc(bytes);
+    while (buf && recv_all(fd, buf, bytes)) {
+        gain(buf, buf, block * bench_channels);
+        if (!send_all(fd, buf, bytes)) break;
+    }
+    close(fd);
+    _exit(0);
+}
+
+static bool socket_run(uint64_t block, bool ping_pong, BenchResult *result) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return false;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        socket_child(fds[1], block);
+    }
+    close(fds[1]);
+    int fd = fds[0];
+
+    const size_t bytes = block * bench_channels * sizeof(float);
+    float *out = (float*) malloc(bytes);
+    float *in = (float*) malloc(bytes);
+    double *samples = ping_pong ? (double*) malloc(BENCH_MAX_SAMPLES * sizeof(double)) : NULL;
+    long num_samples = 0;
+    uint64_t counter = 0, blocks = 0;
+    size_t sent = 0, received = 0, out_pos = bytes, in_pos = 0;
+    volatile float sink = 0.0f;
+    long switches = context_switches();
+    double start = now_seconds(), stop = start + bench_seconds;
+    const size_t window = ping_pong ? bytes : bytes * BENCH_INFLIGHT;
+    double block_start = 0.0;
+    bool timing = false;
+
+    for (;;) {
+        bool sending = now_seconds() < stop;
+        if (!sending && out_pos == bytes && received == sent) break;
+        if (sending && out_pos == bytes && sent - received + bytes <= window) {
+            block_start = now_seconds();
+            timing = true;
+            fill(out, block * bench_channels, &counter);
+            out_pos = 0;
+        }
+        struct pollfd pfd = { fd, POLLIN | (out_pos < bytes ? POLLOUT : 0), 0 };
+        if (poll(&pfd, 1, 1000) <= 0) break;
+        if ((pfd.revents & POLLOUT) && out_pos < bytes) {
+            ssize_t n = send(fd, (char*)out + out_pos, bytes - out_pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                out_pos += (size_t)n;
+                sent += (size_t)n;
+                if (out_pos == bytes) blocks++;
+            }
+        }
+        if (pfd.revents & POLLIN) {
+            ssize_t n = recv(fd, (char*)in + in_pos, bytes - in_pos, MSG_DONTWAIT);
+            if (n > 0) {
+                in_pos += (size_t)n;
+                received += (size_t)n;
+                if (in_pos == bytes) {
+                    sink += in[0];
+                    in_pos = 0;
+                }
+            }
+        }
+        if (ping_pong && timing && received == sent && out_pos == bytes) {
+            // One full round trip: from filling the block to its last byte coming back
+            if (num_samples < BENCH_MAX_SAMPLES) samples[num_samples++] = now_seconds() - block_start;
+            timing = false;
+        }
+    }
+    double elapsed = now_seconds() - start;
+    switches = context_switches() - switches;
+    shutdown(fd, SHUT_WR);
+    close(fd);
+    waitpid(child, NULL, 0);
+    (void)sink;
+
+    result->frames_per_second = received / (bench_channels * sizeof(float)) / elapsed;
+    result->mb_per_second = received / elapsed / 1e6;
+    result->switches_per_block = blocks ? (double)switches / blocks : 0.0;
+    if (ping_pong) percentiles(samples, num_samples, result);
+    free(samples);
+    free(out);
+    free(in);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    static const uint64_t default_blocks[] = { 64, 256, 1024, 4096 };
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:h")) != -1) {
+        switch (opt) {
+        case 'c': bench_channels = atoi(optarg); break;
+        case 't': bench_seconds = strtod(optarg, NULL); break;
+        default:
+            fprintf(stderr, "Usage: %s [-c channels] [-t seconds] [block ...]\n", argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (bench_channels < 1 || bench_seconds <= 0.0) {
+        fprintf(stderr, "Invalid channels or seconds.\n");
+        return 2;
+    }
+    int count = optind < argc ? argc - optind : (int)(sizeof(default_blocks) / sizeof(default_blocks[0]));
+
+    printf("%d channel(s), float32, %.1f s per run\n", bench_channels, bench_seconds);
+    printf("%-6s %-10s %14s %10s %12s %10s %10s\n", "block", "transport", "frames/s", "MB/s", "switch/blk", "rtt p50", "rtt p99");
+    for (int i = 0; i < count; ++i) {
+        uint64_t block = optind < argc ? strtoull(argv[optind + i], NULL, 10) : default_blocks[i];
+        if (block == 0) continue;
+        static const char *names[] = { "shm", "socket" };
+        for (int t = 0; t < 2; ++t) {
+            BenchResult stream, pong;
+            memset(&stream, 0, sizeof(stream));
+            memset(&pong, 0, sizeof(pong));
+            bool ok = t == 0 ? shm_run(block, false, &stream) && shm_run(block, true, &pong)
+                             : socket_run(block, false, &stream) && socket_run(block, true, &pong);
+            if (!ok) return 1;
+            printf("%-6llu %-10s %14.0f %10.1f %12.2f %8.1fus %8.1fus\n", (unsigned long long)block, names[t],
+                   stream.frames_per_second, stream.mb_per_second, stream.switches_per_block,
+                   pong.p50_us, pong.p99_us);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,226 @@
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// ==================
+// DSP Chain Description
+// ==================
+// The stages a DspContext runs, in order, as parsed from a "chain" line such
+// as "highpass:80, pitch, gain:-3, noise, clip:0.9". Every mode (realtime,
+// record, batch, server, shared memory) builds its contexts from the same
+// DspChain; dsp_set_chain() (dsp.h) turns it into fused passes.
+//
+//   pitch[:ENGINE]   pitch shift; ENGINE granular | vocoder | formant overrides
+//                    pitch_engine. "resample" and "formant" are short for
+//                    pitch:granular and pitch:formant.
+//   gain:DB          gain in dB
+//   highpass:HZ      second-order Butterworth high-pass
+//   lowpass:HZ       second-order Butterworth low-pass
+//   noise[:A]        anonymizing noise of amplitude A (default: --noise); the
+//                    noise kernel also clamps to [-1, 1]
+//   clip[:L]         clamp to [-L, L] (default 1)
+//
+// At most one pitch stage; an empty chain passes audio through unchanged.
+
+#define DSP_CHAIN_MAX_STAGES 16
+
+// Pitch shift stage: the delay-line shifter (pitch.h, low latency, supports
+// seeking for segmented batch runs), the phase vocoder (vocoder.h, closer to
+// librosa's output, size - hop frames of latency), or the phase vocoder with
+// its LPC formant stage, which moves the spectral envelope by its own number
+// of semitones instead of with the pitch.
+typedef enum {
+    PITCH_ENGINE_GRANULAR,
+    PITCH_ENGINE_VOCODER,
+    PITCH_ENGINE_FORMANT
+} PitchEngine;
+
+typedef enum {
+    DSP_STAGE_PITCH,
+    DSP_STAGE_GAIN,
+    DSP_STAGE_HIGHPASS,
+    DSP_STAGE_LOWPASS,
+    DSP_STAGE_NOISE,
+    DSP_STAGE_CLIP
+} DspStageType;
+
+typedef struct {
+    DspStageType type;
+    bool has_value;   // false: the stage's default (see above)
+    float value;      // dB, Hz, amplitude or limit; PitchEngine for pitch
+} DspStage;
+
+typedef struct {
+    int count;
+    DspStage stages[DSP_CHAIN_MAX_STAGES];
+} DspChain;
+
+// pitch → noise (which clips): the chain every mode ran before chains existed.
+#define DSP_CHAIN_DEFAULT { 2, { { DSP_STAGE_PITCH, false, 0.0f }, { DSP_STAGE_NOISE, false, 0.0f } } }
+
+// Returns false for an unknown name.
+static inline bool pitch_engine_from_name(const char *name, PitchEngine *engine) {
+    if (strcmp(name, "granular") == 0) *engine = PITCH_ENGINE_GRANULAR;
+    else if (strcmp(name, "vocoder") == 0) *engine = PITCH_ENGINE_VOCODER;
+    else if (strcmp(name, "formant") == 0) *engine = PITCH_ENGINE_FORMANT;
+    else return false;
+    return true;
+}
+
+static inline const char *pitch_engine_name(PitchEngine engine) {
+    return engine == PITCH_ENGINE_VOCODER ? "vocoder" : engine == PITCH_ENGINE_FORMANT ? "formant" : "granular";
+}
+
+static inline const char *dsp_stage_name(DspStageType type) {
+    switch (type) {
+    case DSP_STAGE_PITCH: return "pitch";
+    case DSP_STAGE_GAIN: return "gain";
+    case DSP_STAGE_HIGHPASS: return "highpass";
+    case DSP_STAGE_LOWPASS: return "lowpass";
+    case DSP_STAGE_NOISE: return "noise";
+    default: return "clip";
+    }
+}
+
+// Parses one "name[:value]" item into `stage`; `item` is trimmed and non-empty.
+static inline bool dsp_stage_parse(const char *item, DspStage *stage, char *error, size_t error_size) {
+    char name[32];
+    const char *colon = strchr(item, ':');
+    size_t len = colon ? (size_t)(colon - item) : strlen(item);
+    if (len >= sizeof(name)) len = sizeof(name) - 1;
+    memcpy(name, item, len);
+    name[len] = '\0';
+    const char *value = colon ? colon + 1 : NULL;
+
+    stage->has_value = false;
+    stage->value = 0.0f;
+    PitchEngine engine;
+    if (strcmp(name, "pitch") == 0 || strcmp(name, "resample") == 0 || strcmp(name, "formant") == 0) {
+        stage->type = DSP_STAGE_PITCH;
+        if (strcmp(name, "pitch") != 0) {
+            if (value) {
+                snprintf(error, error_size, "'%s' takes no value", name);
+                return false;
+            }
+            value = strcmp(name, "resample") == 0 ? "granular" : "formant";
+        }
+        if (!value) return true;
+        if (!pitch_engine_from_name(value, &engine)) {
+            snprintf(error, error_size, "unknown pitch engine '%s'", value);
+            return false;
+        }
+        stage->has_value = true;
+        stage->value = (float)engine;
+        return true;
+    }
+    if (strcmp(name, "gain") == 0) stage->type = DSP_STAGE_GAIN;
+    else if (strcmp(name, "highpass") == 0) stage->type = DSP_STAGE_HIGHPASS;
+    else if (strcmp(name, "lowpass") == 0) stage->type = DSP_STAGE_LOWPASS;
+    else if (strcmp(name, "noise") == 0) stage->type = DSP_STAGE_NOISE;
+    else if (strcmp(name, "clip") == 0) stage->type = DSP_STAGE_CLIP;
+    else {
+        snprintf(error, error_size, "unknown stage '%s'", name);
+        return false;
+    }
+    bool required = stage->type == DSP_STAGE_GAIN || stage->type == DSP_STAGE_HIGHPASS || stage->type == DSP_STAGE_LOWPASS;
+    if (!value) {
+        if (!required) return true;
+        snprintf(error, error_size, "'%s' needs a value, e.g. %s:%s", name, name, stage->type == DSP_STAGE_GAIN ? "-3" : "100");
+        return false;
+    }
+    char *end;
+    double v = strtod(value, &end);
+    bool valid = end != value && *end == '\0';
+    if (stage->type == DSP_STAGE_GAIN) valid = valid && v >= -60.0 && v <= 40.0;
+    else if (stage->type == DSP_STAGE_NOISE) valid = valid && v >= 0.0 && v <= 1.0;
+    else if (stage->type == DSP_STAGE_CLIP) valid = valid && v > 0.0 && v <= 1.0;
+    else valid = valid && v >= 10.0 && v <= 96000.0;
+    if (!valid) {
+        snprintf(error, error_size, "invalid value '%s' for '%s'", value, name);
+        return false;
+    }
+    stage->has_value = true;
+    stage->value = (float)v;
+    return true;
+}
+
+// Parses a comma-separated chain. On failure `chain` is unchanged and
+// `error` says why.
+static inline bool dsp_chain_parse(const char *spec, DspChain *chain, char *error, size_t error_size) {
+    DspChain parsed = { 0 };
+    bool pitch = false;
+    const char *p = spec;
+    while (*p) {
+        const char *comma = strchr(p, ',');
+        size_t len = comma ? (size_t)(comma - p) : strlen(p);
+        char item[64];
+        while (len > 0 && isspace((unsigned char)*p)) { p++; len--; }
+        while (len > 0 && isspace((unsigned char)p[len - 1])) len--;
+        if (len == 0 || len >= sizeof(item)) {
+            snprintf(error, error_size, len == 0 ? "empty stage" : "stage name too long");
+            return false;
+        }
+        memcpy(item, p, len);
+        item[len] = '\0';
+        if (parsed.count == DSP_CHAIN_MAX_STAGES) {
+            snprintf(error, error_size, "more than %d stages", DSP_CHAIN_MAX_STAGES);
+            return false;
+        }
+        DspStage *stage = &parsed.stages[parsed.count];
+        if (!dsp_stage_parse(item, stage, error, error_size)) return false;
+        if (stage->type == DSP_STAGE_PITCH) {
+            if (pitch) {
+                snprintf(error, error_size, "only one pitch stage is allowed");
+                return false;
+            }
+            pitch = true;
+        }
+        parsed.count++;
+        if (!comma) break;
+        p = comma + 1;
+    }
+    *chain = parsed;
+    return true;
+}
+
+// "highpass:80 → pitch → noise", for status lines.
+static inline void dsp_chain_format(const DspChain *chain, char *out, size_t size) {
+    size_t used = 0;
+    out[0] = '\0';
+    if (chain->count == 0) snprintf(out, size, "(bypass)");
+    for (int i = 0; i < chain->count && used < size; ++i) {
+        const DspStage *s = &chain->stages[i];
+        int n = snprintf(out + used, size - used, "%s%s", i ? " → " : "", dsp_stage_name(s->type));
+        if (n > 0) used += (size_t)n;
+        if (!s->has_value || used >= size) continue;
+        if (s->type == DSP_STAGE_PITCH) n = snprintf(out + used, size - used, ":%s", pitch_engine_name((PitchEngine)s->value));
+        else n = snprintf(out + used, size - used, ":%g", s->value);
+        if (n > 0) used += (size_t)n;
+    }
+}
+
+// The pitch engine the chain runs: its pitch stage's own, else `fallback`.
+static inline PitchEngine dsp_chain_engine(const DspChain *chain, PitchEngine fallback) {
+    for (int i = 0; i < chain->count; ++i) {
+        const DspStage *s = &chain->stages[i];
+        if (s->type == DSP_STAGE_PITCH && s->has_value) return (PitchEngine)s->value;
+    }
+    return fallback;
+}
+
+// Filters carry state that a batch segment's warm-up does not reproduce
+// exactly, so chains with filters run every file in one piece.
+static inline bool dsp_chain_seekable(const DspChain *chain) {
+    for (int i = 0; i < chain->count; ++i) {
+        DspStageType t = chain->stages[i].type;
+        if (t == DSP_STAGE_HIGHPASS || t == DSP_STAGE_LOWPASS) return false;
+    }
+    return true;
+}
+
+#endif // CHAIN_H
@@ -0,0 +1,65 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// ==================
+// Config Files
+// ==================
+// Plain "key = value" lines. '#' starts a comment, blank lines are skipped and
+// whitespace around keys and values is ignored. The parser knows no keys
+// itself: every pair goes to the caller's `apply` callback, which returns false
+// for an unknown key or a bad value. Loading stops at the first bad line, with
+// the file name and line number in `error`.
+
+#define CONFIG_MAX_LINE 512
+
+typedef bool (*config_apply_fn)(void *ctx, const char *key, const char *value);
+
+static inline char *config_trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+static inline bool config_load(const char *path, config_apply_fn apply, void *ctx, char *error, size_t error_size) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        snprintf(error, error_size, "'%s' could not be opened", path);
+        return false;
+    }
+
+    char line[CONFIG_MAX_LINE];
+    int line_no = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f)) {
+        line_no++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *text = config_trim(line);
+        if (*text == '\0') continue;
+
+        char *eq = strchr(text, '=');
+        if (!eq) {
+            snprintf(error, error_size, "%s:%d: expected 'key = value'", path, line_no);
+            ok = false;
+            break;
+        }
+        *eq = '\0';
+        char *key = config_trim(text);
+        char *value = config_trim(eq + 1);
+        if (!apply(ctx, key, value)) {
+            snprintf(error, error_size, "%s:%d: unknown key or invalid value '%s = %s'", path, line_no, key, value);
+            ok = false;
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+#endif // CONFIG_H
@@ -0,0 +1,439 @@
+#ifndef DSP_H
+#define DSP_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "pitch.h"
+#include "vocoder.h"
+#include "noise.h"
+#include "chain.h"
+#include "vad.h"
+
+// ==================
+// DSP Context
+// ==================
+// Everything the processing chain needs is allocated once, in dsp_init(), and
+// sized for the largest block the caller will pass. dsp_process() itself
+// performs no heap allocation, so it is safe to run from the realtime thread.
+//
+// The stages come from a DspChain (chain.h; pitch → noise by default).
+// dsp_set_chain() compiles them into passes: the pitch stage runs on the
+// whole block, noise uses the SIMD noise+clip kernel (absorbing a clip that
+// follows it), and each run of filter → gain → clip in that order becomes one
+// loop of a kernel specialized at compile time for exactly those stages
+// (DSP_FUSED_KERNEL). Consecutive sample-wise passes are run chunk by chunk,
+// so a block is swept once and each chunk stays in L1 between passes.
+//
+// A granular pitch stage directly followed by noise runs as one pass
+// (dsp_pitch_noise_process()): each PITCH_CHUNK of taps is mixed, noised and
+// clamped straight into `out` by a noise_mix_fn kernel, instead of the shifter
+// writing the block and the noise kernel reading it back. That halves the
+// block-sized traffic (8 instead of 16 bytes per frame) and gives the same
+// output bit for bit.
+//
+// With a voice activity detector (dsp_set_vad(), vad.h) a silent block skips
+// the chain: the pitch stage only takes the input into its history, so it
+// picks up exactly where it would have been when speech resumes, and the
+// output is comfort noise or silence.
+
+#define DSP_NOISE_AMPLITUDE 0.003f
+#define DSP_CHAIN_CHUNK     256   // frames per chunk of sample-wise passes; a multiple of NOISE_LANES
+#define DSP_FILTER_Q        0.70710678f // Butterworth
+
+typedef enum {
+    DSP_PASS_PITCH,
+    DSP_PASS_NOISE,
+    DSP_PASS_FUSED
+} DspPassKind;
+
+typedef struct {
+    float b0, b1, b2, a1, a2;  // normalized by a0
+    float z1, z2;              // transposed direct form II state
+} DspBiquad;
+
+typedef struct DspPass DspPass;
+typedef void (*dsp_fused_fn)(DspPass *pass, const float *in, float *out, long n);
+
+struct DspPass {
+    DspPassKind kind;
+    dsp_fused_fn fused;        // DSP_PASS_FUSED
+    const char *name;          // kernel, e.g. "filter+gain+clip"
+    DspBiquad filter;
+    float gain;                // linear
+    float limit;               // clip
+    bool own_amplitude;        // noise:A given in the chain
+    float amplitude;
+};
+
+typedef struct {
+    long max_block;         // largest block dsp_process() accepts
+    float *input_block;     // scratch: block read from the input ring
+    float *output_block;    // scratch: processed block for the output ring
+    PitchShifter shifter;   // pitch shifter history and phase
+    PitchEngine engine;
+    PhaseVocoder vocoder;   // PITCH_ENGINE_VOCODER and PITCH_ENGINE_FORMANT
+    int sample_rate;
+    int n_steps;
+    NoiseRng rng;           // per-context noise generator, never shared between threads
+    noise_kernel_fn noise_kernel; // AVX2/SSE2/scalar, chosen at init
+    noise_mix_fn noise_mix;       // same instruction set, pitch+noise pass
+    const char *noise_kernel_name;
+    NoiseShape noise_shape;
+    float noise_amplitude;
+    DspChain chain;
+    DspPass passes[DSP_CHAIN_MAX_STAGES];
+    int n_passes;
+    bool has_pitch;
+    Vad vad;                // config.mode VAD_OFF: every block runs the chain
+    bool skipped;           // the last block was silent and skipped the chain
+} DspContext;
+
+// ------------------
+// Fused sample-wise kernels
+// ------------------
+// One loop per combination of filter, gain and clip; the unused stages are
+// compiled out, so e.g. gain+clip is a multiply and two compares per sample.
+#define DSP_FUSED_KERNEL(NAME, FILTER, GAIN, CLIP)                                  \
+    static void NAME(DspPass *pass, const float *in, float *out, long n) {          \
+        const DspBiquad f = pass->filter;                                           \
+        float z1 = f.z1, z2 = f.z2;                                                 \
+        const float gain = pass->gain, limit = pass->limit;                         \
+        for (long i = 0; i < n; ++i) {                                              \
+            float v = in[i];                                                        \
+            if (FILTER) {                                                           \
+                float y = f.b0 * v + z1;                                            \
+                z1 = f.b1 * v - f.a1 * y + z2;                                      \
+                z2 = f.b2 * v - f.a2 * y;                                           \
+                v = y;                                                              \
+            }                                                                       \
+            if (GAIN) v *= gain;                                                    \
+            if (CLIP) v = v < -limit ? -limit : v > limit ? limit : v;              \
+            out[i] = v;                                                             \
+        }                                                                           \
+        /* Flush decaying state before it turns denormal on silence. */            \
+        pass->filter.z1 = fabsf(z1) < 1e-20f ? 0.0f : z1;                           \
+        pass->filter.z2 = fabsf(z2) < 1e-20f ? 0.0f : z2;                           \
+    }
+
+DSP_FUSED_KERNEL(dsp_fused_f, 1, 0, 0)
+DSP_FUSED_KERNEL(dsp_fused_g, 0, 1, 0)
+DSP_FUSED_KERNEL(dsp_fused_fg, 1, 1, 0)
+DSP_FUSED_KERNEL(dsp_fused_c, 0, 0, 1)
+DSP_FUSED_KERNEL(dsp_fused_fc, 1, 0, 1)
+DSP_FUSED_KERNEL(dsp_fused_gc, 0, 1, 1)
+DSP_FUSED_KERNEL(dsp_fused_fgc, 1, 1, 1)
+
+// Indexed by filter | gain << 1 | clip << 2.
+static const struct { dsp_fused_fn fn; const char *name; } dsp_fused_kernels[8] = {
+    { NULL, NULL }, { dsp_fused_f, "filter" }, { dsp_fused_g, "gain" }, { dsp_fused_fg, "filter+gain" },
+    { dsp_fused_c, "clip" }, { dsp_fused_fc, "filter+clip" }, { dsp_fused_gc, "gain+clip" },
+    { dsp_fused_fgc, "filter+gain+clip" }
+};
+
+// RBJ cookbook low/high-pass at `hz`, kept below 0.45 * sample_rate.
+static inline void dsp_biquad_design(DspBiquad *f, bool highpass, float hz, int sample_rate) {
+    double fc = hz < 0.45 * sample_rate ? hz : 0.45 * sample_rate;
+    double w0 = 2.0 * M_PI * fc / sample_rate, c = cos(w0), alpha = sin(w0) / (2.0 * DSP_FILTER_Q);
+    double a0 = 1.0 + alpha;
+    double b1 = highpass ? -(1.0 + c) : 1.0 - c, b0 = (highpass ? 1.0 + c : 1.0 - c) / 2.0;
+    f->b0 = (float)(b0 / a0);
+    f->b1 = (float)(b1 / a0);
+    f->b2 = (float)(b0 / a0);
+    f->a1 = (float)(-2.0 * c / a0);
+    f->a2 = (float)((1.0 - alpha) / a0);
+    f->z1 = f->z2 = 0.0f;
+}
+
+// Compiles `chain` into ctx->passes and resets the filters. The pitch stage's
+// engine is set separately, by dsp_set_pitch_engine(). Call before the first
+// block.
+static inline void dsp_set_chain(DspContext *ctx, const DspChain *chain) {
+    const DspStage *s = chain->stages;
+    const int count = chain->count;
+    ctx->chain = *chain;
+    ctx->n_passes = 0;
+    ctx->has_pitch = false;
+    for (int i = 0; i < count;) {
+        DspPass *pass = &ctx->passes[ctx->n_passes++];
+        memset(pass, 0, sizeof(*pass));
+        if (s[i].type == DSP_STAGE_PITCH) {
+            pass->kind = DSP_PASS_PITCH;
+            pass->name = "pitch";
+            ctx->has_pitch = true;
+            i++;
+            continue;
+        }
+        if (s[i].type == DSP_STAGE_NOISE) {
+            pass->kind = DSP_PASS_NOISE;
+            pass->name = "noise+clip";
+            pass->own_amplitude = s[i].has_value;
+            pass->amplitude = s[i].value;
+            // The noise kernel already clamps to [-1, 1].
+            for (i++; i < count && s[i].type == DSP_STAGE_CLIP && (!s[i].has_value || s[i].value >= 1.0f); i++) {}
+            continue;
+        }
+        int mask = 0;
+        if (s[i].type == DSP_STAGE_HIGHPASS || s[i].type == DSP_STAGE_LOWPASS) {
+            dsp_biquad_design(&pass->filter, s[i].type == DSP_STAGE_HIGHPASS, s[i].value, ctx->sample_rate);
+            mask |= 1;
+            i++;
+        }
+        if (i < count && s[i].type == DSP_STAGE_GAIN) {
+            pass->gain = powf(10.0f, s[i].value / 20.0f);
+            mask |= 2;
+            i++;
+        }
+        if (i < count && s[i].type == DSP_STAGE_CLIP) {
+            pass->limit = s[i].has_value ? s[i].value : 1.0f;
+            mask |= 4;
+            i++;
+        }
+        pass->kind = DSP_PASS_FUSED;
+        pass->fused = dsp_fused_kernels[mask].fn;
+        pass->name = dsp_fused_kernels[mask].name;
+    }
+}
+
+static inline bool dsp_init(DspContext *ctx, int sample_rate, int n_steps, long max_block) {
+    ctx->max_block = max_block;
+    ctx->input_block = (float*) calloc(max_block, sizeof(float));
+    ctx->output_block = (float*) calloc(max_block, sizeof(float));
+    ctx->shifter.history = NULL;
+    ctx->engine = PITCH_ENGINE_GRANULAR;
+    ctx->vocoder.plan = NULL;
+    ctx->sample_rate = sample_rate;
+    ctx->n_steps = n_steps;
+    noise_rng_seed(&ctx->rng, (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)ctx);
+    ctx->noise_kernel = noise_select_kernel(&ctx->noise_kernel_name);
+    ctx->noise_mix = noise_select_mix_kernel();
+    ctx->noise_shape = NOISE_UNIFORM;
+    ctx->noise_amplitude = DSP_NOISE_AMPLITUDE;
+    const DspChain chain = DSP_CHAIN_DEFAULT;
+    dsp_set_chain(ctx, &chain);
+    memset(&ctx->vad, 0, sizeof(ctx->vad));
+    ctx->skipped = false;
+    if (!ctx->input_block || !ctx->output_block ||
+        !pitch_shifter_init(&ctx->shifter, sample_rate, n_steps)) {
+        free(ctx->input_block);
+        free(ctx->output_block);
+        return false;
+    }
+    return true;
+}
+
+static inline void dsp_set_noise(DspContext *ctx, NoiseShape shape, float amplitude) {
+    ctx->noise_shape = shape;
+    ctx->noise_amplitude = amplitude;
+}
+
+// Call before the first block. `formant_steps` is the envelope's shift in
+// semitones, used by PITCH_ENGINE_FORMANT only (0 keeps the speaker's
+// formants). Returns false if the vocoder's state cannot be allocated; the
+// context then keeps the granular shifter.
+static inline bool dsp_set_pitch_engine(DspContext *ctx, PitchEngine engine, float formant_steps) {
+    if (engine == ctx->engine) return true;
+    phase_vocoder_free(&ctx->vocoder);
+    ctx->engine = PITCH_ENGINE_GRANULAR;
+    if (engine == PITCH_ENGINE_GRANULAR) return true;
+    if (!phase_vocoder_init(&ctx->vocoder, ctx->sample_rate, ctx->n_steps)) return false;
+    if (engine == PITCH_ENGINE_FORMANT && !phase_vocoder_set_formants(&ctx->vocoder, ctx->sample_rate, formant_steps)) {
+        phase_vocoder_free(&ctx->vocoder);
+        return false;
+    }
+    ctx->engine = engine;
+    return true;
+}
+
+// Fixed delay of the pitch stage, in frames; 0 without one.
+static inline long dsp_latency(const DspContext *ctx) {
+    if (!ctx->has_pitch) return 0;
+    return ctx->engine != PITCH_ENGINE_GRANULAR ? phase_vocoder_latency(&ctx->vocoder) : pitch_shifter_latency(&ctx->shifter);
+}
+
+// Call after dsp_set_chain() and dsp_set_pitch_engine(), so the hangover
+// covers the pitch stage's delay. Returns false if the detector's scratch
+// cannot be allocated; every block then runs the chain.
+static inline bool dsp_set_vad(DspContext *ctx, const VadConfig *config) {
+    vad_free(&ctx->vad);
+    memset(&ctx->vad, 0, sizeof(ctx->vad));
+    if (config->mode == VAD_OFF) return true;
+    if (!vad_init(&ctx->vad, config, ctx->sample_rate, dsp_latency(ctx))) {
+        ctx->vad.config.mode = VAD_OFF;
+        return false;
+    }
+    return true;
+}
+
+static inline void dsp_free(DspContext *ctx) {
+    vad_free(&ctx->vad);
+    phase_vocoder_free(&ctx->vocoder);
+    pitch_shifter_free(&ctx->shifter);
+    free(ctx->input_block);
+    free(ctx->output_block);
+    ctx->input_block = ctx->output_block = NULL;
+}
+
+// Touches a buffer's pages; realtime mode passes rt_prefault() (rtsched.h).
+typedef void (*dsp_touch_fn)(void *p, size_t bytes);
+
+static inline void dsp_touch_fft(const FftPlan *plan, dsp_touch_fn touch) {
+    const int quarter = plan->half / 2 > 0 ? plan->half / 2 : 1;
+    touch(plan->bitrev, (size_t)plan->half * sizeof(int));
+    touch(plan->tw_re, (size_t)plan->half * sizeof(float));
+    touch(plan->tw_im, (size_t)plan->half * sizeof(float));
+    touch(plan->post_cos, (size_t)(quarter + 1) * sizeof(float));
+    touch(plan->post_sin, (size_t)(quarter + 1) * sizeof(float));
+}
+
+// Hands `touch` every heap buffer dsp_process() reads or writes: the scratch
+// blocks, the granular shifter, the vocoder's state, LPC block and shared
+// plan when a vocoder engine is set, and the detector's flatness scratch.
+// Call after the last dsp_set_*().
+static inline void dsp_prefault(DspContext *ctx, dsp_touch_fn touch) {
+    touch(ctx->input_block, (size_t)ctx->max_block * sizeof(float));
+    touch(ctx->output_block, (size_t)ctx->max_block * sizeof(float));
+    touch(ctx->shifter.history, 2 * ctx->shifter.size * sizeof(float));
+    touch(ctx->shifter.tap_a, PITCH_CHUNK * sizeof(float));
+    touch(ctx->shifter.tap_b, PITCH_CHUNK * sizeof(float));
+    touch(ctx->shifter.gain_a, PITCH_CHUNK * sizeof(float));
+
+    const PhaseVocoder *pv = &ctx->vocoder;
+    if (pv->plan) {
+        const VocoderPlan *plan = pv->plan;
+        const int bins = plan->size / 2 + 1;
+        touch(pv->in_fifo, ((size_t)plan->size * 3 + plan->hop + (size_t)bins * 9) * sizeof(float));
+        touch(pv->peaks, (size_t)bins * sizeof(int));
+        touch(pv->region_end, (size_t)bins * sizeof(int));
+        touch(plan->window, (size_t)plan->size * sizeof(float));
+        touch(plan->synthesis, (size_t)plan->size * sizeof(float));
+        dsp_touch_fft(&plan->fft, touch);
+        if (pv->lpc) {
+            const int grid_bins = plan->envelope_fft.half + 1;
+            touch(pv->lpc, sizeof(LpcEstimator) + ((size_t)bins + grid_bins) * 2 * sizeof(float));
+            dsp_touch_fft(&plan->envelope_fft, touch);
+        }
+    }
+
+    if (ctx->vad.window) {
+        touch(ctx->vad.window, (VAD_FFT_SIZE * 3 + 2) * sizeof(float));
+        dsp_touch_fft(&ctx->vad.fft, touch);
+    }
+}
+
+// Granular pitch shift, noise and clamp in one pass over the block; the
+// shifter's taps for each chunk stay in L1. `in` and `out` may be the same
+// buffer.
+static inline void dsp_pitch_noise_process(PitchShifter *ps, NoiseRng *rng, noise_mix_fn mix,
+                                           NoiseShape shape, float amplitude,
+                                           const float *in, float *out, long n) {
+    for (long off = 0; off < n; off += PITCH_CHUNK) {
+        long c = (n - off < PITCH_CHUNK) ? n - off : PITCH_CHUNK;
+        pitch_shifter_render_chunk(ps, in + off, c);
+        mix(rng, ps->tap_a, ps->tap_b, ps->gain_a, out + off, c, shape, amplitude);
+        pitch_shifter_advance(ps, c);
+    }
+}
+
+static inline void dsp_run_pass(DspContext *ctx, DspPass *pass, const float *in, float *out, long n) {
+    if (pass->kind == DSP_PASS_NOISE) {
+        ctx->noise_kernel(&ctx->rng, in, out, n, ctx->noise_shape,
+                          pass->own_amplitude ? pass->amplitude : ctx->noise_amplitude);
+    } else {
+        pass->fused(pass, in, out, n);
+    }
+}
+
+// A block the detector found silent. The pitch stage takes the input into its
+// history, filters restart from rest, and the output is comfort noise from
+// the chain's first noise stage (VAD_NOISE) or silence.
+static inline void dsp_process_silent(DspContext *ctx, const float *in, float *out, long n) {
+    DspPass *noise = NULL;
+    for (int p = 0; p < ctx->n_passes; ++p) {
+        DspPass *pass = &ctx->passes[p];
+        if (pass->kind == DSP_PASS_PITCH) {
+            if (ctx->engine != PITCH_ENGINE_GRANULAR) phase_vocoder_skip(&ctx->vocoder, in, n);
+            else pitch_shifter_skip(&ctx->shifter, in, n);
+        } else if (pass->kind == DSP_PASS_NOISE) {
+            if (!noise) noise = pass;
+        } else {
+            pass->filter.z1 = pass->filter.z2 = 0.0f;
+        }
+    }
+    memset(out, 0, (size_t)n * sizeof(float));
+    if (noise && ctx->vad.config.mode == VAD_NOISE) dsp_run_pass(ctx, noise, out, out, n);
+}
+
+// Runs the chain. `n` must not exceed max_block; `in` and `out` may be the
+// same buffer.
+static inline void dsp_process(DspContext *ctx, const float *in, float *out, long n) {
+    ctx->skipped = ctx->vad.config.mode != VAD_OFF && !vad_is_speech(&ctx->vad, in, n);
+    if (ctx->skipped) {
+        dsp_process_silent(ctx, in, out, n);
+        return;
+    }
+    const float *src = in;
+    for (int p = 0; p < ctx->n_passes;) {
+        if (ctx->passes[p].kind == DSP_PASS_PITCH) {
+            const DspPass *next = p + 1 < ctx->n_passes ? &ctx->passes[p + 1] : NULL;
+            if (ctx->engine == PITCH_ENGINE_GRANULAR && next && next->kind == DSP_PASS_NOISE) {
+                // PITCH_CHUNK is a multiple of NOISE_LANES, so the noise is drawn
+                // exactly as one noise pass over the block would draw it.
+                dsp_pitch_noise_process(&ctx->shifter, &ctx->rng, ctx->noise_mix, ctx->noise_shape,
+                                        next->own_amplitude ? next->amplitude : ctx->noise_amplitude,
+                                        src, out, n);
+                src = out;
+                p += 2;
+                continue;
+            }
+            if (ctx->engine != PITCH_ENGINE_GRANULAR) phase_vocoder_process(&ctx->vocoder, src, out, n);
+            else pitch_shifter_process(&ctx->shifter, src, out, n);
+            src = out;
+            p++;
+            continue;
+        }
+        int end = p + 1;
+        while (end < ctx->n_passes && ctx->passes[end].kind != DSP_PASS_PITCH) end++;
+        const long step = end - p > 1 ? DSP_CHAIN_CHUNK : n;
+        for (long i = 0; i < n; i += step) {
+            const long m = n - i < step ? n - i : step;
+            const float *chunk = src + i;
+            for (int q = p; q < end; ++q) {
+                dsp_run_pass(ctx, &ctx->passes[q], chunk, out + i, m);
+                chunk = out + i;
+            }
+        }
+        src = out;
+        p = end;
+    }
+    if (src != out) memmove(out, src, (size_t)n * sizeof(float));
+}
+
+// Runs `channels` contexts, one per channel, over `n` interleaved frames.
+// Each context's input_block holds its channel while it is processed, so `n`
+// must not exceed max_block. `in` and `out` may be the same buffer.
+static inline void dsp_process_interleaved(DspContext *dsp, int channels, const float *in, float *out, long n) {
+    if (channels == 1) {
+        dsp_process(&dsp[0], in, out, n);
+        return;
+    }
+    for (int ch = 0; ch < channels; ++ch) {
+        float *plane = dsp[ch].input_block;
+        for (long i = 0; i < n; ++i) plane[i] = in[i * channels + ch];
+        dsp_process(&dsp[ch], plane, plane, n);
+        for (long i = 0; i < n; ++i) out[i * channels + ch] = plane[i];
+    }
+}
+
+// True when every one of the `channels` contexts skipped its last block.
+static inline bool dsp_skipped(const DspContext *dsp, int channels) {
+    for (int ch = 0; ch < channels; ++ch) {
+        if (!dsp[ch].skipped) return false;
+    }
+    return true;
+}
+
+#endif // DSP_H
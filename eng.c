@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // CPU sets, pthread_setaffinity_np and RUSAGE_THREAD for rtsched.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,7 +7,22 @@
 #include <portaudio.h>
 #include <sndfile.h>
 #include <pthread.h> // For threading
+#include <getopt.h>  // --in/--out command line options
+#include <signal.h>  // Ctrl+C stops the server
 #include <unistd.h>  // for sleep
+#include "ringbuf.h" // Lock-free SPSC ring buffer
+#include "dsp.h"     // Preallocated DSP chain (pitch shift → noise → clip)
+#include "allocguard.h" // -DVOICEMASK_ALLOC_GUARD: abort on heap use in the hot path
+#include "offline.h" // Headless file processing
+#include "threadpool.h" // Worker pool for batch mode
+#include "audio.h"   // Audio backends: PortAudio, file, null
+#include "metrics.h" // Lock-free latency/xrun counters and their reporter
+#include "config.h"  // key = value config files
+#include "latency.h" // Output ring depth controller
+#include "rtsched.h" // Processor thread priority, CPU pinning, memory locking
+#include "server.h"  // Multi-stream server on a Unix socket
+#include "shmpcm.h"  // Shared memory rings for co-located recorders
+#include "streamrec.h" // FLAC/Opus copy of the realtime stream, encoded off the audio path
 
 // On Debian/Ubuntu based systems, you might need to install the following packages:
 // sudo apt-get update
@@ -48,34 +64,97 @@
 #define NUM_CHANNELS        1
 #define RECORDING_FILENAME  "recorded_mixed_audio_c.wav"
 #define PITCH_SHIFT_STEPS   -4
+#define NOISE_SHAPE         NOISE_UNIFORM // NOISE_TPDF, or NOISE_GAUSSIAN to match np.random.normal in eng.py
+#define NOISE_AMPLITUDE     0.003f        // half-width (uniform/TPDF) or sigma (Gaussian)
+#define STATS_INTERVAL      5.0           // seconds between realtime status lines; 0 turns them off
+#define METRICS_FILE        NULL          // e.g. "voicemask.prom" (Prometheus text) or "voicemask.json"
+#define RESAMPLE_QUALITY    RESAMPLE_LINEAR // RESAMPLE_CUBIC or RESAMPLE_SINC for cleaner pitch shifting
+#define CONFIG_FILE         "voicemask.conf" // read at startup if present: sample_rate, block_size, channels
+#define LATENCY_TARGET_MS   3.0           // processed audio kept queued ahead of the output; at least one block
+#define LATENCY_MAX_MS      100.0         // the target never widens beyond this, however many underruns
+#define DIRECT_MODE         false         // run the DSP chain inside the audio callback (--direct)
+#define DIRECT_MAX_LOAD     0.5           // direct mode gives up when a block costs more than this share of its period
+#define DIRECT_OVERRUNS     4             // ... for this many blocks in a row
+#define RT_POLICY           SCHED_OTHER   // SCHED_FIFO or SCHED_RR: realtime priority for the processor thread (--sched)
+#define RT_PRIORITY         70            // 1-99, FIFO/RR only; needs CAP_SYS_NICE or an rtprio limit
+#define RT_CPUS             NULL          // pin the processor thread, e.g. "3" or "2-3"
+#define RT_LOCK_MEMORY      false         // mlockall() and prefault the stream's buffers (--mlock)
+#define OUTPUT_FORMAT       PCM_FORMAT_KEEP // PCM_FORMAT_16/24/FLOAT; KEEP = float recordings, input's encoding in batch mode
+#define OUTPUT_DITHER       false         // TPDF dither before quantizing to PCM16/PCM24 (--dither)
+#define PITCH_ENGINE        PITCH_ENGINE_GRANULAR // PITCH_ENGINE_VOCODER: phase vocoder like librosa in eng.py, more latency
+#define FORMANT_SHIFT_STEPS 2.0f          // PITCH_ENGINE_FORMANT: move the formants by this many semitones, 0 = keep them
+#define VAD_CONFIG          VAD_CONFIG_DEFAULT // { VAD_NOISE, -50.0f, false }: skip the chain on silent blocks (--vad)
+#define DSP_CHAIN           DSP_CHAIN_DEFAULT // stages of every mode; "chain = ..." in the config file or --chain (see chain.h)
+#define SHM_RING_BLOCKS     16            // blocks each shared memory ring holds (--shm)
+#define STREAM_RECORD_PATH  NULL          // e.g. "masked.flac": keep the realtime output (--record-to)
+#define STREAM_RECORD_CODEC STREAM_CODEC_FLAC // or STREAM_CODEC_OPUS (.opus, about a tenth of FLAC's size)
+#define STREAM_ROTATE_SECONDS 0.0         // start a new numbered file after this much audio; 0 = never
+#define STREAM_ROTATE_MB    0.0           // ... or once the file reaches this size; 0 = never
+#define STREAM_QUEUE_SECONDS 2.0          // audio queued for the encoder before blocks are dropped
 
 // CHANGE: Constant DURATION_SECONDS removed.
 
 // ==================
 // Realtime Data Structure
 // ==================
-typedef struct {
-    float *buffer;
-    long buffer_size;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond_data_available;
-    pthread_cond_t cond_buffer_empty;
-    long read_idx;
-    long write_idx;
-    bool terminate;
-} RealtimeBuffer;
-
 RealtimeBuffer inputBuffer;
 RealtimeBuffer outputBuffer;
+RealtimeMetrics metrics;
+LatencyController latency;
+Server server;
+
+// Stream format of record and realtime mode. Starts from the General Settings;
+// CONFIG_FILE, --config and the command line can change it.
+typedef struct {
+    int sample_rate;
+    int frames_per_buffer;
+    int channels;
+    PcmFormat output_format; // recordings and batch outputs
+    bool dither;
+    PitchEngine pitch_engine; // pitch shift stage of every mode
+    float formant_steps;      // envelope shift of the formant engine
+    DspChain chain;           // stages of every mode, in order
+    VadConfig vad;            // voice activity detection of the streaming modes
+} AudioSettings;
+
+AudioSettings settings = { SAMPLE_RATE, FRAMES_PER_BUFFER, NUM_CHANNELS, OUTPUT_FORMAT, OUTPUT_DITHER, PITCH_ENGINE,
+                            FORMANT_SHIFT_STEPS, DSP_CHAIN, VAD_CONFIG };
+
+// Realtime mode options that the command line can override
+typedef struct {
+    double stats_interval;    // seconds between status lines, 0 = off
+    const char *metrics_path; // JSON/Prometheus export file, NULL = off
+    bool direct;              // process inside the callback while the chain is cheap enough
+    RtSchedConfig sched;      // processor thread priority and CPUs, memory locking
+    StreamRecConfig record;   // compressed copy of the processed stream, path NULL = off
+} RealtimeOptions;
+
+// State of the realtime processor thread, shared with the callback in direct
+// mode. Only one of them runs the DSP chain at a time: the callback while
+// `direct` is set, the processor thread after that.
+typedef struct {
+    DspContext *dsp;  // one per channel
+    int channels;
+    long frames;      // frames per block
+    float *block;     // one interleaved block
+    bool direct;      // set before the stream starts, cleared only by the callback
+    uint64_t budget_ns; // direct mode: allowed DSP time per block
+    int overruns;     // direct mode: consecutive blocks over budget
+    const RtSchedConfig *sched; // applied by the processor thread to itself
+    StreamRecorder *recorder;   // receives every processed block, NULL = not recording
+} RealtimeProcessor;
+
+// State of the microphone reader used by record mode
+typedef struct {
+    PaStream *stream;
+    long long remaining; // frames still to record
+    long overflows;
+    PaError err;
+} RecordReader;
 
 // ==================
 // Function Prototypes
 // ==================
-void initialize_realtime_buffer(RealtimeBuffer *rb, long size);
-void destroy_realtime_buffer(RealtimeBuffer *rb);
-bool write_to_buffer(RealtimeBuffer *rb, const float *data, long frames);
-bool read_from_buffer(RealtimeBuffer *rb, float *data, long frames);
-
 int paCallback(const void *inputBufferPtr, void *outputBufferPtr,
                unsigned long framesPerBuffer,
                const PaStreamCallbackTimeInfo* timeInfo,
@@ -83,19 +162,47 @@ int paCallback(const void *inputBufferPtr, void *outputBufferPtr,
                void *userData);
 
 void *realtime_processor_thread(void *arg);
-void simple_pitch_shift(float *data, long num_frames, int sample_rate, int n_steps);
+void direct_process(RealtimeProcessor *proc, const float *in, float *out, unsigned long frames);
+uint64_t measure_chain_cost(RealtimeProcessor *proc);
+void apply_thread_scheduling(const RtSchedConfig *sched);
+bool lock_realtime_memory(RealtimeProcessor *proc);
 void record_process_play_save_mode();
-void realtime_mode();
+sf_count_t record_read(void *ctx, float *frames, sf_count_t max_frames);
+void realtime_mode(AudioBackend *backend, const RealtimeOptions *options, const OfflineConfig *dsp_config);
+void print_stats(const MetricsSnapshot *s, void *ctx);
 void display_menu();
 void clear_input_buffer();
+int batch_main(int argc, char **argv);
+int backend_main(const char *name, const char *in, const char *out, double duration, double speed,
+                 const RealtimeOptions *options, const OfflineConfig *dsp_config);
+void print_usage(const char *prog);
+bool apply_setting(void *ctx, const char *key, const char *value);
+bool apply_batch_option(OfflineConfig *config, int *jobs, const char *key, const char *value);
+bool apply_stream_option(RealtimeOptions *options, double *duration, double *speed, const char *key, const char *value);
+bool load_config(const char *path);
+int server_main(const char *path, const OfflineConfig *config, int jobs, double stats_interval);
+void print_server_stats(const ServerSnapshot *s, void *ctx);
+void stop_server(int sig);
+int shm_main(const char *name, const OfflineConfig *config, double stats_interval);
+void stop_shm(int sig);
 
 // ==================
 // Main Function
 // ==================
-int main() {
+int main(int argc, char **argv) {
     PaError err;
     int choice;
 
+    // CONFIG_FILE applies to every mode; command line options override it.
+    if (offline_is_file(CONFIG_FILE) && !load_config(CONFIG_FILE)) {
+        return 1;
+    }
+
+    // Any command line argument selects headless batch mode; PortAudio is never touched.
+    if (argc > 1) {
+        return batch_main(argc, argv);
+    }
+
     err = Pa_Initialize();
     if (err != paNoError) {
         fprintf(stderr, GET_COLOR(BRIGHT_RED)"PortAudio error: %s\n"RESET, Pa_GetErrorText(err));
@@ -120,7 +227,16 @@ int main() {
             printf(GET_COLOR(BRIGHT_YELLOW)"%s\n"RESET, "==================================================");
         } else if (choice == 2) {
             printf(GET_COLOR(MAGENTA)BOLD">>> Selection: Realtime Mode <<<"RESET"\n\n");
-            realtime_mode();
+            AudioPortAudioBackend backend;
+            RealtimeOptions options = { STATS_INTERVAL, METRICS_FILE, DIRECT_MODE,
+                                        { RT_POLICY, RT_PRIORITY, RT_CPUS, RT_LOCK_MEMORY },
+                                        { STREAM_RECORD_PATH, STREAM_RECORD_CODEC, STREAM_ROTATE_SECONDS, STREAM_ROTATE_MB } };
+            OfflineConfig dsp_config = { PITCH_SHIFT_STEPS, NOISE_SHAPE, NOISE_AMPLITUDE, RESAMPLE_QUALITY, 0.0,
+                                         settings.output_format, settings.dither,
+                                         dsp_chain_engine(&settings.chain, settings.pitch_engine),
+                                         settings.formant_steps, settings.chain };
+            audio_portaudio_backend_init(&backend);
+            realtime_mode(&backend.base, &options, &dsp_config);
             printf(GET_COLOR(BRIGHT_YELLOW)"%s\n"RESET, "==================================================");
         } else if (choice == 3) {
             printf(GET_COLOR(BRIGHT_RED)"Exiting the program. Goodbye!"RESET"\n");
@@ -140,11 +256,666 @@ int main() {
 }
 
 
+// ==================
+// Stream Settings
+// ==================
+// config_load() callback, also used for --rate/--block/--channels. Rejects
+// unknown keys and values outside what the realtime path is built for.
+bool apply_setting(void *ctx, const char *key, const char *value) {
+    AudioSettings *s = (AudioSettings*)ctx;
+    char *end;
+    if (strcmp(key, "output_format") == 0) return pcm_format_from_name(value, &s->output_format);
+    if (strcmp(key, "pitch_engine") == 0) return pitch_engine_from_name(value, &s->pitch_engine);
+    if (strcmp(key, "chain") == 0) {
+        char error[128];
+        return dsp_chain_parse(value, &s->chain, error, sizeof(error));
+    }
+    if (strcmp(key, "vad") == 0) return vad_mode_from_name(value, &s->vad.mode);
+    if (strcmp(key, "vad_threshold") == 0) {
+        double db = strtod(value, &end);
+        if (end == value || *end != '\0' || db < -90.0 || db > 0.0) return false;
+        s->vad.threshold_db = (float)db;
+        return true;
+    }
+    if (strcmp(key, "formant_steps") == 0) {
+        double steps = strtod(value, &end);
+        if (end == value || *end != '\0' || steps < -24.0 || steps > 24.0) return false;
+        s->formant_steps = (float)steps;
+        return true;
+    }
+    long v = strtol(value, &end, 10);
+    if (end == value || *end != '\0') return false;
+
+    if (strcmp(key, "sample_rate") == 0 && v >= 8000 && v <= 192000) {
+        s->sample_rate = (int)v;
+    } else if (strcmp(key, "block_size") == 0 && v >= 16 && v <= 8192) {
+        s->frames_per_buffer = (int)v;
+    } else if (strcmp(key, "channels") == 0 && v >= 1 && v <= 8) {
+        s->channels = (int)v;
+    } else if (strcmp(key, "dither") == 0 && (v == 0 || v == 1)) {
+        s->dither = v == 1;
+    } else if (strcmp(key, "vad_flatness") == 0 && (v == 0 || v == 1)) {
+        s->vad.flatness = v == 1;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Loads `path` into the global settings; prints the problem on failure.
+bool load_config(const char *path) {
+    char error[CONFIG_MAX_LINE + 256];
+    if (config_load(path, apply_setting, &settings, error, sizeof(error))) return true;
+    fprintf(stderr, GET_COLOR(RED)"[ERROR] Config: %s\n"RESET, error);
+    return false;
+}
+
+// ==================
+// Headless Batch Mode
+// ==================
+void print_usage(const char *prog) {
+    printf(GET_COLOR(BRIGHT_WHITE)"Usage:"RESET" %s [options] [--in] <file|dir>... [--out <file|dir>]\n", prog);
+    printf("Processes audio files with the same DSP chain as realtime mode, without audio devices.\n\n");
+    printf("  -i, --in PATH          input file or directory (repeatable; bare arguments work too)\n");
+    printf("  -o, --out PATH         output file (single input) or directory\n");
+    printf("                         default: <name>_masked.<ext> next to each input\n");
+    printf("  -s, --steps N          pitch shift in semitones (default %d)\n", PITCH_SHIFT_STEPS);
+    printf("  -n, --noise A          noise amplitude (default %.4f)\n", NOISE_AMPLITUDE);
+    printf("      --noise-shape S    uniform | tpdf | gaussian (default uniform)\n");
+    printf("  -q, --quality Q        linear | cubic | sinc (default linear)\n");
+    printf("      --pitch-engine E   granular | vocoder | formant (default %s); vocoder is an FFT\n", pitch_engine_name(PITCH_ENGINE));
+    printf("                         phase vocoder like librosa in eng.py, with more latency;\n");
+    printf("                         formant also moves the LPC spectral envelope on its own\n");
+    printf("      --formant-steps X  formant engine: envelope shift in semitones, 0 keeps the\n");
+    printf("                         speaker's formants (default %.1f)\n", FORMANT_SHIFT_STEPS);
+    printf("      --chain LIST       processing stages in order, e.g. \"highpass:80, pitch, gain:-3,\n");
+    printf("                         noise, clip:0.9\"; stages: pitch[:ENGINE] resample formant\n");
+    printf("                         gain:DB highpass:HZ lowpass:HZ noise[:A] clip[:L]\n");
+    printf("                         (default \"pitch, noise\")\n");
+    printf("      --vad M            off | noise | silence (default off): in realtime, shared\n");
+    printf("                         memory and server modes, silent blocks skip the chain and\n");
+    printf("                         become comfort noise or silence; the pitch shifter keeps\n");
+    printf("                         its state\n");
+    printf("      --vad-threshold DB speech threshold in dBFS (default %.0f)\n", VAD_THRESHOLD_DB);
+    printf("      --vad-flatness     also count spectrally flat blocks (fans, hiss) as silence\n");
+    printf("  -j, --jobs N           worker threads (default: number of CPUs)\n");
+    printf("      --segment SEC      split files longer than 2*SEC into parallel segments\n");
+    printf("                         of at least SEC seconds; 0 disables (default %.0f)\n", OFFLINE_SEGMENT_SECONDS);
+    printf("  -b, --backend B        run the realtime engine instead: portaudio | file | null\n");
+    printf("                         file: --in WAV is played into it, output goes to --out WAV\n");
+    printf("      --duration SEC     stop after SEC seconds of stream time (file/null)\n");
+    printf("      --speed X          run the simulated clock at X times realtime (default 1)\n");
+    printf("      --fast             run the simulated clock unpaced; the rings will overflow\n");
+    printf("      --stats SEC        realtime status line every SEC seconds, 0 = off (default %.0f)\n", STATS_INTERVAL);
+    printf("      --metrics-file F   rewrite latency/xrun metrics to F every interval\n");
+    printf("                         (JSON if F ends in .json, Prometheus text otherwise)\n");
+    printf("      --direct           run the DSP chain inside the audio callback; falls back to\n");
+    printf("                         the processor thread if it takes over %.0f%% of a block\n", DIRECT_MAX_LOAD * 100);
+    printf("      --record-to FILE   also keep the anonymized realtime stream in FILE, encoded\n");
+    printf("                         on a background thread\n");
+    printf("      --record-format C  flac | opus (default %s); opus needs 8/12/16/24/48 kHz\n", stream_codec_name(STREAM_RECORD_CODEC));
+    printf("      --rotate-seconds S start a new numbered file (FILE-0001.flac, ...) every S seconds\n");
+    printf("      --rotate-mb MB     ... or when the current file reaches MB megabytes\n");
+    printf("  -r, --rate HZ          sample rate of record/realtime streams (default %d)\n", SAMPLE_RATE);
+    printf("      --block N          frames per callback; 64 or 128 for low latency (default %d)\n", FRAMES_PER_BUFFER);
+    printf("  -c, --channels N       channels of record/realtime streams, each processed\n");
+    printf("                         separately (default %d)\n", NUM_CHANNELS);
+    printf("      --format F         output encoding: keep | pcm16 | pcm24 | float; keep writes\n");
+    printf("                         the input's encoding (record mode: float)\n");
+    printf("      --dither           TPDF dither before quantizing to pcm16/pcm24\n");
+    printf("      --config FILE      read sample_rate, block_size, channels, output_format,\n");
+    printf("                         dither, pitch_engine, formant_steps, chain, vad,\n");
+    printf("                         vad_threshold and vad_flatness from FILE;\n");
+    printf("                         %s is read at startup when present\n", CONFIG_FILE);
+    printf("      --sched P          processor thread scheduling: other | fifo | rr (default other)\n");
+    printf("      --priority N       fifo/rr priority, 1-99 (default %d)\n", RT_PRIORITY);
+    printf("      --cpus LIST        pin the processor thread to CPUs, e.g. 3 or 2-3\n");
+    printf("      --mlock            lock memory and prefault the stream's buffers\n");
+    printf("                         (without the privileges each step is skipped with a warning)\n");
+    printf("      --serve SOCKET     anonymize many streams at once over a Unix socket (see loadgen.c);\n");
+    printf("                         -j sets the workers, -s/-n/-q the DSP chain, --stats the status line\n");
+    printf("      --shm NAME         exchange audio with a local recorder through the shared memory\n");
+    printf("                         region /dev/shm/NAME (see shmpcm.h); -r/-c/--block set the format\n");
+    printf("  -h, --help             show this help\n");
+}
+
+// ==================
+// Server Mode
+// ==================
+void stop_server(int sig) {
+    (void)sig;
+    server_stop(&server);
+}
+
+// Called from the server's I/O thread; `ctx` holds the previous snapshot.
+void print_server_stats(const ServerSnapshot *s, void *ctx) {
+    ServerSnapshot *previous = (ServerSnapshot*)ctx;
+    double wall = s->uptime - previous->uptime;
+    double rate = wall > 0.0 ? (s->audio_seconds - previous->audio_seconds) / wall : 0.0;
+    printf(GET_COLOR(BRIGHT_BLACK)"[SERVER] %6.0f s | %d stream(s), %llu in total | %.1fx realtime | block p99 %.0f us | refused %llu, failed %llu\n"RESET,
+           s->uptime, s->active, (unsigned long long)s->sessions, rate, s->process_time.p99 * 1e6,
+           (unsigned long long)s->refused, (unsigned long long)s->failed);
+    fflush(stdout);
+    *previous = *s;
+}
+
+// Serves streams on `path` until Ctrl+C, with the batch mode's DSP settings.
+int server_main(const char *path, const OfflineConfig *config, int jobs, double stats_interval) {
+    ServerSnapshot previous;
+    memset(&previous, 0, sizeof(previous));
+    ServerConfig server_config = { config->n_steps, config->noise_shape, config->noise_amplitude, config->quality,
+                                   config->engine, config->formant_steps, config->chain, settings.vad, jobs, stats_interval, print_server_stats, &previous };
+    if (!server_open(&server, path, &server_config)) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"[ERROR] Server: %s\n"RESET, server.error);
+        return 1;
+    }
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+    printf(GET_COLOR(BRIGHT_CYAN)"[SERVER] Listening on %s: %d worker(s), %+d semitones, noise %.4f. Ctrl+C stops.\n"RESET,
+           path, server.pool.num_threads, config->n_steps, config->noise_amplitude);
+    fflush(stdout);
+
+    server_run(&server);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    bool failed = server.error[0] != '\0';
+    if (failed) fprintf(stderr, GET_COLOR(BRIGHT_RED)"[ERROR] Server: %s\n"RESET, server.error);
+    ServerSnapshot s;
+    server_snapshot(&server, &s);
+    server_close(&server);
+    printf(GET_COLOR(BRIGHT_YELLOW)"[SERVER] Stopped. %llu stream(s), %.1f s of audio in %.0f s.\n"RESET,
+           (unsigned long long)s.sessions, s.audio_seconds, s.uptime);
+    return failed ? 1 : 0;
+}
+
+// ==================
+// Shared Memory Mode
+// ==================
+volatile sig_atomic_t shm_stop_requested = 0;
+
+void stop_shm(int sig) {
+    (void)sig;
+    shm_stop_requested = 1;
+}
+
+// Processes the ingest ring of region `name` into its egress ring until the
+// client closes ingest or Ctrl+C. The DSP chain reads and writes the rings in
+// place; see shmpcm.h for the client side.
+int shm_main(const char *name, const OfflineConfig *config, double stats_interval) {
+    ShmPcm pcm;
+    char error[256];
+    const int channels = settings.channels;
+    const long block = settings.frames_per_buffer;
+    DspContext *dsp = (DspContext*) calloc(channels, sizeof(DspContext));
+    int ready = 0;
+    int rc = 1;
+    uint64_t frames = 0, blocks = 0;
+
+    if (!dsp) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
+        return 1;
+    }
+    for (; ready < channels; ++ready) {
+        if (!dsp_init(&dsp[ready], settings.sample_rate, config->n_steps, block)) {
+            fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
+            goto cleanup;
+        }
+        if (!dsp_set_pitch_engine(&dsp[ready], config->engine, config->formant_steps)) {
+            fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
+            dsp_free(&dsp[ready]);
+            goto cleanup;
+        }
+        dsp_set_noise(&dsp[ready], config->noise_shape, config->noise_amplitude);
+        dsp_set_chain(&dsp[ready], &config->chain);
+        pitch_shifter_set_quality(&dsp[ready].shifter, config->quality);
+        if (!dsp_set_vad(&dsp[ready], &settings.vad)) {
+            fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
+            dsp_free(&dsp[ready]);
+            goto cleanup;
+        }
+    }
+    if (!shm_pcm_create(&pcm, name, settings.sample_rate, channels, (uint64_t)block * SHM_RING_BLOCKS,
+                        error, sizeof(error))) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"[ERROR] Shared memory: %s\n"RESET, error);
+        goto cleanup;
+    }
+    signal(SIGINT, stop_shm);
+    signal(SIGTERM, stop_shm);
+    printf(GET_COLOR(BRIGHT_CYAN)"[SHM] Region %s ready: %d Hz, %d channel(s), %llu frames per ring, %+d semitones. Ctrl+C stops.\n"RESET,
+           pcm.name, settings.sample_rate, channels, (unsigned long long)pcm.ingest->capacity, config->n_steps);
+    fflush(stdout);
+
+    double start = offline_now();
+    double next_stats = start + stats_interval;
+    while (!shm_stop_requested) {
+        ShmWaitStatus status = shm_ring_wait_readable(pcm.ingest, 1, 100);
+        if (status == SHM_CLOSED) break;
+        if (status == SHM_READY && shm_ring_wait_writable(pcm.egress, 1, 100) == SHM_READY) {
+            const float *in;
+            float *out;
+            uint64_t n = shm_ring_read_span(&pcm, pcm.ingest, &in);
+            uint64_t room = shm_ring_write_span(&pcm, pcm.egress, &out);
+            if (n > room) n = room;
+            if (n > (uint64_t)block) n = (uint64_t)block;
+            dsp_process_interleaved(dsp, channels, in, out, (long)n);
+            shm_ring_release(pcm.ingest, n);
+            shm_ring_commit(pcm.egress, n);
+            frames += n;
+            blocks++;
+        }
+        if (stats_interval > 0.0 && offline_now() >= next_stats) {
+            double elapsed = offline_now() - start;
+            printf(GET_COLOR(BRIGHT_BLACK)"[SHM] %6.0f s | %.1f s of audio | %llu block(s) | ingest %llu frames queued\n"RESET,
+                   elapsed, (double)frames / settings.sample_rate, (unsigned long long)blocks,
+                   (unsigned long long)shm_ring_available(pcm.ingest));
+            fflush(stdout);
+            next_stats += stats_interval;
+        }
+    }
+    shm_ring_close(pcm.egress);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    double elapsed = offline_now() - start;
+    printf(GET_COLOR(BRIGHT_YELLOW)"[SHM] Stopped. %.1f s of audio in %llu block(s) over %.1f s.\n"RESET,
+           (double)frames / settings.sample_rate, (unsigned long long)blocks, elapsed);
+    shm_pcm_close(&pcm);
+    rc = 0;
+
+cleanup:
+    for (int ch = 0; ch < ready; ++ch) dsp_free(&dsp[ch]);
+    free(dsp);
+    return rc;
+}
+
+// Runs the realtime engine on the backend named on the command line.
+int backend_main(const char *name, const char *in, const char *out, double duration, double speed,
+                 const RealtimeOptions *options, const OfflineConfig *dsp_config) {
+    AudioPortAudioBackend pa;
+    AudioFileBackend file;
+    AudioBackend *backend;
+
+    if (strcmp(name, "portaudio") == 0) {
+        PaError err = Pa_Initialize();
+        if (err != paNoError) {
+            fprintf(stderr, GET_COLOR(BRIGHT_RED)"PortAudio error: %s\n"RESET, Pa_GetErrorText(err));
+            return 1;
+        }
+        audio_portaudio_backend_init(&pa);
+        realtime_mode(&pa.base, options, dsp_config);
+        Pa_Terminate();
+        return 0;
+    }
+
+    if (strcmp(name, "file") == 0) {
+        if (!in) {
+            fprintf(stderr, GET_COLOR(RED)"The file backend needs an input file (--in).\n"RESET);
+            return 2;
+        }
+        audio_file_backend_init(&file, in, out, duration, speed);
+    } else if (strcmp(name, "null") == 0) {
+        audio_null_backend_init(&file, duration, speed);
+    } else {
+        fprintf(stderr, GET_COLOR(RED)"Unknown backend '%s'.\n"RESET, name);
+        return 2;
+    }
+    backend = &file.base;
+
+    realtime_mode(backend, options, dsp_config);
+    double stream_seconds = (double)file.frames_done / settings.sample_rate;
+    printf(GET_COLOR(BRIGHT_YELLOW)"[REALTIME] %.1f s of stream time in %.2f s (%.1fx realtime).\n"RESET,
+           stream_seconds, file.wall_seconds, file.wall_seconds > 0 ? stream_seconds / file.wall_seconds : 0.0);
+    return backend->error[0] ? 1 : 0;
+}
+
+// -s/-n/-j/--segment, as strictly as apply_setting(): steps are whole
+// semitones within +-24, noise within [0, 1], jobs and segment not negative.
+bool apply_batch_option(OfflineConfig *config, int *jobs, const char *key, const char *value) {
+    char *end;
+    double v = strtod(value, &end);
+    if (end == value || *end != '\0') return false;
+
+    if (strcmp(key, "steps") == 0 && v >= -24.0 && v <= 24.0 && v == (int)v) {
+        config->n_steps = (int)v;
+    } else if (strcmp(key, "noise") == 0 && v >= 0.0 && v <= 1.0) {
+        config->noise_amplitude = (float)v;
+    } else if (strcmp(key, "jobs") == 0 && v >= 0.0 && v <= 4096.0 && v == (int)v) {
+        *jobs = (int)v;
+    } else if (strcmp(key, "segment") == 0 && v >= 0.0 && v <= 86400.0) {
+        config->segment_seconds = v;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Realtime flags, parsed like apply_batch_option(): --priority is a whole
+// SCHED_FIFO/RR priority from 1 to 99; --duration, --speed, --stats and the
+// --rotate-* limits are not negative (0 runs the whole input, unpaced,
+// without a status line or without rotating).
+bool apply_stream_option(RealtimeOptions *options, double *duration, double *speed, const char *key, const char *value) {
+    char *end;
+    double v = strtod(value, &end);
+    if (end == value || *end != '\0' || !isfinite(v)) return false;
+
+    if (strcmp(key, "priority") == 0 && v >= 1.0 && v <= 99.0 && v == (int)v) {
+        options->sched.priority = (int)v;
+    } else if (strcmp(key, "duration") == 0 && v >= 0.0) {
+        *duration = v;
+    } else if (strcmp(key, "speed") == 0 && v >= 0.0) {
+        *speed = v;
+    } else if (strcmp(key, "stats") == 0 && v >= 0.0) {
+        options->stats_interval = v;
+    } else if (strcmp(key, "rotate_seconds") == 0 && v >= 0.0) {
+        options->record.rotate_seconds = v;
+    } else if (strcmp(key, "rotate_mb") == 0 && v >= 0.0) {
+        options->record.rotate_mb = v;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int batch_main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"in", required_argument, NULL, 'i'},
+        {"out", required_argument, NULL, 'o'},
+        {"steps", required_argument, NULL, 's'},
+        {"noise", required_argument, NULL, 'n'},
+        {"noise-shape", required_argument, NULL, 'S'},
+        {"quality", required_argument, NULL, 'q'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"segment", required_argument, NULL, 'G'},
+        {"backend", required_argument, NULL, 'b'},
+        {"duration", required_argument, NULL, 'D'},
+        {"speed", required_argument, NULL, 'V'},
+        {"fast", no_argument, NULL, 'F'},
+        {"stats", required_argument, NULL, 'T'},
+        {"metrics-file", required_argument, NULL, 'M'},
+        {"rate", required_argument, NULL, 'r'},
+        {"block", required_argument, NULL, 'K'},
+        {"channels", required_argument, NULL, 'c'},
+        {"config", required_argument, NULL, 'C'},
+        {"direct", no_argument, NULL, 'X'},
+        {"sched", required_argument, NULL, 'P'},
+        {"priority", required_argument, NULL, 'Y'},
+        {"cpus", required_argument, NULL, 'U'},
+        {"mlock", no_argument, NULL, 'L'},
+        {"serve", required_argument, NULL, 'E'},
+        {"shm", required_argument, NULL, 'H'},
+        {"format", required_argument, NULL, 'W'},
+        {"dither", no_argument, NULL, 'Z'},
+        {"pitch-engine", required_argument, NULL, 'I'},
+        {"formant-steps", required_argument, NULL, 'J'},
+        {"chain", required_argument, NULL, 'N'},
+        {"vad", required_argument, NULL, 'a'},
+        {"vad-threshold", required_argument, NULL, 'd'},
+        {"vad-flatness", no_argument, NULL, 'e'},
+        {"record-to", required_argument, NULL, 'A'},
+        {"record-format", required_argument, NULL, 'O'},
+        {"rotate-seconds", required_argument, NULL, 'R'},
+        {"rotate-mb", required_argument, NULL, 'B'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    OfflineConfig config = { PITCH_SHIFT_STEPS, NOISE_SHAPE, NOISE_AMPLITUDE, RESAMPLE_QUALITY, OFFLINE_SEGMENT_SECONDS,
+                             OUTPUT_FORMAT, OUTPUT_DITHER, PITCH_ENGINE, FORMANT_SHIFT_STEPS, DSP_CHAIN };
+    const char **inputs = (const char**) calloc(argc, sizeof(char*));
+    int num_inputs = 0;
+    const char *out = NULL;
+    int jobs = 0;
+    const char *backend = NULL;
+    const char *serve = NULL;
+    const char *shm = NULL;
+    double duration = 0.0;
+    double speed = 1.0;
+    RealtimeOptions rt_options = { STATS_INTERVAL, METRICS_FILE, DIRECT_MODE,
+                                   { RT_POLICY, RT_PRIORITY, RT_CPUS, RT_LOCK_MEMORY },
+                                   { STREAM_RECORD_PATH, STREAM_RECORD_CODEC, STREAM_ROTATE_SECONDS, STREAM_ROTATE_MB } };
+    int opt;
+
+    if (!inputs) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
+        return 1;
+    }
+
+    while ((opt = getopt_long(argc, argv, "i:o:s:n:q:j:b:r:c:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'i': inputs[num_inputs++] = optarg; break;
+        case 'o': out = optarg; break;
+        case 's':
+        case 'n':
+        case 'j':
+        case 'G': {
+            const char *key = opt == 's' ? "steps" : opt == 'n' ? "noise" : opt == 'j' ? "jobs" : "segment";
+            if (!apply_batch_option(&config, &jobs, key, optarg)) {
+                fprintf(stderr, GET_COLOR(RED)"Invalid %s '%s'.\n"RESET, key, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        }
+        case 'b': backend = optarg; break;
+        case 'E': serve = optarg; break;
+        case 'H': shm = optarg; break;
+        case 'Z': settings.dither = true; break;
+        case 'e': settings.vad.flatness = true; break;
+        case 'a':
+            if (!vad_mode_from_name(optarg, &settings.vad.mode)) {
+                fprintf(stderr, GET_COLOR(RED)"Unknown VAD mode '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'N': {
+            char error[128];
+            if (!dsp_chain_parse(optarg, &settings.chain, error, sizeof(error))) {
+                fprintf(stderr, GET_COLOR(RED)"Invalid chain '%s': %s.\n"RESET, optarg, error);
+                free(inputs);
+                return 2;
+            }
+            break;
+        }
+        case 'I':
+            if (!pitch_engine_from_name(optarg, &settings.pitch_engine)) {
+                fprintf(stderr, GET_COLOR(RED)"Unknown pitch engine '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'W':
+            if (!pcm_format_from_name(optarg, &settings.output_format)) {
+                fprintf(stderr, GET_COLOR(RED)"Unknown output format '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'F': speed = 0.0; break;
+        case 'M': rt_options.metrics_path = optarg; break;
+        case 'X': rt_options.direct = true; break;
+        case 'Y':
+        case 'D':
+        case 'V':
+        case 'T':
+        case 'R':
+        case 'B': {
+            const char *key = opt == 'Y' ? "priority" : opt == 'D' ? "duration" : opt == 'V' ? "speed" :
+                              opt == 'T' ? "stats" : opt == 'R' ? "rotate_seconds" : "rotate_mb";
+            if (!apply_stream_option(&rt_options, &duration, &speed, key, optarg)) {
+                fprintf(stderr, GET_COLOR(RED)"Invalid %s '%s'.\n"RESET, key, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        }
+        case 'U': rt_options.sched.cpus = optarg; break;
+        case 'L': rt_options.sched.lock_memory = true; break;
+        case 'A': rt_options.record.path = optarg; break;
+        case 'O':
+            if (!stream_codec_from_name(optarg, &rt_options.record.codec)) {
+                fprintf(stderr, GET_COLOR(RED)"Unknown recording format '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'P':
+            if (!rt_policy_from_name(optarg, &rt_options.sched.policy)) {
+                fprintf(stderr, GET_COLOR(RED)"Unknown scheduling policy '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'r':
+        case 'K':
+        case 'c':
+        case 'J':
+        case 'd': {
+            const char *key = opt == 'r' ? "sample_rate" : opt == 'K' ? "block_size" :
+                              opt == 'J' ? "formant_steps" : opt == 'd' ? "vad_threshold" : "channels";
+            if (!apply_setting(&settings, key, optarg)) {
+                fprintf(stderr, GET_COLOR(RED)"Invalid %s '%s'.\n"RESET, key, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        }
+        case 'C':
+            if (!load_config(optarg)) {
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'S':
+            if (!noise_shape_from_name(optarg, &config.noise_shape)) {
+                fprintf(stderr, GET_COLOR(RED)"Unknown noise shape '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'q':
+            if (!resample_quality_from_name(optarg, &config.quality)) {
+                fprintf(stderr, GET_COLOR(RED)"Unknown quality '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            free(inputs);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            free(inputs);
+            return 2;
+        }
+    }
+    while (optind < argc) inputs[num_inputs++] = argv[optind++];
+    config.output_format = settings.output_format;
+    config.dither = settings.dither;
+    config.engine = dsp_chain_engine(&settings.chain, settings.pitch_engine);
+    config.formant_steps = settings.formant_steps;
+    config.chain = settings.chain;
+
+    if (serve) {
+        free(inputs);
+        return server_main(serve, &config, jobs, rt_options.stats_interval);
+    }
+    if (shm) {
+        free(inputs);
+        return shm_main(shm, &config, rt_options.stats_interval);
+    }
+
+    if (backend) {
+        int rc;
+        if (num_inputs > 1) {
+            fprintf(stderr, GET_COLOR(RED)"A backend run takes at most one input file.\n"RESET);
+            rc = 2;
+        } else {
+            rc = backend_main(backend, num_inputs ? inputs[0] : NULL, out, duration, speed, &rt_options, &config);
+        }
+        free(inputs);
+        return rc;
+    }
+
+    if (num_inputs == 0) {
+        fprintf(stderr, GET_COLOR(RED)"No input given.\n"RESET);
+        print_usage(argv[0]);
+        free(inputs);
+        return 2;
+    }
+
+    // Several inputs or a directory input means --out names a directory.
+    bool out_is_dir = out && (num_inputs > 1 || offline_is_dir(out) || offline_is_dir(inputs[0]));
+    if (out_is_dir && !offline_is_dir(out) && mkdir(out, 0755) != 0) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"[ERROR] Could not create directory '%s'.\n"RESET, out);
+        free(inputs);
+        return 1;
+    }
+
+    OfflineJobList list = { NULL, 0, 0 };
+    for (int i = 0; i < num_inputs; ++i) {
+        if (!offline_collect(&list, &config, inputs[i], out_is_dir ? out : NULL, out_is_dir ? NULL : out)) {
+            fprintf(stderr, GET_COLOR(YELLOW)"[WARNING] Skipping '%s': not a readable file or directory.\n"RESET, inputs[i]);
+        }
+    }
+    free(inputs);
+    if (list.count == 0) {
+        fprintf(stderr, GET_COLOR(RED)"No files to process.\n"RESET);
+        return 1;
+    }
+
+    ThreadPool pool;
+    if (!threadpool_create(&pool, jobs)) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Thread creation error!\n"RESET);
+        offline_free_jobs(&list);
+        return 1;
+    }
+    printf(GET_COLOR(BRIGHT_CYAN)"[BATCH] %d file(s), %d worker(s), %+d semitones, noise %.4f.\n"RESET,
+           list.count, pool.num_threads, config.n_steps, config.noise_amplitude);
+
+    double start = offline_now();
+    for (int i = 0; i < list.count; ++i) {
+        list.jobs[i].pool = &pool;
+        threadpool_submit(&pool, offline_run_job, &list.jobs[i]);
+    }
+    threadpool_wait(&pool);
+    threadpool_destroy(&pool);
+    double elapsed = offline_now() - start;
+
+    int failed = 0;
+    double audio_seconds = 0.0;
+    for (int i = 0; i < list.count; ++i) {
+        OfflineJob *job = &list.jobs[i];
+        if (job->status == OFFLINE_OK) {
+            double secs = job->sample_rate > 0 ? (double)job->frames / job->sample_rate : 0.0;
+            audio_seconds += secs;
+            printf(GET_COLOR(BRIGHT_GREEN)"[OK] "RESET"%s → %s (%.1f s audio, %d ch, %d segment(s)%s, %.2f s)\n",
+                   job->in_path, job->out_path, secs, job->channels, job->segments,
+                   job->mapped ? ", mmap" : "", job->seconds);
+        } else {
+            failed++;
+            fprintf(stderr, GET_COLOR(RED)"[ERROR] %s: %s%s%s\n"RESET, job->in_path,
+                    job->status == OFFLINE_ERR_OPEN_INPUT ? "could not open input" :
+                    job->status == OFFLINE_ERR_OPEN_OUTPUT ? "could not open output" :
+                    job->status == OFFLINE_ERR_READ ? "read failed" :
+                    job->status == OFFLINE_ERR_WRITE ? "write failed" : "memory allocation error",
+                    job->error[0] ? " - " : "", job->error);
+        }
+    }
+    printf(GET_COLOR(BRIGHT_YELLOW)"[BATCH] %d ok, %d failed. %.1f s of audio in %.2f s (%.0fx realtime).\n"RESET,
+           list.count - failed, failed, audio_seconds, elapsed, elapsed > 0 ? audio_seconds / elapsed : 0.0);
+
+    offline_free_jobs(&list);
+    return failed ? 1 : 0;
+}
+
 // ==================
 // 1. RECORD → PROCESS → PLAY → SAVE Mode Function
 // ==================
 void record_process_play_save_mode() {
     PaStream *stream = NULL;
+    float *chunk = NULL;
     PaError err;
     int duration_seconds; // CHANGE: Local variable for duration
 
@@ -162,92 +933,145 @@ void record_process_play_save_mode() {
         return;
     }
 
-    long num_frames = SAMPLE_RATE * duration_seconds * NUM_CHANNELS;
-    float *recorded_samples = (float*) calloc(num_frames, sizeof(float));
+    OfflineConfig config = { PITCH_SHIFT_STEPS, NOISE_SHAPE, NOISE_AMPLITUDE, RESAMPLE_QUALITY, 0.0,
+                             settings.output_format, settings.dither,
+                             dsp_chain_engine(&settings.chain, settings.pitch_engine),
+                             settings.formant_steps, settings.chain };
+    OfflinePcmWriter writer;
+    RecordReader reader = { NULL, (long long)settings.sample_rate * duration_seconds, 0, paNoError };
+    long long frames_done = 0;
+    OfflineStatus status;
+
+    // The processed audio is written to disk while recording, so memory use does not depend on the duration.
+    SF_INFO sfinfo;
+    memset(&sfinfo, 0, sizeof(SF_INFO));
+    sfinfo.samplerate = settings.sample_rate;
+    sfinfo.channels = settings.channels;
+    sfinfo.format = SF_FORMAT_WAV | offline_pcm_subtype(settings.output_format);
 
-    if (!recorded_samples) {
+    SNDFILE *outfile = sf_open(RECORDING_FILENAME, SFM_WRITE, &sfinfo);
+    if (!outfile) {
+        fprintf(stderr, GET_COLOR(RED)"[ERROR] Could not open file '%s': %s\n"RESET, RECORDING_FILENAME, sf_strerror(NULL));
+        return;
+    }
+    memset(&writer, 0, sizeof(writer));
+    if (!offline_pcm_writer_init(&writer, outfile, &sfinfo, config.dither)) {
         fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
+        offline_pcm_writer_free(&writer);
+        sf_close(outfile);
         return;
     }
 
     printf(GET_COLOR(BRIGHT_CYAN)"[RECORD] Start speaking (%d seconds)..."RESET"\n", duration_seconds);
 
-    err = Pa_OpenDefaultStream(&stream, NUM_CHANNELS, 0, paFloat32, SAMPLE_RATE, paFramesPerBufferUnspecified, NULL, NULL);
+    err = Pa_OpenDefaultStream(&stream, settings.channels, 0, paFloat32, settings.sample_rate, settings.frames_per_buffer, NULL, NULL);
     if (err != paNoError) goto error_record;
 
     err = Pa_StartStream(stream);
     if (err != paNoError) goto error_record;
 
-    err = Pa_ReadStream(stream, recorded_samples, num_frames);
-    if (err != paNoError) goto error_record;
+    reader.stream = stream;
+    status = offline_process_stream(&config, settings.sample_rate, settings.channels, record_read, &reader,
+                                    offline_pcm_write, &writer, &frames_done);
+    if (status == OFFLINE_ERR_READ) {
+        err = reader.err;
+        goto error_record;
+    }
 
     err = Pa_StopStream(stream);
     if (err != paNoError) goto error_record;
     err = Pa_CloseStream(stream);
     if (err != paNoError) goto error_record;
     stream = NULL;
+    offline_pcm_writer_free(&writer);
+    sf_close(outfile);
+    outfile = NULL;
 
+    if (reader.overflows > 0) {
+        fprintf(stderr, GET_COLOR(YELLOW)"[Warning-Input] %ld input overflow(s) during recording.\n"RESET, reader.overflows);
+    }
+    if (status != OFFLINE_OK) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"[ERROR] Processing or saving failed after %lld frames.\n"RESET, frames_done);
+        return;
+    }
     printf(GET_COLOR(BRIGHT_CYAN)"[RECORD] Completed.\n"RESET);
-    printf(GET_COLOR(BRIGHT_YELLOW)"[PROCESSING] Processing audio...\n"RESET);
+    printf(GET_COLOR(BRIGHT_GREEN)"[SAVE] Processed audio saved to '%s'.\n"RESET, RECORDING_FILENAME);
 
-    simple_pitch_shift(recorded_samples, num_frames, SAMPLE_RATE, PITCH_SHIFT_STEPS);
+    printf(GET_COLOR(BRIGHT_MAGENTA)"[PLAYBACK] Playing processed audio...\n"RESET);
 
-    for (long i = 0; i < num_frames; ++i) {
-        float noise = ((float)rand() / (float)RAND_MAX) * 0.006f - 0.003f;
-        recorded_samples[i] += noise;
-        if (recorded_samples[i] > 1.0f) recorded_samples[i] = 1.0f;
-        if (recorded_samples[i] < -1.0f) recorded_samples[i] = -1.0f;
+    // Play the saved file back chunk by chunk.
+    memset(&sfinfo, 0, sizeof(SF_INFO));
+    SNDFILE *infile = sf_open(RECORDING_FILENAME, SFM_READ, &sfinfo);
+    if (!infile) {
+        fprintf(stderr, GET_COLOR(RED)"[ERROR] Could not open file '%s': %s\n"RESET, RECORDING_FILENAME, sf_strerror(NULL));
+        return;
     }
 
-    printf(GET_COLOR(BRIGHT_MAGENTA)"[PLAYBACK] Playing processed audio...\n"RESET);
+    chunk = (float*) malloc((size_t)OFFLINE_CHUNK * sfinfo.channels * sizeof(float));
+    if (!chunk) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
+        sf_close(infile);
+        return;
+    }
 
-    err = Pa_OpenDefaultStream(&stream, 0, NUM_CHANNELS, paFloat32, SAMPLE_RATE, paFramesPerBufferUnspecified, NULL, NULL);
+    err = Pa_OpenDefaultStream(&stream, 0, sfinfo.channels, paFloat32, sfinfo.samplerate, paFramesPerBufferUnspecified, NULL, NULL);
     if (err != paNoError) goto error_play;
 
     err = Pa_StartStream(stream);
     if (err != paNoError) goto error_play;
 
-    err = Pa_WriteStream(stream, recorded_samples, num_frames);
-    if (err != paNoError) goto error_play;
+    sf_count_t n;
+    while ((n = sf_readf_float(infile, chunk, OFFLINE_CHUNK)) > 0) {
+        err = Pa_WriteStream(stream, chunk, (unsigned long)n);
+        if (err != paNoError && err != paOutputUnderflowed) goto error_play;
+    }
 
     err = Pa_StopStream(stream);
     if (err != paNoError) goto error_play;
     err = Pa_CloseStream(stream);
     if (err != paNoError) goto error_play;
     stream = NULL;
+    sf_close(infile);
+    free(chunk);
 
     printf(GET_COLOR(BRIGHT_MAGENTA)"[PLAYBACK] Completed.\n"RESET);
-
-    SF_INFO sfinfo;
-    memset(&sfinfo, 0, sizeof(SF_INFO));
-    sfinfo.samplerate = SAMPLE_RATE;
-    sfinfo.channels = NUM_CHANNELS;
-    sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
-
-    SNDFILE *outfile = sf_open(RECORDING_FILENAME, SFM_WRITE, &sfinfo);
-    if (!outfile) {
-        fprintf(stderr, GET_COLOR(RED)"[ERROR] Could not open file '%s': %s\n"RESET, RECORDING_FILENAME, sf_strerror(NULL));
-    } else {
-        sf_write_float(outfile, recorded_samples, num_frames);
-        sf_close(outfile);
-        printf(GET_COLOR(BRIGHT_GREEN)"[SAVE] Processed audio saved to '%s'.\n"RESET, RECORDING_FILENAME);
-    }
-
-    free(recorded_samples);
     return;
 
 error_record:
     if (stream) Pa_CloseStream(stream);
+    offline_pcm_writer_free(&writer);
+    if (outfile) sf_close(outfile);
     fprintf(stderr, GET_COLOR(BRIGHT_RED)"PortAudio Recording Error: %s\n"RESET, Pa_GetErrorText(err));
-    free(recorded_samples);
     return;
 error_play:
     if (stream) Pa_CloseStream(stream);
+    sf_close(infile);
+    free(chunk);
     fprintf(stderr, GET_COLOR(BRIGHT_RED)"PortAudio Playback Error: %s\n"RESET, Pa_GetErrorText(err));
-    free(recorded_samples);
     return;
 }
 
+// ==================
+// Recording Reader for offline_process_stream()
+// ==================
+// Reads up to `max_frames` from the microphone and stops after the requested
+// duration. An input overflow leaves a gap in the recording but is not fatal.
+sf_count_t record_read(void *ctx, float *frames, sf_count_t max_frames) {
+    RecordReader *reader = (RecordReader*)ctx;
+    sf_count_t n = reader->remaining < max_frames ? reader->remaining : max_frames;
+    if (n <= 0) return 0;
+
+    PaError err = Pa_ReadStream(reader->stream, frames, (unsigned long)n);
+    if (err == paInputOverflowed) {
+        reader->overflows++;
+    } else if (err != paNoError) {
+        reader->err = err;
+        return -1;
+    }
+    reader->remaining -= n;
+    return n;
+}
+
 // ==================
 // Main Menu Function
 // ==================
@@ -270,257 +1094,396 @@ void display_menu() {
 // --- OTHER FUNCTIONS (No changes needed below this line) ---
 
 // ==================
-// Realtime Buffer Functions
+// PortAudio Callback Function
 // ==================
-void initialize_realtime_buffer(RealtimeBuffer *rb, long size) {
-    rb->buffer = (float*) calloc(size, sizeof(float));
-    if (!rb->buffer) {
-        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
-        exit(EXIT_FAILURE);
-    }
-    rb->buffer_size = size;
-    rb->read_idx = 0;
-    rb->write_idx = 0;
-    rb->terminate = false;
-    pthread_mutex_init(&rb->mutex, NULL);
-    pthread_cond_init(&rb->cond_data_available, NULL);
-    pthread_cond_init(&rb->cond_buffer_empty, NULL);
-}
-
-void destroy_realtime_buffer(RealtimeBuffer *rb) {
-    free(rb->buffer);
-    pthread_mutex_destroy(&rb->mutex);
-    pthread_cond_destroy(&rb->cond_data_available);
-    pthread_cond_destroy(&rb->cond_buffer_empty);
-}
-
-bool write_to_buffer(RealtimeBuffer *rb, const float *data, long frames) {
-    pthread_mutex_lock(&rb->mutex);
-    long current_data_size = (rb->write_idx - rb->read_idx + rb->buffer_size) % rb->buffer_size;
-    long free_space = rb->buffer_size - current_data_size - 1;
+int paCallback(const void *inputBufferPtr, void *outputBufferPtr,
+               unsigned long framesPerBuffer,
+               const PaStreamCallbackTimeInfo* timeInfo,
+               PaStreamCallbackFlags statusFlags,
+               void *userData) {
+    float *out = (float*)outputBufferPtr;
+    const float *in = (const float*)inputBufferPtr;
+    RealtimeProcessor *proc = (RealtimeProcessor*)userData;
+    // Read once: direct_process() may hand over to the processor thread below.
+    bool direct = proc->direct && in != NULL && out != NULL && (long)framesPerBuffer <= proc->frames;
+    uint64_t start = metrics_now_ns();
+
+    // No stdio here: problems are only counted, the reporter thread prints them.
+    metrics_count(&metrics.callbacks);
+    if (statusFlags & paInputOverflow) metrics_count(&metrics.input_overflows);
+    if (statusFlags & paOutputUnderflow) metrics_count(&metrics.output_underflows);
+
+    if (direct) {
+        direct_process(proc, in, out, framesPerBuffer);
+    } else {
+        // Neither call blocks: a full input ring drops the whole buffer (never part
+        // of a frame), an empty output ring is padded with silence. Both cases are
+        // counted by the ring. The latency controller keeps the output ring near
+        // its target depth.
+        if (inputBufferPtr != NULL) {
+            size_t frames = framesPerBuffer * settings.channels;
+            // Stamped before the write, so the processor never sees the new block with the old time.
+            metrics_set(&metrics.input_written_ns, metrics_now_ns());
+            if (!rb_write_all(&inputBuffer, in, frames)) metrics_count(&metrics.input_drops);
+            metrics_observe(&metrics.input_fill, rb_available(&inputBuffer) * 100 / inputBuffer.capacity);
+        }
 
-    while (free_space < frames && !rb->terminate) {
-        pthread_cond_wait(&rb->cond_buffer_empty, &rb->mutex);
-        current_data_size = (rb->write_idx - rb->read_idx + rb->buffer_size) % rb->buffer_size;
-        free_space = rb->buffer_size - current_data_size - 1;
+        if (outputBufferPtr != NULL) {
+            metrics_observe(&metrics.output_fill, rb_available(&outputBuffer) * 100 / outputBuffer.capacity);
+            if (!latency_read(&latency, &outputBuffer, out, (long)framesPerBuffer)) metrics_count(&metrics.output_gaps);
+            metrics_set(&metrics.trimmed_frames, latency.trimmed_frames);
+            metrics_set(&metrics.target_widenings, latency.widenings);
+            metrics_set(&metrics.buffer_target_ns, (uint64_t)(1e9 * latency.target / settings.sample_rate));
+        }
     }
 
-    if (rb->terminate) {
-        pthread_mutex_unlock(&rb->mutex);
-        return false;
+    // Input-to-output latency estimate: device delay, what waits in both rings
+    // (nothing in direct mode), DSP delay.
+    if (timeInfo && inputBufferPtr != NULL && outputBufferPtr != NULL) {
+        double device = timeInfo->outputBufferDacTime - timeInfo->inputBufferAdcTime;
+        double queued = direct ? 0.0 :
+            (double)(rb_available(&inputBuffer) + rb_available(&outputBuffer)) / (settings.channels * settings.sample_rate);
+        double total = (device > 0.0 ? device : 0.0) + queued;
+        uint64_t latency_ns = (uint64_t)(total * 1e9) + metrics.fixed_latency_ns;
+        metrics_observe(&metrics.latency, latency_ns);
+        metrics_set(&metrics.latency_now_ns, latency_ns);
     }
 
-    for (long i = 0; i < frames; ++i) {
-        rb->buffer[rb->write_idx] = data[i];
-        rb->write_idx = (rb->write_idx + 1) % rb->buffer_size;
+    metrics_observe(&metrics.callback_time, metrics_now_ns() - start);
+
+    if (atomic_load(&inputBuffer.terminate) || atomic_load(&outputBuffer.terminate)) {
+         return paComplete;
     }
 
-    pthread_cond_signal(&rb->cond_data_available);
-    pthread_mutex_unlock(&rb->mutex);
-    return true;
+    return paContinue;
 }
 
-bool read_from_buffer(RealtimeBuffer *rb, float *data, long frames) {
-    pthread_mutex_lock(&rb->mutex);
-    long current_data_size = (rb->write_idx - rb->read_idx + rb->buffer_size) % rb->buffer_size;
-
-    while (current_data_size < frames && !rb->terminate) {
-        pthread_cond_wait(&rb->cond_data_available, &rb->mutex);
-        current_data_size = (rb->write_idx - rb->read_idx + rb->buffer_size) % rb->buffer_size;
-    }
-
-    if (rb->terminate) {
-        pthread_mutex_unlock(&rb->mutex);
-        return false;
+// ==================
+// Direct (In-Callback) Processing
+// ==================
+// Runs the chain from the device's input buffer straight into its output
+// buffer: no rings, no thread handoff, no extra copies. Called from the
+// callback only. After DIRECT_OVERRUNS blocks in a row over budget it clears
+// `direct`; from the next block on the callback feeds the rings again and the
+// processor thread, idle until then, continues with the same DSP state.
+void direct_process(RealtimeProcessor *proc, const float *in, float *out, unsigned long frames) {
+    uint64_t start = metrics_now_ns();
+    dsp_process_interleaved(proc->dsp, proc->channels, in, out, (long)frames);
+    if (proc->recorder) stream_recorder_push(proc->recorder, out, frames * proc->channels);
+    uint64_t cost = metrics_now_ns() - start;
+    metrics_observe(&metrics.process_time, cost);
+    metrics_count(&metrics.direct_blocks);
+    if (settings.vad.mode != VAD_OFF) metrics_observe_vad(&metrics, dsp_skipped(proc->dsp, proc->channels), cost);
+
+    proc->overruns = cost > proc->budget_ns ? proc->overruns + 1 : 0;
+    if (proc->overruns >= DIRECT_OVERRUNS) {
+        proc->direct = false;
+        metrics_count(&metrics.direct_fallbacks);
     }
+}
 
-    for (long i = 0; i < frames; ++i) {
-        data[i] = rb->buffer[rb->read_idx];
-        rb->read_idx = (rb->read_idx + 1) % rb->buffer_size;
+// Slowest of a few blocks of silence through the chain, after warming it up.
+// Runs before the stream starts; leaves proc->block zeroed.
+uint64_t measure_chain_cost(RealtimeProcessor *proc) {
+    uint64_t worst = 0;
+    // Silent blocks would skip the chain with the detector on; time the whole chain.
+    for (int ch = 0; ch < proc->channels; ++ch) proc->dsp[ch].vad.config.mode = VAD_OFF;
+    for (int i = 0; i < 16; ++i) {
+        uint64_t start = metrics_now_ns();
+        dsp_process_interleaved(proc->dsp, proc->channels, proc->block, proc->block, proc->frames);
+        uint64_t cost = metrics_now_ns() - start;
+        if (i >= 4 && cost > worst) worst = cost;
     }
-
-    pthread_cond_signal(&rb->cond_buffer_empty);
-    pthread_mutex_unlock(&rb->mutex);
-    return true;
+    for (int ch = 0; ch < proc->channels; ++ch) proc->dsp[ch].vad.config.mode = settings.vad.mode;
+    memset(proc->block, 0, (size_t)proc->frames * proc->channels * sizeof(float));
+    return worst;
 }
 
 // ==================
-// PortAudio Callback Function
+// Realtime Scheduling
 // ==================
-int paCallback(const void *inputBufferPtr, void *outputBufferPtr,
-               unsigned long framesPerBuffer,
-               const PaStreamCallbackTimeInfo* timeInfo,
-               PaStreamCallbackFlags statusFlags,
-               void *userData) {
-    float *out = (float*)outputBufferPtr;
-    const float *in = (const float*)inputBufferPtr;
-
-    if (statusFlags & paInputOverflow) fprintf(stderr, GET_COLOR(YELLOW)"[Warning-Input] Input overflow.\n"RESET);
-    if (statusFlags & paOutputUnderflow) fprintf(stderr, GET_COLOR(YELLOW)"[Warning-Output] Output underflow.\n"RESET);
-
-    if (inputBufferPtr != NULL) {
-        if (!write_to_buffer(&inputBuffer, in, framesPerBuffer * NUM_CHANNELS)) {
-            return paComplete;
+// Called by the processor thread on itself. Nothing here is fatal: without
+// the privileges the thread keeps normal scheduling and says so.
+void apply_thread_scheduling(const RtSchedConfig *sched) {
+    if (sched->policy != SCHED_OTHER) {
+        int err = rt_set_scheduling(pthread_self(), sched->policy, sched->priority);
+        if (err == 0) {
+            printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Processor thread scheduling: %s, priority %d\n"RESET,
+                   rt_policy_name(sched->policy), sched->priority);
+        } else if (err == EPERM) {
+            printf(GET_COLOR(YELLOW)"[WARNING] Not permitted to use %s priority %d; the processor thread keeps normal scheduling. "
+                   "Grant CAP_SYS_NICE or an rtprio limit (/etc/security/limits.conf).\n"RESET,
+                   rt_policy_name(sched->policy), sched->priority);
+        } else {
+            printf(GET_COLOR(YELLOW)"[WARNING] Could not set %s priority %d (%s); the processor thread keeps normal scheduling.\n"RESET,
+                   rt_policy_name(sched->policy), sched->priority, strerror(err));
         }
     }
-
-    if (outputBufferPtr != NULL) {
-        if (!read_from_buffer(&outputBuffer, out, framesPerBuffer * NUM_CHANNELS)) {
-            return paComplete;
-        }
-    } else {
-        for (unsigned int i = 0; i < framesPerBuffer * NUM_CHANNELS; i++) {
-            out[i] = 0;
+    if (sched->cpus) {
+        int err = rt_set_affinity(pthread_self(), sched->cpus);
+        if (err == 0) {
+            printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Processor thread pinned to CPU(s) %s\n"RESET, sched->cpus);
+        } else if (err == EINVAL) {
+            printf(GET_COLOR(YELLOW)"[WARNING] CPU list '%s' is invalid or names no usable CPU; the processor thread is not pinned.\n"RESET,
+                   sched->cpus);
+        } else {
+            printf(GET_COLOR(YELLOW)"[WARNING] Could not pin the processor thread to CPU(s) %s (%s).\n"RESET,
+                   sched->cpus, strerror(err));
         }
     }
+}
 
-    if (inputBuffer.terminate || outputBuffer.terminate) {
-         return paComplete;
+// Locks the process in memory and touches every buffer the stream uses, so
+// the audio threads take no page faults once it runs. The buffers are
+// prefaulted even when locking fails. Returns true if memory was locked.
+bool lock_realtime_memory(RealtimeProcessor *proc) {
+    int err = rt_lock_memory();
+    if (err == 0) {
+        printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Memory locked; buffers prefaulted.\n"RESET);
+    } else {
+        printf(GET_COLOR(YELLOW)"[WARNING] Could not lock memory (%s); buffers are prefaulted but may be paged out. "
+               "Raise the memlock limit (ulimit -l) or grant CAP_IPC_LOCK.\n"RESET, strerror(err));
     }
 
-    return paContinue;
+    rt_prefault(inputBuffer.buffer, inputBuffer.capacity * sizeof(float));
+    rt_prefault(outputBuffer.buffer, outputBuffer.capacity * sizeof(float));
+    rt_prefault(latency.scratch, (size_t)2 * latency.block * latency.channels * sizeof(float));
+    rt_prefault(proc->block, (size_t)proc->frames * proc->channels * sizeof(float));
+    if (proc->recorder) rt_prefault(proc->recorder->ring.buffer, proc->recorder->ring.capacity * sizeof(float));
+    for (int ch = 0; ch < proc->channels; ++ch) dsp_prefault(&proc->dsp[ch], rt_prefault);
+    return err == 0;
+}
+
+// ==================
+// Realtime Status Line
+// ==================
+// Called from the metrics reporter thread, never from the audio threads.
+void print_stats(const MetricsSnapshot *s, void *ctx) {
+    (void)ctx;
+    char vad[64] = "";
+    if (s->vad_blocks) snprintf(vad, sizeof(vad), " | silence %.0f%% (%.1f s saved)", s->silence_ratio * 100, s->vad_saved);
+    printf(GET_COLOR(BRIGHT_BLACK)"[STATS] %6.0f s | callback p99 %.0f us (max %.0f) | dsp p99 %.0f us | wake p99 %.0f us | latency %.1f ms (p99 %.1f, ring target %.1f) | ring in %.0f%%, out %.0f%% | xruns +%llu%s\n"RESET,
+           s->uptime, s->callback_time.p99 * 1e6, s->callback_time.max * 1e6, s->process_time.p99 * 1e6, s->wake_time.p99 * 1e6,
+           s->latency_now * 1e3, s->latency.p99 * 1e3, s->buffer_target * 1e3,
+           s->input_fill.p50, s->output_fill.p50, (unsigned long long)s->new_xruns, vad);
+    fflush(stdout);
 }
 
 // ==================
 // Realtime Processor Thread Function
 // ==================
 void *realtime_processor_thread(void *arg) {
-    (void)arg;
+    RealtimeProcessor *proc = (RealtimeProcessor*)arg;
+    DspContext *dsp = &proc->dsp[0];
+    const size_t block = (size_t)proc->frames * proc->channels;
+    char chain[256];
+    dsp_chain_format(&dsp->chain, chain, sizeof(chain));
     printf(GET_COLOR(BRIGHT_BLUE)"[REALTIME] Audio Processor Started.\n"RESET);
-
-    float *input_block = (float*) malloc(FRAMES_PER_BUFFER * NUM_CHANNELS * sizeof(float));
-    float *processed_block = (float*) malloc(FRAMES_PER_BUFFER * NUM_CHANNELS * sizeof(float));
-    if (!input_block || !processed_block) {
-        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
-        exit(EXIT_FAILURE);
+    printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] %d Hz, %d channel(s), %ld-frame blocks (%.1f ms)\n"RESET,
+           settings.sample_rate, proc->channels, proc->frames, 1000.0 * proc->frames / settings.sample_rate);
+    printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Pitch shifter: %s, latency %ld frames (%.1f ms)\n"RESET,
+           pitch_engine_name(dsp->engine), dsp_latency(dsp), 1000.0 * dsp_latency(dsp) / settings.sample_rate);
+    printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Chain: %s (%d pass(es))\n"RESET, chain, dsp->n_passes);
+    if (dsp->vad.config.mode != VAD_OFF) {
+        printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] VAD: %s below %.0f dBFS%s, hangover %.0f ms (%s)\n"RESET,
+               vad_mode_name(dsp->vad.config.mode), dsp->vad.config.threshold_db,
+               dsp->vad.config.flatness ? " or spectrally flat" : "", 1000.0 * dsp->vad.hangover / settings.sample_rate,
+               dsp->vad.kernel_name);
     }
-
-    while (!inputBuffer.terminate) {
-        if (!read_from_buffer(&inputBuffer, input_block, FRAMES_PER_BUFFER * NUM_CHANNELS)) {
-            break;
-        }
-
-        simple_pitch_shift(input_block, FRAMES_PER_BUFFER * NUM_CHANNELS, SAMPLE_RATE, PITCH_SHIFT_STEPS);
-
-        for (unsigned int i = 0; i < FRAMES_PER_BUFFER * NUM_CHANNELS; ++i) {
-            float noise = ((float)rand() / (float)RAND_MAX) * 0.006f - 0.003f;
-            processed_block[i] = input_block[i] + noise;
-            if (processed_block[i] > 1.0f) processed_block[i] = 1.0f;
-            if (processed_block[i] < -1.0f) processed_block[i] = -1.0f;
-        }
-
-        if (!write_to_buffer(&outputBuffer, processed_block, FRAMES_PER_BUFFER * NUM_CHANNELS)) {
-            break;
+    printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Noise kernel: %s, interpolation: %s (%s)\n"RESET, dsp->noise_kernel_name,
+           resample_quality_name(dsp->shifter.resampler.quality), dsp->shifter.resampler.use_avx2 ? "avx2" : "scalar");
+
+    apply_thread_scheduling(proc->sched);
+    if (proc->sched->lock_memory) rt_prefault_stack();
+    // Page faults are counted from here, so the metrics show only those taken while streaming.
+    uint64_t minor_start = 0, major_start = 0, minor, major;
+    bool count_faults = rt_thread_faults(&minor_start, &major_start);
+
+    // From here on the loop must not touch the heap (enforced by -DVOICEMASK_ALLOC_GUARD).
+    alloc_guard_arm();
+    while (rb_wait(&inputBuffer, block)) {
+        uint64_t start = metrics_now_ns();
+        uint64_t written = atomic_load_explicit(&metrics.input_written_ns, memory_order_relaxed);
+        if (start > written) metrics_observe(&metrics.wake_time, start - written);
+        rb_read(&inputBuffer, proc->block, block);
+        dsp_process_interleaved(proc->dsp, proc->channels, proc->block, proc->block, proc->frames);
+        uint64_t cost = metrics_now_ns() - start;
+        metrics_observe(&metrics.process_time, cost);
+        if (settings.vad.mode != VAD_OFF) metrics_observe_vad(&metrics, dsp_skipped(proc->dsp, proc->channels), cost);
+        rb_write_all(&outputBuffer, proc->block, block);
+        if (proc->recorder) stream_recorder_push(proc->recorder, proc->block, block);
+        if (count_faults && rt_thread_faults(&minor, &major)) {
+            metrics_set(&metrics.minor_faults, minor - minor_start);
+            metrics_set(&metrics.major_faults, major - major_start);
         }
     }
+    alloc_guard_disarm();
 
-    free(input_block);
-    free(processed_block);
     printf(GET_COLOR(BRIGHT_BLUE)"[REALTIME] Audio Processor Terminated.\n"RESET);
     return NULL;
 }
 
 // ==================
-// Simple Pitch Shift Function
+// Mode 2: Realtime
 // ==================
-void simple_pitch_shift(float *data, long num_frames, int sample_rate, int n_steps) {
-    float pitch_factor = powf(2.0f, (float)n_steps / 12.0f);
-    float current_sample_pos = 0.0f;
-    float *temp_buffer = (float*) calloc(num_frames, sizeof(float));
-    if (!temp_buffer) {
-        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error! Pitch shift could not be performed.\n"RESET);
+// Rings, DSP contexts and the processor's block are all sized from `settings`;
+// the contexts run the chain described by `dsp_config`.
+void realtime_mode(AudioBackend *backend, const RealtimeOptions *options, const OfflineConfig *dsp_config) {
+    pthread_t processor_tid;
+    MetricsReporter reporter;
+    StreamRecorder recorder;
+    RealtimeProcessor proc = { NULL, settings.channels, settings.frames_per_buffer, NULL, false, 0, 0, &options->sched, NULL };
+    const size_t block = (size_t)proc.frames * proc.channels;
+    int ready = 0;
+    bool memory_locked = false;
+
+    if (!latency_init(&latency, settings.sample_rate, proc.channels, proc.frames, LATENCY_TARGET_MS, LATENCY_MAX_MS)) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
         return;
     }
-
-    for (long i = 0; i < num_frames; ++i) {
-        long idx1 = (long)floorf(current_sample_pos);
-        long idx2 = idx1 + 1;
-        float fraction = current_sample_pos - idx1;
-
-        if (idx2 >= num_frames) {
-            temp_buffer[i] = data[idx1];
+    if (!rb_init(&inputBuffer, latency_ring_samples(&latency))) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
+        latency_free(&latency);
+        return;
+    }
+    if (!rb_init(&outputBuffer, latency_ring_samples(&latency))) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
+        rb_destroy(&inputBuffer);
+        latency_free(&latency);
+        return;
+    }
+    proc.dsp = (DspContext*) calloc(proc.channels, sizeof(DspContext));
+    proc.block = (float*) calloc(block, sizeof(float));
+    if (proc.dsp && proc.block) {
+        for (; ready < proc.channels; ++ready) {
+            if (!dsp_init(&proc.dsp[ready], settings.sample_rate, dsp_config->n_steps, proc.frames)) break;
+            if (!dsp_set_pitch_engine(&proc.dsp[ready], dsp_config->engine, dsp_config->formant_steps)) {
+                dsp_free(&proc.dsp[ready]);
+                break;
+            }
+            dsp_set_noise(&proc.dsp[ready], dsp_config->noise_shape, dsp_config->noise_amplitude);
+            dsp_set_chain(&proc.dsp[ready], &dsp_config->chain);
+            pitch_shifter_set_quality(&proc.dsp[ready].shifter, dsp_config->quality);
+            if (!dsp_set_vad(&proc.dsp[ready], &settings.vad)) {
+                dsp_free(&proc.dsp[ready]);
+                break;
+            }
+        }
+    }
+    if (ready < proc.channels) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Memory allocation error!\n"RESET);
+        goto cleanup_realtime;
+    }
+    metrics_init(&metrics, (uint64_t)(1e9 * dsp_latency(&proc.dsp[0]) / settings.sample_rate));
+
+    if (options->direct) {
+        proc.budget_ns = (uint64_t)(DIRECT_MAX_LOAD * 1e9 * proc.frames / settings.sample_rate);
+        uint64_t cost = measure_chain_cost(&proc);
+        proc.direct = cost <= proc.budget_ns;
+        if (proc.direct) {
+            printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Direct mode: the chain takes %.0f us of a %.0f us budget per block.\n"RESET,
+                   cost / 1e3, proc.budget_ns / 1e3);
         } else {
-            temp_buffer[i] = data[idx1] * (1.0f - fraction) + data[idx2] * fraction;
+            printf(GET_COLOR(YELLOW)"[REALTIME] The chain takes %.0f us per block, over the %.0f us direct mode budget; using the processor thread.\n"RESET,
+                   cost / 1e3, proc.budget_ns / 1e3);
         }
+    }
 
-        current_sample_pos += pitch_factor;
-
-        if (current_sample_pos >= num_frames - 1) {
-            for (long j = i + 1; j < num_frames; ++j) {
-                temp_buffer[j] = 0.0f;
-            }
-            break;
+    if (options->record.path) {
+        if (!stream_recorder_start(&recorder, &options->record, settings.sample_rate, proc.channels, STREAM_QUEUE_SECONDS)) {
+            fprintf(stderr, GET_COLOR(BRIGHT_RED)"[ERROR] Recording: %s\n"RESET, recorder.error);
+            goto cleanup_realtime;
         }
+        proc.recorder = &recorder;
+        printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Recording the processed stream to %s (%s)\n"RESET,
+               recorder.current, stream_codec_name(options->record.codec));
     }
-    memcpy(data, temp_buffer, num_frames * sizeof(float));
-    free(temp_buffer);
-}
-
-// ==================
-// Mode 2: Realtime
-// ==================
-void realtime_mode() {
-    PaStream *stream = NULL;
-    PaError err;
-    pthread_t processor_tid;
-    long buffer_frames = SAMPLE_RATE * 2 * NUM_CHANNELS;
 
-    initialize_realtime_buffer(&inputBuffer, buffer_frames);
-    initialize_realtime_buffer(&outputBuffer, buffer_frames);
+    // Start the output ring at the controller's target depth.
+    for (long primed = 0; primed < latency_prime_frames(&latency); primed += proc.frames) {
+        rb_write_all(&outputBuffer, proc.block, block);
+    }
+    if (options->sched.lock_memory) memory_locked = lock_realtime_memory(&proc);
 
     printf(GET_COLOR(BRIGHT_GREEN)BOLD"*** REALTIME VOICE CHANGER MODE ***"RESET"\n");
     printf(GET_COLOR(BRIGHT_WHITE)"Microphone → Anonymized Voice (Press "GET_COLOR(RED)"Ctrl+C"GET_COLOR(BRIGHT_WHITE)" to exit)\n"RESET);
 
-    if (pthread_create(&processor_tid, NULL, realtime_processor_thread, NULL) != 0) {
+    if (pthread_create(&processor_tid, NULL, realtime_processor_thread, &proc) != 0) {
         fprintf(stderr, GET_COLOR(BRIGHT_RED)"Thread creation error!\n"RESET);
         goto cleanup_realtime;
     }
 
-    err = Pa_OpenDefaultStream(&stream, NUM_CHANNELS, NUM_CHANNELS, paFloat32, SAMPLE_RATE, FRAMES_PER_BUFFER, paCallback, NULL);
-    if (err != paNoError) goto error_realtime;
+    if (!metrics_reporter_start(&reporter, &metrics, &inputBuffer, &outputBuffer, options->stats_interval,
+                                options->metrics_path, print_stats, NULL)) {
+        fprintf(stderr, GET_COLOR(YELLOW)"[WARNING] Could not start the metrics reporter; continuing without it.\n"RESET);
+    }
 
-    err = Pa_StartStream(stream);
-    if (err != paNoError) goto error_realtime;
+    AudioStreamConfig config = { settings.sample_rate, settings.channels, (unsigned long)settings.frames_per_buffer,
+                                 paCallback, &proc };
+    if (!backend->open(backend, &config)) goto error_realtime;
+    if (!backend->start(backend)) goto error_realtime;
 
-    printf(GET_COLOR(BRIGHT_GREEN)"Realtime stream started... Speak to hear the processed sound.\n"RESET);
+    printf(GET_COLOR(BRIGHT_GREEN)"Realtime stream started (%s)... Speak to hear the processed sound.\n"RESET, backend->name);
 
-    // In a real application, you would handle signals (like Ctrl+C) gracefully.
-    // For this simple example, the user must manually stop it.
-    // We wait here until the stream is no longer active.
-    while (Pa_IsStreamActive(stream) == 1) {
-        sleep(1);
+    // The stream runs until the callback returns paComplete or the backend runs
+    // out of input (file backend); a sound card stream runs until Ctrl+C.
+    while (backend->is_active(backend)) {
+        usleep(100 * 1000);
     }
 
     printf(GET_COLOR(BRIGHT_RED)"Stream stopped.\n"RESET);
 
-    err = Pa_StopStream(stream);
-    if (err != paNoError) goto error_realtime;
-    err = Pa_CloseStream(stream);
-    if (err != paNoError) goto error_realtime;
-    stream = NULL;
+    if (backend->stop(backend)) goto close_realtime;
 
 error_realtime:
-    if (err != paNoError && err != paStreamIsStopped) {
-        fprintf(stderr, GET_COLOR(BRIGHT_RED)"PortAudio Realtime Error: %s\n"RESET, Pa_GetErrorText(err));
-    }
-    if (stream) {
-        Pa_AbortStream(stream);
-        Pa_CloseStream(stream);
+    fprintf(stderr, GET_COLOR(BRIGHT_RED)"Realtime Error (%s): %s\n"RESET, backend->name, backend->error);
+close_realtime:
+    backend->close(backend);
+    metrics_reporter_stop(&reporter);
+    if (reporter.export_failed) {
+        fprintf(stderr, GET_COLOR(YELLOW)"[WARNING] Could not write metrics file '%s'.\n"RESET, options->metrics_path);
     }
 
     // Signal the processing thread to terminate
-    inputBuffer.terminate = true;
-    outputBuffer.terminate = true;
-    pthread_cond_broadcast(&inputBuffer.cond_data_available);
-    pthread_cond_broadcast(&inputBuffer.cond_buffer_empty);
-    pthread_cond_broadcast(&outputBuffer.cond_data_available);
-    pthread_cond_broadcast(&outputBuffer.cond_buffer_empty);
+    rb_terminate(&inputBuffer);
+    rb_terminate(&outputBuffer);
 
     pthread_join(processor_tid, NULL);
 
+    if (atomic_load(&metrics.direct_fallbacks) > 0) {
+        printf(GET_COLOR(YELLOW)"[REALTIME] Direct mode fell back to the processor thread after %llu blocks.\n"RESET,
+               (unsigned long long)atomic_load(&metrics.direct_blocks));
+    }
+
+    MetricsHistogramSnapshot wake;
+    metrics_histogram_snapshot(&metrics.wake_time, &wake);
+    if (wake.count > 0) {
+        printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Processor wake-up: p50 %.0f us, p99 %.0f us, max %.0f us; page faults while streaming: %llu minor, %llu major\n"RESET,
+               wake.p50 * 1e6, wake.p99 * 1e6, wake.max * 1e6,
+               (unsigned long long)atomic_load(&metrics.minor_faults), (unsigned long long)atomic_load(&metrics.major_faults));
+    }
+
+    printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Dropped frames (overflow): %lu, silent frames (underflow): %lu\n"RESET,
+           atomic_load(&inputBuffer.overflow_frames) + atomic_load(&outputBuffer.overflow_frames),
+           atomic_load(&outputBuffer.underflow_frames));
+
+    if (proc.recorder) {
+        stream_recorder_stop(&recorder);
+        printf(GET_COLOR(BRIGHT_BLACK)"[REALTIME] Recorded %.1f s to %d file(s), last %s; frames dropped by a slow encoder: %llu\n"RESET,
+               (double)recorder.frames_written / settings.sample_rate, recorder.files, recorder.current,
+               stream_recorder_dropped(&recorder));
+        if (recorder.error[0]) fprintf(stderr, GET_COLOR(BRIGHT_RED)"[ERROR] Recording: %s\n"RESET, recorder.error);
+    }
+
 cleanup_realtime:
-    destroy_realtime_buffer(&inputBuffer);
-    destroy_realtime_buffer(&outputBuffer);
+    if (proc.recorder) stream_recorder_stop(&recorder);
+    rb_destroy(&inputBuffer);
+    rb_destroy(&outputBuffer);
+    latency_free(&latency);
+    for (int ch = 0; ch < ready; ++ch) dsp_free(&proc.dsp[ch]);
+    free(proc.dsp);
+    free(proc.block);
+    if (memory_locked) rt_unlock_memory();
 }
 
 
@@ -0,0 +1,169 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+
+// ==================
+// Real FFT
+// ==================
+// Power-of-two real transform, computed as a complex radix-2 FFT of half the
+// size plus a split pass. Everything the transform needs (bit-reversal table,
+// twiddles) lives in an FftPlan built once by fft_plan_init(); the transforms
+// themselves never allocate and only read the plan, so one plan can be shared
+// by any number of threads.
+//
+// Spectra are kept split: re[k] and im[k] for bins k = 0 .. size/2. The
+// inverse is unnormalized and returns size/2 times the signal; callers fold
+// that factor into their synthesis window.
+
+typedef struct {
+    int size;         // real length, power of two >= 4
+    int half;         // size / 2 complex points
+    int *bitrev;      // half entries
+    float *tw_re;     // e^(-2 pi i k / len) for every stage len >= 4, stage by stage,
+    float *tw_im;     // so the butterflies read them contiguously
+    float *post_cos;  // cos(2 pi k / size), k <= half / 2: the real split
+    float *post_sin;
+} FftPlan;
+
+static inline void fft_plan_free(FftPlan *plan) {
+    free(plan->bitrev);
+    free(plan->tw_re);
+    free(plan->tw_im);
+    free(plan->post_cos);
+    free(plan->post_sin);
+    plan->bitrev = NULL;
+    plan->tw_re = plan->tw_im = plan->post_cos = plan->post_sin = NULL;
+}
+
+// `size` must be a power of two, at least 4. Returns false on allocation failure.
+static inline bool fft_plan_init(FftPlan *plan, int size) {
+    plan->size = size;
+    plan->half = size / 2;
+    const int half = plan->half;
+    const int quarter = half / 2 > 0 ? half / 2 : 1;
+    plan->bitrev = (int*) malloc((size_t)half * sizeof(int));
+    plan->tw_re = (float*) malloc((size_t)half * sizeof(float));
+    plan->tw_im = (float*) malloc((size_t)half * sizeof(float));
+    plan->post_cos = (float*) malloc((size_t)(quarter + 1) * sizeof(float));
+    plan->post_sin = (float*) malloc((size_t)(quarter + 1) * sizeof(float));
+    if (!plan->bitrev || !plan->tw_re || !plan->tw_im || !plan->post_cos || !plan->post_sin) {
+        fft_plan_free(plan);
+        return false;
+    }
+
+    int bits = 0;
+    while ((1 << bits) < half) bits++;
+    for (int i = 0; i < half; ++i) {
+        int r = 0;
+        for (int b = 0; b < bits; ++b) r |= ((i >> b) & 1) << (bits - 1 - b);
+        plan->bitrev[i] = r;
+    }
+    // Stage len starts at offset len / 2 - 2 (stages 4, 8, 16, ... hold 2, 4, 8, ... entries).
+    for (int len = 4; len <= half; len <<= 1) {
+        for (int k = 0; k < len / 2; ++k) {
+            plan->tw_re[len / 2 - 2 + k] = (float)cos(2.0 * M_PI * k / len);
+            plan->tw_im[len / 2 - 2 + k] = (float)-sin(2.0 * M_PI * k / len);
+        }
+    }
+    for (int k = 0; k <= quarter; ++k) {
+        plan->post_cos[k] = (float)cos(2.0 * M_PI * k / size);
+        plan->post_sin[k] = (float)sin(2.0 * M_PI * k / size);
+    }
+    return true;
+}
+
+// In-place forward complex FFT of plan->half points. Called with `re` and
+// `im` swapped it computes the unnormalized inverse.
+static inline void fft_complex(const FftPlan *plan, float *re, float *im) {
+    const int n = plan->half;
+    for (int i = 0; i < n; ++i) {
+        int j = plan->bitrev[i];
+        if (i < j) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    // The first stage needs no twiddles.
+    for (int i = 0; i + 1 < n; i += 2) {
+        float tr = re[i + 1], ti = im[i + 1];
+        re[i + 1] = re[i] - tr;
+        im[i + 1] = im[i] - ti;
+        re[i] += tr;
+        im[i] += ti;
+    }
+    for (int len = 4; len <= n; len <<= 1) {
+        const int half_len = len / 2;
+        const float *wr = plan->tw_re + half_len - 2, *wi = plan->tw_im + half_len - 2;
+        for (int i = 0; i < n; i += len) {
+            float *ar = re + i, *ai = im + i, *br = re + i + half_len, *bi = im + i + half_len;
+            for (int k = 0; k < half_len; ++k) {
+                float tr = br[k] * wr[k] - bi[k] * wi[k];
+                float ti = br[k] * wi[k] + bi[k] * wr[k];
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+// `in` holds plan->size samples; `re`/`im` receive bins 0 .. half (half + 1 each).
+static inline void fft_forward(const FftPlan *plan, const float *in, float *re, float *im) {
+    const int h = plan->half;
+    for (int m = 0; m < h; ++m) {
+        re[m] = in[2 * m];
+        im[m] = in[2 * m + 1];
+    }
+    fft_complex(plan, re, im);
+
+    // X[k] = E + W^k O and X[h - k] = conj(E - W^k O), with W = e^(-2 pi i / size),
+    // E/O the spectra of the even/odd samples recovered from Z[k] and Z[h - k].
+    for (int k = 1; k <= h / 2; ++k) {
+        int j = h - k;
+        float er = 0.5f * (re[k] + re[j]), ei = 0.5f * (im[k] - im[j]);
+        float orr = 0.5f * (im[k] + im[j]), oi = -0.5f * (re[k] - re[j]);
+        float wr = plan->post_cos[k], wi = -plan->post_sin[k];
+        float tr = orr * wr - oi * wi, ti = orr * wi + oi * wr;
+        re[k] = er + tr;
+        im[k] = ei + ti;
+        re[j] = er - tr;
+        im[j] = -(ei - ti);
+    }
+    float z0r = re[0], z0i = im[0];
+    re[0] = z0r + z0i;
+    im[0] = 0.0f;
+    re[h] = z0r - z0i;
+    im[h] = 0.0f;
+}
+
+// Consumes bins 0 .. half of `re`/`im` and writes plan->size samples, scaled by half.
+static inline void fft_inverse(const FftPlan *plan, float *re, float *im, float *out) {
+    const int h = plan->half;
+    float x0 = re[0], xh = re[h];
+    for (int k = 1; k <= h / 2; ++k) {
+        int j = h - k;
+        // E = (X[k] + conj(X[h - k])) / 2, O = (X[k] - conj(X[h - k])) / 2 * conj(W^k)
+        float er = 0.5f * (re[k] + re[j]), ei = 0.5f * (im[k] - im[j]);
+        float dr = 0.5f * (re[k] - re[j]), di = 0.5f * (im[k] + im[j]);
+        float wr = plan->post_cos[k], wi = plan->post_sin[k];
+        float orr = dr * wr - di * wi, oi = dr * wi + di * wr;
+        // Z[k] = E + iO, Z[h - k] = conj(E) + i conj(O)
+        re[k] = er - oi;
+        im[k] = ei + orr;
+        re[j] = er + oi;
+        im[j] = -ei + orr;
+    }
+    re[0] = 0.5f * (x0 + xh);
+    im[0] = 0.5f * (x0 - xh);
+    fft_complex(plan, im, re); // swapped: inverse
+    for (int m = 0; m < h; ++m) {
+        out[2 * m] = re[m];
+        out[2 * m + 1] = im[m];
+    }
+}
+
+#endif // FFT_H
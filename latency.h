@@ -0,0 +1,144 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ringbuf.h"
+
+// ==================
+// Output Latency Controller
+// ==================
+// Keeps the processed audio waiting in the output ring near a target instead
+// of letting it grow. Every underrun leaves the ring one late block deeper
+// (the silence was already played, the block still arrives), so without
+// control latency only ever ratchets up.
+//
+// The controller runs inside the audio callback, replacing rb_read() on the
+// output ring. Before each read it compares the ring fill with the target:
+//   - fill above target for LATENCY_TRIM_AFTER callbacks in a row: up to one
+//     block of the excess is cut out, spliced with a crossfade over the block
+//     so the cut does not click;
+//   - LATENCY_WIDEN_UNDERRUNS underruns within LATENCY_WINDOW_SECONDS: the
+//     target grows by one block, up to max_target;
+//   - LATENCY_RELAX_SECONDS without an underrun: the target shrinks by one
+//     block again, down to min_target.
+// All state belongs to the callback thread; the front end publishes what it
+// needs as metrics.
+
+#define LATENCY_TRIM_AFTER       8
+#define LATENCY_WIDEN_UNDERRUNS  3
+#define LATENCY_WINDOW_SECONDS   2.0
+#define LATENCY_RELAX_SECONDS    30.0
+
+typedef struct {
+    int channels;
+    long block;             // frames per callback
+    long min_target;        // frames, at least one block
+    long max_target;
+    long target;            // frames the ring should hold when a callback starts
+    long window;            // callbacks per underrun window
+    long relax;             // clean callbacks before the target shrinks
+    int over_count;         // consecutive callbacks above target
+    int underruns;          // underruns in the current window
+    long window_left;       // callbacks left in the current window
+    long clean;             // callbacks since the last underrun
+    unsigned long long trimmed_frames;
+    unsigned long long widenings;
+    float *scratch;         // 2 * block frames
+} LatencyController;
+
+// Target and limits are rounded up to whole blocks.
+static inline bool latency_init(LatencyController *lc, int sample_rate, int channels, long block,
+                                double target_ms, double max_ms) {
+    memset(lc, 0, sizeof(*lc));
+    lc->channels = channels;
+    lc->block = block;
+    long target_blocks = (long)ceil(target_ms * sample_rate / 1000.0 / block);
+    long max_blocks = (long)ceil(max_ms * sample_rate / 1000.0 / block);
+    if (target_blocks < 1) target_blocks = 1;
+    if (max_blocks < target_blocks) max_blocks = target_blocks;
+    lc->min_target = lc->target = target_blocks * block;
+    lc->max_target = max_blocks * block;
+    lc->window = (long)(LATENCY_WINDOW_SECONDS * sample_rate / block) + 1;
+    lc->relax = (long)(LATENCY_RELAX_SECONDS * sample_rate / block) + 1;
+    lc->scratch = (float*) calloc((size_t)2 * block * channels, sizeof(float));
+    return lc->scratch != NULL;
+}
+
+static inline void latency_free(LatencyController *lc) {
+    free(lc->scratch);
+    lc->scratch = NULL;
+}
+
+// Silence to queue before the stream starts: the callback takes the previous
+// block's output, so the ring holds one block without it.
+static inline long latency_prime_frames(const LatencyController *lc) {
+    return lc->target - lc->block;
+}
+
+// Ring capacity (in samples) that leaves room for max_target plus a few
+// blocks of scheduling jitter.
+static inline size_t latency_ring_samples(const LatencyController *lc) {
+    return (size_t)(lc->max_target + 4 * lc->block) * lc->channels;
+}
+
+static inline void latency_underrun(LatencyController *lc) {
+    lc->clean = 0;
+    if (lc->window_left == 0) {
+        lc->window_left = lc->window;
+        lc->underruns = 0;
+    }
+    if (++lc->underruns >= LATENCY_WIDEN_UNDERRUNS && lc->target < lc->max_target) {
+        lc->target += lc->block;
+        lc->widenings++;
+        lc->underruns = 0;
+    }
+}
+
+// Callback side: fills `out` with `frames` interleaved frames from `rb`,
+// trimming or padding with silence as described above. Returns false on an
+// underrun. Never blocks or allocates.
+static inline bool latency_read(LatencyController *lc, RealtimeBuffer *rb, float *out, long frames) {
+    const int ch = lc->channels;
+    const size_t wanted = (size_t)frames * ch;
+    long fill = (long)(rb_available(rb) / ch);
+
+    if (lc->window_left > 0) lc->window_left--;
+    if (++lc->clean >= lc->relax && lc->target > lc->min_target) {
+        lc->target -= lc->block;
+        lc->clean = 0;
+    }
+
+    lc->over_count = fill > lc->target ? lc->over_count + 1 : 0;
+    if (lc->over_count >= LATENCY_TRIM_AFTER && frames <= lc->block) {
+        long drop = fill - lc->target;
+        if (drop > frames) drop = frames;
+        if (drop > fill - frames) drop = fill - frames;
+        if (drop > 0) {
+            // Read frames + drop and crossfade from the original timeline to
+            // the one `drop` frames ahead; the last output frame lands on it.
+            float *s = lc->scratch;
+            rb_read(rb, s, (size_t)(frames + drop) * ch);
+            for (long i = 0; i < frames; ++i) {
+                float g = (float)(i + 1) / (float)frames;
+                for (int c = 0; c < ch; ++c) {
+                    float a = s[i * ch + c], b = s[(i + drop) * ch + c];
+                    out[i * ch + c] = a + g * (b - a);
+                }
+            }
+            lc->trimmed_frames += (unsigned long long)drop;
+            lc->over_count = 0;
+            return true;
+        }
+    }
+
+    size_t got = rb_read(rb, out, wanted);
+    if (got == wanted) return true;
+    memset(out + got, 0, (wanted - got) * sizeof(float));
+    latency_underrun(lc);
+    return false;
+}
+
+#endif // LATENCY_H
@@ -0,0 +1,340 @@
+#define _GNU_SOURCE // ppoll
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+
+// ==================
+// Server Load Generator
+// ==================
+// Drives N synthetic voice streams into a running server
+// (./audio_app --serve PATH) over its Unix socket, each one paced like a live
+// microphone: one block per block period, the streams' start times spread
+// over the first period. For every block it measures the time from handing
+// the block to the socket until its processed frames are back, and reports
+// p50/p99/max per stream and over all streams, plus the total throughput in
+// multiples of realtime. --fast sends as fast as the server accepts, which
+// measures throughput rather than latency.
+//
+// Exits with status 1 if any stream failed or got back a different number
+// of frames than it sent.
+//
+// Compile: gcc -O2 loadgen.c -o loadgen -lm -lpthread
+// Usage:   ./loadgen [--socket PATH] [--streams N] [--seconds SEC] [--rate HZ]
+//                    [--channels N] [--block N] [--fast] [--quiet]
+
+#define LOADGEN_SOCKET "voicemask.sock"
+
+typedef struct {
+    int id;
+    int fd;
+    bool failed;
+    bool sending_done;      // SHUT_WR sent
+    bool done;              // server closed the connection
+    long blocks;            // blocks to send
+    long sent;              // blocks completely sent
+    size_t send_off;        // bytes of the current block already sent
+    uint64_t recv_bytes;
+    uint64_t *sent_ns;      // when each block was handed to the socket
+    double *latency;        // seconds, per block received back
+    long received;
+    float *block;
+    double phase;
+    double freq;
+    uint64_t first_due;
+    char error[128];
+} LoadStream;
+
+typedef struct {
+    const char *path;
+    int streams;
+    double seconds;
+    int sample_rate;
+    int channels;
+    long block;
+    bool fast;
+    bool quiet;
+} LoadConfig;
+
+static uint64_t loadgen_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int loadgen_cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double loadgen_percentile(const double *sorted, long n, double q) {
+    if (n == 0) return 0.0;
+    long i = (long)(q * (double)(n - 1) + 0.5);
+    return sorted[i < n ? i : n - 1];
+}
+
+// Blocking connect, hello and reply; the socket is non-blocking afterwards.
+static bool loadgen_connect(LoadStream *st, const LoadConfig *cfg) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", cfg->path);
+
+    st->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (st->fd < 0 || connect(st->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        snprintf(st->error, sizeof(st->error), "connect: %s", strerror(errno));
+        return false;
+    }
+    ServerHello hello = { SERVER_MAGIC, SERVER_VERSION, (uint32_t)cfg->sample_rate, (uint32_t)cfg->channels,
+                          (uint32_t)cfg->block };
+    ServerReply reply;
+    if (send(st->fd, &hello, sizeof(hello), MSG_NOSIGNAL) != (ssize_t)sizeof(hello) ||
+        recv(st->fd, &reply, sizeof(reply), MSG_WAITALL) != (ssize_t)sizeof(reply)) {
+        snprintf(st->error, sizeof(st->error), "handshake failed");
+        return false;
+    }
+    if (reply.magic != SERVER_MAGIC || reply.status != SERVER_OK) {
+        snprintf(st->error, sizeof(st->error), "refused (status %u)", reply.status);
+        return false;
+    }
+    fcntl(st->fd, F_SETFL, fcntl(st->fd, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+static void loadgen_fill(LoadStream *st, const LoadConfig *cfg) {
+    double inc = 2.0 * M_PI * st->freq / cfg->sample_rate;
+    for (long i = 0; i < cfg->block; ++i) {
+        float v = (float)(0.3 * sin(st->phase));
+        st->phase += inc;
+        for (int c = 0; c < cfg->channels; ++c) st->block[i * cfg->channels + c] = v;
+    }
+    if (st->phase > 2.0 * M_PI) st->phase = fmod(st->phase, 2.0 * M_PI);
+}
+
+// Sends every block that is due. Returns true if the socket is full.
+static bool loadgen_send(LoadStream *st, const LoadConfig *cfg, uint64_t now, uint64_t period) {
+    const size_t bytes = (size_t)cfg->block * cfg->channels * sizeof(float);
+    while (st->sent < st->blocks) {
+        if (st->send_off == 0) {
+            if (!cfg->fast && now < st->first_due + (uint64_t)st->sent * period) return false;
+            loadgen_fill(st, cfg);
+            st->sent_ns[st->sent] = now;
+        }
+        ssize_t n = send(st->fd, (const char*)st->block + st->send_off, bytes - st->send_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            snprintf(st->error, sizeof(st->error), "send: %s", strerror(errno));
+            st->failed = true;
+            return false;
+        }
+        st->send_off += (size_t)n;
+        if (st->send_off == bytes) {
+            st->send_off = 0;
+            st->sent++;
+        }
+    }
+    if (!st->sending_done) {
+        shutdown(st->fd, SHUT_WR);
+        st->sending_done = true;
+    }
+    return false;
+}
+
+static void loadgen_receive(LoadStream *st, const LoadConfig *cfg, uint64_t now) {
+    const uint64_t bytes = (uint64_t)cfg->block * cfg->channels * sizeof(float);
+    char buf[65536];
+    for (;;) {
+        ssize_t n = recv(st->fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            st->recv_bytes += (uint64_t)n;
+            while (st->received < st->sent && st->recv_bytes >= (uint64_t)(st->received + 1) * bytes) {
+                st->latency[st->received] = (now - st->sent_ns[st->received]) * 1e-9;
+                st->received++;
+            }
+            continue;
+        }
+        if (n == 0) {
+            st->done = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            snprintf(st->error, sizeof(st->error), "recv: %s", strerror(errno));
+            st->failed = true;
+        }
+        return;
+    }
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  -s, --socket PATH      server socket (default %s)\n", LOADGEN_SOCKET);
+    printf("  -n, --streams N        concurrent streams (default 16)\n");
+    printf("  -t, --seconds SEC      audio per stream (default 10)\n");
+    printf("  -r, --rate HZ          sample rate (default 48000)\n");
+    printf("  -c, --channels N       channels per stream (default 1)\n");
+    printf("  -b, --block N          frames per block (default %d)\n", SERVER_BLOCK);
+    printf("  -f, --fast             send as fast as possible instead of in realtime\n");
+    printf("  -q, --quiet            only print the summary, not every stream\n");
+    printf("  -h, --help             show this help\n");
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"socket", required_argument, NULL, 's'},
+        {"streams", required_argument, NULL, 'n'},
+        {"seconds", required_argument, NULL, 't'},
+        {"rate", required_argument, NULL, 'r'},
+        {"channels", required_argument, NULL, 'c'},
+        {"block", required_argument, NULL, 'b'},
+        {"fast", no_argument, NULL, 'f'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    LoadConfig cfg = { LOADGEN_SOCKET, 16, 10.0, 48000, 1, SERVER_BLOCK, false, false };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "s:n:t:r:c:b:fqh", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's': cfg.path = optarg; break;
+        case 'n': cfg.streams = atoi(optarg); break;
+        case 't': cfg.seconds = strtod(optarg, NULL); break;
+        case 'r': cfg.sample_rate = atoi(optarg); break;
+        case 'c': cfg.channels = atoi(optarg); break;
+        case 'b': cfg.block = atol(optarg); break;
+        case 'f': cfg.fast = true; break;
+        case 'q': cfg.quiet = true; break;
+        case 'h': print_usage(argv[0]); return 0;
+        default: print_usage(argv[0]); return 2;
+        }
+    }
+    if (cfg.streams < 1 || cfg.seconds <= 0.0 || cfg.sample_rate <= 0 || cfg.channels < 1 ||
+        cfg.channels > SERVER_MAX_CHANNELS || cfg.block < SERVER_MIN_BLOCK || cfg.block > SERVER_MAX_BLOCK) {
+        fprintf(stderr, "Invalid arguments.\n");
+        print_usage(argv[0]);
+        return 2;
+    }
+    server_raise_fd_limit();
+
+    const long blocks = (long)ceil(cfg.seconds * cfg.sample_rate / cfg.block);
+    const uint64_t period = (uint64_t)(1e9 * cfg.block / cfg.sample_rate);
+    LoadStream *streams = (LoadStream*) calloc(cfg.streams, sizeof(LoadStream));
+    struct pollfd *fds = (struct pollfd*) calloc(cfg.streams, sizeof(struct pollfd));
+    if (!streams || !fds) {
+        fprintf(stderr, "Memory allocation error!\n");
+        return 1;
+    }
+
+    int connected = 0;
+    for (int i = 0; i < cfg.streams; ++i) {
+        LoadStream *st = &streams[i];
+        st->id = i;
+        st->fd = -1;
+        st->blocks = blocks;
+        st->freq = 110.0 + 7.0 * i;
+        st->sent_ns = (uint64_t*) calloc(blocks, sizeof(uint64_t));
+        st->latency = (double*) calloc(blocks, sizeof(double));
+        st->block = (float*) calloc((size_t)cfg.block * cfg.channels, sizeof(float));
+        if (!st->sent_ns || !st->latency || !st->block) {
+            fprintf(stderr, "Memory allocation error!\n");
+            return 1;
+        }
+        if (loadgen_connect(st, &cfg)) connected++;
+        else st->failed = true;
+    }
+    printf("%d/%d streams connected to %s: %d Hz, %d channel(s), %ld-frame blocks, %.1f s each%s\n",
+           connected, cfg.streams, cfg.path, cfg.sample_rate, cfg.channels, cfg.block, cfg.seconds,
+           cfg.fast ? ", unpaced" : "");
+
+    uint64_t start = loadgen_now_ns();
+    for (int i = 0; i < cfg.streams; ++i) streams[i].first_due = start + period * (uint64_t)i / cfg.streams;
+
+    for (;;) {
+        uint64_t now = loadgen_now_ns();
+        uint64_t next_due = UINT64_MAX;
+        int n = 0;
+        for (int i = 0; i < cfg.streams; ++i) {
+            LoadStream *st = &streams[i];
+            if (st->failed || st->done) continue;
+            bool full = loadgen_send(st, &cfg, now, period);
+            if (st->failed) continue;
+            if (!cfg.fast && st->sent < st->blocks && st->send_off == 0) {
+                uint64_t due = st->first_due + (uint64_t)st->sent * period;
+                if (due < next_due) next_due = due;
+            }
+            fds[n].fd = st->fd;
+            fds[n].events = (short)(POLLIN | (full || (cfg.fast && !st->sending_done) ? POLLOUT : 0));
+            fds[n].revents = 0;
+            n++;
+        }
+        if (n == 0) break;
+
+        struct timespec timeout = { 1, 0 };
+        if (next_due != UINT64_MAX) {
+            uint64_t wait = next_due > now ? next_due - now : 0;
+            timeout.tv_sec = (time_t)(wait / 1000000000ull);
+            timeout.tv_nsec = (long)(wait % 1000000000ull);
+        }
+        if (ppoll(fds, n, &timeout, NULL) < 0 && errno != EINTR) {
+            perror("ppoll");
+            return 1;
+        }
+        now = loadgen_now_ns();
+        for (int i = 0; i < cfg.streams; ++i) {
+            LoadStream *st = &streams[i];
+            if (!st->failed && !st->done) loadgen_receive(st, &cfg, now);
+        }
+    }
+    double elapsed = (loadgen_now_ns() - start) * 1e-9;
+
+    // Per-stream and overall latency
+    double *all = (double*) malloc((size_t)blocks * cfg.streams * sizeof(double));
+    long all_n = 0;
+    int bad = 0;
+    double audio = 0.0, worst_p99 = 0.0;
+    if (!cfg.quiet) printf("\n%-8s %8s %10s %10s %10s  %s\n", "stream", "blocks", "p50 ms", "p99 ms", "max ms", "status");
+    for (int i = 0; i < cfg.streams; ++i) {
+        LoadStream *st = &streams[i];
+        bool complete = !st->failed && st->recv_bytes == (uint64_t)st->sent * cfg.block * cfg.channels * sizeof(float);
+        if (!st->failed && !complete) {
+            snprintf(st->error, sizeof(st->error), "got %llu of %llu bytes back",
+                     (unsigned long long)st->recv_bytes,
+                     (unsigned long long)((uint64_t)st->sent * cfg.block * cfg.channels * sizeof(float)));
+        }
+        if (!complete) bad++;
+        if (all) memcpy(all + all_n, st->latency, st->received * sizeof(double));
+        all_n += all ? st->received : 0;
+        audio += (double)st->received * cfg.block / cfg.sample_rate;
+        qsort(st->latency, st->received, sizeof(double), loadgen_cmp_double);
+        double p99 = loadgen_percentile(st->latency, st->received, 0.99);
+        if (p99 > worst_p99) worst_p99 = p99;
+        if (!cfg.quiet) {
+            printf("%-8d %8ld %10.2f %10.2f %10.2f  %s\n", st->id, st->received,
+                   loadgen_percentile(st->latency, st->received, 0.50) * 1e3, p99 * 1e3,
+                   st->received ? st->latency[st->received - 1] * 1e3 : 0.0, complete ? "ok" : st->error);
+        }
+        if (st->fd >= 0) close(st->fd);
+        free(st->sent_ns);
+        free(st->latency);
+        free(st->block);
+    }
+    if (all) {
+        qsort(all, all_n, sizeof(double), loadgen_cmp_double);
+        printf("\n%-8s %8ld %10.2f %10.2f %10.2f  %d ok, %d failed (worst stream p99 %.2f ms)\n", "all", all_n,
+               loadgen_percentile(all, all_n, 0.50) * 1e3, loadgen_percentile(all, all_n, 0.99) * 1e3,
+               all_n ? all[all_n - 1] * 1e3 : 0.0, cfg.streams - bad, bad, worst_p99 * 1e3);
+    }
+    printf("%.1f s of audio in %.2f s: %.1fx realtime\n", audio, elapsed, elapsed > 0 ? audio / elapsed : 0.0);
+
+    free(all);
+    free(streams);
+    free(fds);
+    return bad ? 1 : 0;
+}
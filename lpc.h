@@ -0,0 +1,193 @@
+#ifndef LPC_H
+#define LPC_H
+
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "fft.h"
+#include "noise.h"
+
+// ==================
+// LPC Spectral Envelope
+// ==================
+// All-pole estimate of the vocal tract's spectral envelope over a sliding
+// frame, for the vocoder's formant stage (vocoder.h). The frame's
+// autocorrelation r[0..order] is not recomputed every hop: each hop the
+// products of the `hop` frames leaving the frame are subtracted and those of
+// the `hop` frames entering it are added, so a frame costs 2 * hop * (order + 1)
+// multiply-adds instead of size * (order + 1). The running sums are kept in
+// double and rebuilt from scratch every LPC_REFRESH_FRAMES frames, so rounding
+// cannot drift. Every lag is one dot product over contiguous samples, run by
+// an AVX2/FMA, SSE2 or scalar kernel picked at init like noise.h's; the
+// kernels round differently, which the refresh also bounds.
+//
+// Levinson-Durbin turns r into the predictor A(z) = 1 + a1 z^-1 + ... and the
+// envelope at each FFT bin is 1 / |A|, evaluated with one real FFT of the
+// zero-padded coefficients. The autocorrelation of a rectangular frame is
+// positive definite, and a white-noise floor of LPC_NOISE_FLOOR on r[0] plus
+// a small lag window keep the recursion well conditioned on silence and pure
+// tones.
+
+#define LPC_MAX_ORDER      64
+#define LPC_REFRESH_FRAMES 32
+#define LPC_NOISE_FLOOR    1e-4  // added to r[0], relative: a -40 dB white floor
+#define LPC_LAG_BANDWIDTH  60.0  // Hz, Gaussian lag window
+
+typedef float (*lpc_dot_fn)(const float *a, const float *b, int n);
+
+typedef struct {
+    int order;
+    int size;                          // frame length the sums cover
+    int frames;                        // frames since the last full rebuild
+    double r[LPC_MAX_ORDER + 1];       // running autocorrelation of the frame
+    float lag_window[LPC_MAX_ORDER + 1];
+    lpc_dot_fn dot;
+    const char *kernel_name;
+    float a[LPC_MAX_ORDER + 1];        // predictor, a[0] = 1
+} LpcEstimator;
+
+// ------------------
+// Dot product kernels
+// ------------------
+static float lpc_dot_scalar(const float *a, const float *b, int n) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef NOISE_X86
+__attribute__((target("sse2")))
+static float lpc_dot_sse2(const float *a, const float *b, int n) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(s0, s1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + lpc_dot_scalar(a + i, b + i, n - i);
+}
+
+// Two accumulators hide the FMA latency. The upper halves are cleared before
+// the SSE tail, which would otherwise pay the AVX-to-SSE transition.
+__attribute__((target("avx2,fma")))
+static float lpc_dot_avx2(const float *a, const float *b, int n) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    __m256 s = _mm256_add_ps(s0, s1);
+    __m128 q = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, q);
+    _mm256_zeroupper();
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + lpc_dot_sse2(a + i, b + i, n - i);
+}
+#endif // NOISE_X86
+
+// Picks the widest kernel the running CPU supports.
+static inline lpc_dot_fn lpc_select_kernel(const char **name) {
+#ifdef NOISE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        if (name) *name = "avx2";
+        return lpc_dot_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        if (name) *name = "sse2";
+        return lpc_dot_sse2;
+    }
+#endif
+    if (name) *name = "scalar";
+    return lpc_dot_scalar;
+}
+
+// Order 2 + rate / 1000 (one pole pair per kHz of bandwidth, plus tilt),
+// capped at LPC_MAX_ORDER.
+static inline int lpc_order_for_rate(int sample_rate) {
+    int order = 2 + sample_rate / 1000;
+    return order > LPC_MAX_ORDER ? LPC_MAX_ORDER : order < 4 ? 4 : order;
+}
+
+static inline void lpc_init(LpcEstimator *lpc, int sample_rate, int size) {
+    memset(lpc, 0, sizeof(*lpc));
+    lpc->order = lpc_order_for_rate(sample_rate);
+    if (lpc->order >= size) lpc->order = size - 1;
+    lpc->size = size;
+    lpc->frames = LPC_REFRESH_FRAMES; // the first frame rebuilds
+    for (int k = 0; k <= lpc->order; ++k) {
+        double w = 2.0 * M_PI * LPC_LAG_BANDWIDTH * k / sample_rate;
+        lpc->lag_window[k] = (float)exp(-0.5 * w * w);
+    }
+    lpc->a[0] = 1.0f;
+    lpc->dot = lpc_select_kernel(&lpc->kernel_name);
+}
+
+// Brings r up to date for the frame x[0 .. size), whose last `hop` frames
+// are new since the previous call.
+static inline void lpc_enter(LpcEstimator *lpc, const float *x, int hop) {
+    const int order = lpc->order, size = lpc->size;
+    if (lpc->frames >= LPC_REFRESH_FRAMES) {
+        for (int k = 0; k <= order; ++k) lpc->r[k] = lpc->dot(x + k, x, size - k);
+        lpc->frames = 0;
+    } else {
+        const float *tail = x + size - hop;
+        for (int k = 0; k <= order; ++k) lpc->r[k] += lpc->dot(tail, tail - k, hop);
+    }
+    lpc->frames++;
+}
+
+// Removes the pairs whose older sample is one of x[0 .. hop), the frames
+// about to leave the front. Call with the same frame, before it slides.
+static inline void lpc_leave(LpcEstimator *lpc, const float *x, int hop) {
+    if (lpc->frames >= LPC_REFRESH_FRAMES) return; // the next frame rebuilds anyway
+    for (int k = 0; k <= lpc->order; ++k) lpc->r[k] -= lpc->dot(x, x + k, hop);
+}
+
+// Levinson-Durbin on the windowed, floored autocorrelation. Leaves a flat
+// predictor (a = 1, 0, 0, ...) and returns false for a silent frame.
+static inline bool lpc_solve(LpcEstimator *lpc) {
+    const int order = lpc->order;
+    double r[LPC_MAX_ORDER + 1], a[LPC_MAX_ORDER + 1], tmp[LPC_MAX_ORDER + 1];
+    for (int k = 0; k <= order; ++k) r[k] = lpc->r[k] * lpc->lag_window[k];
+    r[0] *= 1.0 + LPC_NOISE_FLOOR;
+
+    for (int j = 1; j <= order; ++j) lpc->a[j] = 0.0f;
+    if (!(r[0] > 1e-12)) return false;
+    a[0] = 1.0;
+    double err = r[0];
+    for (int i = 1; i <= order; ++i) {
+        double acc = r[i];
+        for (int j = 1; j < i; ++j) acc += a[j] * r[i - j];
+        double k = -acc / err;
+        if (k >= 1.0 || k <= -1.0) break; // numerically unstable: keep the lower order
+        for (int j = 1; j < i; ++j) tmp[j] = a[j] + k * a[i - j];
+        for (int j = 1; j < i; ++j) a[j] = tmp[j];
+        a[i] = k;
+        err *= 1.0 - k * k;
+        for (int j = 1; j <= i; ++j) lpc->a[j] = (float)a[j];
+    }
+    return true;
+}
+
+// absa[k] = |A| at FFT bin k = 0 .. size/2: the reciprocal of the envelope.
+// `frame` (size floats) and `re`/`im` (size/2 + 1 bins) are scratch.
+static inline void lpc_inverse_envelope(const LpcEstimator *lpc, const FftPlan *plan,
+                                        float *frame, float *re, float *im, float *absa) {
+    memset(frame, 0, (size_t)plan->size * sizeof(float));
+    memcpy(frame, lpc->a, (size_t)(lpc->order + 1) * sizeof(float));
+    fft_forward(plan, frame, re, im);
+    for (int k = 0; k <= plan->half; ++k) absa[k] = sqrtf(re[k] * re[k] + im[k] * im[k]);
+}
+
+#endif // LPC_H
@@ -0,0 +1,489 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include "ringbuf.h"
+
+#if defined(__linux__) && !defined(SCHED_BATCH)
+#define SCHED_BATCH 3 // <sched.h> only exposes it with _GNU_SOURCE
+#endif
+
+// ==================
+// Realtime Metrics
+// ==================
+// Counters and fixed-bucket histograms for the realtime pipeline. Writers
+// (the audio callback and the processor thread) only do relaxed atomic adds
+// and a compare-and-swap for the maximum, so recording never blocks and
+// never touches stdio or the heap. A low-priority reporter thread takes
+// snapshots, hands them to a print function supplied by the front end and,
+// optionally, rewrites a JSON or Prometheus text file on every interval.
+//
+// Histograms hold cumulative counts since the stream started; percentiles
+// are reported as the upper bound of the bucket they fall in.
+
+#define METRICS_MAX_BUCKETS 16
+
+// Time buckets in nanoseconds: 10 us ... 1 s
+static const uint64_t metrics_time_bounds[] = {
+    10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+    100000000, 250000000, 500000000, 1000000000
+};
+// Processor wake-up buckets in nanoseconds: 5 us ... 100 ms
+static const uint64_t metrics_wake_bounds[] = {
+    5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000
+};
+// Ring fill buckets in percent
+static const uint64_t metrics_fill_bounds[] = { 1, 5, 10, 25, 50, 75, 90, 100 };
+
+typedef struct {
+    const char *name;        // exported name, e.g. "callback_seconds"
+    const uint64_t *bounds;  // inclusive upper bounds, ascending
+    int num_bounds;          // at most METRICS_MAX_BUCKETS; one more bucket catches the rest
+    double scale;            // raw value * scale = exported unit
+    _Atomic uint64_t counts[METRICS_MAX_BUCKETS + 1];
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} MetricsHistogram;
+
+typedef struct {
+    MetricsHistogram callback_time;   // time spent inside the audio callback
+    MetricsHistogram process_time;    // processor thread: one block through the DSP chain
+    MetricsHistogram wake_time;       // callback's latest input write to the processor thread running
+    MetricsHistogram latency;         // input ADC to output DAC, including ring and DSP delay
+    MetricsHistogram input_fill;      // input ring fill after the callback wrote
+    MetricsHistogram output_fill;     // output ring fill before the callback read
+    _Atomic uint64_t callbacks;
+    _Atomic uint64_t input_overflows; // paInputOverflow reported by the device
+    _Atomic uint64_t output_underflows; // paOutputUnderflow reported by the device
+    _Atomic uint64_t input_drops;     // callbacks that found the input ring full
+    _Atomic uint64_t output_gaps;     // callbacks that found the output ring short
+    _Atomic uint64_t latency_now_ns;  // gauge: most recent latency sample
+    _Atomic uint64_t buffer_target_ns; // gauge: output ring depth the latency controller steers to
+    _Atomic uint64_t trimmed_frames;  // frames the latency controller cut out
+    _Atomic uint64_t target_widenings; // times repeated underruns raised the target
+    _Atomic uint64_t direct_blocks;   // blocks processed inside the callback (direct mode)
+    _Atomic uint64_t direct_fallbacks; // direct mode handed over to the processor thread
+    _Atomic uint64_t input_written_ns; // when the callback last wrote the input ring
+    _Atomic uint64_t minor_faults;    // processor thread page faults since its loop started
+    _Atomic uint64_t major_faults;
+    _Atomic uint64_t vad_blocks;      // blocks the voice activity detector looked at
+    _Atomic uint64_t vad_silent_blocks; // ... and found silent, skipping the chain
+    _Atomic uint64_t vad_speech_ns;   // processing time of the other blocks
+    _Atomic uint64_t vad_silent_ns;   // processing time of the silent ones
+    uint64_t fixed_latency_ns;        // DSP delay added to every latency sample
+} RealtimeMetrics;
+
+static inline uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void metrics_histogram_init(MetricsHistogram *h, const char *name, const uint64_t *bounds,
+                                          int num_bounds, double scale) {
+    h->name = name;
+    h->bounds = bounds;
+    h->num_bounds = num_bounds;
+    h->scale = scale;
+    for (int i = 0; i <= METRICS_MAX_BUCKETS; ++i) atomic_init(&h->counts[i], 0);
+    atomic_init(&h->sum, 0);
+    atomic_init(&h->max, 0);
+}
+
+static inline void metrics_init(RealtimeMetrics *m, uint64_t fixed_latency_ns) {
+    const int time_n = (int)(sizeof(metrics_time_bounds) / sizeof(metrics_time_bounds[0]));
+    const int wake_n = (int)(sizeof(metrics_wake_bounds) / sizeof(metrics_wake_bounds[0]));
+    const int fill_n = (int)(sizeof(metrics_fill_bounds) / sizeof(metrics_fill_bounds[0]));
+    metrics_histogram_init(&m->callback_time, "callback_seconds", metrics_time_bounds, time_n, 1e-9);
+    metrics_histogram_init(&m->process_time, "process_seconds", metrics_time_bounds, time_n, 1e-9);
+    metrics_histogram_init(&m->wake_time, "processor_wake_seconds", metrics_wake_bounds, wake_n, 1e-9);
+    metrics_histogram_init(&m->latency, "latency_seconds", metrics_time_bounds, time_n, 1e-9);
+    metrics_histogram_init(&m->input_fill, "input_ring_fill_percent", metrics_fill_bounds, fill_n, 1.0);
+    metrics_histogram_init(&m->output_fill, "output_ring_fill_percent", metrics_fill_bounds, fill_n, 1.0);
+    atomic_init(&m->callbacks, 0);
+    atomic_init(&m->input_overflows, 0);
+    atomic_init(&m->output_underflows, 0);
+    atomic_init(&m->input_drops, 0);
+    atomic_init(&m->output_gaps, 0);
+    atomic_init(&m->latency_now_ns, 0);
+    atomic_init(&m->buffer_target_ns, 0);
+    atomic_init(&m->trimmed_frames, 0);
+    atomic_init(&m->target_widenings, 0);
+    atomic_init(&m->direct_blocks, 0);
+    atomic_init(&m->direct_fallbacks, 0);
+    atomic_init(&m->input_written_ns, 0);
+    atomic_init(&m->minor_faults, 0);
+    atomic_init(&m->major_faults, 0);
+    atomic_init(&m->vad_blocks, 0);
+    atomic_init(&m->vad_silent_blocks, 0);
+    atomic_init(&m->vad_speech_ns, 0);
+    atomic_init(&m->vad_silent_ns, 0);
+    m->fixed_latency_ns = fixed_latency_ns;
+}
+
+// Lock-free; safe from the audio callback.
+static inline void metrics_observe(MetricsHistogram *h, uint64_t value) {
+    int b = 0;
+    while (b < h->num_bounds && value > h->bounds[b]) ++b;
+    atomic_fetch_add_explicit(&h->counts[b], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+    uint64_t old = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (value > old &&
+           !atomic_compare_exchange_weak_explicit(&h->max, &old, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static inline void metrics_count(_Atomic uint64_t *counter) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+// One block through a chain with voice activity detection; `cost` is its
+// processing time.
+static inline void metrics_observe_vad(RealtimeMetrics *m, bool silent, uint64_t cost) {
+    atomic_fetch_add_explicit(&m->vad_blocks, 1, memory_order_relaxed);
+    if (silent) atomic_fetch_add_explicit(&m->vad_silent_blocks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(silent ? &m->vad_silent_ns : &m->vad_speech_ns, cost, memory_order_relaxed);
+}
+
+// Gauges and counters kept elsewhere are published with a plain store.
+static inline void metrics_set(_Atomic uint64_t *gauge, uint64_t value) {
+    atomic_store_explicit(gauge, value, memory_order_relaxed);
+}
+
+// ------------------
+// Snapshots
+// ------------------
+typedef struct {
+    uint64_t count;
+    double sum;   // exported unit
+    double max;
+    double p50;
+    double p99;
+    double p999;
+    uint64_t buckets[METRICS_MAX_BUCKETS + 1]; // cumulative
+} MetricsHistogramSnapshot;
+
+typedef struct {
+    double uptime;                    // seconds since the reporter started
+    uint64_t callbacks;
+    uint64_t input_overflows;
+    uint64_t output_underflows;
+    uint64_t ring_dropped_frames;     // input or output ring was full
+    uint64_t ring_silent_frames;      // output ring was empty, silence was played
+    uint64_t input_drops;
+    uint64_t output_gaps;
+    uint64_t new_xruns;               // device xruns + ring drops/gaps since the previous snapshot
+    double latency_now;               // seconds
+    double buffer_target;             // seconds
+    uint64_t trimmed_frames;
+    uint64_t target_widenings;
+    uint64_t direct_blocks;
+    uint64_t direct_fallbacks;
+    uint64_t minor_faults;
+    uint64_t major_faults;
+    uint64_t vad_blocks;              // 0 without voice activity detection
+    uint64_t vad_silent_blocks;
+    double silence_ratio;             // silent share of vad_blocks
+    double vad_saved;                 // seconds: silent blocks at the speech blocks' mean cost, minus their actual cost
+    MetricsHistogramSnapshot callback_time;
+    MetricsHistogramSnapshot process_time;
+    MetricsHistogramSnapshot wake_time;
+    MetricsHistogramSnapshot latency;
+    MetricsHistogramSnapshot input_fill;
+    MetricsHistogramSnapshot output_fill;
+} MetricsSnapshot;
+
+static inline double metrics_quantile(const MetricsHistogram *h, const MetricsHistogramSnapshot *s, double q) {
+    if (s->count == 0) return 0.0;
+    uint64_t rank = (uint64_t)(q * (double)s->count);
+    if (rank >= s->count) rank = s->count - 1;
+    for (int b = 0; b < h->num_bounds; ++b) {
+        if (s->buckets[b] > rank) return h->bounds[b] * h->scale < s->max ? h->bounds[b] * h->scale : s->max;
+    }
+    return s->max;
+}
+
+static inline void metrics_histogram_snapshot(const MetricsHistogram *h, MetricsHistogramSnapshot *s) {
+    uint64_t running = 0;
+    for (int b = 0; b <= h->num_bounds; ++b) {
+        running += atomic_load_explicit(&h->counts[b], memory_order_relaxed);
+        s->buckets[b] = running;
+    }
+    // The sum may be a few samples ahead of the bucket counts.
+    s->count = running;
+    s->sum = atomic_load_explicit(&h->sum, memory_order_relaxed) * h->scale;
+    s->max = atomic_load_explicit(&h->max, memory_order_relaxed) * h->scale;
+    s->p50 = metrics_quantile(h, s, 0.50);
+    s->p99 = metrics_quantile(h, s, 0.99);
+    s->p999 = metrics_quantile(h, s, 0.999);
+}
+
+// ------------------
+// Export
+// ------------------
+static inline void metrics_write_prometheus_histogram(FILE *f, const MetricsHistogram *h,
+                                                      const MetricsHistogramSnapshot *s) {
+    fprintf(f, "# TYPE voicemask_%s histogram\n", h->name);
+    for (int b = 0; b < h->num_bounds; ++b) {
+        fprintf(f, "voicemask_%s_bucket{le=\"%g\"} %llu\n", h->name, h->bounds[b] * h->scale,
+                (unsigned long long)s->buckets[b]);
+    }
+    fprintf(f, "voicemask_%s_bucket{le=\"+Inf\"} %llu\n", h->name, (unsigned long long)s->count);
+    fprintf(f, "voicemask_%s_sum %g\n", h->name, s->sum);
+    fprintf(f, "voicemask_%s_count %llu\n", h->name, (unsigned long long)s->count);
+}
+
+static inline void metrics_write_prometheus(FILE *f, const RealtimeMetrics *m, const MetricsSnapshot *s) {
+    fprintf(f, "# TYPE voicemask_callbacks_total counter\nvoicemask_callbacks_total %llu\n",
+            (unsigned long long)s->callbacks);
+    fprintf(f, "# TYPE voicemask_input_overflows_total counter\nvoicemask_input_overflows_total %llu\n",
+            (unsigned long long)s->input_overflows);
+    fprintf(f, "# TYPE voicemask_output_underflows_total counter\nvoicemask_output_underflows_total %llu\n",
+            (unsigned long long)s->output_underflows);
+    fprintf(f, "# TYPE voicemask_input_drops_total counter\nvoicemask_input_drops_total %llu\n",
+            (unsigned long long)s->input_drops);
+    fprintf(f, "# TYPE voicemask_output_gaps_total counter\nvoicemask_output_gaps_total %llu\n",
+            (unsigned long long)s->output_gaps);
+    fprintf(f, "# TYPE voicemask_ring_dropped_frames_total counter\nvoicemask_ring_dropped_frames_total %llu\n",
+            (unsigned long long)s->ring_dropped_frames);
+    fprintf(f, "# TYPE voicemask_ring_silent_frames_total counter\nvoicemask_ring_silent_frames_total %llu\n",
+            (unsigned long long)s->ring_silent_frames);
+    fprintf(f, "# TYPE voicemask_latency_current_seconds gauge\nvoicemask_latency_current_seconds %g\n",
+            s->latency_now);
+    fprintf(f, "# TYPE voicemask_buffer_target_seconds gauge\nvoicemask_buffer_target_seconds %g\n",
+            s->buffer_target);
+    fprintf(f, "# TYPE voicemask_latency_trimmed_frames_total counter\nvoicemask_latency_trimmed_frames_total %llu\n",
+            (unsigned long long)s->trimmed_frames);
+    fprintf(f, "# TYPE voicemask_latency_target_widenings_total counter\nvoicemask_latency_target_widenings_total %llu\n",
+            (unsigned long long)s->target_widenings);
+    fprintf(f, "# TYPE voicemask_direct_blocks_total counter\nvoicemask_direct_blocks_total %llu\n",
+            (unsigned long long)s->direct_blocks);
+    fprintf(f, "# TYPE voicemask_direct_fallbacks_total counter\nvoicemask_direct_fallbacks_total %llu\n",
+            (unsigned long long)s->direct_fallbacks);
+    fprintf(f, "# TYPE voicemask_processor_minor_faults_total counter\nvoicemask_processor_minor_faults_total %llu\n",
+            (unsigned long long)s->minor_faults);
+    fprintf(f, "# TYPE voicemask_processor_major_faults_total counter\nvoicemask_processor_major_faults_total %llu\n",
+            (unsigned long long)s->major_faults);
+    fprintf(f, "# TYPE voicemask_vad_blocks_total counter\nvoicemask_vad_blocks_total %llu\n",
+            (unsigned long long)s->vad_blocks);
+    fprintf(f, "# TYPE voicemask_vad_silent_blocks_total counter\nvoicemask_vad_silent_blocks_total %llu\n",
+            (unsigned long long)s->vad_silent_blocks);
+    fprintf(f, "# TYPE voicemask_vad_silence_ratio gauge\nvoicemask_vad_silence_ratio %g\n", s->silence_ratio);
+    fprintf(f, "# TYPE voicemask_vad_saved_seconds_total counter\nvoicemask_vad_saved_seconds_total %g\n", s->vad_saved);
+    metrics_write_prometheus_histogram(f, &m->callback_time, &s->callback_time);
+    metrics_write_prometheus_histogram(f, &m->process_time, &s->process_time);
+    metrics_write_prometheus_histogram(f, &m->wake_time, &s->wake_time);
+    metrics_write_prometheus_histogram(f, &m->latency, &s->latency);
+    metrics_write_prometheus_histogram(f, &m->input_fill, &s->input_fill);
+    metrics_write_prometheus_histogram(f, &m->output_fill, &s->output_fill);
+}
+
+static inline void metrics_write_json_histogram(FILE *f, const MetricsHistogram *h,
+                                                const MetricsHistogramSnapshot *s, bool last) {
+    fprintf(f, "  \"%s\": {\"count\": %llu, \"sum\": %g, \"max\": %g, \"p50\": %g, \"p99\": %g, \"p999\": %g}%s\n",
+            h->name, (unsigned long long)s->count, s->sum, s->max, s->p50, s->p99, s->p999, last ? "" : ",");
+}
+
+static inline void metrics_write_json(FILE *f, const RealtimeMetrics *m, const MetricsSnapshot *s) {
+    fprintf(f, "{\n  \"uptime_seconds\": %.3f,\n  \"callbacks\": %llu,\n  \"input_overflows\": %llu,\n"
+               "  \"output_underflows\": %llu,\n  \"input_drops\": %llu,\n  \"output_gaps\": %llu,\n"
+               "  \"ring_dropped_frames\": %llu,\n  \"ring_silent_frames\": %llu,\n"
+               "  \"latency_current_seconds\": %g,\n  \"buffer_target_seconds\": %g,\n"
+               "  \"latency_trimmed_frames\": %llu,\n  \"latency_target_widenings\": %llu,\n"
+               "  \"direct_blocks\": %llu,\n  \"direct_fallbacks\": %llu,\n"
+               "  \"processor_minor_faults\": %llu,\n  \"processor_major_faults\": %llu,\n"
+               "  \"vad_blocks\": %llu,\n  \"vad_silent_blocks\": %llu,\n  \"vad_silence_ratio\": %g,\n"
+               "  \"vad_saved_seconds\": %g,\n",
+            s->uptime, (unsigned long long)s->callbacks, (unsigned long long)s->input_overflows,
+            (unsigned long long)s->output_underflows, (unsigned long long)s->input_drops,
+            (unsigned long long)s->output_gaps, (unsigned long long)s->ring_dropped_frames,
+            (unsigned long long)s->ring_silent_frames, s->latency_now, s->buffer_target,
+            (unsigned long long)s->trimmed_frames, (unsigned long long)s->target_widenings,
+            (unsigned long long)s->direct_blocks, (unsigned long long)s->direct_fallbacks,
+            (unsigned long long)s->minor_faults, (unsigned long long)s->major_faults,
+            (unsigned long long)s->vad_blocks, (unsigned long long)s->vad_silent_blocks, s->silence_ratio, s->vad_saved);
+    metrics_write_json_histogram(f, &m->callback_time, &s->callback_time, false);
+    metrics_write_json_histogram(f, &m->process_time, &s->process_time, false);
+    metrics_write_json_histogram(f, &m->wake_time, &s->wake_time, false);
+    metrics_write_json_histogram(f, &m->latency, &s->latency, false);
+    metrics_write_json_histogram(f, &m->input_fill, &s->input_fill, false);
+    metrics_write_json_histogram(f, &m->output_fill, &s->output_fill, true);
+    fprintf(f, "}\n");
+}
+
+// Writes `path` atomically (temporary file + rename): JSON when the name ends
+// in ".json", Prometheus text exposition format otherwise.
+static inline bool metrics_export(const char *path, const RealtimeMetrics *m, const MetricsSnapshot *s) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return false;
+    FILE *f = fopen(tmp, "w");
+    if (!f) return false;
+    size_t len = strlen(path);
+    if (len >= 5 && strcmp(path + len - 5, ".json") == 0) metrics_write_json(f, m, s);
+    else metrics_write_prometheus(f, m, s);
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) ok = false;
+    if (ok && rename(tmp, path) != 0) ok = false;
+    if (!ok) remove(tmp);
+    return ok;
+}
+
+// ------------------
+// Reporter thread
+// ------------------
+typedef void (*metrics_print_fn)(const MetricsSnapshot *snapshot, void *ctx);
+
+typedef struct {
+    RealtimeMetrics *metrics;
+    RealtimeBuffer *input;
+    RealtimeBuffer *output;
+    double interval;          // seconds between reports
+    const char *path;         // optional export file
+    metrics_print_fn print;   // optional status line
+    void *print_ctx;
+    bool export_failed;       // set once if the export file could not be written
+
+    pthread_t thread;
+    bool started;
+    bool stop;
+    uint64_t last_events;
+    double start;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} MetricsReporter;
+
+static inline void metrics_take_snapshot(MetricsReporter *r, MetricsSnapshot *s) {
+    RealtimeMetrics *m = r->metrics;
+    s->uptime = metrics_now_ns() * 1e-9 - r->start;
+    s->callbacks = atomic_load_explicit(&m->callbacks, memory_order_relaxed);
+    s->input_overflows = atomic_load_explicit(&m->input_overflows, memory_order_relaxed);
+    s->output_underflows = atomic_load_explicit(&m->output_underflows, memory_order_relaxed);
+    s->input_drops = atomic_load_explicit(&m->input_drops, memory_order_relaxed);
+    s->output_gaps = atomic_load_explicit(&m->output_gaps, memory_order_relaxed);
+    s->ring_dropped_frames = atomic_load(&r->input->overflow_frames) + atomic_load(&r->output->overflow_frames);
+    s->ring_silent_frames = atomic_load(&r->output->underflow_frames);
+    s->latency_now = atomic_load_explicit(&m->latency_now_ns, memory_order_relaxed) * 1e-9;
+    s->buffer_target = atomic_load_explicit(&m->buffer_target_ns, memory_order_relaxed) * 1e-9;
+    s->trimmed_frames = atomic_load_explicit(&m->trimmed_frames, memory_order_relaxed);
+    s->target_widenings = atomic_load_explicit(&m->target_widenings, memory_order_relaxed);
+    s->direct_blocks = atomic_load_explicit(&m->direct_blocks, memory_order_relaxed);
+    s->direct_fallbacks = atomic_load_explicit(&m->direct_fallbacks, memory_order_relaxed);
+    s->minor_faults = atomic_load_explicit(&m->minor_faults, memory_order_relaxed);
+    s->major_faults = atomic_load_explicit(&m->major_faults, memory_order_relaxed);
+    s->vad_blocks = atomic_load_explicit(&m->vad_blocks, memory_order_relaxed);
+    s->vad_silent_blocks = atomic_load_explicit(&m->vad_silent_blocks, memory_order_relaxed);
+    uint64_t speech_blocks = s->vad_blocks > s->vad_silent_blocks ? s->vad_blocks - s->vad_silent_blocks : 0;
+    double speech_ns = (double)atomic_load_explicit(&m->vad_speech_ns, memory_order_relaxed);
+    double silent_ns = (double)atomic_load_explicit(&m->vad_silent_ns, memory_order_relaxed);
+    s->silence_ratio = s->vad_blocks ? (double)s->vad_silent_blocks / (double)s->vad_blocks : 0.0;
+    s->vad_saved = speech_blocks ? (s->vad_silent_blocks * (speech_ns / speech_blocks) - silent_ns) * 1e-9 : 0.0;
+    if (s->vad_saved < 0.0) s->vad_saved = 0.0;
+    metrics_histogram_snapshot(&m->callback_time, &s->callback_time);
+    metrics_histogram_snapshot(&m->process_time, &s->process_time);
+    metrics_histogram_snapshot(&m->wake_time, &s->wake_time);
+    metrics_histogram_snapshot(&m->latency, &s->latency);
+    metrics_histogram_snapshot(&m->input_fill, &s->input_fill);
+    metrics_histogram_snapshot(&m->output_fill, &s->output_fill);
+
+    uint64_t events = s->input_overflows + s->output_underflows + s->input_drops + s->output_gaps;
+    s->new_xruns = events - r->last_events;
+    r->last_events = events;
+}
+
+static inline void metrics_report(MetricsReporter *r) {
+    MetricsSnapshot s;
+    metrics_take_snapshot(r, &s);
+    if (r->print) r->print(&s, r->print_ctx);
+    if (r->path && !metrics_export(r->path, r->metrics, &s)) r->export_failed = true;
+}
+
+static void *metrics_reporter_thread(void *arg) {
+    MetricsReporter *r = (MetricsReporter*)arg;
+#if defined(__linux__) && defined(SCHED_BATCH)
+    // Stay out of the audio threads' way; failure just leaves normal priority.
+    struct sched_param param = { 0 };
+    pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+#endif
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    pthread_mutex_lock(&r->mutex);
+    while (!r->stop) {
+        deadline.tv_sec += (time_t)r->interval;
+        deadline.tv_nsec += (long)((r->interval - (double)(time_t)r->interval) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!r->stop && pthread_cond_timedwait(&r->cond, &r->mutex, &deadline) != ETIMEDOUT) {
+        }
+        if (r->stop) break;
+        pthread_mutex_unlock(&r->mutex);
+        metrics_report(r);
+        pthread_mutex_lock(&r->mutex);
+    }
+    pthread_mutex_unlock(&r->mutex);
+    return NULL;
+}
+
+// Starts the reporter when interval > 0. Returns false if the thread could not be started.
+static inline bool metrics_reporter_start(MetricsReporter *r, RealtimeMetrics *metrics,
+                                          RealtimeBuffer *input, RealtimeBuffer *output,
+                                          double interval, const char *path,
+                                          metrics_print_fn print, void *print_ctx) {
+    memset(r, 0, sizeof(*r));
+    r->metrics = metrics;
+    r->input = input;
+    r->output = output;
+    r->interval = interval;
+    r->path = path;
+    r->print = print;
+    r->print_ctx = print_ctx;
+    r->start = metrics_now_ns() * 1e-9;
+    if (interval <= 0.0) return true;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&r->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&r->mutex, NULL);
+    if (pthread_create(&r->thread, NULL, metrics_reporter_thread, r) != 0) {
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->mutex);
+        return false;
+    }
+    r->started = true;
+    return true;
+}
+
+// Stops the thread and writes the export file one last time.
+static inline void metrics_reporter_stop(MetricsReporter *r) {
+    if (r->started) {
+        pthread_mutex_lock(&r->mutex);
+        r->stop = true;
+        pthread_cond_signal(&r->cond);
+        pthread_mutex_unlock(&r->mutex);
+        pthread_join(r->thread, NULL);
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->mutex);
+        r->started = false;
+    }
+    if (r->path) {
+        MetricsSnapshot s;
+        metrics_take_snapshot(r, &s);
+        if (!metrics_export(r->path, r->metrics, &s)) r->export_failed = true;
+    }
+}
+
+#endif // METRICS_H
@@ -0,0 +1,327 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NOISE_X86 1
+#endif
+
+// ==================
+// Noise + Clip Kernel
+// ==================
+// Adds noise to a block and clamps it to [-1, 1] in one pass. The generator is
+// eight independent xoshiro128+ lanes, so one step yields eight floats and maps
+// directly onto an AVX2 register (or two SSE2 registers). The AVX2, SSE2 and
+// scalar kernels produce bit-identical output; noise_select_kernel() picks the
+// widest one the CPU supports at runtime.
+//
+// Each DspContext owns its own NoiseRng, so there is no shared state between
+// threads.
+//
+// The crossfade variants (noise_mix_clip_*) take the granular pitch shifter's
+// two taps and tap A's gain instead of a finished block, so the shifter's
+// mix, the noise and the clamp are one pass (see dsp_pitch_noise_process()).
+// They compute the mix exactly as pitch_shifter_process() does and draw the
+// noise in the same order, so their output matches the two separate passes
+// bit for bit.
+
+#define NOISE_LANES 8
+
+typedef enum {
+    NOISE_UNIFORM,  // uniform in [-amplitude, amplitude)
+    NOISE_TPDF,     // triangular in (-amplitude, amplitude), sum of two uniforms
+    NOISE_GAUSSIAN  // approximately normal with sigma = amplitude (like np.random.normal)
+} NoiseShape;
+
+// Returns false for an unknown name.
+static inline bool noise_shape_from_name(const char *name, NoiseShape *shape) {
+    if (strcmp(name, "uniform") == 0) *shape = NOISE_UNIFORM;
+    else if (strcmp(name, "tpdf") == 0) *shape = NOISE_TPDF;
+    else if (strcmp(name, "gaussian") == 0) *shape = NOISE_GAUSSIAN;
+    else return false;
+    return true;
+}
+
+typedef struct {
+    uint32_t s[4][NOISE_LANES]; // one row per state word, lanes contiguous
+} NoiseRng;
+
+typedef void (*noise_kernel_fn)(NoiseRng *rng, const float *in, float *out, long n,
+                                NoiseShape shape, float amplitude);
+
+// out = clamp(b + gain * (a - b) + noise)
+typedef void (*noise_mix_fn)(NoiseRng *rng, const float *a, const float *b, const float *gain,
+                             float *out, long n, NoiseShape shape, float amplitude);
+
+static inline uint64_t noise_splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static inline void noise_rng_seed(NoiseRng *rng, uint64_t seed) {
+    for (int i = 0; i < 4; ++i) {
+        for (int lane = 0; lane < NOISE_LANES; ++lane) {
+            rng->s[i][lane] = (uint32_t)noise_splitmix64(&seed);
+        }
+    }
+}
+
+// Irwin-Hall(4) has variance 1/3; this rescales it to unit variance.
+#define NOISE_GAUSS_SCALE 1.7320508f
+
+// ------------------
+// Scalar
+// ------------------
+static inline float noise_bits_to_unit(uint32_t x) {
+    union { uint32_t u; float f; } v = { (x >> 9) | 0x3f800000u };
+    return v.f - 1.0f; // [0, 1)
+}
+
+static inline void noise_step_scalar(NoiseRng *rng, float out[NOISE_LANES]) {
+    for (int lane = 0; lane < NOISE_LANES; ++lane) {
+        uint32_t s0 = rng->s[0][lane], s1 = rng->s[1][lane];
+        uint32_t s2 = rng->s[2][lane], s3 = rng->s[3][lane];
+        uint32_t result = s0 + s3;
+        uint32_t t = s1 << 9;
+        s2 ^= s0;
+        s3 ^= s1;
+        s1 ^= s2;
+        s0 ^= s3;
+        s2 ^= t;
+        s3 = (s3 << 11) | (s3 >> 21);
+        rng->s[0][lane] = s0; rng->s[1][lane] = s1;
+        rng->s[2][lane] = s2; rng->s[3][lane] = s3;
+        out[lane] = noise_bits_to_unit(result);
+    }
+}
+
+static inline void noise_shaped_scalar(NoiseRng *rng, NoiseShape shape, float amplitude,
+                                       float out[NOISE_LANES]) {
+    float u[NOISE_LANES], v[NOISE_LANES];
+    noise_step_scalar(rng, u);
+    if (shape == NOISE_UNIFORM) {
+        for (int k = 0; k < NOISE_LANES; ++k) out[k] = (u[k] * 2.0f - 1.0f) * amplitude;
+    } else if (shape == NOISE_TPDF) {
+        noise_step_scalar(rng, v);
+        for (int k = 0; k < NOISE_LANES; ++k) out[k] = (u[k] - v[k]) * amplitude;
+    } else {
+        float acc[NOISE_LANES];
+        for (int k = 0; k < NOISE_LANES; ++k) acc[k] = u[k];
+        for (int r = 0; r < 3; ++r) {
+            noise_step_scalar(rng, v);
+            for (int k = 0; k < NOISE_LANES; ++k) acc[k] += v[k];
+        }
+        for (int k = 0; k < NOISE_LANES; ++k) out[k] = (acc[k] - 2.0f) * (NOISE_GAUSS_SCALE * amplitude);
+    }
+}
+
+static inline float noise_clamp(float x) {
+    x = x < -1.0f ? -1.0f : x;
+    return x > 1.0f ? 1.0f : x;
+}
+
+static void noise_add_clip_scalar(NoiseRng *rng, const float *in, float *out, long n,
+                                  NoiseShape shape, float amplitude) {
+    float noise[NOISE_LANES];
+    long i = 0;
+    for (; i + NOISE_LANES <= n; i += NOISE_LANES) {
+        noise_shaped_scalar(rng, shape, amplitude, noise);
+        for (int k = 0; k < NOISE_LANES; ++k) out[i + k] = noise_clamp(in[i + k] + noise[k]);
+    }
+    if (i < n) {
+        noise_shaped_scalar(rng, shape, amplitude, noise);
+        for (int k = 0; i + k < n; ++k) out[i + k] = noise_clamp(in[i + k] + noise[k]);
+    }
+}
+
+static void noise_mix_clip_scalar(NoiseRng *rng, const float *a, const float *b, const float *gain,
+                                  float *out, long n, NoiseShape shape, float amplitude) {
+    float noise[NOISE_LANES];
+    long i = 0;
+    for (; i + NOISE_LANES <= n; i += NOISE_LANES) {
+        noise_shaped_scalar(rng, shape, amplitude, noise);
+        for (int k = 0; k < NOISE_LANES; ++k) out[i + k] = noise_clamp(b[i + k] + gain[i + k] * (a[i + k] - b[i + k]) + noise[k]);
+    }
+    if (i < n) {
+        noise_shaped_scalar(rng, shape, amplitude, noise);
+        for (int k = 0; i + k < n; ++k) out[i + k] = noise_clamp(b[i + k] + gain[i + k] * (a[i + k] - b[i + k]) + noise[k]);
+    }
+}
+
+#ifdef NOISE_X86
+// ------------------
+// SSE2 (two 4-lane halves per step)
+// ------------------
+__attribute__((target("sse2")))
+static inline __m128 noise_step_sse2(NoiseRng *rng, int half) {
+    __m128i *s0p = (__m128i*)&rng->s[0][half * 4], *s1p = (__m128i*)&rng->s[1][half * 4];
+    __m128i *s2p = (__m128i*)&rng->s[2][half * 4], *s3p = (__m128i*)&rng->s[3][half * 4];
+    __m128i s0 = _mm_loadu_si128(s0p), s1 = _mm_loadu_si128(s1p);
+    __m128i s2 = _mm_loadu_si128(s2p), s3 = _mm_loadu_si128(s3p);
+    __m128i result = _mm_add_epi32(s0, s3);
+    __m128i t = _mm_slli_epi32(s1, 9);
+    s2 = _mm_xor_si128(s2, s0);
+    s3 = _mm_xor_si128(s3, s1);
+    s1 = _mm_xor_si128(s1, s2);
+    s0 = _mm_xor_si128(s0, s3);
+    s2 = _mm_xor_si128(s2, t);
+    s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+    _mm_storeu_si128(s0p, s0); _mm_storeu_si128(s1p, s1);
+    _mm_storeu_si128(s2p, s2); _mm_storeu_si128(s3p, s3);
+    __m128i bits = _mm_or_si128(_mm_srli_epi32(result, 9), _mm_set1_epi32(0x3f800000));
+    return _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(1.0f));
+}
+
+__attribute__((target("sse2")))
+static inline __m128 noise_shaped_sse2(NoiseRng *rng, int half, NoiseShape shape, float amplitude) {
+    __m128 u = noise_step_sse2(rng, half);
+    if (shape == NOISE_UNIFORM) {
+        return _mm_mul_ps(_mm_sub_ps(_mm_add_ps(u, u), _mm_set1_ps(1.0f)), _mm_set1_ps(amplitude));
+    } else if (shape == NOISE_TPDF) {
+        return _mm_mul_ps(_mm_sub_ps(u, noise_step_sse2(rng, half)), _mm_set1_ps(amplitude));
+    }
+    __m128 acc = u;
+    for (int r = 0; r < 3; ++r) acc = _mm_add_ps(acc, noise_step_sse2(rng, half));
+    return _mm_mul_ps(_mm_sub_ps(acc, _mm_set1_ps(2.0f)), _mm_set1_ps(NOISE_GAUSS_SCALE * amplitude));
+}
+
+__attribute__((target("sse2")))
+static void noise_add_clip_sse2(NoiseRng *rng, const float *in, float *out, long n,
+                                NoiseShape shape, float amplitude) {
+    const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+    long i = 0;
+    for (; i + NOISE_LANES <= n; i += NOISE_LANES) {
+        // Lanes are independent, so advancing each half separately matches the scalar order.
+        __m128 n0 = noise_shaped_sse2(rng, 0, shape, amplitude);
+        __m128 n1 = noise_shaped_sse2(rng, 1, shape, amplitude);
+        __m128 a = _mm_add_ps(_mm_loadu_ps(in + i), n0);
+        __m128 b = _mm_add_ps(_mm_loadu_ps(in + i + 4), n1);
+        _mm_storeu_ps(out + i, _mm_min_ps(_mm_max_ps(a, lo), hi));
+        _mm_storeu_ps(out + i + 4, _mm_min_ps(_mm_max_ps(b, lo), hi));
+    }
+    if (i < n) noise_add_clip_scalar(rng, in + i, out + i, n - i, shape, amplitude);
+}
+
+__attribute__((target("sse2")))
+static inline __m128 noise_mix_sse2(const float *a, const float *b, const float *gain) {
+    __m128 vb = _mm_loadu_ps(b);
+    return _mm_add_ps(vb, _mm_mul_ps(_mm_loadu_ps(gain), _mm_sub_ps(_mm_loadu_ps(a), vb)));
+}
+
+__attribute__((target("sse2")))
+static void noise_mix_clip_sse2(NoiseRng *rng, const float *a, const float *b, const float *gain,
+                                float *out, long n, NoiseShape shape, float amplitude) {
+    const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+    long i = 0;
+    for (; i + NOISE_LANES <= n; i += NOISE_LANES) {
+        __m128 n0 = noise_shaped_sse2(rng, 0, shape, amplitude);
+        __m128 n1 = noise_shaped_sse2(rng, 1, shape, amplitude);
+        __m128 x0 = _mm_add_ps(noise_mix_sse2(a + i, b + i, gain + i), n0);
+        __m128 x1 = _mm_add_ps(noise_mix_sse2(a + i + 4, b + i + 4, gain + i + 4), n1);
+        _mm_storeu_ps(out + i, _mm_min_ps(_mm_max_ps(x0, lo), hi));
+        _mm_storeu_ps(out + i + 4, _mm_min_ps(_mm_max_ps(x1, lo), hi));
+    }
+    if (i < n) noise_mix_clip_scalar(rng, a + i, b + i, gain + i, out + i, n - i, shape, amplitude);
+}
+
+// ------------------
+// AVX2 (all eight lanes per step)
+// ------------------
+__attribute__((target("avx2")))
+static inline __m256 noise_step_avx2(NoiseRng *rng) {
+    __m256i s0 = _mm256_loadu_si256((__m256i*)rng->s[0]), s1 = _mm256_loadu_si256((__m256i*)rng->s[1]);
+    __m256i s2 = _mm256_loadu_si256((__m256i*)rng->s[2]), s3 = _mm256_loadu_si256((__m256i*)rng->s[3]);
+    __m256i result = _mm256_add_epi32(s0, s3);
+    __m256i t = _mm256_slli_epi32(s1, 9);
+    s2 = _mm256_xor_si256(s2, s0);
+    s3 = _mm256_xor_si256(s3, s1);
+    s1 = _mm256_xor_si256(s1, s2);
+    s0 = _mm256_xor_si256(s0, s3);
+    s2 = _mm256_xor_si256(s2, t);
+    s3 = _mm256_or_si256(_mm256_slli_epi32(s3, 11), _mm256_srli_epi32(s3, 21));
+    _mm256_storeu_si256((__m256i*)rng->s[0], s0); _mm256_storeu_si256((__m256i*)rng->s[1], s1);
+    _mm256_storeu_si256((__m256i*)rng->s[2], s2); _mm256_storeu_si256((__m256i*)rng->s[3], s3);
+    __m256i bits = _mm256_or_si256(_mm256_srli_epi32(result, 9), _mm256_set1_epi32(0x3f800000));
+    return _mm256_sub_ps(_mm256_castsi256_ps(bits), _mm256_set1_ps(1.0f));
+}
+
+// `amp` is amplitude broadcast, `gauss_amp` NOISE_GAUSS_SCALE * amplitude.
+__attribute__((target("avx2")))
+static inline __m256 noise_shaped_avx2(NoiseRng *rng, NoiseShape shape, __m256 amp, __m256 gauss_amp) {
+    __m256 u = noise_step_avx2(rng);
+    if (shape == NOISE_UNIFORM) {
+        return _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(u, u), _mm256_set1_ps(1.0f)), amp);
+    } else if (shape == NOISE_TPDF) {
+        return _mm256_mul_ps(_mm256_sub_ps(u, noise_step_avx2(rng)), amp);
+    }
+    for (int r = 0; r < 3; ++r) u = _mm256_add_ps(u, noise_step_avx2(rng));
+    return _mm256_mul_ps(_mm256_sub_ps(u, _mm256_set1_ps(2.0f)), gauss_amp);
+}
+
+__attribute__((target("avx2")))
+static void noise_add_clip_avx2(NoiseRng *rng, const float *in, float *out, long n,
+                                NoiseShape shape, float amplitude) {
+    const __m256 lo = _mm256_set1_ps(-1.0f), hi = _mm256_set1_ps(1.0f);
+    const __m256 amp = _mm256_set1_ps(amplitude);
+    const __m256 gauss_amp = _mm256_set1_ps(NOISE_GAUSS_SCALE * amplitude);
+    long i = 0;
+    for (; i + NOISE_LANES <= n; i += NOISE_LANES) {
+        __m256 x = _mm256_add_ps(_mm256_loadu_ps(in + i), noise_shaped_avx2(rng, shape, amp, gauss_amp));
+        _mm256_storeu_ps(out + i, _mm256_min_ps(_mm256_max_ps(x, lo), hi));
+    }
+    if (i < n) noise_add_clip_scalar(rng, in + i, out + i, n - i, shape, amplitude);
+}
+
+// Plain multiply and add rather than FMA, so the mix rounds like the scalar code.
+__attribute__((target("avx2")))
+static void noise_mix_clip_avx2(NoiseRng *rng, const float *a, const float *b, const float *gain,
+                                float *out, long n, NoiseShape shape, float amplitude) {
+    const __m256 lo = _mm256_set1_ps(-1.0f), hi = _mm256_set1_ps(1.0f);
+    const __m256 amp = _mm256_set1_ps(amplitude);
+    const __m256 gauss_amp = _mm256_set1_ps(NOISE_GAUSS_SCALE * amplitude);
+    long i = 0;
+    for (; i + NOISE_LANES <= n; i += NOISE_LANES) {
+        __m256 vb = _mm256_loadu_ps(b + i);
+        __m256 mixed = _mm256_add_ps(vb, _mm256_mul_ps(_mm256_loadu_ps(gain + i), _mm256_sub_ps(_mm256_loadu_ps(a + i), vb)));
+        __m256 x = _mm256_add_ps(mixed, noise_shaped_avx2(rng, shape, amp, gauss_amp));
+        _mm256_storeu_ps(out + i, _mm256_min_ps(_mm256_max_ps(x, lo), hi));
+    }
+    if (i < n) noise_mix_clip_scalar(rng, a + i, b + i, gain + i, out + i, n - i, shape, amplitude);
+}
+#endif // NOISE_X86
+
+// Picks the widest kernel the running CPU supports. Call once at setup.
+static inline noise_kernel_fn noise_select_kernel(const char **name) {
+#ifdef NOISE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        if (name) *name = "avx2";
+        return noise_add_clip_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        if (name) *name = "sse2";
+        return noise_add_clip_sse2;
+    }
+#endif
+    if (name) *name = "scalar";
+    return noise_add_clip_scalar;
+}
+
+// The crossfade kernel for the same CPU; picks the same instruction set as
+// noise_select_kernel().
+static inline noise_mix_fn noise_select_mix_kernel(void) {
+#ifdef NOISE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return noise_mix_clip_avx2;
+    if (__builtin_cpu_supports("sse2")) return noise_mix_clip_sse2;
+#endif
+    return noise_mix_clip_scalar;
+}
+
+#endif // NOISE_H
@@ -0,0 +1,755 @@
+#ifndef OFFLINE_H
+#define OFFLINE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sndfile.h>
+#include "dsp.h"
+#include "threadpool.h"
+#include "wavmap.h"
+#include "pcmconv.h"
+#include "allocguard.h"
+
+// ==================
+// Offline (Headless) Processing
+// ==================
+// Runs the same DSP chain as the realtime path over audio files, without
+// PortAudio. Any format libsndfile can read is accepted; the output keeps the
+// input's container/encoding when libsndfile can write it and falls back to
+// 32-bit float WAV otherwise. Each channel gets its own DspContext. Files are
+// read and written in OFFLINE_CHUNK-frame pieces, so memory does not grow with
+// the length of the recording.
+//
+// A job is self-contained so a batch can be spread over a ThreadPool with
+// offline_run_job() as the task function. When the job has a pool and the
+// input is seekable and long enough, the file is also split into segments that
+// run on the same pool (see "Segmented processing" below). PCM and float WAV
+// files skip libsndfile and are processed between memory mappings of the
+// input and output (see "Memory-mapped WAV" below).
+//
+// With -DVOICEMASK_ALLOC_GUARD each dsp_process_interleaved() call is
+// guarded like the realtime processor loop; reading and writing stay outside
+// the guard because libsndfile allocates per call.
+
+#define OFFLINE_CHUNK           4096
+#define OFFLINE_SEGMENT_SECONDS 30.0  // default minimum segment length
+#define OFFLINE_SEGMENTS_PER_WORKER 4 // upper bound, for load balancing
+
+typedef struct {
+    int n_steps;
+    NoiseShape noise_shape;
+    float noise_amplitude;
+    ResampleQuality quality;
+    double segment_seconds; // minimum segment length; 0 processes every file in one piece
+    PcmFormat output_format; // PCM_FORMAT_KEEP writes the input's encoding
+    bool dither;            // TPDF dither before quantizing to PCM16/PCM24
+    PitchEngine engine;     // the vocoder cannot seek, so it always runs files in one piece
+    float formant_steps;    // envelope shift of PITCH_ENGINE_FORMANT
+    DspChain chain;         // stages every context runs; filters keep files in one piece
+} OfflineConfig;
+
+typedef enum {
+    OFFLINE_OK,
+    OFFLINE_ERR_OPEN_INPUT,
+    OFFLINE_ERR_OPEN_OUTPUT,
+    OFFLINE_ERR_MEMORY,
+    OFFLINE_ERR_READ,
+    OFFLINE_ERR_WRITE
+} OfflineStatus;
+
+struct OfflineSegment;
+
+// Encodes processed frames for a libsndfile output (see "Output encoding")
+typedef struct {
+    SNDFILE *file;
+    int channels;
+    bool raw;             // WAV data chunk in one of PcmFormat's encodings: bytes go in as they are
+    PcmEncoder enc;
+    float *scratch;       // OFFLINE_CHUNK frames: dithered samples
+    unsigned char *bytes; // OFFLINE_CHUNK frames: encoded samples
+} OfflinePcmWriter;
+
+typedef struct {
+    const OfflineConfig *config;
+    ThreadPool *pool;  // optional: pool to run segments of a long file on
+    char *in_path;
+    char *out_path;
+    OfflineStatus status;
+    char error[256];   // libsndfile or system message for open/read/write failures
+    long long frames;  // frames processed per channel
+    int sample_rate;
+    int channels;
+    int segments;      // pieces the file was processed in
+    double seconds;    // wall-clock processing time
+
+    // Segmented run state
+    double start;
+    SNDFILE *out;
+    OfflinePcmWriter writer;
+    struct OfflineSegment *seg;
+    atomic_int segments_left;
+    bool mapped;       // WAV fast path: segments write straight into out_map
+    _Atomic long long frames_mapped;
+    WavMap in_map;
+    WavMap out_map;
+} OfflineJob;
+
+typedef struct {
+    OfflineJob *jobs;
+    int count;
+    int capacity;
+} OfflineJobList;
+
+static inline double offline_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline bool offline_is_dir(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static inline bool offline_is_file(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// True when `out_path` already exists and is the same file as `in_path`
+// (also through links or a directory mapped onto itself).
+static inline bool offline_same_file(const char *in_path, const char *out_path) {
+    struct stat in_st, out_st;
+    return stat(in_path, &in_st) == 0 && stat(out_path, &out_st) == 0 &&
+           in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino;
+}
+
+static inline char *offline_join(const char *dir, const char *name) {
+    size_t len = strlen(dir) + 1 + strlen(name) + 1;
+    char *p = (char*) malloc(len);
+    if (p) snprintf(p, len, "%s%s%s", dir, (dir[0] && dir[strlen(dir) - 1] == '/') ? "" : "/", name);
+    return p;
+}
+
+// "dir/name.ext" -> "dir/name_masked.ext"
+static inline char *offline_default_output(const char *in_path) {
+    const char *slash = strrchr(in_path, '/');
+    const char *dot = strrchr(in_path, '.');
+    if (!dot || (slash && dot < slash)) dot = in_path + strlen(in_path);
+    size_t stem = (size_t)(dot - in_path);
+    size_t len = strlen(in_path) + sizeof("_masked");
+    char *p = (char*) malloc(len);
+    if (p) snprintf(p, len, "%.*s_masked%s", (int)stem, in_path, dot);
+    return p;
+}
+
+static inline bool offline_add_job(OfflineJobList *list, const OfflineConfig *config,
+                                   const char *in_path, char *out_path) {
+    if (!out_path) return false;
+    if (list->count == list->capacity) {
+        int cap = list->capacity ? list->capacity * 2 : 16;
+        OfflineJob *jobs = (OfflineJob*) realloc(list->jobs, cap * sizeof(OfflineJob));
+        if (!jobs) {
+            free(out_path);
+            return false;
+        }
+        list->jobs = jobs;
+        list->capacity = cap;
+    }
+    OfflineJob *job = &list->jobs[list->count++];
+    memset(job, 0, sizeof(*job));
+    job->config = config;
+    job->in_path = strdup(in_path);
+    job->out_path = out_path;
+    return job->in_path != NULL;
+}
+
+// Adds `in_path` (a file, or every regular non-hidden file in a directory).
+// With `out_dir` set, outputs go there under the input's file name; otherwise
+// `out_file` is used for a single file, or "<name>_masked.<ext>" next to it.
+static inline bool offline_collect(OfflineJobList *list, const OfflineConfig *config,
+                                   const char *in_path, const char *out_dir, const char *out_file) {
+    if (offline_is_dir(in_path)) {
+        DIR *dir = opendir(in_path);
+        if (!dir) return false;
+        struct dirent *entry;
+        bool ok = true;
+        while (ok && (entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            char *path = offline_join(in_path, entry->d_name);
+            if (!path) {
+                ok = false;
+                break;
+            }
+            if (offline_is_file(path)) {
+                char *out = out_dir ? offline_join(out_dir, entry->d_name) : offline_default_output(path);
+                ok = offline_add_job(list, config, path, out);
+            }
+            free(path);
+        }
+        closedir(dir);
+        return ok;
+    }
+
+    if (!offline_is_file(in_path)) return false;
+    const char *base = strrchr(in_path, '/');
+    base = base ? base + 1 : in_path;
+    char *out = out_dir ? offline_join(out_dir, base)
+              : out_file ? strdup(out_file)
+              : offline_default_output(in_path);
+    return offline_add_job(list, config, in_path, out);
+}
+
+static inline void offline_free_jobs(OfflineJobList *list) {
+    for (int i = 0; i < list->count; ++i) {
+        free(list->jobs[i].in_path);
+        free(list->jobs[i].out_path);
+    }
+    free(list->jobs);
+    list->jobs = NULL;
+    list->count = list->capacity = 0;
+}
+
+// ------------------
+// Streaming core
+// ------------------
+// Pulls interleaved frames from `read_fn`, runs them through one DspContext per
+// channel and hands them to `write_fn`, OFFLINE_CHUNK frames at a time. Memory use
+// is fixed by the chunk size and channel count, whatever the stream length.
+// `read_fn` returns the number of frames produced (0 at the end, negative on
+// error); `write_fn` returns false on error.
+
+typedef sf_count_t (*offline_read_fn)(void *ctx, float *frames, sf_count_t max_frames);
+typedef bool (*offline_write_fn)(void *ctx, const float *frames, sf_count_t n);
+
+// General form: the reader starts at absolute frame `first_frame` of the
+// stream, and the first `skip_frames` processed frames are only used to warm
+// up the DSP state and are not written. `frames_done` counts written frames.
+static inline OfflineStatus offline_process_range(const OfflineConfig *cfg, int sample_rate, int channels,
+                                                  long long first_frame, long long skip_frames,
+                                                  offline_read_fn read_fn, void *read_ctx,
+                                                  offline_write_fn write_fn, void *write_ctx,
+                                                  long long *frames_done) {
+    OfflineStatus status = OFFLINE_OK;
+    DspContext *dsp = (DspContext*) calloc(channels, sizeof(DspContext));
+    float *frames = (float*) malloc((size_t)OFFLINE_CHUNK * channels * sizeof(float));
+    int ready = 0;
+
+    *frames_done = 0;
+    if (!dsp || !frames) {
+        status = OFFLINE_ERR_MEMORY;
+        goto done;
+    }
+    for (; ready < channels; ++ready) {
+        if (!dsp_init(&dsp[ready], sample_rate, cfg->n_steps, OFFLINE_CHUNK)) {
+            status = OFFLINE_ERR_MEMORY;
+            goto done;
+        }
+        if (!dsp_set_pitch_engine(&dsp[ready], cfg->engine, cfg->formant_steps)) {
+            dsp_free(&dsp[ready]);
+            status = OFFLINE_ERR_MEMORY;
+            goto done;
+        }
+        dsp_set_noise(&dsp[ready], cfg->noise_shape, cfg->noise_amplitude);
+        dsp_set_chain(&dsp[ready], &cfg->chain);
+        pitch_shifter_set_quality(&dsp[ready].shifter, cfg->quality);
+        pitch_shifter_seek(&dsp[ready].shifter, first_frame);
+    }
+
+    for (;;) {
+        sf_count_t n = read_fn(read_ctx, frames, OFFLINE_CHUNK);
+        if (n == 0) break;
+        if (n < 0) {
+            status = OFFLINE_ERR_READ;
+            break;
+        }
+
+        alloc_guard_arm();
+        dsp_process_interleaved(dsp, channels, frames, frames, (long)n);
+        alloc_guard_disarm();
+
+        sf_count_t drop = skip_frames < n ? (sf_count_t)skip_frames : n;
+        skip_frames -= drop;
+        if (n > drop && !write_fn(write_ctx, frames + drop * channels, n - drop)) {
+            status = OFFLINE_ERR_WRITE;
+            break;
+        }
+        *frames_done += n - drop;
+    }
+
+done:
+    for (int ch = 0; ch < ready; ++ch) dsp_free(&dsp[ch]);
+    free(dsp);
+    free(frames);
+    return status;
+}
+
+static inline OfflineStatus offline_process_stream(const OfflineConfig *cfg, int sample_rate, int channels,
+                                                   offline_read_fn read_fn, void *read_ctx,
+                                                   offline_write_fn write_fn, void *write_ctx,
+                                                   long long *frames_done) {
+    return offline_process_range(cfg, sample_rate, channels, 0, 0, read_fn, read_ctx,
+                                 write_fn, write_ctx, frames_done);
+}
+
+static inline sf_count_t offline_sndfile_read(void *ctx, float *frames, sf_count_t max_frames) {
+    return sf_readf_float((SNDFILE*)ctx, frames, max_frames);
+}
+
+// ------------------
+// Output encoding
+// ------------------
+// WAV outputs in float, PCM16 or PCM24 are encoded by pcmconv.h and written
+// with sf_write_raw(), skipping libsndfile's own float conversion. Other
+// containers and encodings still get float frames (dithered first when the
+// encoding is PCM16/PCM24) and let libsndfile convert them.
+
+static inline int offline_pcm_subtype(PcmFormat format) {
+    return format == PCM_FORMAT_16 ? SF_FORMAT_PCM_16 : format == PCM_FORMAT_24 ? SF_FORMAT_PCM_24 : SF_FORMAT_FLOAT;
+}
+
+// Sets info->format for `format`, keeping the container when it supports it.
+static inline void offline_output_format(SF_INFO *info, PcmFormat format) {
+    if (format != PCM_FORMAT_KEEP) info->format = (info->format & SF_FORMAT_TYPEMASK) | offline_pcm_subtype(format);
+    if (!sf_format_check(info)) info->format = SF_FORMAT_WAV | offline_pcm_subtype(format);
+}
+
+static inline bool offline_pcm_writer_init(OfflinePcmWriter *w, SNDFILE *file, const SF_INFO *info, bool dither) {
+    const int subtype = info->format & SF_FORMAT_SUBMASK;
+    PcmFormat format = subtype == SF_FORMAT_PCM_16 ? PCM_FORMAT_16 : subtype == SF_FORMAT_PCM_24 ? PCM_FORMAT_24 : PCM_FORMAT_FLOAT;
+    w->file = file;
+    w->channels = info->channels;
+    w->raw = (info->format & SF_FORMAT_TYPEMASK) == SF_FORMAT_WAV && (info->format & SF_FORMAT_ENDMASK) == 0 &&
+             subtype == offline_pcm_subtype(format);
+    pcm_encoder_init(&w->enc, format, dither, (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)w);
+    w->scratch = (float*) malloc((size_t)OFFLINE_CHUNK * w->channels * sizeof(float));
+    w->bytes = (unsigned char*) malloc((size_t)OFFLINE_CHUNK * w->channels * pcm_format_bytes(format));
+    return w->scratch && w->bytes;
+}
+
+static inline void offline_pcm_writer_free(OfflinePcmWriter *w) {
+    free(w->scratch);
+    free(w->bytes);
+    w->scratch = NULL;
+    w->bytes = NULL;
+}
+
+// offline_write_fn for an OfflinePcmWriter
+static inline bool offline_pcm_write(void *ctx, const float *frames, sf_count_t n) {
+    OfflinePcmWriter *w = (OfflinePcmWriter*)ctx;
+    while (n > 0) {
+        sf_count_t count = n < OFFLINE_CHUNK ? n : OFFLINE_CHUNK;
+        long samples = (long)count * w->channels;
+        if (w->raw) {
+            sf_count_t bytes = (sf_count_t)samples * pcm_format_bytes(w->enc.format);
+            pcm_encode(&w->enc, frames, w->scratch, w->bytes, samples);
+            if (sf_write_raw(w->file, w->bytes, bytes) != bytes) return false;
+        } else {
+            const float *out = frames;
+            if (w->enc.dither) {
+                w->enc.noise_kernel(&w->enc.rng, frames, w->scratch, samples, NOISE_TPDF, w->enc.lsb);
+                out = w->scratch;
+            }
+            if (sf_writef_float(w->file, out, count) != count) return false;
+        }
+        frames += samples;
+        n -= count;
+    }
+    return true;
+}
+
+// ------------------
+// Segmented processing
+// ------------------
+// A long file is cut into contiguous segments that are processed in parallel.
+// Each segment re-reads at least pitch_shifter_history_frames() of input
+// before its start, from an OFFLINE_CHUNK boundary, and discards the output
+// for them; together with pitch_shifter_seek() this gives its shifter exactly
+// the state a sequential run has at that frame, so the segments are simply
+// concatenated. Without noise the output is bit-identical to a sequential run;
+// the noise is random either way. Segments write raw float frames to
+// anonymous temporary files, and whichever segment finishes last copies them
+// into the output in order, so memory stays bounded as in the sequential path.
+
+typedef struct OfflineSegment {
+    OfflineJob *job;
+    long long start;   // first output frame
+    long long end;     // one past the last output frame
+    FILE *tmp;
+    OfflineStatus status;
+    char error[256];
+} OfflineSegment;
+
+typedef struct {
+    SNDFILE *file;
+    long long remaining;
+} OfflineBoundedReader;
+
+static inline sf_count_t offline_bounded_read(void *ctx, float *frames, sf_count_t max_frames) {
+    OfflineBoundedReader *reader = (OfflineBoundedReader*)ctx;
+    sf_count_t want = reader->remaining < max_frames ? (sf_count_t)reader->remaining : max_frames;
+    if (want <= 0) return 0;
+    sf_count_t n = sf_readf_float(reader->file, frames, want);
+    if (n <= 0) return -1; // the file is shorter than its header said
+    reader->remaining -= n;
+    return n;
+}
+
+static inline bool offline_segment_write(void *ctx, const float *frames, sf_count_t n) {
+    OfflineSegment *seg = (OfflineSegment*)ctx;
+    size_t count = (size_t)n * seg->job->channels;
+    return fwrite(frames, sizeof(float), count, seg->tmp) == count;
+}
+
+// Copies the segment files into the output and finishes the job.
+static inline void offline_stitch(OfflineJob *job) {
+    float *frames = (float*) malloc((size_t)OFFLINE_CHUNK * job->channels * sizeof(float));
+
+    for (int i = 0; i < job->segments && job->status == OFFLINE_OK; ++i) {
+        if (job->seg[i].status != OFFLINE_OK) {
+            job->status = job->seg[i].status;
+            memcpy(job->error, job->seg[i].error, sizeof(job->error));
+        }
+    }
+    if (job->status == OFFLINE_OK && !frames) job->status = OFFLINE_ERR_MEMORY;
+
+    for (int i = 0; i < job->segments && job->status == OFFLINE_OK; ++i) {
+        FILE *tmp = job->seg[i].tmp;
+        size_t n;
+        rewind(tmp);
+        while ((n = fread(frames, sizeof(float) * job->channels, OFFLINE_CHUNK, tmp)) > 0) {
+            if (!offline_pcm_write(&job->writer, frames, (sf_count_t)n)) {
+                job->status = OFFLINE_ERR_WRITE;
+                snprintf(job->error, sizeof(job->error), "%s", sf_strerror(job->out));
+                break;
+            }
+            job->frames += (long long)n;
+        }
+        if (job->status == OFFLINE_OK && ferror(tmp)) {
+            job->status = OFFLINE_ERR_READ;
+            snprintf(job->error, sizeof(job->error), "temporary file: %s", strerror(errno));
+        }
+    }
+
+    for (int i = 0; i < job->segments; ++i) {
+        if (job->seg[i].tmp) fclose(job->seg[i].tmp);
+    }
+    free(frames);
+    free(job->seg);
+    job->seg = NULL;
+    offline_pcm_writer_free(&job->writer);
+    sf_close(job->out);
+    job->out = NULL;
+    job->seconds = offline_now() - job->start;
+}
+
+static inline void offline_run_segment(void *arg) {
+    OfflineSegment *seg = (OfflineSegment*)arg;
+    OfflineJob *job = seg->job;
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+
+    SNDFILE *in = sf_open(job->in_path, SFM_READ, &info);
+    if (!in) {
+        seg->status = OFFLINE_ERR_OPEN_INPUT;
+        snprintf(seg->error, sizeof(seg->error), "%s", sf_strerror(NULL));
+    } else {
+        // Chunk-aligned, so the shifter sees the same block boundaries as a sequential run.
+        long long warm = seg->start - pitch_shifter_history_frames(job->sample_rate);
+        warm = warm > 0 ? warm / OFFLINE_CHUNK * OFFLINE_CHUNK : 0;
+        OfflineBoundedReader reader = { in, seg->end - warm };
+        long long frames = 0;
+
+        if (sf_seek(in, warm, SEEK_SET) < 0) {
+            seg->status = OFFLINE_ERR_READ;
+        } else {
+            seg->status = offline_process_range(job->config, job->sample_rate, job->channels, warm,
+                                                seg->start - warm, offline_bounded_read, &reader,
+                                                offline_segment_write, seg, &frames);
+        }
+        if (seg->status == OFFLINE_ERR_READ) snprintf(seg->error, sizeof(seg->error), "%s", sf_strerror(in));
+        if (seg->status == OFFLINE_ERR_WRITE) snprintf(seg->error, sizeof(seg->error), "temporary file: %s", strerror(errno));
+        if (seg->status == OFFLINE_OK && fflush(seg->tmp) != 0) {
+            seg->status = OFFLINE_ERR_WRITE;
+            snprintf(seg->error, sizeof(seg->error), "temporary file: %s", strerror(errno));
+        }
+        sf_close(in);
+    }
+
+    if (atomic_fetch_sub(&job->segments_left, 1) == 1) offline_stitch(job);
+}
+
+// Number of segments for `frames` frames; 1 means sequential.
+static inline int offline_segment_count(const OfflineJob *job, const SF_INFO *info) {
+    if (!job->pool || job->config->segment_seconds <= 0.0 || !info->seekable ||
+        job->config->engine != PITCH_ENGINE_GRANULAR || !dsp_chain_seekable(&job->config->chain)) return 1;
+    long long min_frames = (long long)(job->config->segment_seconds * info->samplerate);
+    if (min_frames < 1) min_frames = 1;
+    long long n = info->frames / min_frames;
+    long long cap = (long long)job->pool->num_threads * OFFLINE_SEGMENTS_PER_WORKER;
+    if (n > cap) n = cap;
+    return n < 2 ? 1 : (int)n;
+}
+
+// Sets up the segments and submits them. Returns false if nothing was started,
+// with job->status describing why.
+static inline bool offline_start_segments(OfflineJob *job, long long total_frames) {
+    job->seg = (OfflineSegment*) calloc(job->segments, sizeof(OfflineSegment));
+    if (!job->seg) {
+        job->status = OFFLINE_ERR_MEMORY;
+        return false;
+    }
+    for (int i = 0; i < job->segments; ++i) {
+        OfflineSegment *seg = &job->seg[i];
+        seg->job = job;
+        // Boundaries on OFFLINE_CHUNK multiples keep every read the same as in a sequential run.
+        seg->start = total_frames * i / job->segments / OFFLINE_CHUNK * OFFLINE_CHUNK;
+        seg->end = i + 1 == job->segments ? total_frames
+                 : total_frames * (i + 1) / job->segments / OFFLINE_CHUNK * OFFLINE_CHUNK;
+        seg->tmp = tmpfile();
+        if (!seg->tmp) {
+            job->status = OFFLINE_ERR_OPEN_OUTPUT;
+            snprintf(job->error, sizeof(job->error), "temporary file: %s", strerror(errno));
+            for (int j = 0; j < i; ++j) fclose(job->seg[j].tmp);
+            free(job->seg);
+            job->seg = NULL;
+            return false;
+        }
+    }
+
+    atomic_store(&job->segments_left, job->segments);
+    for (int i = 0; i < job->segments; ++i) {
+        if (!threadpool_submit(job->pool, offline_run_segment, &job->seg[i])) offline_run_segment(&job->seg[i]);
+    }
+    return true;
+}
+
+// ------------------
+// Memory-mapped WAV
+// ------------------
+// The same chain, warm-up and segment boundaries as above, but between
+// mappings: float input is read in place and float output written in place,
+// other sample formats are converted chunk by chunk through one float buffer
+// (PCM16/PCM24 output by the pcmconv.h kernels, dithered if configured).
+// The output file already has its final size, so segments write their own
+// frame ranges directly and no temporary files or stitching are needed.
+
+static inline OfflineStatus offline_process_mapped(const OfflineConfig *cfg, const WavMap *in, WavMap *out,
+                                                   long long start, long long end, long long *frames_done) {
+    const int channels = in->channels;
+    OfflineStatus status = OFFLINE_OK;
+    DspContext *dsp = (DspContext*) calloc(channels, sizeof(DspContext));
+    float *scratch = (float*) malloc((size_t)OFFLINE_CHUNK * channels * sizeof(float));
+    int ready = 0;
+    PcmEncoder enc;
+    const PcmFormat encoding = out->format == WAV_PCM16 ? PCM_FORMAT_16 : out->format == WAV_PCM24 ? PCM_FORMAT_24 : PCM_FORMAT_KEEP;
+    if (encoding != PCM_FORMAT_KEEP) pcm_encoder_init(&enc, encoding, cfg->dither, (uint64_t)time(NULL) ^ (uint64_t)start);
+
+    // Chunk-aligned, as in offline_run_segment()
+    long long warm = start - pitch_shifter_history_frames(in->sample_rate);
+    warm = start > 0 && warm > 0 ? warm / OFFLINE_CHUNK * OFFLINE_CHUNK : 0;
+    *frames_done = 0;
+    if (!dsp || !scratch) {
+        status = OFFLINE_ERR_MEMORY;
+        goto done;
+    }
+    for (; ready < channels; ++ready) {
+        if (!dsp_init(&dsp[ready], in->sample_rate, cfg->n_steps, OFFLINE_CHUNK)) {
+            status = OFFLINE_ERR_MEMORY;
+            goto done;
+        }
+        if (!dsp_set_pitch_engine(&dsp[ready], cfg->engine, cfg->formant_steps)) {
+            dsp_free(&dsp[ready]);
+            status = OFFLINE_ERR_MEMORY;
+            goto done;
+        }
+        dsp_set_noise(&dsp[ready], cfg->noise_shape, cfg->noise_amplitude);
+        dsp_set_chain(&dsp[ready], &cfg->chain);
+        pitch_shifter_set_quality(&dsp[ready].shifter, cfg->quality);
+        pitch_shifter_seek(&dsp[ready].shifter, warm);
+    }
+    if (end > start) wavmap_willneed(in, warm, end - warm);
+
+    for (long long pos = warm; pos < end; pos += OFFLINE_CHUNK) {
+        long n = end - pos < OFFLINE_CHUNK ? (long)(end - pos) : OFFLINE_CHUNK;
+        const float *src = scratch;
+        float *dst = scratch;
+        if (wavmap_is_float(in)) src = wavmap_frames(in, pos);
+        else wavmap_read_float(in, pos, n, scratch);
+        // Warm-up chunks end at `start` (both are chunk multiples) and are discarded.
+        if (pos >= start && wavmap_is_float(out)) dst = wavmap_frames(out, pos);
+
+        alloc_guard_arm();
+        dsp_process_interleaved(dsp, channels, src, dst, n);
+        alloc_guard_disarm();
+
+        if (pos < start) continue;
+        if (dst == scratch && encoding != PCM_FORMAT_KEEP) {
+            pcm_encode(&enc, scratch, scratch, (unsigned char*)wavmap_frames(out, pos), n * channels);
+        } else if (dst == scratch) {
+            wavmap_write_float(out, pos, scratch, n);
+        }
+        *frames_done += n;
+    }
+
+done:
+    for (int ch = 0; ch < ready; ++ch) dsp_free(&dsp[ch]);
+    free(dsp);
+    free(scratch);
+    return status;
+}
+
+static inline void offline_finish_mapped(OfflineJob *job) {
+    for (int i = 0; i < job->segments; ++i) {
+        if (job->status == OFFLINE_OK) job->status = job->seg[i].status;
+    }
+    if (job->status == OFFLINE_OK && msync(job->out_map.base, job->out_map.size, MS_ASYNC) != 0) {
+        job->status = OFFLINE_ERR_WRITE;
+        snprintf(job->error, sizeof(job->error), "%s: %s", job->out_path, strerror(errno));
+    }
+    free(job->seg);
+    job->seg = NULL;
+    wavmap_close(&job->in_map);
+    wavmap_close(&job->out_map);
+    job->seconds = offline_now() - job->start;
+}
+
+static inline void offline_run_mapped_segment(void *arg) {
+    OfflineSegment *seg = (OfflineSegment*)arg;
+    OfflineJob *job = seg->job;
+    long long frames = 0;
+    seg->status = offline_process_mapped(job->config, &job->in_map, &job->out_map, seg->start, seg->end, &frames);
+    atomic_fetch_add(&job->frames_mapped, frames);
+    if (atomic_fetch_sub(&job->segments_left, 1) == 1) {
+        job->frames = atomic_load(&job->frames_mapped);
+        offline_finish_mapped(job);
+    }
+}
+
+// Takes the job if its input is a WAV file wavmap.h handles. Returns false,
+// without touching the output, when libsndfile has to do it instead.
+static inline bool offline_run_mapped(OfflineJob *job) {
+    SF_INFO info;
+    if (!wavmap_open(&job->in_map, job->in_path, job->error, sizeof(job->error))) {
+        job->error[0] = '\0'; // libsndfile gets its turn and reports its own error
+        return false;
+    }
+    job->mapped = true;
+    job->sample_rate = job->in_map.sample_rate;
+    job->channels = job->in_map.channels;
+    const PcmFormat format = job->config->output_format;
+    const WavSampleFormat out_format = format == PCM_FORMAT_16 ? WAV_PCM16 : format == PCM_FORMAT_24 ? WAV_PCM24 :
+                                       format == PCM_FORMAT_FLOAT ? WAV_FLOAT : job->in_map.format;
+    if (!wavmap_create(&job->out_map, job->out_path, job->sample_rate, job->channels, out_format,
+                       job->in_map.frames, job->error, sizeof(job->error))) {
+        job->status = OFFLINE_ERR_OPEN_OUTPUT;
+        wavmap_close(&job->in_map);
+        job->seconds = offline_now() - job->start;
+        return true;
+    }
+
+    memset(&info, 0, sizeof(info));
+    info.frames = job->in_map.frames;
+    info.samplerate = job->sample_rate;
+    info.channels = job->channels;
+    info.seekable = 1;
+    job->segments = offline_segment_count(job, &info);
+    job->seg = (OfflineSegment*) calloc(job->segments, sizeof(OfflineSegment));
+    if (!job->seg) {
+        job->status = OFFLINE_ERR_MEMORY;
+        job->segments = 0;
+        offline_finish_mapped(job);
+        return true;
+    }
+    for (int i = 0; i < job->segments; ++i) {
+        OfflineSegment *seg = &job->seg[i];
+        seg->job = job;
+        seg->start = info.frames * i / job->segments / OFFLINE_CHUNK * OFFLINE_CHUNK;
+        seg->end = i + 1 == job->segments ? info.frames
+                 : info.frames * (i + 1) / job->segments / OFFLINE_CHUNK * OFFLINE_CHUNK;
+    }
+    atomic_store(&job->frames_mapped, 0);
+    atomic_store(&job->segments_left, job->segments);
+    if (job->segments == 1) {
+        offline_run_mapped_segment(&job->seg[0]);
+        return true;
+    }
+    for (int i = 0; i < job->segments; ++i) {
+        if (!threadpool_submit(job->pool, offline_run_mapped_segment, &job->seg[i])) offline_run_mapped_segment(&job->seg[i]);
+    }
+    return true;
+}
+
+// Processes one file. Safe to call concurrently for different jobs. With a
+// pool, a long file may still be in progress when this returns; the job is
+// complete once threadpool_wait() returns.
+static inline void offline_run_job(void *arg) {
+    OfflineJob *job = (OfflineJob*)arg;
+    SF_INFO in_info, out_info;
+    SNDFILE *in = NULL, *out = NULL;
+
+    job->start = offline_now();
+    job->segments = 1;
+    if (offline_same_file(job->in_path, job->out_path)) {
+        // Opening the output truncates it before a single input frame is read.
+        job->status = OFFLINE_ERR_OPEN_OUTPUT;
+        snprintf(job->error, sizeof(job->error), "%s is the input file", job->out_path);
+        job->seconds = offline_now() - job->start;
+        return;
+    }
+    if (offline_run_mapped(job)) return;
+    memset(&in_info, 0, sizeof(in_info));
+    in = sf_open(job->in_path, SFM_READ, &in_info);
+    if (!in) {
+        job->status = OFFLINE_ERR_OPEN_INPUT;
+        snprintf(job->error, sizeof(job->error), "%s", sf_strerror(NULL));
+        goto done;
+    }
+    job->sample_rate = in_info.samplerate;
+    job->channels = in_info.channels;
+
+    out_info = in_info;
+    out_info.frames = 0;
+    offline_output_format(&out_info, job->config->output_format);
+    out = sf_open(job->out_path, SFM_WRITE, &out_info);
+    if (!out) {
+        job->status = OFFLINE_ERR_OPEN_OUTPUT;
+        snprintf(job->error, sizeof(job->error), "%s", sf_strerror(NULL));
+        goto done;
+    }
+    if (!offline_pcm_writer_init(&job->writer, out, &out_info, job->config->dither)) {
+        job->status = OFFLINE_ERR_MEMORY;
+        goto done;
+    }
+
+    job->segments = offline_segment_count(job, &in_info);
+    if (job->segments > 1) {
+        sf_close(in);
+        job->out = out;
+        if (offline_start_segments(job, in_info.frames)) return;
+        job->out = NULL;
+        in = NULL;
+        goto done;
+    }
+
+    job->status = offline_process_stream(job->config, in_info.samplerate, in_info.channels,
+                                         offline_sndfile_read, in, offline_pcm_write, &job->writer,
+                                         &job->frames);
+    if (job->status == OFFLINE_ERR_READ) snprintf(job->error, sizeof(job->error), "%s", sf_strerror(in));
+    if (job->status == OFFLINE_ERR_WRITE) snprintf(job->error, sizeof(job->error), "%s", sf_strerror(out));
+
+done:
+    offline_pcm_writer_free(&job->writer);
+    if (out) sf_close(out);
+    if (in) sf_close(in);
+    job->seconds = offline_now() - job->start;
+}
+
+#endif // OFFLINE_H
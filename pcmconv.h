@@ -0,0 +1,212 @@
+#ifndef PCMCONV_H
+#define PCMCONV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "noise.h"
+
+// ==================
+// Output Sample Formats
+// ==================
+// Converts processed float samples to the little-endian bytes of a 16-bit,
+// 24-bit or float WAV data chunk, so writers can hand finished bytes to the
+// file instead of going through libsndfile's conversion. Samples are scaled
+// by 0x7FFF / 0x7FFFFF like libsndfile, rounded to nearest and saturated; the
+// AVX2, SSSE3/SSE2 and scalar kernels give identical bytes, and
+// pcm_encoder_init() picks the widest one the CPU supports.
+//
+// Optional TPDF dither runs the noise stage (noise.h) once more with
+// NOISE_TPDF and a half-width of one output LSB before quantizing, which
+// turns the truncation distortion of quiet passages into a constant noise
+// floor. The anonymizing noise of the DSP chain is far above that floor, so
+// dither is mostly useful for PCM16 at low NOISE_AMPLITUDE.
+
+typedef enum {
+    PCM_FORMAT_KEEP,  // writer's default: the input's encoding in batch mode, float in record mode
+    PCM_FORMAT_FLOAT,
+    PCM_FORMAT_16,
+    PCM_FORMAT_24
+} PcmFormat;
+
+typedef void (*pcm_convert_fn)(const float *in, unsigned char *out, long n);
+
+typedef struct {
+    PcmFormat format;
+    bool dither;
+    float lsb;                    // dither half-width
+    NoiseRng rng;
+    noise_kernel_fn noise_kernel;
+    pcm_convert_fn convert;
+    const char *kernel_name;
+} PcmEncoder;
+
+// Returns false for an unknown name.
+static inline bool pcm_format_from_name(const char *name, PcmFormat *format) {
+    if (strcmp(name, "keep") == 0) *format = PCM_FORMAT_KEEP;
+    else if (strcmp(name, "float") == 0) *format = PCM_FORMAT_FLOAT;
+    else if (strcmp(name, "pcm16") == 0) *format = PCM_FORMAT_16;
+    else if (strcmp(name, "pcm24") == 0) *format = PCM_FORMAT_24;
+    else return false;
+    return true;
+}
+
+static inline const char *pcm_format_name(PcmFormat format) {
+    return format == PCM_FORMAT_16 ? "pcm16" : format == PCM_FORMAT_24 ? "pcm24" :
+           format == PCM_FORMAT_FLOAT ? "float" : "keep";
+}
+
+static inline int pcm_format_bytes(PcmFormat format) {
+    return format == PCM_FORMAT_16 ? 2 : format == PCM_FORMAT_24 ? 3 : 4;
+}
+
+// ------------------
+// Scalar
+// ------------------
+static void pcm_float_copy(const float *in, unsigned char *out, long n) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(out, in, (size_t)n * sizeof(float));
+#else
+    for (long i = 0; i < n; ++i) {
+        uint32_t bits;
+        memcpy(&bits, &in[i], sizeof(bits));
+        out[4 * i] = (unsigned char)bits;
+        out[4 * i + 1] = (unsigned char)(bits >> 8);
+        out[4 * i + 2] = (unsigned char)(bits >> 16);
+        out[4 * i + 3] = (unsigned char)(bits >> 24);
+    }
+#endif
+}
+
+static void pcm_s16_scalar(const float *in, unsigned char *out, long n) {
+    for (long i = 0; i < n; ++i) {
+        float v = in[i] * 32767.0f;
+        v = v < -32768.0f ? -32768.0f : v > 32767.0f ? 32767.0f : v;
+        int32_t s = (int32_t)lrintf(v);
+        out[2 * i] = (unsigned char)s;
+        out[2 * i + 1] = (unsigned char)(s >> 8);
+    }
+}
+
+static void pcm_s24_scalar(const float *in, unsigned char *out, long n) {
+    for (long i = 0; i < n; ++i) {
+        float v = in[i] * 8388607.0f;
+        v = v < -8388608.0f ? -8388608.0f : v > 8388607.0f ? 8388607.0f : v;
+        int32_t s = (int32_t)lrintf(v);
+        out[3 * i] = (unsigned char)s;
+        out[3 * i + 1] = (unsigned char)(s >> 8);
+        out[3 * i + 2] = (unsigned char)(s >> 16);
+    }
+}
+
+#ifdef NOISE_X86
+// ------------------
+// SSE2 / SSSE3
+// ------------------
+// cvtps rounds to nearest even under the default MXCSR, like lrintf().
+__attribute__((target("sse2")))
+static void pcm_s16_sse2(const float *in, unsigned char *out, long n) {
+    const __m128 scale = _mm_set1_ps(32767.0f), lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+    long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), lo), hi);
+        _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+    pcm_s16_scalar(in + i, out + 2 * i, n - i);
+}
+
+// Packs the low three bytes of four int32 into 12 bytes; the 16-byte store
+// spills four bytes that the next iteration (or the scalar tail) overwrites.
+__attribute__((target("ssse3")))
+static void pcm_s24_ssse3(const float *in, unsigned char *out, long n) {
+    const __m128 scale = _mm_set1_ps(8388607.0f), lo = _mm_set1_ps(-8388608.0f), hi = _mm_set1_ps(8388607.0f);
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    long i = 0;
+    for (; i + 6 <= n; i += 4) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), lo), hi);
+        _mm_storeu_si128((__m128i*)(out + 3 * i), _mm_shuffle_epi8(_mm_cvtps_epi32(v), pack));
+    }
+    pcm_s24_scalar(in + i, out + 3 * i, n - i);
+}
+
+// ------------------
+// AVX2
+// ------------------
+__attribute__((target("avx2")))
+static void pcm_s16_avx2(const float *in, unsigned char *out, long n) {
+    const __m256 scale = _mm256_set1_ps(32767.0f), lo = _mm256_set1_ps(-32768.0f), hi = _mm256_set1_ps(32767.0f);
+    long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), lo), hi);
+        __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), lo), hi);
+        // packs works per 128-bit lane; the permute puts the quarters back in order.
+        __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+        _mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    pcm_s16_sse2(in + i, out + 2 * i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void pcm_s24_avx2(const float *in, unsigned char *out, long n) {
+    const __m256 scale = _mm256_set1_ps(8388607.0f), lo = _mm256_set1_ps(-8388608.0f), hi = _mm256_set1_ps(8388607.0f);
+    const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                          0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    long i = 0;
+    for (; i + 10 <= n; i += 8) {
+        __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), lo), hi);
+        __m256i packed = _mm256_shuffle_epi8(_mm256_cvtps_epi32(v), pack);
+        _mm_storeu_si128((__m128i*)(out + 3 * i), _mm256_castsi256_si128(packed));
+        _mm_storeu_si128((__m128i*)(out + 3 * i + 12), _mm256_extracti128_si256(packed, 1));
+    }
+    pcm_s24_ssse3(in + i, out + 3 * i, n - i);
+}
+#endif // NOISE_X86
+
+// Picks the widest kernel for `format` the running CPU supports.
+static inline pcm_convert_fn pcm_select_kernel(PcmFormat format, const char **name) {
+    if (format != PCM_FORMAT_16 && format != PCM_FORMAT_24) {
+        if (name) *name = "copy";
+        return pcm_float_copy;
+    }
+#ifdef NOISE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        if (name) *name = "avx2";
+        return format == PCM_FORMAT_16 ? pcm_s16_avx2 : pcm_s24_avx2;
+    }
+    if (format == PCM_FORMAT_16 && __builtin_cpu_supports("sse2")) {
+        if (name) *name = "sse2";
+        return pcm_s16_sse2;
+    }
+    if (format == PCM_FORMAT_24 && __builtin_cpu_supports("ssse3")) {
+        if (name) *name = "ssse3";
+        return pcm_s24_ssse3;
+    }
+#endif
+    if (name) *name = "scalar";
+    return format == PCM_FORMAT_16 ? pcm_s16_scalar : pcm_s24_scalar;
+}
+
+// `format` must not be PCM_FORMAT_KEEP; dither only applies to PCM16/PCM24.
+static inline void pcm_encoder_init(PcmEncoder *enc, PcmFormat format, bool dither, uint64_t seed) {
+    enc->format = format;
+    enc->dither = dither && (format == PCM_FORMAT_16 || format == PCM_FORMAT_24);
+    enc->lsb = format == PCM_FORMAT_16 ? 1.0f / 32767.0f : 1.0f / 8388607.0f;
+    noise_rng_seed(&enc->rng, seed);
+    enc->noise_kernel = noise_select_kernel(NULL);
+    enc->convert = pcm_select_kernel(format, &enc->kernel_name);
+}
+
+// Encodes `n` samples into `out` (n * pcm_format_bytes() bytes). With dither,
+// `scratch` (n floats, may be `in` itself) receives the dithered samples.
+static inline void pcm_encode(PcmEncoder *enc, const float *in, float *scratch, unsigned char *out, long n) {
+    if (enc->dither) {
+        enc->noise_kernel(&enc->rng, in, scratch, n, NOISE_TPDF, enc->lsb);
+        in = scratch;
+    }
+    enc->convert(in, out, n);
+}
+
+#endif // PCMCONV_H
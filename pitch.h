@@ -0,0 +1,212 @@
+#ifndef PITCH_H
+#define PITCH_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "resample.h"
+
+// ==================
+// Streaming Pitch Shifter
+// ==================
+// Delay-line overlap-add pitch shifter. Two read taps sweep through a history
+// buffer at `ratio` times the input rate, half a grain apart, and are
+// crossfaded with complementary Hann gains so each tap is silent at the moment
+// it jumps back. All state (history, write position, grain phase) lives in the
+// object, so consecutive blocks join seamlessly and every call produces exactly
+// as many output frames as it consumes.
+//
+// Between two jumps a tap is a constant-step read, so each one is rendered
+// with the fractional resampler (resample.h). The history is stored twice in a
+// row (mirrored) so any read window is contiguous memory.
+//
+// The taps sit between PITCH_TAP_MARGIN and PITCH_TAP_MARGIN + one grain
+// behind the input, so the algorithmic latency is half a grain plus the margin
+// (see pitch_shifter_latency()).
+
+#define PITCH_GRAIN_SECONDS 0.04
+#define PITCH_CHUNK         256              // frames rendered per inner pass
+#define PITCH_TAP_MARGIN    RESAMPLE_AFTER   // keeps interpolation support in the past
+
+typedef struct {
+    float *history;    // 2 * size floats, history[i] == history[i + size]
+    size_t size;       // power of two
+    size_t mask;
+    size_t write_pos;  // total frames consumed so far
+    double ratio;      // output/input frequency ratio, 2^(steps/12)
+    double grain;      // grain length in frames
+    double phase;      // grain phase of tap A in [0, 1); tap B is half a grain away
+    double phase_inc;  // per-frame phase advance, (1 - ratio) / grain
+    Resampler resampler;
+    float *tap_a;      // PITCH_CHUNK scratch
+    float *tap_b;
+    float *gain_a;
+} PitchShifter;
+
+static inline bool pitch_shifter_init(PitchShifter *ps, int sample_rate, int n_steps) {
+    memset(ps, 0, sizeof(*ps));
+    ps->grain = floor(sample_rate * PITCH_GRAIN_SECONDS);
+    ps->ratio = pow(2.0, (double)n_steps / 12.0);
+    ps->phase = 0.0;
+    ps->phase_inc = (1.0 - ps->ratio) / ps->grain;
+
+    // Oldest read: grain + margin + interpolation support before the chunk start.
+    size_t needed = (size_t)ps->grain + PITCH_CHUNK + PITCH_TAP_MARGIN + RESAMPLE_BEFORE + RESAMPLE_AFTER + 2;
+    ps->size = 2;
+    while (ps->size < needed) ps->size <<= 1;
+    ps->mask = ps->size - 1;
+
+    ps->history = (float*) calloc(2 * ps->size, sizeof(float));
+    ps->tap_a = (float*) calloc(PITCH_CHUNK, sizeof(float));
+    ps->tap_b = (float*) calloc(PITCH_CHUNK, sizeof(float));
+    ps->gain_a = (float*) calloc(PITCH_CHUNK, sizeof(float));
+    if (!ps->history || !ps->tap_a || !ps->tap_b || !ps->gain_a ||
+        !resampler_init(&ps->resampler, RESAMPLE_LINEAR, ps->ratio)) {
+        free(ps->history);
+        free(ps->tap_a);
+        free(ps->tap_b);
+        free(ps->gain_a);
+        ps->history = NULL;
+        return false;
+    }
+    return true;
+}
+
+static inline void pitch_shifter_free(PitchShifter *ps) {
+    if (!ps->history) return;
+    resampler_free(&ps->resampler);
+    free(ps->history);
+    free(ps->tap_a);
+    free(ps->tap_b);
+    free(ps->gain_a);
+    ps->history = NULL;
+}
+
+// Interpolation quality can be changed between calls; no reallocation.
+static inline void pitch_shifter_set_quality(PitchShifter *ps, ResampleQuality quality) {
+    ps->resampler.quality = quality;
+}
+
+// Fixed delay introduced by the shifter, in frames.
+static inline long pitch_shifter_latency(const PitchShifter *ps) {
+    return (long)(ps->grain / 2.0) + PITCH_TAP_MARGIN;
+}
+
+// Input frames the taps of a shifter at `sample_rate` can still read behind
+// the write position. Feeding this many frames after pitch_shifter_seek()
+// leaves the shifter in the same state as a run that started at frame 0.
+static inline long pitch_shifter_history_frames(int sample_rate) {
+    return (long)floor(sample_rate * PITCH_GRAIN_SECONDS) + PITCH_TAP_MARGIN + RESAMPLE_BEFORE + 1;
+}
+
+// Number of frames, starting now, before a tap at `phase` wraps around.
+static inline long pitch_run_length(double phase, double inc, long limit) {
+    double run;
+    if (inc > 0.0) run = ceil((1.0 - phase) / inc);
+    else if (inc < 0.0) run = floor(phase / -inc) + 1.0;
+    else return limit;
+    if (run < 1.0) run = 1.0;
+    return run < (double)limit ? (long)run : limit;
+}
+
+static inline double pitch_wrap(double phase) {
+    while (phase >= 1.0) phase -= 1.0;
+    while (phase < 0.0) phase += 1.0;
+    return phase;
+}
+
+// Positions a freshly initialized shifter at absolute input frame `frame`:
+// the write position and grain phase a run from frame 0 would have there. The
+// phase is accumulated chunk by chunk exactly as pitch_shifter_process() does,
+// so it is bit-identical whenever that run used blocks that are multiples of
+// PITCH_CHUNK.
+static inline void pitch_shifter_seek(PitchShifter *ps, long long frame) {
+    long long f = 0;
+    ps->write_pos = (size_t)frame;
+    ps->phase = 0.0;
+    for (; f + PITCH_CHUNK <= frame; f += PITCH_CHUNK) ps->phase = pitch_wrap(ps->phase + PITCH_CHUNK * ps->phase_inc);
+    if (f < frame) ps->phase = pitch_wrap(ps->phase + (frame - f) * ps->phase_inc);
+}
+
+// Renders one tap for frames [0, n) of the current chunk. `chunk_start` is the
+// absolute index of the chunk's first frame. Optionally writes the Hann gain
+// of the tap for each frame.
+static inline void pitch_render_tap(PitchShifter *ps, size_t chunk_start, double phase,
+                                    float *out, float *gain, long n) {
+    long done = 0;
+    while (done < n) {
+        long run = pitch_run_length(phase, ps->phase_inc, n - done);
+
+        // Absolute read position of the first frame of this run.
+        double pos = (double)(chunk_start + done) - PITCH_TAP_MARGIN - phase * ps->grain;
+        double whole = floor(pos);
+        size_t start = ((size_t)(long long)whole - RESAMPLE_BEFORE) & ps->mask;
+        resample_interior(&ps->resampler, ps->history + start, RESAMPLE_BEFORE + (pos - whole),
+                          ps->ratio, out + done, run);
+
+        if (gain) {
+            // sin^2(pi * phase) = cos^2(pi * (phase - 0.5)), with a short even polynomial for cos.
+            for (long k = 0; k < run; ++k) {
+                float x = (float)M_PI * ((float)(phase + k * ps->phase_inc) - 0.5f);
+                float x2 = x * x;
+                float c = 1.0f + x2 * (-0.5f + x2 * (1.0f / 24.0f + x2 * (-1.0f / 720.0f + x2 * (1.0f / 40320.0f))));
+                gain[done + k] = c * c;
+            }
+        }
+
+        done += run;
+        phase = pitch_wrap(phase + run * ps->phase_inc);
+    }
+}
+
+// Appends the `c` <= PITCH_CHUNK frames of `in` to both copies of the history.
+static inline void pitch_shifter_write(PitchShifter *ps, const float *in, long c) {
+    size_t w = ps->write_pos & ps->mask;
+    size_t first = ps->size - w;
+    if (first > (size_t)c) first = (size_t)c;
+    memcpy(ps->history + w, in, first * sizeof(float));
+    memcpy(ps->history + w + ps->size, in, first * sizeof(float));
+    memcpy(ps->history, in + first, (c - first) * sizeof(float));
+    memcpy(ps->history + ps->size, in + first, (c - first) * sizeof(float));
+}
+
+// Appends the `c` <= PITCH_CHUNK frames of `in` to the history and renders
+// both taps and tap A's gain for them into tap_a, tap_b and gain_a. The output
+// is tap_b + gain_a * (tap_a - tap_b); mix it, then call
+// pitch_shifter_advance().
+static inline void pitch_shifter_render_chunk(PitchShifter *ps, const float *in, long c) {
+    pitch_shifter_write(ps, in, c);
+    pitch_render_tap(ps, ps->write_pos, ps->phase, ps->tap_a, ps->gain_a, c);
+    pitch_render_tap(ps, ps->write_pos, pitch_wrap(ps->phase + 0.5), ps->tap_b, NULL, c);
+}
+
+static inline void pitch_shifter_advance(PitchShifter *ps, long c) {
+    ps->write_pos += c;
+    ps->phase = pitch_wrap(ps->phase + c * ps->phase_inc);
+}
+
+// Takes `n` frames into the history without rendering them, for blocks whose
+// output is not needed. The shifter ends up exactly where
+// pitch_shifter_process() would have left it.
+static inline void pitch_shifter_skip(PitchShifter *ps, const float *in, long n) {
+    for (long off = 0; off < n; off += PITCH_CHUNK) {
+        long c = (n - off < PITCH_CHUNK) ? n - off : PITCH_CHUNK;
+        pitch_shifter_write(ps, in + off, c);
+        pitch_shifter_advance(ps, c);
+    }
+}
+
+// Shifts `n` frames from `in` into `out`. `in` and `out` may be the same buffer.
+static inline void pitch_shifter_process(PitchShifter *ps, const float *in, float *out, long n) {
+    for (long off = 0; off < n; off += PITCH_CHUNK) {
+        long c = (n - off < PITCH_CHUNK) ? n - off : PITCH_CHUNK;
+        pitch_shifter_render_chunk(ps, in + off, c);
+        for (long k = 0; k < c; ++k) {
+            out[off + k] = ps->tap_b[k] + ps->gain_a[k] * (ps->tap_a[k] - ps->tap_b[k]);
+        }
+        pitch_shifter_advance(ps, c);
+    }
+}
+
+#endif // PITCH_H
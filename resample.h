@@ -0,0 +1,191 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLE_X86 1
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// ==================
+// Fractional Resampler
+// ==================
+// Reads `n` output samples from `src` at positions pos, pos + step, ... with
+// linear, cubic-Hermite or 8-tap windowed-sinc interpolation. The quality is a
+// plain field and can be switched at any time without reallocation.
+//
+// resample_interior() does no bounds checks: the caller guarantees that
+// RESAMPLE_BEFORE frames before and RESAMPLE_AFTER frames after every read
+// position are valid. On AVX2 machines it computes eight outputs per step with
+// gathers; the sinc coefficients come from a precomputed phase table.
+
+#define RESAMPLE_BEFORE      3
+#define RESAMPLE_AFTER       4
+#define RESAMPLE_SINC_TAPS   8
+#define RESAMPLE_SINC_PHASES 1024
+
+typedef enum {
+    RESAMPLE_LINEAR,
+    RESAMPLE_CUBIC,
+    RESAMPLE_SINC
+} ResampleQuality;
+
+typedef struct {
+    ResampleQuality quality;
+    float *sinc_table; // (RESAMPLE_SINC_PHASES + 1) rows of RESAMPLE_SINC_TAPS coefficients
+    bool use_avx2;
+} Resampler;
+
+// `step` is the largest read step the resampler will see; above 1 the sinc
+// cutoff is lowered to avoid aliasing.
+static inline bool resampler_init(Resampler *rs, ResampleQuality quality, double step) {
+    double cutoff = step > 1.0 ? 0.95 / step : 0.95;
+    rs->quality = quality;
+    rs->sinc_table = (float*) malloc((RESAMPLE_SINC_PHASES + 1) * RESAMPLE_SINC_TAPS * sizeof(float));
+    if (!rs->sinc_table) return false;
+
+    for (int p = 0; p <= RESAMPLE_SINC_PHASES; ++p) {
+        double frac = (double)p / RESAMPLE_SINC_PHASES;
+        double sum = 0.0;
+        float *row = rs->sinc_table + p * RESAMPLE_SINC_TAPS;
+        for (int t = 0; t < RESAMPLE_SINC_TAPS; ++t) {
+            double x = (double)(t - RESAMPLE_BEFORE) - frac;
+            double s = (x == 0.0) ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            double w = 0.42 + 0.5 * cos(M_PI * x / 4.0) + 0.08 * cos(2.0 * M_PI * x / 4.0); // Blackman
+            row[t] = (float)(s * w);
+            sum += s * w;
+        }
+        for (int t = 0; t < RESAMPLE_SINC_TAPS; ++t) row[t] = (float)(row[t] / sum);
+    }
+
+#ifdef RESAMPLE_X86
+    __builtin_cpu_init();
+    rs->use_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    rs->use_avx2 = false;
+#endif
+    return true;
+}
+
+static inline void resampler_free(Resampler *rs) {
+    free(rs->sinc_table);
+    rs->sinc_table = NULL;
+}
+
+static inline const char *resample_quality_name(ResampleQuality q) {
+    return q == RESAMPLE_SINC ? "sinc" : q == RESAMPLE_CUBIC ? "cubic" : "linear";
+}
+
+// Returns false for an unknown name.
+static inline bool resample_quality_from_name(const char *name, ResampleQuality *q) {
+    if (strcmp(name, "linear") == 0) *q = RESAMPLE_LINEAR;
+    else if (strcmp(name, "cubic") == 0) *q = RESAMPLE_CUBIC;
+    else if (strcmp(name, "sinc") == 0) *q = RESAMPLE_SINC;
+    else return false;
+    return true;
+}
+
+// ------------------
+// Scalar
+// ------------------
+static inline float resample_one(const Resampler *rs, const float *src, long i, float frac) {
+    if (rs->quality == RESAMPLE_LINEAR) {
+        return src[i] + (src[i + 1] - src[i]) * frac;
+    }
+    if (rs->quality == RESAMPLE_CUBIC) {
+        float xm1 = src[i - 1], x0 = src[i], x1 = src[i + 1], x2 = src[i + 2];
+        float c1 = 0.5f * (x1 - xm1);
+        float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+        float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+        return ((c3 * frac + c2) * frac + c1) * frac + x0;
+    }
+    const float *row = rs->sinc_table + (long)(frac * RESAMPLE_SINC_PHASES + 0.5f) * RESAMPLE_SINC_TAPS;
+    const float *s = src + i - RESAMPLE_BEFORE;
+    float acc = 0.0f;
+    for (int t = 0; t < RESAMPLE_SINC_TAPS; ++t) acc += s[t] * row[t];
+    return acc;
+}
+
+static inline void resample_interior_scalar(const Resampler *rs, const float *src, double pos,
+                                            double step, float *out, long n) {
+    for (long k = 0; k < n; ++k) {
+        double p = pos + k * step;
+        long i = (long)floor(p);
+        out[k] = resample_one(rs, src, i, (float)(p - i));
+    }
+}
+
+#ifdef RESAMPLE_X86
+// ------------------
+// AVX2
+// ------------------
+__attribute__((target("avx2,fma")))
+static void resample_interior_avx2(const Resampler *rs, const float *src, double pos,
+                                   double step, float *out, long n) {
+    const __m256 lane_step = _mm256_mul_ps(_mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0), _mm256_set1_ps((float)step));
+    const __m256 phases = _mm256_set1_ps((float)RESAMPLE_SINC_PHASES);
+    long k = 0;
+    for (; k + 8 <= n; k += 8) {
+        // Integer base in double, small per-lane offsets in float.
+        double p0 = pos + k * step;
+        long base = (long)floor(p0);
+        const float *b = src + base;
+        __m256 off = _mm256_add_ps(_mm256_set1_ps((float)(p0 - base)), lane_step);
+        __m256 fl = _mm256_floor_ps(off);
+        __m256i idx = _mm256_cvtps_epi32(fl);
+        __m256 frac = _mm256_sub_ps(off, fl);
+        __m256 y;
+
+        if (rs->quality == RESAMPLE_LINEAR) {
+            __m256 x0 = _mm256_i32gather_ps(b, idx, 4);
+            __m256 x1 = _mm256_i32gather_ps(b + 1, idx, 4);
+            y = _mm256_fmadd_ps(_mm256_sub_ps(x1, x0), frac, x0);
+        } else if (rs->quality == RESAMPLE_CUBIC) {
+            __m256 xm1 = _mm256_i32gather_ps(b - 1, idx, 4);
+            __m256 x0 = _mm256_i32gather_ps(b, idx, 4);
+            __m256 x1 = _mm256_i32gather_ps(b + 1, idx, 4);
+            __m256 x2 = _mm256_i32gather_ps(b + 2, idx, 4);
+            __m256 half = _mm256_set1_ps(0.5f);
+            __m256 c1 = _mm256_mul_ps(half, _mm256_sub_ps(x1, xm1));
+            __m256 c2 = _mm256_sub_ps(_mm256_fmadd_ps(_mm256_set1_ps(2.0f), x1, xm1),
+                                      _mm256_fmadd_ps(_mm256_set1_ps(2.5f), x0, _mm256_mul_ps(half, x2)));
+            __m256 c3 = _mm256_fmadd_ps(half, _mm256_sub_ps(x2, xm1),
+                                        _mm256_mul_ps(_mm256_set1_ps(1.5f), _mm256_sub_ps(x0, x1)));
+            y = _mm256_fmadd_ps(_mm256_fmadd_ps(_mm256_fmadd_ps(c3, frac, c2), frac, c1), frac, x0);
+        } else {
+            __m256i row = _mm256_slli_epi32(
+                _mm256_cvttps_epi32(_mm256_fmadd_ps(frac, phases, _mm256_set1_ps(0.5f))), 3);
+            const float *s = b - RESAMPLE_BEFORE;
+            y = _mm256_setzero_ps();
+            for (int t = 0; t < RESAMPLE_SINC_TAPS; ++t) {
+                __m256 x = _mm256_i32gather_ps(s + t, idx, 4);
+                __m256 c = _mm256_i32gather_ps(rs->sinc_table + t, row, 4);
+                y = _mm256_fmadd_ps(x, c, y);
+            }
+        }
+        _mm256_storeu_ps(out + k, y);
+    }
+    if (k < n) resample_interior_scalar(rs, src, pos + k * step, step, out + k, n - k);
+}
+#endif // RESAMPLE_X86
+
+static inline void resample_interior(const Resampler *rs, const float *src, double pos,
+                                     double step, float *out, long n) {
+#ifdef RESAMPLE_X86
+    if (rs->use_avx2) {
+        resample_interior_avx2(rs, src, pos, step, out, n);
+        return;
+    }
+#endif
+    resample_interior_scalar(rs, src, pos, step, out, n);
+}
+
+#endif // RESAMPLE_H
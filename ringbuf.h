@@ -0,0 +1,182 @@
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// ==================
+// Lock-free SPSC Ring Buffer
+// ==================
+// One producer thread and one consumer thread. Neither side ever takes a lock,
+// so the PortAudio callback can write/read without blocking. Indices grow
+// monotonically and are masked into a power-of-two sized buffer. A full ring
+// drops the excess frames, an empty ring leaves the tail to the caller (the
+// callback fills it with silence); both are counted.
+//
+// Only the consumer may sleep, via rb_wait(). The producer wakes it through an
+// eventfd (Linux) or a non-blocking pipe (other POSIX systems), and only when
+// the consumer has announced that it is waiting.
+
+typedef struct {
+    float *buffer;
+    size_t capacity;              // power of two
+    size_t mask;
+    _Atomic size_t write_idx;     // owned by the producer
+    _Atomic size_t read_idx;      // owned by the consumer
+    atomic_bool terminate;
+    atomic_bool waiting;          // consumer is (about to be) asleep in rb_wait()
+    atomic_ulong overflow_frames; // frames dropped because the ring was full
+    atomic_ulong underflow_frames;// frames requested but not available
+    int wake_fd[2];               // [0] read end, [1] write end (same fd for eventfd)
+} RealtimeBuffer;
+
+static inline size_t rb_round_pow2(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+// Returns false on allocation / descriptor failure; the caller reports it.
+static inline bool rb_init(RealtimeBuffer *rb, size_t min_frames) {
+    rb->capacity = rb_round_pow2(min_frames < 2 ? 2 : min_frames);
+    rb->mask = rb->capacity - 1;
+    rb->buffer = (float*) calloc(rb->capacity, sizeof(float));
+    if (!rb->buffer) return false;
+    atomic_init(&rb->write_idx, 0);
+    atomic_init(&rb->read_idx, 0);
+    atomic_init(&rb->terminate, false);
+    atomic_init(&rb->waiting, false);
+    atomic_init(&rb->overflow_frames, 0);
+    atomic_init(&rb->underflow_frames, 0);
+#ifdef __linux__
+    rb->wake_fd[0] = rb->wake_fd[1] = eventfd(0, EFD_CLOEXEC);
+    if (rb->wake_fd[0] < 0) {
+        free(rb->buffer);
+        return false;
+    }
+#else
+    if (pipe(rb->wake_fd) != 0) {
+        free(rb->buffer);
+        return false;
+    }
+    fcntl(rb->wake_fd[1], F_SETFL, fcntl(rb->wake_fd[1], F_GETFL) | O_NONBLOCK);
+#endif
+    return true;
+}
+
+static inline void rb_destroy(RealtimeBuffer *rb) {
+    free(rb->buffer);
+    rb->buffer = NULL;
+    close(rb->wake_fd[0]);
+    if (rb->wake_fd[1] != rb->wake_fd[0]) close(rb->wake_fd[1]);
+}
+
+static inline size_t rb_available(RealtimeBuffer *rb) {
+    size_t w = atomic_load_explicit(&rb->write_idx, memory_order_acquire);
+    size_t r = atomic_load_explicit(&rb->read_idx, memory_order_acquire);
+    return w - r;
+}
+
+static inline size_t rb_free_space(RealtimeBuffer *rb) {
+    return rb->capacity - rb_available(rb);
+}
+
+static inline void rb_signal(RealtimeBuffer *rb) {
+    uint64_t one = 1;
+#ifdef __linux__
+    ssize_t n = write(rb->wake_fd[1], &one, sizeof(one));
+#else
+    ssize_t n = write(rb->wake_fd[1], &one, 1);
+#endif
+    (void)n; // a full pipe already holds a pending wakeup
+}
+
+// Producer side. Never blocks; returns the number of frames actually stored.
+static inline size_t rb_write(RealtimeBuffer *rb, const float *data, size_t frames) {
+    size_t w = atomic_load_explicit(&rb->write_idx, memory_order_relaxed);
+    size_t r = atomic_load_explicit(&rb->read_idx, memory_order_acquire);
+    size_t space = rb->capacity - (w - r);
+
+    if (frames > space) {
+        atomic_fetch_add_explicit(&rb->overflow_frames, frames - space, memory_order_relaxed);
+        frames = space;
+    }
+
+    size_t start = w & rb->mask;
+    size_t first = rb->capacity - start;
+    if (first > frames) first = frames;
+    memcpy(rb->buffer + start, data, first * sizeof(float));
+    memcpy(rb->buffer, data + first, (frames - first) * sizeof(float));
+
+    atomic_store_explicit(&rb->write_idx, w + frames, memory_order_seq_cst);
+    if (atomic_load_explicit(&rb->waiting, memory_order_seq_cst) &&
+        atomic_exchange_explicit(&rb->waiting, false, memory_order_acq_rel)) {
+        rb_signal(rb);
+    }
+    return frames;
+}
+
+// Producer side for interleaved audio: stores all `frames` or, if they do not
+// fit, none of them (counted as overflow), so a full ring never splits a frame
+// across channels.
+static inline bool rb_write_all(RealtimeBuffer *rb, const float *data, size_t frames) {
+    if (rb_free_space(rb) < frames) {
+        atomic_fetch_add_explicit(&rb->overflow_frames, frames, memory_order_relaxed);
+        return false;
+    }
+    rb_write(rb, data, frames);
+    return true;
+}
+
+// Consumer side. Never blocks; returns the number of frames actually read.
+// Missing frames are counted as underflow and left for the caller to fill.
+static inline size_t rb_read(RealtimeBuffer *rb, float *data, size_t frames) {
+    size_t r = atomic_load_explicit(&rb->read_idx, memory_order_relaxed);
+    size_t w = atomic_load_explicit(&rb->write_idx, memory_order_acquire);
+    size_t avail = w - r;
+
+    if (frames > avail) {
+        atomic_fetch_add_explicit(&rb->underflow_frames, frames - avail, memory_order_relaxed);
+        frames = avail;
+    }
+
+    size_t start = r & rb->mask;
+    size_t first = rb->capacity - start;
+    if (first > frames) first = frames;
+    memcpy(data, rb->buffer + start, first * sizeof(float));
+    memcpy(data + first, rb->buffer, (frames - first) * sizeof(float));
+
+    atomic_store_explicit(&rb->read_idx, r + frames, memory_order_release);
+    return frames;
+}
+
+// Consumer side. Sleeps until at least `frames` are available or the buffer
+// is terminated. Returns false on termination.
+static inline bool rb_wait(RealtimeBuffer *rb, size_t frames) {
+    while (!atomic_load_explicit(&rb->terminate, memory_order_acquire)) {
+        atomic_store_explicit(&rb->waiting, true, memory_order_seq_cst);
+        if (rb_available(rb) >= frames) {
+            atomic_store_explicit(&rb->waiting, false, memory_order_relaxed);
+            return true;
+        }
+        uint64_t v;
+        if (read(rb->wake_fd[0], &v, sizeof(v)) < 0 && errno != EINTR) return false;
+    }
+    return false;
+}
+
+static inline void rb_terminate(RealtimeBuffer *rb) {
+    atomic_store_explicit(&rb->terminate, true, memory_order_release);
+    rb_signal(rb);
+}
+
+#endif // RINGBUF_H
@@ -0,0 +1,139 @@
+#ifndef RTSCHED_H
+#define RTSCHED_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+// ==================
+// Realtime Scheduling
+// ==================
+// Optional hardening for the processor thread: a SCHED_FIFO/SCHED_RR
+// priority, a CPU set, and locked, prefaulted memory so the steady state
+// takes no page faults. Every step is independent and returns 0 or an errno
+// value instead of failing the stream; the front end reports what did not
+// apply (usually EPERM without CAP_SYS_NICE / CAP_IPC_LOCK or matching
+// rtprio / memlock limits) and carries on.
+//
+// CPU sets and per-thread page fault counts need _GNU_SOURCE (cpu_set_t,
+// pthread_setaffinity_np, RUSAGE_THREAD) and are Linux only; elsewhere
+// rt_set_affinity() returns ENOTSUP and rt_thread_faults() false.
+
+#define RT_PREFAULT_STACK (256 * 1024) // stack the processor thread touches up front
+
+typedef struct {
+    int policy;        // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int priority;      // 1..99, FIFO/RR only
+    const char *cpus;  // e.g. "3" or "0-1,4"; NULL = any CPU
+    bool lock_memory;  // mlockall() current and future pages
+} RtSchedConfig;
+
+static inline bool rt_policy_from_name(const char *name, int *policy) {
+    if (strcmp(name, "other") == 0) *policy = SCHED_OTHER;
+    else if (strcmp(name, "fifo") == 0) *policy = SCHED_FIFO;
+    else if (strcmp(name, "rr") == 0) *policy = SCHED_RR;
+    else return false;
+    return true;
+}
+
+static inline const char *rt_policy_name(int policy) {
+    return policy == SCHED_FIFO ? "SCHED_FIFO" : policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER";
+}
+
+// Returns 0 or an errno value (EINVAL for a priority out of range).
+static inline int rt_set_scheduling(pthread_t thread, int policy, int priority) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    if (policy != SCHED_OTHER) {
+        if (priority < sched_get_priority_min(policy) || priority > sched_get_priority_max(policy)) return EINVAL;
+        param.sched_priority = priority;
+    }
+    return pthread_setschedparam(thread, policy, &param);
+}
+
+#if defined(__linux__) && defined(CPU_SET)
+// "0-1,4" -> {0, 1, 4}. Returns false on a malformed list.
+static inline bool rt_parse_cpus(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE) return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= CPU_SETSIZE) return false;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) CPU_SET((int)cpu, set);
+        if (*p == ',') p++;
+        else if (*p) return false;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+static inline int rt_set_affinity(pthread_t thread, const char *cpus) {
+    cpu_set_t set;
+    if (!rt_parse_cpus(cpus, &set)) return EINVAL;
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+#else
+static inline int rt_set_affinity(pthread_t thread, const char *cpus) {
+    (void)thread;
+    (void)cpus;
+    return ENOTSUP;
+}
+#endif
+
+// Locks the whole process; later allocations are locked as they are mapped.
+static inline int rt_lock_memory(void) {
+    return mlockall(MCL_CURRENT | MCL_FUTURE) == 0 ? 0 : errno;
+}
+
+static inline void rt_unlock_memory(void) {
+    munlockall();
+}
+
+// Touches every page of a buffer so it is resident before the stream starts.
+// Harmless on memory that is already resident or locked.
+static inline void rt_prefault(void *p, size_t bytes) {
+    volatile char *c = (volatile char*)p;
+    long page = sysconf(_SC_PAGESIZE);
+    if (!p || bytes == 0) return;
+    if (page <= 0) page = 4096;
+    for (size_t i = 0; i < bytes; i += (size_t)page) c[i] = c[i];
+    c[bytes - 1] = c[bytes - 1];
+}
+
+// Called by the thread itself: faults in RT_PREFAULT_STACK bytes of its stack.
+static inline void rt_prefault_stack(void) {
+    volatile char stack[RT_PREFAULT_STACK];
+    for (size_t i = 0; i < sizeof(stack); i += 1024) stack[i] = 0;
+}
+
+// Page faults taken by the calling thread so far. Major faults went to disk;
+// minor faults only mapped a page, but still cost a trip into the kernel.
+static inline bool rt_thread_faults(uint64_t *minor, uint64_t *major) {
+#ifdef RUSAGE_THREAD
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) return false;
+    *minor = (uint64_t)usage.ru_minflt;
+    *major = (uint64_t)usage.ru_majflt;
+    return true;
+#else
+    (void)minor;
+    (void)major;
+    return false;
+#endif
+}
+
+#endif // RTSCHED_H
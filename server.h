@@ -0,0 +1,595 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "dsp.h"
+#include "ringbuf.h"
+#include "threadpool.h"
+#include "metrics.h"
+
+// ==================
+// Multi-Stream Server
+// ==================
+// Anonymizes many independent voice streams in one process. Every client
+// connection on a Unix stream socket is one session with its own DSP state
+// (one DspContext per channel) and a pair of SPSC rings:
+//
+//   client ──socket──> I/O thread ──in ring──> worker ──out ring──> I/O thread ──socket──> client
+//
+// One I/O thread polls all sockets: it accepts connections, reads raw PCM into
+// each session's input ring and sends whatever its output ring holds. A
+// session with a whole block waiting (or the tail after the client finished
+// sending) and room for the result is handed to the worker pool as one task;
+// the task processes up to SERVER_BATCH_BLOCKS blocks and returns the session.
+// A session is held by at most one worker at a time, so its blocks stay in
+// order, while different sessions spread over all cores.
+//
+// Protocol: the client sends a ServerHello, the server answers with a
+// ServerReply. With status SERVER_OK, the client then streams interleaved
+// native-endian float32 frames and receives the same number of processed
+// frames back (the pitch shifter delays the audio by latency_frames, not the
+// frame count). To finish, the client shuts down its sending side; the server
+// processes the last partial block, sends the rest and closes the connection.
+//
+// Workers only take a session's rings and DSP state; the session list, the
+// sockets and all allocation belong to the I/O thread.
+
+#define SERVER_MAGIC        0x4b534d56u // "VMSK"
+#define SERVER_VERSION      1
+#define SERVER_BLOCK        256  // default frames per scheduled block
+#define SERVER_MIN_BLOCK    16
+#define SERVER_MAX_BLOCK    8192
+#define SERVER_MAX_CHANNELS 8
+#define SERVER_RING_BLOCKS  16   // per-direction ring depth
+#define SERVER_BATCH_BLOCKS 4    // blocks a task processes before giving the worker up
+#define SERVER_BACKLOG      128
+
+typedef struct {
+    uint32_t magic;         // SERVER_MAGIC
+    uint32_t version;       // SERVER_VERSION
+    uint32_t sample_rate;   // 8000..192000
+    uint32_t channels;      // 1..SERVER_MAX_CHANNELS
+    uint32_t block_frames;  // SERVER_MIN_BLOCK..SERVER_MAX_BLOCK, 0 = server default
+} ServerHello;
+
+typedef enum {
+    SERVER_OK,
+    SERVER_ERR_PROTOCOL,    // bad magic or version
+    SERVER_ERR_FORMAT,      // sample rate, channels or block size out of range
+    SERVER_ERR_MEMORY
+} ServerStatus;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t status;        // ServerStatus
+    uint32_t block_frames;  // block size the session runs at
+    uint32_t latency_frames; // pitch shifter delay
+} ServerReply;
+
+typedef struct Server Server;
+
+typedef struct {
+    Server *server;
+    int fd;
+    bool hello_done;
+    bool failed;            // I/O error or refused: closed once no worker holds it
+    int sample_rate;
+    int channels;
+    long block;             // frames per scheduled block
+    DspContext *dsp;        // one per channel
+    int dsp_ready;
+    RealtimeBuffer in;      // I/O thread -> worker
+    RealtimeBuffer out;     // worker -> I/O thread
+    bool rings_ready;
+    float *work;            // worker scratch, one block
+    unsigned char *rx;      // received bytes short of a whole frame (and the hello)
+    size_t rx_len;
+    size_t rx_cap;
+    float *tx;              // processed samples being sent
+    size_t tx_off;          // bytes
+    size_t tx_len;
+    atomic_bool scheduled;  // a worker task holds the session
+    atomic_bool input_done; // the client shut down its sending side
+} ServerSession;
+
+typedef struct {
+    double uptime;
+    int active;             // open sessions
+    uint64_t sessions;      // accepted since start
+    uint64_t refused;       // bad hello
+    uint64_t failed;        // dropped on an I/O error
+    uint64_t blocks;
+    double audio_seconds;   // stream time processed, summed over sessions
+    MetricsHistogramSnapshot process_time;
+} ServerSnapshot;
+
+typedef void (*server_print_fn)(const ServerSnapshot *snapshot, void *ctx);
+
+typedef struct {
+    int n_steps;
+    NoiseShape noise_shape;
+    float noise_amplitude;
+    ResampleQuality quality;
+    PitchEngine engine;
+    float formant_steps;    // PITCH_ENGINE_FORMANT only
+    DspChain chain;
+    VadConfig vad;          // skip the chain on silent blocks
+    int workers;            // 0 = one per CPU
+    double stats_interval;  // seconds between print calls, 0 = off
+    server_print_fn print;
+    void *print_ctx;
+} ServerConfig;
+
+struct Server {
+    ServerConfig config;
+    const char *path;
+    int listen_fd;
+    int wake_fd[2];         // workers -> I/O thread, non-blocking pipe
+    ThreadPool pool;
+    ServerSession **sessions;
+    int count;
+    int capacity;
+    atomic_bool stop;
+    double start;
+    uint64_t sessions_total; // I/O thread only
+    uint64_t refused;
+    uint64_t failed;
+    _Atomic uint64_t blocks;
+    _Atomic uint64_t audio_ns;
+    MetricsHistogram process_time; // one block through one session's chain
+    char error[256];
+};
+
+static inline void server_wake(Server *srv) {
+    char one = 1;
+    ssize_t n = write(srv->wake_fd[1], &one, 1);
+    (void)n; // a full pipe already holds a pending wakeup
+}
+
+// Async-signal-safe: may be called from a SIGINT handler.
+static inline void server_stop(Server *srv) {
+    atomic_store(&srv->stop, true);
+    server_wake(srv);
+}
+
+static inline void server_set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+// Every session holds a socket and two ring descriptors; hundreds of streams
+// need more than the usual soft limit of 1024.
+static inline void server_raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// ------------------
+// Sessions
+// ------------------
+static inline void server_session_free(ServerSession *s) {
+    if (s->fd >= 0) close(s->fd);
+    for (int ch = 0; ch < s->dsp_ready; ++ch) dsp_free(&s->dsp[ch]);
+    if (s->rings_ready) {
+        rb_destroy(&s->in);
+        rb_destroy(&s->out);
+    }
+    free(s->dsp);
+    free(s->work);
+    free(s->rx);
+    free(s->tx);
+    free(s);
+}
+
+static inline bool server_session_send(ServerSession *s, const void *data, size_t len) {
+    return send(s->fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)len;
+}
+
+// Validates the hello and sets the session up. On failure the reply carries
+// the reason and the session is closed.
+static inline void server_session_start(Server *srv, ServerSession *s) {
+    ServerHello hello;
+    memcpy(&hello, s->rx, sizeof(hello));
+    s->rx_len -= sizeof(hello);
+    memmove(s->rx, s->rx + sizeof(hello), s->rx_len);
+    s->hello_done = true;
+
+    ServerReply reply = { SERVER_MAGIC, SERVER_OK, 0, 0 };
+    long block = hello.block_frames ? (long)hello.block_frames : SERVER_BLOCK;
+    if (hello.magic != SERVER_MAGIC || hello.version != SERVER_VERSION) {
+        reply.status = SERVER_ERR_PROTOCOL;
+    } else if (hello.sample_rate < 8000 || hello.sample_rate > 192000 || hello.channels < 1 ||
+               hello.channels > SERVER_MAX_CHANNELS || block < SERVER_MIN_BLOCK || block > SERVER_MAX_BLOCK) {
+        reply.status = SERVER_ERR_FORMAT;
+    } else {
+        s->sample_rate = (int)hello.sample_rate;
+        s->channels = (int)hello.channels;
+        s->block = block;
+        size_t samples = (size_t)block * s->channels;
+        s->dsp = (DspContext*) calloc(s->channels, sizeof(DspContext));
+        s->work = (float*) malloc(samples * sizeof(float));
+        s->tx = (float*) malloc(samples * sizeof(float));
+        unsigned char *rx = (unsigned char*) realloc(s->rx, samples * sizeof(float));
+        if (rx) {
+            s->rx = rx;
+            s->rx_cap = samples * sizeof(float);
+        }
+        if (s->dsp && s->work && s->tx && rx) {
+            for (; s->dsp_ready < s->channels; ++s->dsp_ready) {
+                DspContext *dsp = &s->dsp[s->dsp_ready];
+                if (!dsp_init(dsp, s->sample_rate, srv->config.n_steps, block)) break;
+                if (!dsp_set_pitch_engine(dsp, srv->config.engine, srv->config.formant_steps)) {
+                    dsp_free(dsp);
+                    break;
+                }
+                dsp_set_noise(dsp, srv->config.noise_shape, srv->config.noise_amplitude);
+                dsp_set_chain(dsp, &srv->config.chain);
+                pitch_shifter_set_quality(&dsp->shifter, srv->config.quality);
+                if (!dsp_set_vad(dsp, &srv->config.vad)) {
+                    dsp_free(dsp);
+                    break;
+                }
+            }
+        }
+        if (s->dsp_ready == s->channels && rb_init(&s->in, samples * SERVER_RING_BLOCKS)) {
+            if (rb_init(&s->out, samples * SERVER_RING_BLOCKS)) s->rings_ready = true;
+            else rb_destroy(&s->in);
+        }
+        if (s->rings_ready) {
+            reply.block_frames = (uint32_t)block;
+            reply.latency_frames = (uint32_t)dsp_latency(&s->dsp[0]);
+        } else {
+            reply.status = SERVER_ERR_MEMORY;
+        }
+    }
+
+    if (!server_session_send(s, &reply, sizeof(reply)) || reply.status != SERVER_OK) {
+        if (reply.status != SERVER_OK) srv->refused++;
+        s->failed = true;
+    }
+}
+
+// Moves whole frames from the receive buffer into the input ring.
+static inline void server_session_push(ServerSession *s) {
+    size_t frame = (size_t)s->channels * sizeof(float);
+    size_t bytes = s->rx_len / frame * frame;
+    if (bytes == 0 || !rb_write_all(&s->in, (const float*)s->rx, bytes / sizeof(float))) return;
+    s->rx_len -= bytes;
+    memmove(s->rx, s->rx + bytes, s->rx_len);
+}
+
+static inline void server_session_read(Server *srv, ServerSession *s) {
+    for (;;) {
+        size_t room;
+        if (!s->hello_done) {
+            room = sizeof(ServerHello) - s->rx_len;
+        } else {
+            server_session_push(s);
+            room = s->rx_cap - s->rx_len;
+            size_t space = rb_free_space(&s->in) * sizeof(float);
+            if (space < room) room = space;
+            if (room == 0) return;
+        }
+        ssize_t n = recv(s->fd, s->rx + s->rx_len, room, MSG_DONTWAIT);
+        if (n > 0) {
+            s->rx_len += (size_t)n;
+            if (!s->hello_done && s->rx_len == sizeof(ServerHello)) {
+                server_session_start(srv, s);
+                if (s->failed) return;
+            }
+            continue;
+        }
+        if (n == 0) {
+            if (!s->hello_done) s->failed = true;
+            else server_session_push(s);
+            atomic_store_explicit(&s->input_done, true, memory_order_release);
+            return;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            s->failed = true;
+            srv->failed++;
+        }
+        return;
+    }
+}
+
+static inline void server_session_flush(Server *srv, ServerSession *s) {
+    if (!s->rings_ready || s->failed) return;
+    for (;;) {
+        if (s->tx_off == s->tx_len) {
+            size_t n = rb_available(&s->out);
+            if (n > (size_t)s->block * s->channels) n = (size_t)s->block * s->channels;
+            if (n == 0) return;
+            rb_read(&s->out, s->tx, n);
+            s->tx_off = 0;
+            s->tx_len = n * sizeof(float);
+        }
+        ssize_t n = send(s->fd, (const char*)s->tx + s->tx_off, s->tx_len - s->tx_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n >= 0) {
+            s->tx_off += (size_t)n;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            s->failed = true;
+            srv->failed++;
+        }
+        return;
+    }
+}
+
+// A whole block (or, after the client finished, the tail) and room for its result.
+static inline bool server_session_ready(ServerSession *s) {
+    size_t block = (size_t)s->block * s->channels;
+    size_t avail = rb_available(&s->in);
+    bool done = atomic_load_explicit(&s->input_done, memory_order_acquire);
+    return (avail >= block || (done && avail > 0)) && rb_free_space(&s->out) >= block;
+}
+
+// Worker task. Never touches the session after handing it back.
+static inline void server_run_session(void *arg) {
+    ServerSession *s = (ServerSession*)arg;
+    Server *srv = s->server;
+    const size_t block = (size_t)s->block * s->channels;
+    uint64_t frames = 0;
+    int blocks = 0;
+
+    for (; blocks < SERVER_BATCH_BLOCKS; ++blocks) {
+        bool done = atomic_load_explicit(&s->input_done, memory_order_acquire);
+        size_t avail = rb_available(&s->in);
+        size_t n = avail >= block ? block : done ? avail : 0;
+        if (n == 0 || rb_free_space(&s->out) < n) break;
+        rb_read(&s->in, s->work, n);
+        uint64_t start = metrics_now_ns();
+        dsp_process_interleaved(s->dsp, s->channels, s->work, s->work, (long)(n / s->channels));
+        metrics_observe(&srv->process_time, metrics_now_ns() - start);
+        rb_write(&s->out, s->work, n);
+        frames += n / s->channels;
+    }
+    atomic_fetch_add_explicit(&srv->blocks, (uint64_t)blocks, memory_order_relaxed);
+    atomic_fetch_add_explicit(&srv->audio_ns, frames * 1000000000ull / (uint64_t)s->sample_rate, memory_order_relaxed);
+
+    atomic_store_explicit(&s->scheduled, false, memory_order_release);
+    server_wake(srv);
+}
+
+static inline bool server_session_finished(ServerSession *s) {
+    if (atomic_load_explicit(&s->scheduled, memory_order_acquire)) return false;
+    if (s->failed) return true;
+    // A partial frame left at the end of the input is dropped.
+    return atomic_load_explicit(&s->input_done, memory_order_acquire) && s->rings_ready &&
+           s->rx_len < (size_t)s->channels * sizeof(float) && rb_available(&s->in) == 0 &&
+           rb_available(&s->out) == 0 && s->tx_off == s->tx_len;
+}
+
+static inline short server_session_events(ServerSession *s) {
+    short events = 0;
+    if (s->failed) return 0;
+    if (!s->hello_done) return POLLIN;
+    if (!atomic_load_explicit(&s->input_done, memory_order_relaxed) && s->rx_len < s->rx_cap &&
+        rb_free_space(&s->in) > 0) {
+        events |= POLLIN;
+    }
+    if (s->tx_off < s->tx_len) events |= POLLOUT;
+    return events;
+}
+
+static inline void server_accept(Server *srv) {
+    for (;;) {
+        int fd = accept(srv->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return; // EAGAIN, or out of descriptors: the connection waits in the backlog
+        }
+        if (srv->count == srv->capacity) {
+            int cap = srv->capacity ? srv->capacity * 2 : 64;
+            ServerSession **sessions = (ServerSession**) realloc(srv->sessions, cap * sizeof(ServerSession*));
+            if (!sessions) {
+                close(fd);
+                return;
+            }
+            srv->sessions = sessions;
+            srv->capacity = cap;
+        }
+        ServerSession *s = (ServerSession*) calloc(1, sizeof(ServerSession));
+        unsigned char *rx = (unsigned char*) malloc(sizeof(ServerHello));
+        if (!s || !rx) {
+            free(s);
+            free(rx);
+            close(fd);
+            return;
+        }
+        server_set_nonblocking(fd);
+        s->server = srv;
+        s->fd = fd;
+        s->rx = rx;
+        s->rx_cap = sizeof(ServerHello);
+        atomic_init(&s->scheduled, false);
+        atomic_init(&s->input_done, false);
+        srv->sessions[srv->count++] = s;
+        srv->sessions_total++;
+    }
+}
+
+// ------------------
+// Server
+// ------------------
+static inline void server_snapshot(Server *srv, ServerSnapshot *s) {
+    s->uptime = metrics_now_ns() * 1e-9 - srv->start;
+    s->active = srv->count;
+    s->sessions = srv->sessions_total;
+    s->refused = srv->refused;
+    s->failed = srv->failed;
+    s->blocks = atomic_load_explicit(&srv->blocks, memory_order_relaxed);
+    s->audio_seconds = atomic_load_explicit(&srv->audio_ns, memory_order_relaxed) * 1e-9;
+    metrics_histogram_snapshot(&srv->process_time, &s->process_time);
+}
+
+// Binds `path` (replacing a stale socket left by an earlier run) and starts
+// the workers. Returns false with a message in `error`.
+static inline bool server_open(Server *srv, const char *path, const ServerConfig *config) {
+    const int time_n = (int)(sizeof(metrics_time_bounds) / sizeof(metrics_time_bounds[0]));
+    struct sockaddr_un addr;
+    struct stat st;
+
+    memset(srv, 0, sizeof(*srv));
+    srv->config = *config;
+    srv->path = path;
+    srv->listen_fd = srv->wake_fd[0] = srv->wake_fd[1] = -1;
+    atomic_init(&srv->stop, false);
+    atomic_init(&srv->blocks, 0);
+    atomic_init(&srv->audio_ns, 0);
+    metrics_histogram_init(&srv->process_time, "server_process_seconds", metrics_time_bounds, time_n, 1e-9);
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        snprintf(srv->error, sizeof(srv->error), "socket path '%s' is too long", path);
+        return false;
+    }
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            snprintf(srv->error, sizeof(srv->error), "'%s' exists and is not a socket", path);
+            return false;
+        }
+        unlink(path);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    server_raise_fd_limit();
+    srv->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (srv->listen_fd < 0 || bind(srv->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(srv->listen_fd, SERVER_BACKLOG) != 0) {
+        snprintf(srv->error, sizeof(srv->error), "could not listen on '%s': %s", path, strerror(errno));
+        if (srv->listen_fd >= 0) close(srv->listen_fd);
+        return false;
+    }
+    server_set_nonblocking(srv->listen_fd);
+    if (pipe(srv->wake_fd) != 0) {
+        snprintf(srv->error, sizeof(srv->error), "pipe: %s", strerror(errno));
+        close(srv->listen_fd);
+        unlink(path);
+        return false;
+    }
+    server_set_nonblocking(srv->wake_fd[0]);
+    server_set_nonblocking(srv->wake_fd[1]);
+    if (!threadpool_create(&srv->pool, config->workers)) {
+        snprintf(srv->error, sizeof(srv->error), "could not start the worker threads");
+        close(srv->listen_fd);
+        close(srv->wake_fd[0]);
+        close(srv->wake_fd[1]);
+        unlink(path);
+        return false;
+    }
+    srv->start = metrics_now_ns() * 1e-9;
+    return true;
+}
+
+// The I/O loop; returns after server_stop() or a poll() failure (message in `error`).
+static inline void server_run(Server *srv) {
+    struct pollfd *fds = NULL;
+    int fds_cap = 0;
+    double interval = srv->config.print ? srv->config.stats_interval : 0.0;
+    double next_report = srv->start + interval;
+
+    while (!atomic_load(&srv->stop)) {
+        int n = srv->count + 2;
+        if (n > fds_cap) {
+            struct pollfd *grown = (struct pollfd*) realloc(fds, n * 2 * sizeof(struct pollfd));
+            if (!grown) {
+                snprintf(srv->error, sizeof(srv->error), "out of memory");
+                break;
+            }
+            fds = grown;
+            fds_cap = n * 2;
+        }
+        fds[0].fd = srv->listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = srv->wake_fd[0];
+        fds[1].events = POLLIN;
+        for (int i = 0; i < srv->count; ++i) {
+            fds[i + 2].fd = srv->sessions[i]->fd;
+            fds[i + 2].events = server_session_events(srv->sessions[i]);
+        }
+        for (int i = 0; i < n; ++i) fds[i].revents = 0;
+
+        int timeout = -1;
+        if (interval > 0.0) {
+            double left = next_report - metrics_now_ns() * 1e-9;
+            timeout = left > 0.0 ? (int)(left * 1000.0) + 1 : 0;
+        }
+        if (poll(fds, n, timeout) < 0 && errno != EINTR) {
+            snprintf(srv->error, sizeof(srv->error), "poll: %s", strerror(errno));
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            char drain[256];
+            while (read(srv->wake_fd[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+
+        // Sessions accepted below are not in `fds` yet; they are polled next round.
+        int polled = n - 2;
+        for (int i = 0; i < polled; ++i) {
+            ServerSession *s = srv->sessions[i];
+            if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) server_session_read(srv, s);
+            if (s->rings_ready && !s->failed) server_session_push(s); // what did not fit before
+            server_session_flush(srv, s);
+            if (!s->failed && s->rings_ready && !atomic_load_explicit(&s->scheduled, memory_order_acquire) &&
+                server_session_ready(s)) {
+                atomic_store_explicit(&s->scheduled, true, memory_order_relaxed);
+                if (!threadpool_submit(&srv->pool, server_run_session, s)) {
+                    atomic_store_explicit(&s->scheduled, false, memory_order_relaxed);
+                }
+            }
+        }
+        int kept = 0;
+        for (int i = 0; i < srv->count; ++i) {
+            if (server_session_finished(srv->sessions[i])) server_session_free(srv->sessions[i]);
+            else srv->sessions[kept++] = srv->sessions[i];
+        }
+        srv->count = kept;
+        if (fds[0].revents & POLLIN) server_accept(srv);
+
+        if (interval > 0.0 && metrics_now_ns() * 1e-9 >= next_report) {
+            ServerSnapshot snapshot;
+            server_snapshot(srv, &snapshot);
+            srv->config.print(&snapshot, srv->config.print_ctx);
+            next_report += interval;
+        }
+    }
+    free(fds);
+}
+
+// Waits for running tasks, drops every open session and removes the socket.
+static inline void server_close(Server *srv) {
+    threadpool_wait(&srv->pool);
+    threadpool_destroy(&srv->pool);
+    for (int i = 0; i < srv->count; ++i) server_session_free(srv->sessions[i]);
+    free(srv->sessions);
+    srv->sessions = NULL;
+    srv->count = srv->capacity = 0;
+    close(srv->listen_fd);
+    close(srv->wake_fd[0]);
+    close(srv->wake_fd[1]);
+    unlink(srv->path);
+}
+
+#endif // SERVER_H
@@ -0,0 +1,350 @@
+#ifndef SHMPCM_H
+#define SHMPCM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+// ==================
+// Shared-Memory PCM Transport
+// ==================
+// Exchanges audio with a co-located process without a syscall or a copy per
+// block. One POSIX shared memory region (shm_open) holds two SPSC rings of
+// interleaved float frames:
+//
+//   ingest  client (e.g. a recorder) -> voicemask
+//   egress  voicemask -> client
+//
+// voicemask creates the region (shm_pcm_create, `--shm NAME`), the client
+// attaches to it (shm_pcm_open). Both sides work on the ring memory in place:
+// shm_ring_write_span() hands out the free space to fill and
+// shm_ring_commit() publishes it; shm_ring_read_span() hands out the queued
+// frames and shm_ring_release() gives the space back. The DSP chain reads its
+// input straight from the ingest ring and writes its output straight into the
+// egress ring. shm_ring_write() and shm_ring_read() are copying shortcuts for
+// clients that already have their audio in a buffer.
+//
+// Indices count frames, and capacities are a power of two frames, so a span
+// never splits a frame. A side that has to wait sleeps on a futex word in the
+// ring (Linux; elsewhere it polls every SHM_POLL_US). The other side only
+// makes the wake syscall when the sleeper has announced itself.
+//
+// This file is the whole client library: a recorder includes it, calls
+// shm_pcm_open() and uses the ring functions. Each ring has exactly one
+// producer and one consumer, so one client attaches to a region at a time.
+
+#define SHM_MAGIC    0x4d485356u // "VSHM"
+#define SHM_VERSION  1
+#define SHM_POLL_US  200
+
+typedef enum {
+    SHM_READY,
+    SHM_TIMEOUT,
+    SHM_CLOSED      // the producer closed the ring and it is drained
+} ShmWaitStatus;
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t write_idx; // frames, written by the producer
+    _Atomic uint32_t data_seq;               // futex word: bumped on every commit
+    _Atomic uint32_t consumer_waiting;
+    _Alignas(64) _Atomic uint64_t read_idx;  // frames, written by the consumer
+    _Atomic uint32_t space_seq;              // futex word: bumped on every release
+    _Atomic uint32_t producer_waiting;
+    _Alignas(64) _Atomic uint32_t closed;    // producer finished: no more frames will come
+    uint32_t channels;
+    uint64_t capacity;                       // frames, power of two
+    uint64_t data_offset;                    // bytes from the start of the region
+} ShmRing;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint64_t size;          // bytes of the whole region
+    ShmRing ingest;
+    ShmRing egress;
+} ShmPcmHeader;
+
+// A mapping of the region in this process
+typedef struct {
+    ShmPcmHeader *header;
+    ShmRing *ingest;
+    ShmRing *egress;
+    size_t size;
+    bool owner;             // created it: unlinks the name on close
+    char name[64];
+} ShmPcm;
+
+// ------------------
+// Futex
+// ------------------
+static inline void shm_futex_wait(_Atomic uint32_t *word, uint32_t value, int timeout_ms) {
+#ifdef __linux__
+    struct timespec ts = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, value, &ts, NULL, 0);
+#else
+    (void)timeout_ms;
+    if (atomic_load(word) == value) usleep(SHM_POLL_US);
+#endif
+}
+
+static inline void shm_futex_wake(_Atomic uint32_t *word) {
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+// ------------------
+// Rings
+// ------------------
+static inline float *shm_ring_data(ShmPcm *pcm, ShmRing *ring) {
+    return (float*)((char*)pcm->header + ring->data_offset);
+}
+
+static inline uint64_t shm_ring_available(ShmRing *ring) {
+    return atomic_load_explicit(&ring->write_idx, memory_order_acquire) -
+           atomic_load_explicit(&ring->read_idx, memory_order_acquire);
+}
+
+static inline uint64_t shm_ring_free(ShmRing *ring) {
+    return ring->capacity - shm_ring_available(ring);
+}
+
+// Producer side: contiguous free frames starting at *frames.
+static inline uint64_t shm_ring_write_span(ShmPcm *pcm, ShmRing *ring, float **frames) {
+    uint64_t w = atomic_load_explicit(&ring->write_idx, memory_order_relaxed);
+    uint64_t r = atomic_load_explicit(&ring->read_idx, memory_order_acquire);
+    uint64_t start = w & (ring->capacity - 1);
+    uint64_t n = ring->capacity - (w - r);
+    if (n > ring->capacity - start) n = ring->capacity - start;
+    *frames = shm_ring_data(pcm, ring) + start * ring->channels;
+    return n;
+}
+
+// Producer side: publishes `n` frames written into the span.
+static inline void shm_ring_commit(ShmRing *ring, uint64_t n) {
+    atomic_fetch_add_explicit(&ring->write_idx, n, memory_order_seq_cst);
+    atomic_fetch_add_explicit(&ring->data_seq, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->consumer_waiting, memory_order_seq_cst)) shm_futex_wake(&ring->data_seq);
+}
+
+// Consumer side: contiguous queued frames starting at *frames.
+static inline uint64_t shm_ring_read_span(ShmPcm *pcm, ShmRing *ring, const float **frames) {
+    uint64_t r = atomic_load_explicit(&ring->read_idx, memory_order_relaxed);
+    uint64_t w = atomic_load_explicit(&ring->write_idx, memory_order_acquire);
+    uint64_t start = r & (ring->capacity - 1);
+    uint64_t n = w - r;
+    if (n > ring->capacity - start) n = ring->capacity - start;
+    *frames = shm_ring_data(pcm, ring) + start * ring->channels;
+    return n;
+}
+
+// Consumer side: hands `n` read frames back to the producer.
+static inline void shm_ring_release(ShmRing *ring, uint64_t n) {
+    atomic_fetch_add_explicit(&ring->read_idx, n, memory_order_seq_cst);
+    atomic_fetch_add_explicit(&ring->space_seq, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->producer_waiting, memory_order_seq_cst)) shm_futex_wake(&ring->space_seq);
+}
+
+// Producer side: no more frames will follow. Wakes a waiting consumer.
+static inline void shm_ring_close(ShmRing *ring) {
+    atomic_store_explicit(&ring->closed, 1, memory_order_seq_cst);
+    atomic_fetch_add_explicit(&ring->data_seq, 1, memory_order_seq_cst);
+    shm_futex_wake(&ring->data_seq);
+}
+
+// Consumer side: waits up to timeout_ms for at least `frames` queued frames.
+// A closed ring returns SHM_READY while anything is left, then SHM_CLOSED.
+static inline ShmWaitStatus shm_ring_wait_readable(ShmRing *ring, uint64_t frames, int timeout_ms) {
+    for (;;) {
+        uint32_t seq = atomic_load_explicit(&ring->data_seq, memory_order_seq_cst);
+        uint64_t avail = shm_ring_available(ring);
+        if (avail >= frames) return SHM_READY;
+        if (atomic_load_explicit(&ring->closed, memory_order_acquire)) {
+            // Re-read: frames committed just before the close count.
+            avail = shm_ring_available(ring);
+            return avail > 0 ? SHM_READY : SHM_CLOSED;
+        }
+        if (timeout_ms <= 0) return SHM_TIMEOUT;
+        atomic_store_explicit(&ring->consumer_waiting, 1, memory_order_seq_cst);
+        if (shm_ring_available(ring) < frames && !atomic_load_explicit(&ring->closed, memory_order_seq_cst)) {
+            shm_futex_wait(&ring->data_seq, seq, timeout_ms);
+        }
+        atomic_store_explicit(&ring->consumer_waiting, 0, memory_order_relaxed);
+        if (shm_ring_available(ring) < frames && !atomic_load(&ring->closed)) return SHM_TIMEOUT;
+    }
+}
+
+// Producer side: waits up to timeout_ms for room for `frames` frames.
+static inline ShmWaitStatus shm_ring_wait_writable(ShmRing *ring, uint64_t frames, int timeout_ms) {
+    for (;;) {
+        uint32_t seq = atomic_load_explicit(&ring->space_seq, memory_order_seq_cst);
+        if (shm_ring_free(ring) >= frames) return SHM_READY;
+        if (timeout_ms <= 0) return SHM_TIMEOUT;
+        atomic_store_explicit(&ring->producer_waiting, 1, memory_order_seq_cst);
+        if (shm_ring_free(ring) < frames) shm_futex_wait(&ring->space_seq, seq, timeout_ms);
+        atomic_store_explicit(&ring->producer_waiting, 0, memory_order_relaxed);
+        if (shm_ring_free(ring) < frames) return SHM_TIMEOUT;
+    }
+}
+
+// Copying producer side: stores up to `n` frames, returns how many fit.
+static inline uint64_t shm_ring_write(ShmPcm *pcm, ShmRing *ring, const float *frames, uint64_t n) {
+    uint64_t done = 0;
+    while (done < n) {
+        float *span;
+        uint64_t room = shm_ring_write_span(pcm, ring, &span);
+        if (room == 0) break;
+        if (room > n - done) room = n - done;
+        memcpy(span, frames + done * ring->channels, room * ring->channels * sizeof(float));
+        shm_ring_commit(ring, room);
+        done += room;
+    }
+    return done;
+}
+
+// Copying consumer side: takes up to `n` frames, returns how many there were.
+static inline uint64_t shm_ring_read(ShmPcm *pcm, ShmRing *ring, float *frames, uint64_t n) {
+    uint64_t done = 0;
+    while (done < n) {
+        const float *span;
+        uint64_t avail = shm_ring_read_span(pcm, ring, &span);
+        if (avail == 0) break;
+        if (avail > n - done) avail = n - done;
+        memcpy(frames + done * ring->channels, span, avail * ring->channels * sizeof(float));
+        shm_ring_release(ring, avail);
+        done += avail;
+    }
+    return done;
+}
+
+// ------------------
+// Regions
+// ------------------
+static inline bool shm_pcm_map(ShmPcm *pcm, int fd, size_t size, char *error, size_t error_size) {
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        snprintf(error, error_size, "mmap '%s': %s", pcm->name, strerror(errno));
+        return false;
+    }
+    pcm->header = (ShmPcmHeader*)base;
+    pcm->ingest = &pcm->header->ingest;
+    pcm->egress = &pcm->header->egress;
+    pcm->size = size;
+    return true;
+}
+
+static inline bool shm_pcm_set_name(ShmPcm *pcm, const char *name, char *error, size_t error_size) {
+    memset(pcm, 0, sizeof(*pcm));
+    if (snprintf(pcm->name, sizeof(pcm->name), "%s%s", name[0] == '/' ? "" : "/", name) >= (int)sizeof(pcm->name) ||
+        strchr(pcm->name + 1, '/')) {
+        snprintf(error, error_size, "invalid shared memory name '%s'", name);
+        return false;
+    }
+    return true;
+}
+
+static inline void shm_ring_init(ShmRing *ring, int channels, uint64_t capacity, uint64_t data_offset) {
+    atomic_init(&ring->write_idx, 0);
+    atomic_init(&ring->data_seq, 0);
+    atomic_init(&ring->consumer_waiting, 0);
+    atomic_init(&ring->read_idx, 0);
+    atomic_init(&ring->space_seq, 0);
+    atomic_init(&ring->producer_waiting, 0);
+    atomic_init(&ring->closed, 0);
+    ring->channels = (uint32_t)channels;
+    ring->capacity = capacity;
+    ring->data_offset = data_offset;
+}
+
+// Creates /dev/shm/<name> with two rings of at least `min_frames` frames.
+// Fails if the name is taken; a region left behind by a crashed run has to
+// be removed first (rm /dev/shm/<name>).
+static inline bool shm_pcm_create(ShmPcm *pcm, const char *name, int sample_rate, int channels,
+                                  uint64_t min_frames, char *error, size_t error_size) {
+    if (!shm_pcm_set_name(pcm, name, error, error_size)) return false;
+    uint64_t capacity = 2;
+    while (capacity < min_frames) capacity <<= 1;
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t header = (sizeof(ShmPcmHeader) + page - 1) / page * page;
+    const size_t ring_bytes = (size_t)capacity * channels * sizeof(float);
+    const size_t size = header + 2 * ring_bytes;
+
+    int fd = shm_open(pcm->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        snprintf(error, error_size, "shm_open '%s': %s", pcm->name, strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        snprintf(error, error_size, "ftruncate '%s': %s", pcm->name, strerror(errno));
+        close(fd);
+        shm_unlink(pcm->name);
+        return false;
+    }
+    if (!shm_pcm_map(pcm, fd, size, error, error_size)) {
+        shm_unlink(pcm->name);
+        return false;
+    }
+    pcm->owner = true;
+    ShmPcmHeader *h = pcm->header;
+    h->version = SHM_VERSION;
+    h->sample_rate = (uint32_t)sample_rate;
+    h->channels = (uint32_t)channels;
+    h->size = size;
+    shm_ring_init(&h->ingest, channels, capacity, header);
+    shm_ring_init(&h->egress, channels, capacity, header + ring_bytes);
+    // Published last: a client that sees the magic sees a complete header.
+    atomic_thread_fence(memory_order_release);
+    h->magic = SHM_MAGIC;
+    return true;
+}
+
+// Client side: attaches to a region created by `voicemask --shm <name>`.
+static inline bool shm_pcm_open(ShmPcm *pcm, const char *name, char *error, size_t error_size) {
+    struct stat st;
+    if (!shm_pcm_set_name(pcm, name, error, error_size)) return false;
+    int fd = shm_open(pcm->name, O_RDWR, 0);
+    if (fd < 0) {
+        snprintf(error, error_size, "shm_open '%s': %s", pcm->name, strerror(errno));
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmPcmHeader)) {
+        snprintf(error, error_size, "'%s' is not a voicemask region", pcm->name);
+        close(fd);
+        return false;
+    }
+    if (!shm_pcm_map(pcm, fd, (size_t)st.st_size, error, error_size)) return false;
+    atomic_thread_fence(memory_order_acquire);
+    if (pcm->header->magic != SHM_MAGIC || pcm->header->version != SHM_VERSION ||
+        pcm->header->size != pcm->size) {
+        snprintf(error, error_size, "'%s' is not a voicemask region (or a different version)", pcm->name);
+        munmap(pcm->header, pcm->size);
+        pcm->header = NULL;
+        return false;
+    }
+    return true;
+}
+
+static inline void shm_pcm_close(ShmPcm *pcm) {
+    if (pcm->header) munmap(pcm->header, pcm->size);
+    if (pcm->owner) shm_unlink(pcm->name);
+    pcm->header = NULL;
+}
+
+#endif // SHMPCM_H
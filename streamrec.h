@@ -0,0 +1,229 @@
+#ifndef STREAMREC_H
+#define STREAMREC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sndfile.h>
+#include "ringbuf.h"
+
+// ==================
+// Compressed Stream Recorder
+// ==================
+// Keeps the anonymized realtime stream as FLAC or Ogg/Opus files. The audio
+// side (the processor thread, or the callback in direct mode) only copies
+// each processed block into a lock-free ring with stream_recorder_push(); a
+// writer thread drains the ring and does all encoding and file I/O. When the
+// writer falls behind, whole blocks are dropped and counted, so a slow disk
+// never stalls the stream.
+//
+// With rotation the files are numbered: "masked.flac" becomes
+// "masked-0001.flac", "masked-0002.flac", ... and a new file starts when the
+// current one reaches `rotate_seconds` of audio or `rotate_mb` megabytes on
+// disk. Opus needs libsndfile 1.0.29 or later and a sample rate of 8, 12, 16,
+// 24 or 48 kHz.
+
+typedef enum {
+    STREAM_CODEC_FLAC,   // lossless, 16-bit
+    STREAM_CODEC_OPUS    // lossy, Ogg container
+} StreamCodec;
+
+typedef struct {
+    const char *path;       // NULL = no recording
+    StreamCodec codec;
+    double rotate_seconds;  // 0 = never rotate by duration
+    double rotate_mb;       // 0 = never rotate by size
+} StreamRecConfig;
+
+typedef struct {
+    StreamRecConfig config;
+    int sample_rate;
+    int channels;
+    RealtimeBuffer ring;    // audio side → writer thread
+    float *chunk;           // writer thread's read buffer
+    size_t chunk_samples;
+    SNDFILE *file;
+    char current[512];      // path of the open file
+    int index;              // number of the open file, 0 before the first one
+    long long file_frames;  // frames in the open file
+
+    pthread_t thread;
+    bool started;
+    // Written by the writer thread; read after stream_recorder_stop().
+    unsigned long long frames_written;
+    int files;
+    char error[768];        // first failure; the writer stops recording after it
+} StreamRecorder;
+
+// Returns false for an unknown name.
+static inline bool stream_codec_from_name(const char *name, StreamCodec *codec) {
+    if (strcmp(name, "flac") == 0) *codec = STREAM_CODEC_FLAC;
+    else if (strcmp(name, "opus") == 0) *codec = STREAM_CODEC_OPUS;
+    else return false;
+    return true;
+}
+
+static inline const char *stream_codec_name(StreamCodec codec) {
+    return codec == STREAM_CODEC_OPUS ? "opus" : "flac";
+}
+
+static inline int stream_codec_format(StreamCodec codec) {
+    return codec == STREAM_CODEC_OPUS ? SF_FORMAT_OGG | SF_FORMAT_OPUS : SF_FORMAT_FLAC | SF_FORMAT_PCM_16;
+}
+
+// Name of file number `index`: the configured path as is without rotation,
+// otherwise with "-NNNN" before the extension.
+static inline void stream_recorder_file_name(const StreamRecorder *rec, int index, char *out, size_t size) {
+    const char *path = rec->config.path;
+    if (rec->config.rotate_seconds <= 0.0 && rec->config.rotate_mb <= 0.0) {
+        snprintf(out, size, "%s", path);
+        return;
+    }
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(path, '.');
+    if (!dot || (slash && dot < slash)) dot = path + strlen(path);
+    snprintf(out, size, "%.*s-%04d%s", (int)(dot - path), path, index, dot);
+}
+
+static inline bool stream_recorder_fail(StreamRecorder *rec, const char *what, const char *detail) {
+    snprintf(rec->error, sizeof(rec->error), "%s '%s': %s", what, rec->current, detail);
+    return false;
+}
+
+// Closes the open file (if any) and starts the next one.
+static inline bool stream_recorder_open_next(StreamRecorder *rec) {
+    if (rec->file) sf_close(rec->file);
+    rec->file = NULL;
+    rec->file_frames = 0;
+    stream_recorder_file_name(rec, ++rec->index, rec->current, sizeof(rec->current));
+
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.samplerate = rec->sample_rate;
+    info.channels = rec->channels;
+    info.format = stream_codec_format(rec->config.codec);
+    rec->file = sf_open(rec->current, SFM_WRITE, &info);
+    if (!rec->file) return stream_recorder_fail(rec, "Could not create", sf_strerror(NULL));
+    // FLAC's integer path clips, so out-of-range samples do not wrap around.
+    sf_command(rec->file, SFC_SET_CLIPPING, NULL, SF_TRUE);
+    rec->files++;
+    return true;
+}
+
+static inline bool stream_recorder_rotate_due(StreamRecorder *rec) {
+    if (rec->config.rotate_seconds > 0.0 &&
+        rec->file_frames >= (long long)(rec->config.rotate_seconds * rec->sample_rate)) {
+        return true;
+    }
+    // The encoder buffers a little, so the size on disk lags by at most a frame or page.
+    struct stat st;
+    return rec->config.rotate_mb > 0.0 && stat(rec->current, &st) == 0 &&
+           (double)st.st_size >= rec->config.rotate_mb * 1024.0 * 1024.0;
+}
+
+// Writes `samples` interleaved samples, splitting them at duration limits.
+static inline bool stream_recorder_write(StreamRecorder *rec, const float *data, size_t samples) {
+    sf_count_t frames = (sf_count_t)(samples / rec->channels);
+    long long limit = rec->config.rotate_seconds > 0.0 ? (long long)(rec->config.rotate_seconds * rec->sample_rate) : 0;
+    while (frames > 0) {
+        if (stream_recorder_rotate_due(rec) && !stream_recorder_open_next(rec)) return false;
+        sf_count_t n = frames;
+        if (limit > 0 && n > limit - rec->file_frames) n = (sf_count_t)(limit - rec->file_frames);
+        if (sf_writef_float(rec->file, data, n) != n) return stream_recorder_fail(rec, "Could not write", sf_strerror(rec->file));
+        rec->file_frames += n;
+        rec->frames_written += (unsigned long long)n;
+        data += (size_t)n * rec->channels;
+        frames -= n;
+    }
+    return true;
+}
+
+static void *stream_recorder_thread(void *arg) {
+    StreamRecorder *rec = (StreamRecorder*)arg;
+    bool ok = true, running = true;
+    while (running) {
+        // Once terminated, one last pass writes whatever is still queued.
+        running = rb_wait(&rec->ring, (size_t)rec->channels);
+        size_t n;
+        while ((n = rb_available(&rec->ring)) > 0) {
+            if (n > rec->chunk_samples) n = rec->chunk_samples;
+            rb_read(&rec->ring, rec->chunk, n);
+            // After a failure the queue is still drained, so the audio side keeps its room.
+            if (ok) ok = stream_recorder_write(rec, rec->chunk, n);
+        }
+    }
+    return NULL;
+}
+
+// Opens the first file and starts the writer thread. The ring holds
+// `queue_seconds` of audio; beyond that the audio side drops blocks. On
+// failure `rec->error` says why and nothing is left to free.
+static inline bool stream_recorder_start(StreamRecorder *rec, const StreamRecConfig *config,
+                                         int sample_rate, int channels, double queue_seconds) {
+    memset(rec, 0, sizeof(*rec));
+    rec->config = *config;
+    rec->sample_rate = sample_rate;
+    rec->channels = channels;
+
+    // libsndfile only finds an unsupported Opus rate after creating the file.
+    if (config->codec == STREAM_CODEC_OPUS && sample_rate != 8000 && sample_rate != 12000 &&
+        sample_rate != 16000 && sample_rate != 24000 && sample_rate != 48000) {
+        snprintf(rec->error, sizeof(rec->error), "opus needs a sample rate of 8, 12, 16, 24 or 48 kHz, not %d Hz", sample_rate);
+        return false;
+    }
+    SF_INFO info = { 0, sample_rate, channels, stream_codec_format(config->codec), 0, 0 };
+    if (!sf_format_check(&info)) {
+        snprintf(rec->error, sizeof(rec->error), "%s is not available for %d Hz, %d channel(s) in this libsndfile",
+                 stream_codec_name(config->codec), sample_rate, channels);
+        return false;
+    }
+    // Drained in chunks of 1/10 s; the ring holds whole frames only.
+    rec->chunk_samples = (size_t)(sample_rate / 10 > 0 ? sample_rate / 10 : 1) * channels;
+    rec->chunk = (float*) malloc(rec->chunk_samples * sizeof(float));
+    if (!rec->chunk || !rb_init(&rec->ring, (size_t)(queue_seconds * sample_rate) * channels)) {
+        snprintf(rec->error, sizeof(rec->error), "memory allocation error");
+        free(rec->chunk);
+        return false;
+    }
+    if (stream_recorder_open_next(rec) &&
+        pthread_create(&rec->thread, NULL, stream_recorder_thread, rec) == 0) {
+        rec->started = true;
+        return true;
+    }
+    if (!rec->error[0]) snprintf(rec->error, sizeof(rec->error), "could not start the writer thread");
+    if (rec->file) sf_close(rec->file);
+    rb_destroy(&rec->ring);
+    free(rec->chunk);
+    return false;
+}
+
+// Audio side: queues one processed block (`samples` interleaved samples).
+// Never blocks or allocates; a block that does not fit is dropped whole.
+static inline void stream_recorder_push(StreamRecorder *rec, const float *data, size_t samples) {
+    rb_write_all(&rec->ring, data, samples);
+}
+
+// Frames the audio side had to drop because the writer fell behind.
+static inline unsigned long long stream_recorder_dropped(StreamRecorder *rec) {
+    return atomic_load(&rec->ring.overflow_frames) / (unsigned long)rec->channels;
+}
+
+// Writes what is still queued, closes the file and frees everything. Call
+// after the audio side has stopped pushing.
+static inline void stream_recorder_stop(StreamRecorder *rec) {
+    if (!rec->started) return;
+    rb_terminate(&rec->ring);
+    pthread_join(rec->thread, NULL);
+    if (rec->file) sf_close(rec->file);
+    rec->file = NULL;
+    rb_destroy(&rec->ring);
+    free(rec->chunk);
+    rec->chunk = NULL;
+    rec->started = false;
+}
+
+#endif // STREAMREC_H
@@ -0,0 +1,237 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// ==================
+// Thread Pool
+// ==================
+// Work-stealing pool for offline work (batch files, long-file segments) and
+// server sessions, never for the realtime device path. Every worker owns a
+// deque: submissions are spread over the deques round-robin, a worker takes
+// from the front of its own deque and, when that is empty, steals from the
+// back of another worker's. Tasks may submit further tasks; threadpool_wait()
+// returns once all of them are done.
+
+typedef void (*threadpool_task_fn)(void *arg);
+
+typedef struct {
+    threadpool_task_fn fn;
+    void *arg;
+} ThreadPoolTask;
+
+typedef struct {
+    ThreadPoolTask *tasks;  // ring of `capacity` slots
+    int head;
+    int count;
+    int capacity;
+    pthread_mutex_t lock;
+} ThreadPoolDeque;
+
+typedef struct ThreadPool ThreadPool;
+
+typedef struct {
+    ThreadPool *pool;
+    int index;
+} ThreadPoolWorker;
+
+struct ThreadPool {
+    pthread_t *threads;
+    ThreadPoolWorker *workers;
+    ThreadPoolDeque *deques;  // one per worker
+    int num_threads;
+    int next_deque;           // round-robin submission target
+    int queued;               // tasks sitting in deques
+    int pending;              // queued + running tasks
+    bool shutdown;
+    pthread_mutex_t mutex;    // guards next_deque, queued, pending, shutdown
+    pthread_cond_t cond_task;
+    pthread_cond_t cond_idle;
+};
+
+static inline bool threadpool_deque_push(ThreadPoolDeque *dq, ThreadPoolTask task) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->capacity) {
+        int cap = dq->capacity ? dq->capacity * 2 : 16;
+        ThreadPoolTask *tasks = (ThreadPoolTask*) malloc(cap * sizeof(ThreadPoolTask));
+        if (!tasks) {
+            pthread_mutex_unlock(&dq->lock);
+            return false;
+        }
+        for (int i = 0; i < dq->count; ++i) tasks[i] = dq->tasks[(dq->head + i) % dq->capacity];
+        free(dq->tasks);
+        dq->tasks = tasks;
+        dq->head = 0;
+        dq->capacity = cap;
+    }
+    dq->tasks[(dq->head + dq->count) % dq->capacity] = task;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return true;
+}
+
+// Owner side: oldest task first.
+static inline bool threadpool_deque_pop(ThreadPoolDeque *dq, ThreadPoolTask *task) {
+    bool ok = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        *task = dq->tasks[dq->head];
+        dq->head = (dq->head + 1) % dq->capacity;
+        dq->count--;
+        ok = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+// Thief side: newest task first, so owner and thief rarely want the same slot.
+static inline bool threadpool_deque_steal(ThreadPoolDeque *dq, ThreadPoolTask *task) {
+    bool ok = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        *task = dq->tasks[(dq->head + dq->count) % dq->capacity];
+        ok = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+static inline bool threadpool_take(ThreadPool *pool, int self, ThreadPoolTask *task) {
+    if (threadpool_deque_pop(&pool->deques[self], task)) return true;
+    for (int i = 1; i < pool->num_threads; ++i) {
+        if (threadpool_deque_steal(&pool->deques[(self + i) % pool->num_threads], task)) return true;
+    }
+    return false;
+}
+
+static void *threadpool_worker(void *arg) {
+    ThreadPoolWorker *worker = (ThreadPoolWorker*)arg;
+    ThreadPool *pool = worker->pool;
+    ThreadPoolTask task;
+    for (;;) {
+        if (threadpool_take(pool, worker->index, &task)) {
+            pthread_mutex_lock(&pool->mutex);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->mutex);
+
+            task.fn(task.arg);
+
+            pthread_mutex_lock(&pool->mutex);
+            if (--pool->pending == 0) pthread_cond_broadcast(&pool->cond_idle);
+            pthread_mutex_unlock(&pool->mutex);
+            continue;
+        }
+
+        // Nothing to take: sleep until a submission. `queued` is raised under
+        // the mutex after the push, so a wakeup cannot be missed. It can dip
+        // below zero while a task is taken before its submitter has counted it.
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->queued <= 0 && !pool->shutdown) pthread_cond_wait(&pool->cond_task, &pool->mutex);
+        bool done = pool->queued <= 0 && pool->shutdown;
+        pthread_mutex_unlock(&pool->mutex);
+        if (done) return NULL;
+    }
+}
+
+static inline int threadpool_default_size(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static inline void threadpool_release(ThreadPool *pool) {
+    for (int i = 0; i < pool->num_threads; ++i) {
+        free(pool->deques[i].tasks);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->deques);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond_task);
+    pthread_cond_destroy(&pool->cond_idle);
+}
+
+// Returns false if the pool could not be set up with all `num_threads` workers.
+static inline bool threadpool_create(ThreadPool *pool, int num_threads) {
+    if (num_threads < 1) num_threads = threadpool_default_size();
+    pool->threads = (pthread_t*) calloc(num_threads, sizeof(pthread_t));
+    pool->workers = (ThreadPoolWorker*) calloc(num_threads, sizeof(ThreadPoolWorker));
+    pool->deques = (ThreadPoolDeque*) calloc(num_threads, sizeof(ThreadPoolDeque));
+    if (!pool->threads || !pool->workers || !pool->deques) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->deques);
+        return false;
+    }
+    pool->next_deque = 0;
+    pool->queued = 0;
+    pool->pending = 0;
+    pool->shutdown = false;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond_task, NULL);
+    pthread_cond_init(&pool->cond_idle, NULL);
+    for (int i = 0; i < num_threads; ++i) pthread_mutex_init(&pool->deques[i].lock, NULL);
+
+    // Workers index the deques with num_threads, so it is fixed before any starts.
+    pool->num_threads = num_threads;
+    int started = 0;
+    for (; started < num_threads; ++started) {
+        pool->workers[started].pool = pool;
+        pool->workers[started].index = started;
+        if (pthread_create(&pool->threads[started], NULL, threadpool_worker, &pool->workers[started]) != 0) break;
+    }
+    if (started < num_threads) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->shutdown = true;
+        pthread_cond_broadcast(&pool->cond_task);
+        pthread_mutex_unlock(&pool->mutex);
+        for (int i = 0; i < started; ++i) pthread_join(pool->threads[i], NULL);
+        threadpool_release(pool);
+        return false;
+    }
+    return true;
+}
+
+static inline bool threadpool_submit(ThreadPool *pool, threadpool_task_fn fn, void *arg) {
+    ThreadPoolTask task = { fn, arg };
+
+    pthread_mutex_lock(&pool->mutex);
+    int target = pool->next_deque;
+    pool->next_deque = (target + 1) % pool->num_threads;
+    pool->pending++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    bool ok = threadpool_deque_push(&pool->deques[target], task);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (ok) {
+        pool->queued++;
+        pthread_cond_signal(&pool->cond_task);
+    } else if (--pool->pending == 0) {
+        pthread_cond_broadcast(&pool->cond_idle);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return ok;
+}
+
+// Blocks until every submitted task has finished.
+static inline void threadpool_wait(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending > 0) pthread_cond_wait(&pool->cond_idle, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static inline void threadpool_destroy(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->cond_task);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < pool->num_threads; ++i) pthread_join(pool->threads[i], NULL);
+    threadpool_release(pool);
+}
+
+#endif // THREADPOOL_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // rtsched.h için CPU kümeleri, pthread_setaffinity_np ve RUSAGE_THREAD
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,7 +7,22 @@
 #include <portaudio.h>
 #include <sndfile.h>
 #include <pthread.h> // Threading için
+#include <getopt.h>  // --in/--out komut satırı seçenekleri
+#include <signal.h>  // Ctrl+C sunucuyu durdurur
 #include <unistd.h>  // sleep için
+#include "ringbuf.h" // Kilitsiz SPSC halka tampon
+#include "dsp.h"     // Önceden ayrılmış DSP zinciri (pitch shift → gürültü → kırpma)
+#include "allocguard.h" // -DVOICEMASK_ALLOC_GUARD: sıcak yolda heap kullanımında durdur
+#include "offline.h" // Arayüzsüz dosya işleme
+#include "threadpool.h" // Toplu mod için işçi havuzu
+#include "audio.h"   // Ses backend'leri: PortAudio, dosya, null
+#include "metrics.h" // Kilitsiz gecikme/xrun sayaçları ve raporlayıcısı
+#include "config.h"  // anahtar = değer yapılandırma dosyaları
+#include "latency.h" // Çıkış tamponu derinlik denetleyicisi
+#include "rtsched.h" // İşleyici thread önceliği, CPU sabitleme, bellek kilitleme
+#include "server.h"  // Unix soketi üzerinde çok akışlı sunucu
+#include "shmpcm.h"  // Aynı makinedeki kaydediciler için paylaşılan bellek halkaları
+#include "streamrec.h" // Gerçek zamanlı akışın ses yolu dışında kodlanan FLAC/Opus kopyası
 
 //sudo apt-get update
 //sudo apt-get install portaudio19-dev libsndfile1-dev
@@ -45,34 +61,97 @@
 #define NUM_CHANNELS        1
 #define RECORDING_FILENAME  "kaydedilen_karisik_ses_c.wav"
 #define PITCH_SHIFT_STEPS   -4
+#define NOISE_SHAPE         NOISE_UNIFORM // NOISE_TPDF veya tr.py'deki np.random.normal için NOISE_GAUSSIAN
+#define NOISE_AMPLITUDE     0.003f        // yarı genişlik (uniform/TPDF) veya sigma (Gaussian)
+#define STATS_INTERVAL      5.0           // gerçek zamanlı durum satırları arası saniye; 0 kapatır
+#define METRICS_FILE        NULL          // ör. "voicemask.prom" (Prometheus metni) veya "voicemask.json"
+#define RESAMPLE_QUALITY    RESAMPLE_LINEAR // daha temiz pitch shift için RESAMPLE_CUBIC veya RESAMPLE_SINC
+#define CONFIG_FILE         "voicemask.conf" // varsa başlangıçta okunur: sample_rate, block_size, channels
+#define LATENCY_TARGET_MS   3.0           // çıkışın önünde bekletilen işlenmiş ses; en az bir blok
+#define LATENCY_MAX_MS      100.0         // hedef, kaç yetersizlik olursa olsun bunun ötesine genişlemez
+#define DIRECT_MODE         false         // DSP zincirini ses callback'i içinde çalıştır (--direct)
+#define DIRECT_MAX_LOAD     0.5           // bir blok süresinin bu payından uzun süren bloklarda doğrudan moddan vazgeçilir
+#define DIRECT_OVERRUNS     4             // ... art arda bu kadar blok olursa
+#define RT_POLICY           SCHED_OTHER   // SCHED_FIFO veya SCHED_RR: işleyici thread için gerçek zamanlı öncelik (--sched)
+#define RT_PRIORITY         70            // 1-99, yalnızca FIFO/RR; CAP_SYS_NICE veya rtprio sınırı gerekir
+#define RT_CPUS             NULL          // işleyici thread'i sabitle, ör. "3" veya "2-3"
+#define RT_LOCK_MEMORY      false         // mlockall() ve akış tamponlarını önceden sayfala (--mlock)
+#define OUTPUT_FORMAT       PCM_FORMAT_KEEP // PCM_FORMAT_16/24/FLOAT; KEEP = float kayıt, toplu modda girişin kodlaması
+#define OUTPUT_DITHER       false         // PCM16/PCM24'e nicemlemeden önce TPDF dither (--dither)
+#define PITCH_ENGINE        PITCH_ENGINE_GRANULAR // PITCH_ENGINE_VOCODER: tr.py'deki librosa gibi faz vocoder'ı, daha çok gecikme
+#define FORMANT_SHIFT_STEPS 2.0f          // PITCH_ENGINE_FORMANT: formantları bu kadar yarım ton kaydır, 0 = koru
+#define VAD_CONFIG          VAD_CONFIG_DEFAULT // { VAD_NOISE, -50.0f, false }: sessiz bloklarda zinciri atla (--vad)
+#define DSP_CHAIN           DSP_CHAIN_DEFAULT // her modun aşamaları; yapılandırma dosyasında "chain = ..." veya --chain (bkz. chain.h)
+#define SHM_RING_BLOCKS     16            // her paylaşılan bellek halkasının tuttuğu blok sayısı (--shm)
+#define STREAM_RECORD_PATH  NULL          // örn. "maskeli.flac": gerçek zamanlı çıkışı sakla (--record-to)
+#define STREAM_RECORD_CODEC STREAM_CODEC_FLAC // veya STREAM_CODEC_OPUS (.opus, FLAC boyutunun onda biri kadar)
+#define STREAM_ROTATE_SECONDS 0.0         // bu kadar sesten sonra yeni numaralı dosyaya geç; 0 = asla
+#define STREAM_ROTATE_MB    0.0           // ... veya dosya bu boyuta ulaşınca; 0 = asla
+#define STREAM_QUEUE_SECONDS 2.0          // bloklar düşürülmeden önce kodlayıcı için kuyruğa alınan ses
 
 // DEĞİŞİKLİK: Sabit DURATION_SECONDS kaldırıldı.
 
 // ==================
 // Realtime Data Yapısı
 // ==================
-typedef struct {
-    float *buffer;
-    long buffer_size;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond_data_available;
-    pthread_cond_t cond_buffer_empty;
-    long read_idx;
-    long write_idx;
-    bool terminate;
-} RealtimeBuffer;
-
 RealtimeBuffer inputBuffer;
 RealtimeBuffer outputBuffer;
+RealtimeMetrics metrics;
+LatencyController latency;
+Server server;
+
+// Kayıt ve gerçek zamanlı modun akış biçimi. Genel Ayarlar'dan başlar;
+// CONFIG_FILE, --config ve komut satırı değiştirebilir.
+typedef struct {
+    int sample_rate;
+    int frames_per_buffer;
+    int channels;
+    PcmFormat output_format; // kayıtlar ve toplu mod çıktıları
+    bool dither;
+    PitchEngine pitch_engine; // her modun perde kaydırma aşaması
+    float formant_steps;      // formant motorunun zarf kaydırması
+    DspChain chain;           // her modun aşamaları, sırayla
+    VadConfig vad;            // akış modlarının ses etkinliği algılaması
+} AudioSettings;
+
+AudioSettings settings = { SAMPLE_RATE, FRAMES_PER_BUFFER, NUM_CHANNELS, OUTPUT_FORMAT, OUTPUT_DITHER, PITCH_ENGINE,
+                            FORMANT_SHIFT_STEPS, DSP_CHAIN, VAD_CONFIG };
+
+// Komut satırının değiştirebildiği gerçek zamanlı mod seçenekleri
+typedef struct {
+    double stats_interval;    // durum satırları arası saniye, 0 = kapalı
+    const char *metrics_path; // JSON/Prometheus dışa aktarma dosyası, NULL = kapalı
+    bool direct;              // zincir yeterince hafifken callback içinde işle
+    RtSchedConfig sched;      // işleyici thread önceliği ve CPU'ları, bellek kilitleme
+    StreamRecConfig record;   // işlenmiş akışın sıkıştırılmış kopyası, path NULL = kapalı
+} RealtimeOptions;
+
+// Gerçek zamanlı işleyici thread'inin durumu; doğrudan modda callback ile
+// paylaşılır. DSP zincirini aynı anda yalnızca biri çalıştırır: `direct`
+// açıkken callback, sonrasında işleyici thread.
+typedef struct {
+    DspContext *dsp;  // kanal başına bir tane
+    int channels;
+    long frames;      // blok başına örnek
+    float *block;     // iç içe geçmiş tek blok
+    bool direct;      // akış başlamadan ayarlanır, yalnızca callback temizler
+    uint64_t budget_ns; // doğrudan mod: blok başına izin verilen DSP süresi
+    int overruns;     // doğrudan mod: art arda bütçeyi aşan bloklar
+    const RtSchedConfig *sched; // işleyici thread kendisine uygular
+    StreamRecorder *recorder;   // her işlenmiş bloğu alır, NULL = kayıt yok
+} RealtimeProcessor;
+
+// Kayıt modunun kullandığı mikrofon okuyucusunun durumu
+typedef struct {
+    PaStream *stream;
+    long long remaining; // kaydedilecek kalan örnek
+    long overflows;
+    PaError err;
+} RecordReader;
 
 // ==================
 // Fonksiyon Prototipleri
 // ==================
-void initialize_realtime_buffer(RealtimeBuffer *rb, long size);
-void destroy_realtime_buffer(RealtimeBuffer *rb);
-bool write_to_buffer(RealtimeBuffer *rb, const float *data, long frames);
-bool read_from_buffer(RealtimeBuffer *rb, float *data, long frames);
-
 int paCallback(const void *inputBufferPtr, void *outputBufferPtr,
                unsigned long framesPerBuffer,
                const PaStreamCallbackTimeInfo* timeInfo,
@@ -80,19 +159,47 @@ int paCallback(const void *inputBufferPtr, void *outputBufferPtr,
                void *userData);
 
 void *realtime_processor_thread(void *arg);
-void simple_pitch_shift(float *data, long num_frames, int sample_rate, int n_steps);
+void direct_process(RealtimeProcessor *proc, const float *in, float *out, unsigned long frames);
+uint64_t measure_chain_cost(RealtimeProcessor *proc);
+void apply_thread_scheduling(const RtSchedConfig *sched);
+bool lock_realtime_memory(RealtimeProcessor *proc);
 void record_process_play_save_mode();
-void realtime_mode();
+sf_count_t record_read(void *ctx, float *frames, sf_count_t max_frames);
+void realtime_mode(AudioBackend *backend, const RealtimeOptions *options, const OfflineConfig *dsp_config);
+void print_stats(const MetricsSnapshot *s, void *ctx);
 void display_menu();
 void clear_input_buffer();
+int batch_main(int argc, char **argv);
+int backend_main(const char *name, const char *in, const char *out, double duration, double speed,
+                 const RealtimeOptions *options, const OfflineConfig *dsp_config);
+void print_usage(const char *prog);
+bool apply_setting(void *ctx, const char *key, const char *value);
+bool apply_batch_option(OfflineConfig *config, int *jobs, const char *key, const char *value);
+bool apply_stream_option(RealtimeOptions *options, double *duration, double *speed, const char *key, const char *value);
+bool load_config(const char *path);
+int server_main(const char *path, const OfflineConfig *config, int jobs, double stats_interval);
+void print_server_stats(const ServerSnapshot *s, void *ctx);
+void stop_server(int sig);
+int shm_main(const char *name, const OfflineConfig *config, double stats_interval);
+void stop_shm(int sig);
 
 // ==================
 // Main Fonksiyonu
 // ==================
-int main() {
+int main(int argc, char **argv) {
     PaError err;
     int choice;
 
+    // CONFIG_FILE her modda geçerlidir; komut satırı seçenekleri onu geçersiz kılar.
+    if (offline_is_file(CONFIG_FILE) && !load_config(CONFIG_FILE)) {
+        return 1;
+    }
+
+    // Herhangi bir komut satırı argümanı arayüzsüz toplu modu seçer; PortAudio hiç kullanılmaz.
+    if (argc > 1) {
+        return batch_main(argc, argv);
+    }
+
     err = Pa_Initialize();
     if (err != paNoError) {
         fprintf(stderr, GET_COLOR(BRIGHT_RED)"PortAudio hatası: %s\n"RESET, Pa_GetErrorText(err));
@@ -117,7 +224,16 @@ int main() {
             printf(GET_COLOR(BRIGHT_YELLOW)"%s\n"RESET, "==================================================");
         } else if (choice == 2) {
             printf(GET_COLOR(MAGENTA)BOLD">>> Seçim: Gerçek Zamanlı Mod <<<"RESET"\n\n");
-            realtime_mode();
+            AudioPortAudioBackend backend;
+            RealtimeOptions options = { STATS_INTERVAL, METRICS_FILE, DIRECT_MODE,
+                                        { RT_POLICY, RT_PRIORITY, RT_CPUS, RT_LOCK_MEMORY },
+                                        { STREAM_RECORD_PATH, STREAM_RECORD_CODEC, STREAM_ROTATE_SECONDS, STREAM_ROTATE_MB } };
+            OfflineConfig dsp_config = { PITCH_SHIFT_STEPS, NOISE_SHAPE, NOISE_AMPLITUDE, RESAMPLE_QUALITY, 0.0,
+                                         settings.output_format, settings.dither,
+                                         dsp_chain_engine(&settings.chain, settings.pitch_engine),
+                                         settings.formant_steps, settings.chain };
+            audio_portaudio_backend_init(&backend);
+            realtime_mode(&backend.base, &options, &dsp_config);
             printf(GET_COLOR(BRIGHT_YELLOW)"%s\n"RESET, "==================================================");
         } else if (choice == 3) {
             printf(GET_COLOR(BRIGHT_RED)"Programdan çıkılıyor. Hoşça kalın!"RESET"\n");
@@ -137,11 +253,666 @@ int main() {
 }
 
 
+// ==================
+// Akış Ayarları
+// ==================
+// config_load() geri çağrısı; --rate/--block/--channels de bunu kullanır.
+// Bilinmeyen anahtarları ve gerçek zamanlı yolun desteklemediği değerleri reddeder.
+bool apply_setting(void *ctx, const char *key, const char *value) {
+    AudioSettings *s = (AudioSettings*)ctx;
+    char *end;
+    if (strcmp(key, "output_format") == 0) return pcm_format_from_name(value, &s->output_format);
+    if (strcmp(key, "pitch_engine") == 0) return pitch_engine_from_name(value, &s->pitch_engine);
+    if (strcmp(key, "chain") == 0) {
+        char error[128];
+        return dsp_chain_parse(value, &s->chain, error, sizeof(error));
+    }
+    if (strcmp(key, "vad") == 0) return vad_mode_from_name(value, &s->vad.mode);
+    if (strcmp(key, "vad_threshold") == 0) {
+        double db = strtod(value, &end);
+        if (end == value || *end != '\0' || db < -90.0 || db > 0.0) return false;
+        s->vad.threshold_db = (float)db;
+        return true;
+    }
+    if (strcmp(key, "formant_steps") == 0) {
+        double steps = strtod(value, &end);
+        if (end == value || *end != '\0' || steps < -24.0 || steps > 24.0) return false;
+        s->formant_steps = (float)steps;
+        return true;
+    }
+    long v = strtol(value, &end, 10);
+    if (end == value || *end != '\0') return false;
+
+    if (strcmp(key, "sample_rate") == 0 && v >= 8000 && v <= 192000) {
+        s->sample_rate = (int)v;
+    } else if (strcmp(key, "block_size") == 0 && v >= 16 && v <= 8192) {
+        s->frames_per_buffer = (int)v;
+    } else if (strcmp(key, "channels") == 0 && v >= 1 && v <= 8) {
+        s->channels = (int)v;
+    } else if (strcmp(key, "dither") == 0 && (v == 0 || v == 1)) {
+        s->dither = v == 1;
+    } else if (strcmp(key, "vad_flatness") == 0 && (v == 0 || v == 1)) {
+        s->vad.flatness = v == 1;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// `path` dosyasını genel ayarlara yükler; hata olursa sorunu yazdırır.
+bool load_config(const char *path) {
+    char error[CONFIG_MAX_LINE + 256];
+    if (config_load(path, apply_setting, &settings, error, sizeof(error))) return true;
+    fprintf(stderr, GET_COLOR(RED)"[HATA] Yapılandırma: %s\n"RESET, error);
+    return false;
+}
+
+// ==================
+// Arayüzsüz Toplu İşleme Modu
+// ==================
+void print_usage(const char *prog) {
+    printf(GET_COLOR(BRIGHT_WHITE)"Kullanım:"RESET" %s [seçenekler] [--in] <dosya|dizin>... [--out <dosya|dizin>]\n", prog);
+    printf("Ses dosyalarını, ses cihazı kullanmadan gerçek zamanlı modla aynı DSP zinciriyle işler.\n\n");
+    printf("  -i, --in YOL           giriş dosyası veya dizini (tekrarlanabilir; çıplak argümanlar da olur)\n");
+    printf("  -o, --out YOL          çıkış dosyası (tek giriş) veya dizini\n");
+    printf("                         varsayılan: her girişin yanında <ad>_masked.<uzantı>\n");
+    printf("  -s, --steps N          yarım ton cinsinden pitch kaydırma (varsayılan %d)\n", PITCH_SHIFT_STEPS);
+    printf("  -n, --noise A          gürültü genliği (varsayılan %.4f)\n", NOISE_AMPLITUDE);
+    printf("      --noise-shape S    uniform | tpdf | gaussian (varsayılan uniform)\n");
+    printf("  -q, --quality Q        linear | cubic | sinc (varsayılan linear)\n");
+    printf("      --pitch-engine M   granular | vocoder | formant (varsayılan %s); vocoder, tr.py'deki\n", pitch_engine_name(PITCH_ENGINE));
+    printf("                         librosa gibi FFT faz vocoder'ıdır, gecikmesi daha fazladır;\n");
+    printf("                         formant ayrıca LPC spektral zarfını bağımsız kaydırır\n");
+    printf("      --formant-steps X  formant motoru: yarım ton cinsinden zarf kaydırma, 0 konuşmacının\n");
+    printf("                         formantlarını korur (varsayılan %.1f)\n", FORMANT_SHIFT_STEPS);
+    printf("      --chain LİSTE      sırayla işleme aşamaları, ör. \"highpass:80, pitch, gain:-3,\n");
+    printf("                         noise, clip:0.9\"; aşamalar: pitch[:MOTOR] resample formant\n");
+    printf("                         gain:DB highpass:HZ lowpass:HZ noise[:A] clip[:L]\n");
+    printf("                         (varsayılan \"pitch, noise\")\n");
+    printf("      --vad K            off | noise | silence (varsayılan off): gerçek zamanlı,\n");
+    printf("                         paylaşımlı bellek ve sunucu modlarında sessiz bloklar zinciri\n");
+    printf("                         atlar, konfor gürültüsü veya sessizlik olur; perde kaydırıcı\n");
+    printf("                         durumunu korur\n");
+    printf("      --vad-threshold DB dBFS cinsinden konuşma eşiği (varsayılan %.0f)\n", VAD_THRESHOLD_DB);
+    printf("      --vad-flatness     spektrumu düz blokları (fan, cızırtı) da sessiz say\n");
+    printf("  -j, --jobs N           işçi thread sayısı (varsayılan: CPU sayısı)\n");
+    printf("      --segment SN       2*SN saniyeden uzun dosyaları en az SN saniyelik\n");
+    printf("                         paralel parçalara böl; 0 kapatır (varsayılan %.0f)\n", OFFLINE_SEGMENT_SECONDS);
+    printf("  -b, --backend B        bunun yerine gerçek zamanlı motoru çalıştır: portaudio | file | null\n");
+    printf("                         file: --in WAV girişe verilir, çıkış --out WAV dosyasına yazılır\n");
+    printf("      --duration SN      SN saniyelik akış süresinden sonra dur (file/null)\n");
+    printf("      --speed X          simüle saati gerçek zamanın X katı hızda çalıştır (varsayılan 1)\n");
+    printf("      --fast             simüle saati sınırsız hızda çalıştır; halkalar taşar\n");
+    printf("      --stats SN         her SN saniyede bir durum satırı, 0 = kapalı (varsayılan %.0f)\n", STATS_INTERVAL);
+    printf("      --metrics-file D   gecikme/xrun metriklerini her aralıkta D dosyasına yaz\n");
+    printf("                         (D .json ile bitiyorsa JSON, yoksa Prometheus metni)\n");
+    printf("      --direct           DSP zincirini ses callback'i içinde çalıştır; bir bloğun\n");
+    printf("                         %%%.0f'inden uzun sürerse işleyici thread'e geçer\n", DIRECT_MAX_LOAD * 100);
+    printf("      --record-to DOSYA  anonimleştirilmiş gerçek zamanlı akışı ayrıca DOSYA'da sakla;\n");
+    printf("                         kodlama arka plandaki bir thread'de yapılır\n");
+    printf("      --record-format K  flac | opus (varsayılan %s); opus 8/12/16/24/48 kHz ister\n", stream_codec_name(STREAM_RECORD_CODEC));
+    printf("      --rotate-seconds S her S saniyede yeni numaralı dosyaya geç (DOSYA-0001.flac, ...)\n");
+    printf("      --rotate-mb MB     ... veya geçerli dosya MB megabayta ulaşınca\n");
+    printf("  -r, --rate HZ          kayıt/gerçek zamanlı akışların örnekleme hızı (varsayılan %d)\n", SAMPLE_RATE);
+    printf("      --block N          callback başına örnek; düşük gecikme için 64 veya 128 (varsayılan %d)\n", FRAMES_PER_BUFFER);
+    printf("  -c, --channels N       kayıt/gerçek zamanlı akışların kanal sayısı; her kanal\n");
+    printf("                         ayrı işlenir (varsayılan %d)\n", NUM_CHANNELS);
+    printf("      --format B         çıkış kodlaması: keep | pcm16 | pcm24 | float; keep girişin\n");
+    printf("                         kodlamasını yazar (kayıt modu: float)\n");
+    printf("      --dither           pcm16/pcm24'e nicemlemeden önce TPDF dither uygula\n");
+    printf("      --config DOSYA     sample_rate, block_size, channels, output_format, dither,\n");
+    printf("                         pitch_engine, formant_steps, chain, vad, vad_threshold ve\n");
+    printf("                         vad_flatness değerlerini DOSYA'dan oku;\n");
+    printf("                         %s varsa başlangıçta okunur\n", CONFIG_FILE);
+    printf("      --sched P          işleyici thread zamanlaması: other | fifo | rr (varsayılan other)\n");
+    printf("      --priority N       fifo/rr önceliği, 1-99 (varsayılan %d)\n", RT_PRIORITY);
+    printf("      --cpus LİSTE       işleyici thread'i CPU'lara sabitle, ör. 3 veya 2-3\n");
+    printf("      --mlock            belleği kilitle ve akış tamponlarını önceden sayfala\n");
+    printf("                         (yetki yoksa her adım bir uyarıyla atlanır)\n");
+    printf("      --serve SOKET      bir Unix soketi üzerinden aynı anda birçok akışı anonimleştir (bkz. loadgen.c);\n");
+    printf("                         -j işçi sayısını, -s/-n/-q DSP zincirini, --stats durum satırını belirler\n");
+    printf("      --shm AD           sesi yerel bir kaydediciyle /dev/shm/AD paylaşılan bellek\n");
+    printf("                         bölgesi üzerinden değiş tokuş et (bkz. shmpcm.h); biçimi -r/-c/--block belirler\n");
+    printf("  -h, --help             bu yardımı göster\n");
+}
+
+// ==================
+// Sunucu Modu
+// ==================
+void stop_server(int sig) {
+    (void)sig;
+    server_stop(&server);
+}
+
+// Sunucunun G/Ç thread'inden çağrılır; `ctx` bir önceki anlık görüntüyü tutar.
+void print_server_stats(const ServerSnapshot *s, void *ctx) {
+    ServerSnapshot *previous = (ServerSnapshot*)ctx;
+    double wall = s->uptime - previous->uptime;
+    double rate = wall > 0.0 ? (s->audio_seconds - previous->audio_seconds) / wall : 0.0;
+    printf(GET_COLOR(BRIGHT_BLACK)"[SUNUCU] %6.0f sn | %d akış, toplam %llu | gerçek zamanın %.1f katı | blok p99 %.0f us | reddedilen %llu, başarısız %llu\n"RESET,
+           s->uptime, s->active, (unsigned long long)s->sessions, rate, s->process_time.p99 * 1e6,
+           (unsigned long long)s->refused, (unsigned long long)s->failed);
+    fflush(stdout);
+    *previous = *s;
+}
+
+// Ctrl+C'ye kadar `path` üzerinde akışlara hizmet eder; DSP ayarları toplu moddakilerdir.
+int server_main(const char *path, const OfflineConfig *config, int jobs, double stats_interval) {
+    ServerSnapshot previous;
+    memset(&previous, 0, sizeof(previous));
+    ServerConfig server_config = { config->n_steps, config->noise_shape, config->noise_amplitude, config->quality,
+                                   config->engine, config->formant_steps, config->chain, settings.vad, jobs, stats_interval, print_server_stats, &previous };
+    if (!server_open(&server, path, &server_config)) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"[HATA] Sunucu: %s\n"RESET, server.error);
+        return 1;
+    }
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+    printf(GET_COLOR(BRIGHT_CYAN)"[SUNUCU] %s dinleniyor: %d işçi, %+d yarım ton, gürültü %.4f. Durdurmak için Ctrl+C.\n"RESET,
+           path, server.pool.num_threads, config->n_steps, config->noise_amplitude);
+    fflush(stdout);
+
+    server_run(&server);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    bool failed = server.error[0] != '\0';
+    if (failed) fprintf(stderr, GET_COLOR(BRIGHT_RED)"[HATA] Sunucu: %s\n"RESET, server.error);
+    ServerSnapshot s;
+    server_snapshot(&server, &s);
+    server_close(&server);
+    printf(GET_COLOR(BRIGHT_YELLOW)"[SUNUCU] Durduruldu. %llu akış, %.1f sn ses %.0f sn'de.\n"RESET,
+           (unsigned long long)s.sessions, s.audio_seconds, s.uptime);
+    return failed ? 1 : 0;
+}
+
+// ==================
+// Paylaşılan Bellek Modu
+// ==================
+volatile sig_atomic_t shm_stop_requested = 0;
+
+void stop_shm(int sig) {
+    (void)sig;
+    shm_stop_requested = 1;
+}
+
+// `name` bölgesinin giriş halkasını, istemci girişi kapatana ya da Ctrl+C'ye
+// kadar çıkış halkasına işler. DSP zinciri halkaları yerinde okur ve yazar;
+// istemci tarafı için bkz. shmpcm.h.
+int shm_main(const char *name, const OfflineConfig *config, double stats_interval) {
+    ShmPcm pcm;
+    char error[256];
+    const int channels = settings.channels;
+    const long block = settings.frames_per_buffer;
+    DspContext *dsp = (DspContext*) calloc(channels, sizeof(DspContext));
+    int ready = 0;
+    int rc = 1;
+    uint64_t frames = 0, blocks = 0;
+
+    if (!dsp) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
+        return 1;
+    }
+    for (; ready < channels; ++ready) {
+        if (!dsp_init(&dsp[ready], settings.sample_rate, config->n_steps, block)) {
+            fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
+            goto cleanup;
+        }
+        if (!dsp_set_pitch_engine(&dsp[ready], config->engine, config->formant_steps)) {
+            fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
+            dsp_free(&dsp[ready]);
+            goto cleanup;
+        }
+        dsp_set_noise(&dsp[ready], config->noise_shape, config->noise_amplitude);
+        dsp_set_chain(&dsp[ready], &config->chain);
+        pitch_shifter_set_quality(&dsp[ready].shifter, config->quality);
+        if (!dsp_set_vad(&dsp[ready], &settings.vad)) {
+            fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
+            dsp_free(&dsp[ready]);
+            goto cleanup;
+        }
+    }
+    if (!shm_pcm_create(&pcm, name, settings.sample_rate, channels, (uint64_t)block * SHM_RING_BLOCKS,
+                        error, sizeof(error))) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"[HATA] Paylaşılan bellek: %s\n"RESET, error);
+        goto cleanup;
+    }
+    signal(SIGINT, stop_shm);
+    signal(SIGTERM, stop_shm);
+    printf(GET_COLOR(BRIGHT_CYAN)"[SHM] %s bölgesi hazır: %d Hz, %d kanal, halka başına %llu çerçeve, %+d yarım ton. Ctrl+C durdurur.\n"RESET,
+           pcm.name, settings.sample_rate, channels, (unsigned long long)pcm.ingest->capacity, config->n_steps);
+    fflush(stdout);
+
+    double start = offline_now();
+    double next_stats = start + stats_interval;
+    while (!shm_stop_requested) {
+        ShmWaitStatus status = shm_ring_wait_readable(pcm.ingest, 1, 100);
+        if (status == SHM_CLOSED) break;
+        if (status == SHM_READY && shm_ring_wait_writable(pcm.egress, 1, 100) == SHM_READY) {
+            const float *in;
+            float *out;
+            uint64_t n = shm_ring_read_span(&pcm, pcm.ingest, &in);
+            uint64_t room = shm_ring_write_span(&pcm, pcm.egress, &out);
+            if (n > room) n = room;
+            if (n > (uint64_t)block) n = (uint64_t)block;
+            dsp_process_interleaved(dsp, channels, in, out, (long)n);
+            shm_ring_release(pcm.ingest, n);
+            shm_ring_commit(pcm.egress, n);
+            frames += n;
+            blocks++;
+        }
+        if (stats_interval > 0.0 && offline_now() >= next_stats) {
+            double elapsed = offline_now() - start;
+            printf(GET_COLOR(BRIGHT_BLACK)"[SHM] %6.0f sn | %.1f sn ses | %llu blok | girişte %llu çerçeve bekliyor\n"RESET,
+                   elapsed, (double)frames / settings.sample_rate, (unsigned long long)blocks,
+                   (unsigned long long)shm_ring_available(pcm.ingest));
+            fflush(stdout);
+            next_stats += stats_interval;
+        }
+    }
+    shm_ring_close(pcm.egress);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    double elapsed = offline_now() - start;
+    printf(GET_COLOR(BRIGHT_YELLOW)"[SHM] Durduruldu. %.1f sn ses, %llu blokta, %.1f sn'de.\n"RESET,
+           (double)frames / settings.sample_rate, (unsigned long long)blocks, elapsed);
+    shm_pcm_close(&pcm);
+    rc = 0;
+
+cleanup:
+    for (int ch = 0; ch < ready; ++ch) dsp_free(&dsp[ch]);
+    free(dsp);
+    return rc;
+}
+
+// Komut satırında adı verilen backend üzerinde gerçek zamanlı motoru çalıştırır.
+int backend_main(const char *name, const char *in, const char *out, double duration, double speed,
+                 const RealtimeOptions *options, const OfflineConfig *dsp_config) {
+    AudioPortAudioBackend pa;
+    AudioFileBackend file;
+    AudioBackend *backend;
+
+    if (strcmp(name, "portaudio") == 0) {
+        PaError err = Pa_Initialize();
+        if (err != paNoError) {
+            fprintf(stderr, GET_COLOR(BRIGHT_RED)"PortAudio hatası: %s\n"RESET, Pa_GetErrorText(err));
+            return 1;
+        }
+        audio_portaudio_backend_init(&pa);
+        realtime_mode(&pa.base, options, dsp_config);
+        Pa_Terminate();
+        return 0;
+    }
+
+    if (strcmp(name, "file") == 0) {
+        if (!in) {
+            fprintf(stderr, GET_COLOR(RED)"Dosya backend'i bir giriş dosyası ister (--in).\n"RESET);
+            return 2;
+        }
+        audio_file_backend_init(&file, in, out, duration, speed);
+    } else if (strcmp(name, "null") == 0) {
+        audio_null_backend_init(&file, duration, speed);
+    } else {
+        fprintf(stderr, GET_COLOR(RED)"Bilinmeyen backend '%s'.\n"RESET, name);
+        return 2;
+    }
+    backend = &file.base;
+
+    realtime_mode(backend, options, dsp_config);
+    double stream_seconds = (double)file.frames_done / settings.sample_rate;
+    printf(GET_COLOR(BRIGHT_YELLOW)"[GERÇEK ZAMANLI] %.1f sn akış süresi %.2f sn'de (%.1fx gerçek zaman).\n"RESET,
+           stream_seconds, file.wall_seconds, file.wall_seconds > 0 ? stream_seconds / file.wall_seconds : 0.0);
+    return backend->error[0] ? 1 : 0;
+}
+
+// -s/-n/-j/--segment, apply_setting() kadar sıkı: adımlar ±24 içinde tam
+// yarım ton, gürültü [0, 1] aralığında, iş sayısı ve segment negatif olamaz.
+bool apply_batch_option(OfflineConfig *config, int *jobs, const char *key, const char *value) {
+    char *end;
+    double v = strtod(value, &end);
+    if (end == value || *end != '\0') return false;
+
+    if (strcmp(key, "steps") == 0 && v >= -24.0 && v <= 24.0 && v == (int)v) {
+        config->n_steps = (int)v;
+    } else if (strcmp(key, "noise") == 0 && v >= 0.0 && v <= 1.0) {
+        config->noise_amplitude = (float)v;
+    } else if (strcmp(key, "jobs") == 0 && v >= 0.0 && v <= 4096.0 && v == (int)v) {
+        *jobs = (int)v;
+    } else if (strcmp(key, "segment") == 0 && v >= 0.0 && v <= 86400.0) {
+        config->segment_seconds = v;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Gerçek zamanlı seçenekler, apply_batch_option() gibi ayrıştırılır:
+// --priority 1 ile 99 arasında tam bir SCHED_FIFO/RR önceliği; --duration,
+// --speed, --stats ve --rotate-* sınırları negatif olamaz (0 tüm girişi, hız
+// sınırı olmadan, durum satırı olmadan veya dosya değiştirmeden çalıştırır).
+bool apply_stream_option(RealtimeOptions *options, double *duration, double *speed, const char *key, const char *value) {
+    char *end;
+    double v = strtod(value, &end);
+    if (end == value || *end != '\0' || !isfinite(v)) return false;
+
+    if (strcmp(key, "priority") == 0 && v >= 1.0 && v <= 99.0 && v == (int)v) {
+        options->sched.priority = (int)v;
+    } else if (strcmp(key, "duration") == 0 && v >= 0.0) {
+        *duration = v;
+    } else if (strcmp(key, "speed") == 0 && v >= 0.0) {
+        *speed = v;
+    } else if (strcmp(key, "stats") == 0 && v >= 0.0) {
+        options->stats_interval = v;
+    } else if (strcmp(key, "rotate_seconds") == 0 && v >= 0.0) {
+        options->record.rotate_seconds = v;
+    } else if (strcmp(key, "rotate_mb") == 0 && v >= 0.0) {
+        options->record.rotate_mb = v;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int batch_main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        {"in", required_argument, NULL, 'i'},
+        {"out", required_argument, NULL, 'o'},
+        {"steps", required_argument, NULL, 's'},
+        {"noise", required_argument, NULL, 'n'},
+        {"noise-shape", required_argument, NULL, 'S'},
+        {"quality", required_argument, NULL, 'q'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"segment", required_argument, NULL, 'G'},
+        {"backend", required_argument, NULL, 'b'},
+        {"duration", required_argument, NULL, 'D'},
+        {"speed", required_argument, NULL, 'V'},
+        {"fast", no_argument, NULL, 'F'},
+        {"stats", required_argument, NULL, 'T'},
+        {"metrics-file", required_argument, NULL, 'M'},
+        {"rate", required_argument, NULL, 'r'},
+        {"block", required_argument, NULL, 'K'},
+        {"channels", required_argument, NULL, 'c'},
+        {"config", required_argument, NULL, 'C'},
+        {"direct", no_argument, NULL, 'X'},
+        {"sched", required_argument, NULL, 'P'},
+        {"priority", required_argument, NULL, 'Y'},
+        {"cpus", required_argument, NULL, 'U'},
+        {"mlock", no_argument, NULL, 'L'},
+        {"serve", required_argument, NULL, 'E'},
+        {"shm", required_argument, NULL, 'H'},
+        {"format", required_argument, NULL, 'W'},
+        {"dither", no_argument, NULL, 'Z'},
+        {"pitch-engine", required_argument, NULL, 'I'},
+        {"formant-steps", required_argument, NULL, 'J'},
+        {"chain", required_argument, NULL, 'N'},
+        {"vad", required_argument, NULL, 'a'},
+        {"vad-threshold", required_argument, NULL, 'd'},
+        {"vad-flatness", no_argument, NULL, 'e'},
+        {"record-to", required_argument, NULL, 'A'},
+        {"record-format", required_argument, NULL, 'O'},
+        {"rotate-seconds", required_argument, NULL, 'R'},
+        {"rotate-mb", required_argument, NULL, 'B'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    OfflineConfig config = { PITCH_SHIFT_STEPS, NOISE_SHAPE, NOISE_AMPLITUDE, RESAMPLE_QUALITY, OFFLINE_SEGMENT_SECONDS,
+                             OUTPUT_FORMAT, OUTPUT_DITHER, PITCH_ENGINE, FORMANT_SHIFT_STEPS, DSP_CHAIN };
+    const char **inputs = (const char**) calloc(argc, sizeof(char*));
+    int num_inputs = 0;
+    const char *out = NULL;
+    int jobs = 0;
+    const char *backend = NULL;
+    const char *serve = NULL;
+    const char *shm = NULL;
+    double duration = 0.0;
+    double speed = 1.0;
+    RealtimeOptions rt_options = { STATS_INTERVAL, METRICS_FILE, DIRECT_MODE,
+                                   { RT_POLICY, RT_PRIORITY, RT_CPUS, RT_LOCK_MEMORY },
+                                   { STREAM_RECORD_PATH, STREAM_RECORD_CODEC, STREAM_ROTATE_SECONDS, STREAM_ROTATE_MB } };
+    int opt;
+
+    if (!inputs) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
+        return 1;
+    }
+
+    while ((opt = getopt_long(argc, argv, "i:o:s:n:q:j:b:r:c:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'i': inputs[num_inputs++] = optarg; break;
+        case 'o': out = optarg; break;
+        case 's':
+        case 'n':
+        case 'j':
+        case 'G': {
+            const char *key = opt == 's' ? "steps" : opt == 'n' ? "noise" : opt == 'j' ? "jobs" : "segment";
+            if (!apply_batch_option(&config, &jobs, key, optarg)) {
+                fprintf(stderr, GET_COLOR(RED)"Geçersiz %s '%s'.\n"RESET, key, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        }
+        case 'b': backend = optarg; break;
+        case 'E': serve = optarg; break;
+        case 'H': shm = optarg; break;
+        case 'Z': settings.dither = true; break;
+        case 'e': settings.vad.flatness = true; break;
+        case 'a':
+            if (!vad_mode_from_name(optarg, &settings.vad.mode)) {
+                fprintf(stderr, GET_COLOR(RED)"Bilinmeyen VAD modu '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'N': {
+            char error[128];
+            if (!dsp_chain_parse(optarg, &settings.chain, error, sizeof(error))) {
+                fprintf(stderr, GET_COLOR(RED)"Geçersiz zincir '%s': %s.\n"RESET, optarg, error);
+                free(inputs);
+                return 2;
+            }
+            break;
+        }
+        case 'I':
+            if (!pitch_engine_from_name(optarg, &settings.pitch_engine)) {
+                fprintf(stderr, GET_COLOR(RED)"Bilinmeyen perde motoru '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'W':
+            if (!pcm_format_from_name(optarg, &settings.output_format)) {
+                fprintf(stderr, GET_COLOR(RED)"Bilinmeyen çıkış biçimi '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'F': speed = 0.0; break;
+        case 'M': rt_options.metrics_path = optarg; break;
+        case 'X': rt_options.direct = true; break;
+        case 'Y':
+        case 'D':
+        case 'V':
+        case 'T':
+        case 'R':
+        case 'B': {
+            const char *key = opt == 'Y' ? "priority" : opt == 'D' ? "duration" : opt == 'V' ? "speed" :
+                              opt == 'T' ? "stats" : opt == 'R' ? "rotate_seconds" : "rotate_mb";
+            if (!apply_stream_option(&rt_options, &duration, &speed, key, optarg)) {
+                fprintf(stderr, GET_COLOR(RED)"Geçersiz %s '%s'.\n"RESET, key, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        }
+        case 'U': rt_options.sched.cpus = optarg; break;
+        case 'L': rt_options.sched.lock_memory = true; break;
+        case 'A': rt_options.record.path = optarg; break;
+        case 'O':
+            if (!stream_codec_from_name(optarg, &rt_options.record.codec)) {
+                fprintf(stderr, GET_COLOR(RED)"Bilinmeyen kayıt biçimi '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'P':
+            if (!rt_policy_from_name(optarg, &rt_options.sched.policy)) {
+                fprintf(stderr, GET_COLOR(RED)"Bilinmeyen zamanlama politikası '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'r':
+        case 'K':
+        case 'c':
+        case 'J':
+        case 'd': {
+            const char *key = opt == 'r' ? "sample_rate" : opt == 'K' ? "block_size" :
+                              opt == 'J' ? "formant_steps" : opt == 'd' ? "vad_threshold" : "channels";
+            if (!apply_setting(&settings, key, optarg)) {
+                fprintf(stderr, GET_COLOR(RED)"Geçersiz %s '%s'.\n"RESET, key, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        }
+        case 'C':
+            if (!load_config(optarg)) {
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'S':
+            if (!noise_shape_from_name(optarg, &config.noise_shape)) {
+                fprintf(stderr, GET_COLOR(RED)"Bilinmeyen gürültü şekli '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'q':
+            if (!resample_quality_from_name(optarg, &config.quality)) {
+                fprintf(stderr, GET_COLOR(RED)"Bilinmeyen kalite '%s'.\n"RESET, optarg);
+                free(inputs);
+                return 2;
+            }
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            free(inputs);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            free(inputs);
+            return 2;
+        }
+    }
+    while (optind < argc) inputs[num_inputs++] = argv[optind++];
+    config.output_format = settings.output_format;
+    config.dither = settings.dither;
+    config.engine = dsp_chain_engine(&settings.chain, settings.pitch_engine);
+    config.formant_steps = settings.formant_steps;
+    config.chain = settings.chain;
+
+    if (serve) {
+        free(inputs);
+        return server_main(serve, &config, jobs, rt_options.stats_interval);
+    }
+    if (shm) {
+        free(inputs);
+        return shm_main(shm, &config, rt_options.stats_interval);
+    }
+
+    if (backend) {
+        int rc;
+        if (num_inputs > 1) {
+            fprintf(stderr, GET_COLOR(RED)"Backend çalıştırması en fazla bir giriş dosyası alır.\n"RESET);
+            rc = 2;
+        } else {
+            rc = backend_main(backend, num_inputs ? inputs[0] : NULL, out, duration, speed, &rt_options, &config);
+        }
+        free(inputs);
+        return rc;
+    }
+
+    if (num_inputs == 0) {
+        fprintf(stderr, GET_COLOR(RED)"Giriş verilmedi.\n"RESET);
+        print_usage(argv[0]);
+        free(inputs);
+        return 2;
+    }
+
+    // Birden fazla giriş veya dizin girişi varsa --out bir dizindir.
+    bool out_is_dir = out && (num_inputs > 1 || offline_is_dir(out) || offline_is_dir(inputs[0]));
+    if (out_is_dir && !offline_is_dir(out) && mkdir(out, 0755) != 0) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"[HATA] '%s' dizini oluşturulamadı.\n"RESET, out);
+        free(inputs);
+        return 1;
+    }
+
+    OfflineJobList list = { NULL, 0, 0 };
+    for (int i = 0; i < num_inputs; ++i) {
+        if (!offline_collect(&list, &config, inputs[i], out_is_dir ? out : NULL, out_is_dir ? NULL : out)) {
+            fprintf(stderr, GET_COLOR(YELLOW)"[UYARI] '%s' atlanıyor: okunabilir bir dosya veya dizin değil.\n"RESET, inputs[i]);
+        }
+    }
+    free(inputs);
+    if (list.count == 0) {
+        fprintf(stderr, GET_COLOR(RED)"İşlenecek dosya yok.\n"RESET);
+        return 1;
+    }
+
+    ThreadPool pool;
+    if (!threadpool_create(&pool, jobs)) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Thread oluşturma hatası!\n"RESET);
+        offline_free_jobs(&list);
+        return 1;
+    }
+    printf(GET_COLOR(BRIGHT_CYAN)"[TOPLU] %d dosya, %d işçi, %+d yarım ton, gürültü %.4f.\n"RESET,
+           list.count, pool.num_threads, config.n_steps, config.noise_amplitude);
+
+    double start = offline_now();
+    for (int i = 0; i < list.count; ++i) {
+        list.jobs[i].pool = &pool;
+        threadpool_submit(&pool, offline_run_job, &list.jobs[i]);
+    }
+    threadpool_wait(&pool);
+    threadpool_destroy(&pool);
+    double elapsed = offline_now() - start;
+
+    int failed = 0;
+    double audio_seconds = 0.0;
+    for (int i = 0; i < list.count; ++i) {
+        OfflineJob *job = &list.jobs[i];
+        if (job->status == OFFLINE_OK) {
+            double secs = job->sample_rate > 0 ? (double)job->frames / job->sample_rate : 0.0;
+            audio_seconds += secs;
+            printf(GET_COLOR(BRIGHT_GREEN)"[TAMAM] "RESET"%s → %s (%.1f sn ses, %d kanal, %d parça%s, %.2f sn)\n",
+                   job->in_path, job->out_path, secs, job->channels, job->segments,
+                   job->mapped ? ", mmap" : "", job->seconds);
+        } else {
+            failed++;
+            fprintf(stderr, GET_COLOR(RED)"[HATA] %s: %s%s%s\n"RESET, job->in_path,
+                    job->status == OFFLINE_ERR_OPEN_INPUT ? "giriş açılamadı" :
+                    job->status == OFFLINE_ERR_OPEN_OUTPUT ? "çıkış açılamadı" :
+                    job->status == OFFLINE_ERR_READ ? "okuma başarısız" :
+                    job->status == OFFLINE_ERR_WRITE ? "yazma başarısız" : "bellek ayırma hatası",
+                    job->error[0] ? " - " : "", job->error);
+        }
+    }
+    printf(GET_COLOR(BRIGHT_YELLOW)"[TOPLU] %d başarılı, %d başarısız. %.1f sn ses %.2f sn'de işlendi (gerçek zamanın %.0f katı).\n"RESET,
+           list.count - failed, failed, audio_seconds, elapsed, elapsed > 0 ? audio_seconds / elapsed : 0.0);
+
+    offline_free_jobs(&list);
+    return failed ? 1 : 0;
+}
+
 // ==================
 // 1. KAYDET → İŞLE → DİNLE → KAYDET Modu Fonksiyonu
 // ==================
 void record_process_play_save_mode() {
     PaStream *stream = NULL;
+    float *chunk = NULL;
     PaError err;
     int duration_seconds; // DEĞİŞİKLİK: Süre için yerel değişken
 
@@ -159,92 +930,145 @@ void record_process_play_save_mode() {
         return;
     }
 
-    long num_frames = SAMPLE_RATE * duration_seconds * NUM_CHANNELS;
-    float *recorded_samples = (float*) calloc(num_frames, sizeof(float));
+    OfflineConfig config = { PITCH_SHIFT_STEPS, NOISE_SHAPE, NOISE_AMPLITUDE, RESAMPLE_QUALITY, 0.0,
+                             settings.output_format, settings.dither,
+                             dsp_chain_engine(&settings.chain, settings.pitch_engine),
+                             settings.formant_steps, settings.chain };
+    OfflinePcmWriter writer;
+    RecordReader reader = { NULL, (long long)settings.sample_rate * duration_seconds, 0, paNoError };
+    long long frames_done = 0;
+    OfflineStatus status;
+
+    // İşlenmiş ses kayıt sırasında diske yazılır, bu yüzden bellek kullanımı süreye bağlı değildir.
+    SF_INFO sfinfo;
+    memset(&sfinfo, 0, sizeof(SF_INFO));
+    sfinfo.samplerate = settings.sample_rate;
+    sfinfo.channels = settings.channels;
+    sfinfo.format = SF_FORMAT_WAV | offline_pcm_subtype(settings.output_format);
 
-    if (!recorded_samples) {
+    SNDFILE *outfile = sf_open(RECORDING_FILENAME, SFM_WRITE, &sfinfo);
+    if (!outfile) {
+        fprintf(stderr, GET_COLOR(RED)"[HATA] '%s' dosyası açılamadı: %s\n"RESET, RECORDING_FILENAME, sf_strerror(NULL));
+        return;
+    }
+    memset(&writer, 0, sizeof(writer));
+    if (!offline_pcm_writer_init(&writer, outfile, &sfinfo, config.dither)) {
         fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
+        offline_pcm_writer_free(&writer);
+        sf_close(outfile);
         return;
     }
 
     printf(GET_COLOR(BRIGHT_CYAN)"[KAYIT] Konuşmaya başlayın (%d saniye)..."RESET"\n", duration_seconds);
 
-    err = Pa_OpenDefaultStream(&stream, NUM_CHANNELS, 0, paFloat32, SAMPLE_RATE, paFramesPerBufferUnspecified, NULL, NULL);
+    err = Pa_OpenDefaultStream(&stream, settings.channels, 0, paFloat32, settings.sample_rate, settings.frames_per_buffer, NULL, NULL);
     if (err != paNoError) goto error_record;
 
     err = Pa_StartStream(stream);
     if (err != paNoError) goto error_record;
 
-    err = Pa_ReadStream(stream, recorded_samples, num_frames);
-    if (err != paNoError) goto error_record;
+    reader.stream = stream;
+    status = offline_process_stream(&config, settings.sample_rate, settings.channels, record_read, &reader,
+                                    offline_pcm_write, &writer, &frames_done);
+    if (status == OFFLINE_ERR_READ) {
+        err = reader.err;
+        goto error_record;
+    }
 
     err = Pa_StopStream(stream);
     if (err != paNoError) goto error_record;
     err = Pa_CloseStream(stream);
     if (err != paNoError) goto error_record;
     stream = NULL;
+    offline_pcm_writer_free(&writer);
+    sf_close(outfile);
+    outfile = NULL;
 
+    if (reader.overflows > 0) {
+        fprintf(stderr, GET_COLOR(YELLOW)"[Uyarı-Giriş] Kayıt sırasında %ld giriş taşması.\n"RESET, reader.overflows);
+    }
+    if (status != OFFLINE_OK) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"[HATA] İşleme veya kaydetme %lld örnekten sonra başarısız oldu.\n"RESET, frames_done);
+        return;
+    }
     printf(GET_COLOR(BRIGHT_CYAN)"[KAYIT] Tamamlandı.\n"RESET);
-    printf(GET_COLOR(BRIGHT_YELLOW)"[İŞLEME] Ses işleniyor...\n"RESET);
+    printf(GET_COLOR(BRIGHT_GREEN)"[KAYIT] İşlenmiş ses '%s' dosyasına kaydedildi.\n"RESET, RECORDING_FILENAME);
 
-    simple_pitch_shift(recorded_samples, num_frames, SAMPLE_RATE, PITCH_SHIFT_STEPS);
+    printf(GET_COLOR(BRIGHT_MAGENTA)"[OYNATMA] İşlenmiş ses çalınıyor...\n"RESET);
 
-    for (long i = 0; i < num_frames; ++i) {
-        float noise = ((float)rand() / (float)RAND_MAX) * 0.006f - 0.003f;
-        recorded_samples[i] += noise;
-        if (recorded_samples[i] > 1.0f) recorded_samples[i] = 1.0f;
-        if (recorded_samples[i] < -1.0f) recorded_samples[i] = -1.0f;
+    // Kaydedilen dosyayı parça parça çal.
+    memset(&sfinfo, 0, sizeof(SF_INFO));
+    SNDFILE *infile = sf_open(RECORDING_FILENAME, SFM_READ, &sfinfo);
+    if (!infile) {
+        fprintf(stderr, GET_COLOR(RED)"[HATA] '%s' dosyası açılamadı: %s\n"RESET, RECORDING_FILENAME, sf_strerror(NULL));
+        return;
     }
 
-    printf(GET_COLOR(BRIGHT_MAGENTA)"[OYNATMA] İşlenmiş ses çalınıyor...\n"RESET);
+    chunk = (float*) malloc((size_t)OFFLINE_CHUNK * sfinfo.channels * sizeof(float));
+    if (!chunk) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
+        sf_close(infile);
+        return;
+    }
 
-    err = Pa_OpenDefaultStream(&stream, 0, NUM_CHANNELS, paFloat32, SAMPLE_RATE, paFramesPerBufferUnspecified, NULL, NULL);
+    err = Pa_OpenDefaultStream(&stream, 0, sfinfo.channels, paFloat32, sfinfo.samplerate, paFramesPerBufferUnspecified, NULL, NULL);
     if (err != paNoError) goto error_play;
 
     err = Pa_StartStream(stream);
     if (err != paNoError) goto error_play;
 
-    err = Pa_WriteStream(stream, recorded_samples, num_frames);
-    if (err != paNoError) goto error_play;
+    sf_count_t n;
+    while ((n = sf_readf_float(infile, chunk, OFFLINE_CHUNK)) > 0) {
+        err = Pa_WriteStream(stream, chunk, (unsigned long)n);
+        if (err != paNoError && err != paOutputUnderflowed) goto error_play;
+    }
 
     err = Pa_StopStream(stream);
     if (err != paNoError) goto error_play;
     err = Pa_CloseStream(stream);
     if (err != paNoError) goto error_play;
     stream = NULL;
+    sf_close(infile);
+    free(chunk);
 
     printf(GET_COLOR(BRIGHT_MAGENTA)"[OYNATMA] Tamamlandı.\n"RESET);
-
-    SF_INFO sfinfo;
-    memset(&sfinfo, 0, sizeof(SF_INFO));
-    sfinfo.samplerate = SAMPLE_RATE;
-    sfinfo.channels = NUM_CHANNELS;
-    sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
-
-    SNDFILE *outfile = sf_open(RECORDING_FILENAME, SFM_WRITE, &sfinfo);
-    if (!outfile) {
-        fprintf(stderr, GET_COLOR(RED)"[HATA] '%s' dosyası açılamadı: %s\n"RESET, RECORDING_FILENAME, sf_strerror(NULL));
-    } else {
-        sf_write_float(outfile, recorded_samples, num_frames);
-        sf_close(outfile);
-        printf(GET_COLOR(BRIGHT_GREEN)"[KAYIT] İşlenmiş ses '%s' dosyasına kaydedildi.\n"RESET, RECORDING_FILENAME);
-    }
-
-    free(recorded_samples);
     return;
 
 error_record:
     if (stream) Pa_CloseStream(stream);
+    offline_pcm_writer_free(&writer);
+    if (outfile) sf_close(outfile);
     fprintf(stderr, GET_COLOR(BRIGHT_RED)"PortAudio Kayıt Hatası: %s\n"RESET, Pa_GetErrorText(err));
-    free(recorded_samples);
     return;
 error_play:
     if (stream) Pa_CloseStream(stream);
+    sf_close(infile);
+    free(chunk);
     fprintf(stderr, GET_COLOR(BRIGHT_RED)"PortAudio Çalma Hatası: %s\n"RESET, Pa_GetErrorText(err));
-    free(recorded_samples);
     return;
 }
 
+// ==================
+// offline_process_stream() için Kayıt Okuyucu
+// ==================
+// Mikrofondan en fazla `max_frames` örnek okur ve istenen süre dolunca durur.
+// Giriş taşması kayıtta bir boşluk bırakır ama kaydı durdurmaz.
+sf_count_t record_read(void *ctx, float *frames, sf_count_t max_frames) {
+    RecordReader *reader = (RecordReader*)ctx;
+    sf_count_t n = reader->remaining < max_frames ? reader->remaining : max_frames;
+    if (n <= 0) return 0;
+
+    PaError err = Pa_ReadStream(reader->stream, frames, (unsigned long)n);
+    if (err == paInputOverflowed) {
+        reader->overflows++;
+    } else if (err != paNoError) {
+        reader->err = err;
+        return -1;
+    }
+    reader->remaining -= n;
+    return n;
+}
+
 // ==================
 // Ana Menü Fonksiyonu
 // ==================
@@ -267,253 +1091,396 @@ void display_menu() {
 // --- DİĞER FONKSİYONLAR (Değişiklik yapılmadı) ---
 
 // ==================
-// Realtime Buffer Fonksiyonları
+// PortAudio Callback Fonksiyonu
 // ==================
-void initialize_realtime_buffer(RealtimeBuffer *rb, long size) {
-    rb->buffer = (float*) calloc(size, sizeof(float));
-    if (!rb->buffer) {
-        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
-        exit(EXIT_FAILURE);
-    }
-    rb->buffer_size = size;
-    rb->read_idx = 0;
-    rb->write_idx = 0;
-    rb->terminate = false;
-    pthread_mutex_init(&rb->mutex, NULL);
-    pthread_cond_init(&rb->cond_data_available, NULL);
-    pthread_cond_init(&rb->cond_buffer_empty, NULL);
-}
-
-void destroy_realtime_buffer(RealtimeBuffer *rb) {
-    free(rb->buffer);
-    pthread_mutex_destroy(&rb->mutex);
-    pthread_cond_destroy(&rb->cond_data_available);
-    pthread_cond_destroy(&rb->cond_buffer_empty);
-}
-
-bool write_to_buffer(RealtimeBuffer *rb, const float *data, long frames) {
-    pthread_mutex_lock(&rb->mutex);
-    long current_data_size = (rb->write_idx - rb->read_idx + rb->buffer_size) % rb->buffer_size;
-    long free_space = rb->buffer_size - current_data_size - 1;
+int paCallback(const void *inputBufferPtr, void *outputBufferPtr,
+               unsigned long framesPerBuffer,
+               const PaStreamCallbackTimeInfo* timeInfo,
+               PaStreamCallbackFlags statusFlags,
+               void *userData) {
+    float *out = (float*)outputBufferPtr;
+    const float *in = (const float*)inputBufferPtr;
+    RealtimeProcessor *proc = (RealtimeProcessor*)userData;
+    // Bir kez okunur: direct_process() aşağıda işleyici thread'e devredebilir.
+    bool direct = proc->direct && in != NULL && out != NULL && (long)framesPerBuffer <= proc->frames;
+    uint64_t start = metrics_now_ns();
+
+    // Burada stdio yok: sorunlar yalnızca sayılır, raporlayıcı thread yazdırır.
+    metrics_count(&metrics.callbacks);
+    if (statusFlags & paInputOverflow) metrics_count(&metrics.input_overflows);
+    if (statusFlags & paOutputUnderflow) metrics_count(&metrics.output_underflows);
+
+    if (direct) {
+        direct_process(proc, in, out, framesPerBuffer);
+    } else {
+        // Hiçbir çağrı bloklamaz: dolu giriş tamponu tüm bloğu düşürür (asla bir
+        // örneğin bir kısmını değil), boş çıkış tamponu sessizlikle doldurulur. Her
+        // iki durum da tampon tarafından sayılır. Gecikme denetleyicisi çıkış
+        // tamponunu hedef derinliğinin yakınında tutar.
+        if (inputBufferPtr != NULL) {
+            size_t frames = framesPerBuffer * settings.channels;
+            // Yazmadan önce damgalanır; işleyici yeni bloğu hiçbir zaman eski zamanla görmez.
+            metrics_set(&metrics.input_written_ns, metrics_now_ns());
+            if (!rb_write_all(&inputBuffer, in, frames)) metrics_count(&metrics.input_drops);
+            metrics_observe(&metrics.input_fill, rb_available(&inputBuffer) * 100 / inputBuffer.capacity);
+        }
 
-    while (free_space < frames && !rb->terminate) {
-        pthread_cond_wait(&rb->cond_buffer_empty, &rb->mutex);
-        current_data_size = (rb->write_idx - rb->read_idx + rb->buffer_size) % rb->buffer_size;
-        free_space = rb->buffer_size - current_data_size - 1;
+        if (outputBufferPtr != NULL) {
+            metrics_observe(&metrics.output_fill, rb_available(&outputBuffer) * 100 / outputBuffer.capacity);
+            if (!latency_read(&latency, &outputBuffer, out, (long)framesPerBuffer)) metrics_count(&metrics.output_gaps);
+            metrics_set(&metrics.trimmed_frames, latency.trimmed_frames);
+            metrics_set(&metrics.target_widenings, latency.widenings);
+            metrics_set(&metrics.buffer_target_ns, (uint64_t)(1e9 * latency.target / settings.sample_rate));
+        }
     }
 
-    if (rb->terminate) {
-        pthread_mutex_unlock(&rb->mutex);
-        return false;
+    // Girişten çıkışa gecikme tahmini: cihaz gecikmesi, iki tamponda bekleyenler
+    // (doğrudan modda hiçbir şey), DSP gecikmesi.
+    if (timeInfo && inputBufferPtr != NULL && outputBufferPtr != NULL) {
+        double device = timeInfo->outputBufferDacTime - timeInfo->inputBufferAdcTime;
+        double queued = direct ? 0.0 :
+            (double)(rb_available(&inputBuffer) + rb_available(&outputBuffer)) / (settings.channels * settings.sample_rate);
+        double total = (device > 0.0 ? device : 0.0) + queued;
+        uint64_t latency_ns = (uint64_t)(total * 1e9) + metrics.fixed_latency_ns;
+        metrics_observe(&metrics.latency, latency_ns);
+        metrics_set(&metrics.latency_now_ns, latency_ns);
     }
 
-    for (long i = 0; i < frames; ++i) {
-        rb->buffer[rb->write_idx] = data[i];
-        rb->write_idx = (rb->write_idx + 1) % rb->buffer_size;
+    metrics_observe(&metrics.callback_time, metrics_now_ns() - start);
+
+    if (atomic_load(&inputBuffer.terminate) || atomic_load(&outputBuffer.terminate)) {
+         return paComplete;
     }
 
-    pthread_cond_signal(&rb->cond_data_available);
-    pthread_mutex_unlock(&rb->mutex);
-    return true;
+    return paContinue;
 }
 
-bool read_from_buffer(RealtimeBuffer *rb, float *data, long frames) {
-    pthread_mutex_lock(&rb->mutex);
-    long current_data_size = (rb->write_idx - rb->read_idx + rb->buffer_size) % rb->buffer_size;
-
-    while (current_data_size < frames && !rb->terminate) {
-        pthread_cond_wait(&rb->cond_data_available, &rb->mutex);
-        current_data_size = (rb->write_idx - rb->read_idx + rb->buffer_size) % rb->buffer_size;
-    }
-
-    if (rb->terminate) {
-        pthread_mutex_unlock(&rb->mutex);
-        return false;
+// ==================
+// Doğrudan (Callback İçi) İşleme
+// ==================
+// Zinciri cihazın giriş tamponundan doğrudan çıkış tamponuna çalıştırır:
+// halka tampon yok, thread devri yok, fazladan kopya yok. Yalnızca callback'ten
+// çağrılır. Art arda DIRECT_OVERRUNS blok bütçeyi aşarsa `direct` bayrağını
+// temizler; sonraki bloktan itibaren callback yine tamponları besler ve o ana
+// kadar boşta bekleyen işleyici thread aynı DSP durumuyla devam eder.
+void direct_process(RealtimeProcessor *proc, const float *in, float *out, unsigned long frames) {
+    uint64_t start = metrics_now_ns();
+    dsp_process_interleaved(proc->dsp, proc->channels, in, out, (long)frames);
+    if (proc->recorder) stream_recorder_push(proc->recorder, out, frames * proc->channels);
+    uint64_t cost = metrics_now_ns() - start;
+    metrics_observe(&metrics.process_time, cost);
+    metrics_count(&metrics.direct_blocks);
+    if (settings.vad.mode != VAD_OFF) metrics_observe_vad(&metrics, dsp_skipped(proc->dsp, proc->channels), cost);
+
+    proc->overruns = cost > proc->budget_ns ? proc->overruns + 1 : 0;
+    if (proc->overruns >= DIRECT_OVERRUNS) {
+        proc->direct = false;
+        metrics_count(&metrics.direct_fallbacks);
     }
+}
 
-    for (long i = 0; i < frames; ++i) {
-        data[i] = rb->buffer[rb->read_idx];
-        rb->read_idx = (rb->read_idx + 1) % rb->buffer_size;
+// Zincir ısındıktan sonra birkaç sessiz bloğun en yavaşı. Akış başlamadan
+// çalışır; proc->block sıfırlanmış olarak kalır.
+uint64_t measure_chain_cost(RealtimeProcessor *proc) {
+    uint64_t worst = 0;
+    // Algılayıcı açıkken sessiz bloklar zinciri atlar; tüm zincirin süresini ölç.
+    for (int ch = 0; ch < proc->channels; ++ch) proc->dsp[ch].vad.config.mode = VAD_OFF;
+    for (int i = 0; i < 16; ++i) {
+        uint64_t start = metrics_now_ns();
+        dsp_process_interleaved(proc->dsp, proc->channels, proc->block, proc->block, proc->frames);
+        uint64_t cost = metrics_now_ns() - start;
+        if (i >= 4 && cost > worst) worst = cost;
     }
-
-    pthread_cond_signal(&rb->cond_buffer_empty);
-    pthread_mutex_unlock(&rb->mutex);
-    return true;
+    for (int ch = 0; ch < proc->channels; ++ch) proc->dsp[ch].vad.config.mode = settings.vad.mode;
+    memset(proc->block, 0, (size_t)proc->frames * proc->channels * sizeof(float));
+    return worst;
 }
 
 // ==================
-// PortAudio Callback Fonksiyonu
+// Gerçek Zamanlı Zamanlama
 // ==================
-int paCallback(const void *inputBufferPtr, void *outputBufferPtr,
-               unsigned long framesPerBuffer,
-               const PaStreamCallbackTimeInfo* timeInfo,
-               PaStreamCallbackFlags statusFlags,
-               void *userData) {
-    float *out = (float*)outputBufferPtr;
-    const float *in = (const float*)inputBufferPtr;
-
-    if (statusFlags & paInputOverflow) fprintf(stderr, GET_COLOR(YELLOW)"[Uyarı-Giriş] Giriş taşması.\n"RESET);
-    if (statusFlags & paOutputUnderflow) fprintf(stderr, GET_COLOR(YELLOW)"[Uyarı-Çıkış] Çıkış yetersizliği.\n"RESET);
-
-    if (inputBufferPtr != NULL) {
-        if (!write_to_buffer(&inputBuffer, in, framesPerBuffer * NUM_CHANNELS)) {
-            return paComplete;
+// İşleyici thread tarafından kendisi için çağrılır. Hiçbiri ölümcül değildir:
+// yetki yoksa thread normal zamanlamada kalır ve bunu bildirir.
+void apply_thread_scheduling(const RtSchedConfig *sched) {
+    if (sched->policy != SCHED_OTHER) {
+        int err = rt_set_scheduling(pthread_self(), sched->policy, sched->priority);
+        if (err == 0) {
+            printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] İşleyici thread zamanlaması: %s, öncelik %d\n"RESET,
+                   rt_policy_name(sched->policy), sched->priority);
+        } else if (err == EPERM) {
+            printf(GET_COLOR(YELLOW)"[UYARI] %s öncelik %d için izin yok; işleyici thread normal zamanlamada kalıyor. "
+                   "CAP_SYS_NICE veya bir rtprio sınırı verin (/etc/security/limits.conf).\n"RESET,
+                   rt_policy_name(sched->policy), sched->priority);
+        } else {
+            printf(GET_COLOR(YELLOW)"[UYARI] %s öncelik %d ayarlanamadı (%s); işleyici thread normal zamanlamada kalıyor.\n"RESET,
+                   rt_policy_name(sched->policy), sched->priority, strerror(err));
         }
     }
-
-    if (outputBufferPtr != NULL) {
-        if (!read_from_buffer(&outputBuffer, out, framesPerBuffer * NUM_CHANNELS)) {
-            return paComplete;
-        }
-    } else {
-        for (unsigned int i = 0; i < framesPerBuffer * NUM_CHANNELS; i++) {
-            out[i] = 0;
+    if (sched->cpus) {
+        int err = rt_set_affinity(pthread_self(), sched->cpus);
+        if (err == 0) {
+            printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] İşleyici thread %s numaralı CPU'lara sabitlendi\n"RESET, sched->cpus);
+        } else if (err == EINVAL) {
+            printf(GET_COLOR(YELLOW)"[UYARI] '%s' CPU listesi geçersiz veya kullanılabilir CPU içermiyor; işleyici thread sabitlenmedi.\n"RESET,
+                   sched->cpus);
+        } else {
+            printf(GET_COLOR(YELLOW)"[UYARI] İşleyici thread %s numaralı CPU'lara sabitlenemedi (%s).\n"RESET,
+                   sched->cpus, strerror(err));
         }
     }
+}
 
-    if (inputBuffer.terminate || outputBuffer.terminate) {
-         return paComplete;
+// Süreci bellekte kilitler ve akışın kullandığı her tamponun sayfalarına
+// dokunur; böylece akış başladıktan sonra ses thread'leri sayfa hatası almaz.
+// Kilitleme başarısız olsa da tamponlar önceden sayfalanır. Bellek
+// kilitlendiyse true döndürür.
+bool lock_realtime_memory(RealtimeProcessor *proc) {
+    int err = rt_lock_memory();
+    if (err == 0) {
+        printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] Bellek kilitlendi; tamponlar önceden sayfalandı.\n"RESET);
+    } else {
+        printf(GET_COLOR(YELLOW)"[UYARI] Bellek kilitlenemedi (%s); tamponlar önceden sayfalandı ama diske atılabilir. "
+               "memlock sınırını yükseltin (ulimit -l) veya CAP_IPC_LOCK verin.\n"RESET, strerror(err));
     }
 
-    return paContinue;
+    rt_prefault(inputBuffer.buffer, inputBuffer.capacity * sizeof(float));
+    rt_prefault(outputBuffer.buffer, outputBuffer.capacity * sizeof(float));
+    rt_prefault(latency.scratch, (size_t)2 * latency.block * latency.channels * sizeof(float));
+    rt_prefault(proc->block, (size_t)proc->frames * proc->channels * sizeof(float));
+    if (proc->recorder) rt_prefault(proc->recorder->ring.buffer, proc->recorder->ring.capacity * sizeof(float));
+    for (int ch = 0; ch < proc->channels; ++ch) dsp_prefault(&proc->dsp[ch], rt_prefault);
+    return err == 0;
+}
+
+// ==================
+// Gerçek Zamanlı Durum Satırı
+// ==================
+// Ses thread'lerinden değil, metrik raporlayıcı thread'inden çağrılır.
+void print_stats(const MetricsSnapshot *s, void *ctx) {
+    (void)ctx;
+    char vad[64] = "";
+    if (s->vad_blocks) snprintf(vad, sizeof(vad), " | sessizlik %%%.0f (%.1f sn kazanıldı)", s->silence_ratio * 100, s->vad_saved);
+    printf(GET_COLOR(BRIGHT_BLACK)"[İSTAT] %6.0f sn | callback p99 %.0f us (en çok %.0f) | dsp p99 %.0f us | uyanma p99 %.0f us | gecikme %.1f ms (p99 %.1f, tampon hedefi %.1f) | tampon giriş %%%.0f, çıkış %%%.0f | xrun +%llu%s\n"RESET,
+           s->uptime, s->callback_time.p99 * 1e6, s->callback_time.max * 1e6, s->process_time.p99 * 1e6, s->wake_time.p99 * 1e6,
+           s->latency_now * 1e3, s->latency.p99 * 1e3, s->buffer_target * 1e3,
+           s->input_fill.p50, s->output_fill.p50, (unsigned long long)s->new_xruns, vad);
+    fflush(stdout);
 }
 
 // ==================
 // Realtime Processor Thread Fonksiyonu
 // ==================
 void *realtime_processor_thread(void *arg) {
-    (void)arg;
+    RealtimeProcessor *proc = (RealtimeProcessor*)arg;
+    DspContext *dsp = &proc->dsp[0];
+    const size_t block = (size_t)proc->frames * proc->channels;
+    char chain[256];
+    dsp_chain_format(&dsp->chain, chain, sizeof(chain));
     printf(GET_COLOR(BRIGHT_BLUE)"[GERÇEK ZAMANLI] Ses İşleyici Başlatıldı.\n"RESET);
-
-    float *input_block = (float*) malloc(FRAMES_PER_BUFFER * NUM_CHANNELS * sizeof(float));
-    float *processed_block = (float*) malloc(FRAMES_PER_BUFFER * NUM_CHANNELS * sizeof(float));
-    if (!input_block || !processed_block) {
-        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
-        exit(EXIT_FAILURE);
+    printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] %d Hz, %d kanal, %ld örneklik bloklar (%.1f ms)\n"RESET,
+           settings.sample_rate, proc->channels, proc->frames, 1000.0 * proc->frames / settings.sample_rate);
+    printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] Pitch shifter: %s, gecikme %ld örnek (%.1f ms)\n"RESET,
+           pitch_engine_name(dsp->engine), dsp_latency(dsp), 1000.0 * dsp_latency(dsp) / settings.sample_rate);
+    printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] Zincir: %s (%d geçiş)\n"RESET, chain, dsp->n_passes);
+    if (dsp->vad.config.mode != VAD_OFF) {
+        printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] VAD: %s, %.0f dBFS altı%s, bekleme %.0f ms (%s)\n"RESET,
+               vad_mode_name(dsp->vad.config.mode), dsp->vad.config.threshold_db,
+               dsp->vad.config.flatness ? " veya düz spektrum" : "", 1000.0 * dsp->vad.hangover / settings.sample_rate,
+               dsp->vad.kernel_name);
     }
-
-    while (!inputBuffer.terminate) {
-        if (!read_from_buffer(&inputBuffer, input_block, FRAMES_PER_BUFFER * NUM_CHANNELS)) {
-            break;
-        }
-
-        simple_pitch_shift(input_block, FRAMES_PER_BUFFER * NUM_CHANNELS, SAMPLE_RATE, PITCH_SHIFT_STEPS);
-
-        for (unsigned int i = 0; i < FRAMES_PER_BUFFER * NUM_CHANNELS; ++i) {
-            float noise = ((float)rand() / (float)RAND_MAX) * 0.006f - 0.003f;
-            processed_block[i] = input_block[i] + noise;
-            if (processed_block[i] > 1.0f) processed_block[i] = 1.0f;
-            if (processed_block[i] < -1.0f) processed_block[i] = -1.0f;
-        }
-
-        if (!write_to_buffer(&outputBuffer, processed_block, FRAMES_PER_BUFFER * NUM_CHANNELS)) {
-            break;
+    printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] Gürültü çekirdeği: %s, interpolasyon: %s (%s)\n"RESET, dsp->noise_kernel_name,
+           resample_quality_name(dsp->shifter.resampler.quality), dsp->shifter.resampler.use_avx2 ? "avx2" : "scalar");
+
+    apply_thread_scheduling(proc->sched);
+    if (proc->sched->lock_memory) rt_prefault_stack();
+    // Sayfa hataları buradan itibaren sayılır; metrikler yalnızca akış sırasındakileri gösterir.
+    uint64_t minor_start = 0, major_start = 0, minor, major;
+    bool count_faults = rt_thread_faults(&minor_start, &major_start);
+
+    // Buradan sonra döngü heap kullanmamalı (-DVOICEMASK_ALLOC_GUARD ile denetlenir).
+    alloc_guard_arm();
+    while (rb_wait(&inputBuffer, block)) {
+        uint64_t start = metrics_now_ns();
+        uint64_t written = atomic_load_explicit(&metrics.input_written_ns, memory_order_relaxed);
+        if (start > written) metrics_observe(&metrics.wake_time, start - written);
+        rb_read(&inputBuffer, proc->block, block);
+        dsp_process_interleaved(proc->dsp, proc->channels, proc->block, proc->block, proc->frames);
+        uint64_t cost = metrics_now_ns() - start;
+        metrics_observe(&metrics.process_time, cost);
+        if (settings.vad.mode != VAD_OFF) metrics_observe_vad(&metrics, dsp_skipped(proc->dsp, proc->channels), cost);
+        rb_write_all(&outputBuffer, proc->block, block);
+        if (proc->recorder) stream_recorder_push(proc->recorder, proc->block, block);
+        if (count_faults && rt_thread_faults(&minor, &major)) {
+            metrics_set(&metrics.minor_faults, minor - minor_start);
+            metrics_set(&metrics.major_faults, major - major_start);
         }
     }
+    alloc_guard_disarm();
 
-    free(input_block);
-    free(processed_block);
     printf(GET_COLOR(BRIGHT_BLUE)"[GERÇEK ZAMANLI] Ses İşleyici Sonlandırıldı.\n"RESET);
     return NULL;
 }
 
 // ==================
-// Basit Pitch Shift Fonksiyonu
+// Mod 2: Gerçek Zamanlı
 // ==================
-void simple_pitch_shift(float *data, long num_frames, int sample_rate, int n_steps) {
-    float pitch_factor = powf(2.0f, (float)n_steps / 12.0f);
-    float current_sample_pos = 0.0f;
-    float *temp_buffer = (float*) calloc(num_frames, sizeof(float));
-    if (!temp_buffer) {
-        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası! Pitch shift yapılamadı.\n"RESET);
+// Tamponlar, DSP bağlamları ve işleyicinin bloğu `settings` değerlerine göre boyutlanır;
+// bağlamlar `dsp_config` ile tanımlanan zinciri çalıştırır.
+void realtime_mode(AudioBackend *backend, const RealtimeOptions *options, const OfflineConfig *dsp_config) {
+    pthread_t processor_tid;
+    MetricsReporter reporter;
+    StreamRecorder recorder;
+    RealtimeProcessor proc = { NULL, settings.channels, settings.frames_per_buffer, NULL, false, 0, 0, &options->sched, NULL };
+    const size_t block = (size_t)proc.frames * proc.channels;
+    int ready = 0;
+    bool memory_locked = false;
+
+    if (!latency_init(&latency, settings.sample_rate, proc.channels, proc.frames, LATENCY_TARGET_MS, LATENCY_MAX_MS)) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
         return;
     }
-
-    for (long i = 0; i < num_frames; ++i) {
-        long idx1 = (long)floorf(current_sample_pos);
-        long idx2 = idx1 + 1;
-        float fraction = current_sample_pos - idx1;
-
-        if (idx2 >= num_frames) {
-            temp_buffer[i] = data[idx1];
+    if (!rb_init(&inputBuffer, latency_ring_samples(&latency))) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
+        latency_free(&latency);
+        return;
+    }
+    if (!rb_init(&outputBuffer, latency_ring_samples(&latency))) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
+        rb_destroy(&inputBuffer);
+        latency_free(&latency);
+        return;
+    }
+    proc.dsp = (DspContext*) calloc(proc.channels, sizeof(DspContext));
+    proc.block = (float*) calloc(block, sizeof(float));
+    if (proc.dsp && proc.block) {
+        for (; ready < proc.channels; ++ready) {
+            if (!dsp_init(&proc.dsp[ready], settings.sample_rate, dsp_config->n_steps, proc.frames)) break;
+            if (!dsp_set_pitch_engine(&proc.dsp[ready], dsp_config->engine, dsp_config->formant_steps)) {
+                dsp_free(&proc.dsp[ready]);
+                break;
+            }
+            dsp_set_noise(&proc.dsp[ready], dsp_config->noise_shape, dsp_config->noise_amplitude);
+            dsp_set_chain(&proc.dsp[ready], &dsp_config->chain);
+            pitch_shifter_set_quality(&proc.dsp[ready].shifter, dsp_config->quality);
+            if (!dsp_set_vad(&proc.dsp[ready], &settings.vad)) {
+                dsp_free(&proc.dsp[ready]);
+                break;
+            }
+        }
+    }
+    if (ready < proc.channels) {
+        fprintf(stderr, GET_COLOR(BRIGHT_RED)"Bellek ayırma hatası!\n"RESET);
+        goto cleanup_realtime;
+    }
+    metrics_init(&metrics, (uint64_t)(1e9 * dsp_latency(&proc.dsp[0]) / settings.sample_rate));
+
+    if (options->direct) {
+        proc.budget_ns = (uint64_t)(DIRECT_MAX_LOAD * 1e9 * proc.frames / settings.sample_rate);
+        uint64_t cost = measure_chain_cost(&proc);
+        proc.direct = cost <= proc.budget_ns;
+        if (proc.direct) {
+            printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] Doğrudan mod: zincir blok başına %.0f us bütçenin %.0f us'sini kullanıyor.\n"RESET,
+                   proc.budget_ns / 1e3, cost / 1e3);
         } else {
-            temp_buffer[i] = data[idx1] * (1.0f - fraction) + data[idx2] * fraction;
+            printf(GET_COLOR(YELLOW)"[GERÇEK ZAMANLI] Zincir blok başına %.0f us sürüyor, doğrudan mod bütçesi %.0f us; işleyici thread kullanılıyor.\n"RESET,
+                   cost / 1e3, proc.budget_ns / 1e3);
         }
+    }
 
-        current_sample_pos += pitch_factor;
-
-        if (current_sample_pos >= num_frames - 1) {
-            for (long j = i + 1; j < num_frames; ++j) {
-                temp_buffer[j] = 0.0f;
-            }
-            break;
+    if (options->record.path) {
+        if (!stream_recorder_start(&recorder, &options->record, settings.sample_rate, proc.channels, STREAM_QUEUE_SECONDS)) {
+            fprintf(stderr, GET_COLOR(BRIGHT_RED)"[HATA] Kayıt: %s\n"RESET, recorder.error);
+            goto cleanup_realtime;
         }
+        proc.recorder = &recorder;
+        printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] İşlenmiş akış %s dosyasına kaydediliyor (%s)\n"RESET,
+               recorder.current, stream_codec_name(options->record.codec));
     }
-    memcpy(data, temp_buffer, num_frames * sizeof(float));
-    free(temp_buffer);
-}
-
-// ==================
-// Mod 2: Gerçek Zamanlı
-// ==================
-void realtime_mode() {
-    PaStream *stream = NULL;
-    PaError err;
-    pthread_t processor_tid;
-    long buffer_frames = SAMPLE_RATE * 2 * NUM_CHANNELS;
 
-    initialize_realtime_buffer(&inputBuffer, buffer_frames);
-    initialize_realtime_buffer(&outputBuffer, buffer_frames);
+    // Çıkış tamponunu denetleyicinin hedef derinliğinden başlat.
+    for (long primed = 0; primed < latency_prime_frames(&latency); primed += proc.frames) {
+        rb_write_all(&outputBuffer, proc.block, block);
+    }
+    if (options->sched.lock_memory) memory_locked = lock_realtime_memory(&proc);
 
     printf(GET_COLOR(BRIGHT_GREEN)BOLD"*** GERÇEK ZAMANLI SES DEĞİŞTİRME MODU ***"RESET"\n");
     printf(GET_COLOR(BRIGHT_WHITE)"Mikrofon → Anonim Ses (Çıkmak için "GET_COLOR(RED)"Ctrl+C"GET_COLOR(BRIGHT_WHITE)")\n"RESET);
 
-    if (pthread_create(&processor_tid, NULL, realtime_processor_thread, NULL) != 0) {
+    if (pthread_create(&processor_tid, NULL, realtime_processor_thread, &proc) != 0) {
         fprintf(stderr, GET_COLOR(BRIGHT_RED)"Thread oluşturma hatası!\n"RESET);
         goto cleanup_realtime;
     }
 
-    err = Pa_OpenDefaultStream(&stream, NUM_CHANNELS, NUM_CHANNELS, paFloat32, SAMPLE_RATE, FRAMES_PER_BUFFER, paCallback, NULL);
-    if (err != paNoError) goto error_realtime;
+    if (!metrics_reporter_start(&reporter, &metrics, &inputBuffer, &outputBuffer, options->stats_interval,
+                                options->metrics_path, print_stats, NULL)) {
+        fprintf(stderr, GET_COLOR(YELLOW)"[UYARI] Metrik raporlayıcı başlatılamadı; onsuz devam ediliyor.\n"RESET);
+    }
 
-    err = Pa_StartStream(stream);
-    if (err != paNoError) goto error_realtime;
+    AudioStreamConfig config = { settings.sample_rate, settings.channels, (unsigned long)settings.frames_per_buffer,
+                                 paCallback, &proc };
+    if (!backend->open(backend, &config)) goto error_realtime;
+    if (!backend->start(backend)) goto error_realtime;
 
-    printf(GET_COLOR(BRIGHT_GREEN)"Gerçek zamanlı akış başladı... Konuşun ve işlenmiş sesi duyun.\n"RESET);
+    printf(GET_COLOR(BRIGHT_GREEN)"Gerçek zamanlı akış başladı (%s)... Konuşun ve işlenmiş sesi duyun.\n"RESET, backend->name);
 
-    while (Pa_IsStreamActive(stream) == 1) {
-        sleep(1);
+    // Akış, callback paComplete döndürene veya backend'in girişi bitene kadar
+    // (dosya backend'i) sürer; ses kartı akışı Ctrl+C'ye kadar sürer.
+    while (backend->is_active(backend)) {
+        usleep(100 * 1000);
     }
 
     printf(GET_COLOR(BRIGHT_RED)"Akış durduruldu.\n"RESET);
 
-    err = Pa_StopStream(stream);
-    if (err != paNoError) goto error_realtime;
-    err = Pa_CloseStream(stream);
-    if (err != paNoError) goto error_realtime;
-    stream = NULL;
+    if (backend->stop(backend)) goto close_realtime;
 
 error_realtime:
-    if (err != paNoError && err != paStreamIsStopped) {
-        fprintf(stderr, GET_COLOR(BRIGHT_RED)"PortAudio Gerçek Zamanlı Hata: %s\n"RESET, Pa_GetErrorText(err));
-    }
-    if (stream) {
-        Pa_AbortStream(stream);
-        Pa_CloseStream(stream);
+    fprintf(stderr, GET_COLOR(BRIGHT_RED)"Gerçek Zamanlı Hata (%s): %s\n"RESET, backend->name, backend->error);
+close_realtime:
+    backend->close(backend);
+    metrics_reporter_stop(&reporter);
+    if (reporter.export_failed) {
+        fprintf(stderr, GET_COLOR(YELLOW)"[UYARI] Metrik dosyası '%s' yazılamadı.\n"RESET, options->metrics_path);
     }
 
-    inputBuffer.terminate = true;
-    outputBuffer.terminate = true;
-    pthread_cond_broadcast(&inputBuffer.cond_data_available);
-    pthread_cond_broadcast(&inputBuffer.cond_buffer_empty);
-    pthread_cond_broadcast(&outputBuffer.cond_data_available);
-    pthread_cond_broadcast(&outputBuffer.cond_buffer_empty);
+    rb_terminate(&inputBuffer);
+    rb_terminate(&outputBuffer);
 
     pthread_join(processor_tid, NULL);
 
+    if (atomic_load(&metrics.direct_fallbacks) > 0) {
+        printf(GET_COLOR(YELLOW)"[GERÇEK ZAMANLI] Doğrudan mod %llu bloktan sonra işleyici thread'e geçti.\n"RESET,
+               (unsigned long long)atomic_load(&metrics.direct_blocks));
+    }
+
+    MetricsHistogramSnapshot wake;
+    metrics_histogram_snapshot(&metrics.wake_time, &wake);
+    if (wake.count > 0) {
+        printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] İşleyici uyanması: p50 %.0f us, p99 %.0f us, en çok %.0f us; akış sırasında sayfa hatası: %llu küçük, %llu büyük\n"RESET,
+               wake.p50 * 1e6, wake.p99 * 1e6, wake.max * 1e6,
+               (unsigned long long)atomic_load(&metrics.minor_faults), (unsigned long long)atomic_load(&metrics.major_faults));
+    }
+
+    printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] Düşürülen örnek (taşma): %lu, sessiz örnek (yetersizlik): %lu\n"RESET,
+           atomic_load(&inputBuffer.overflow_frames) + atomic_load(&outputBuffer.overflow_frames),
+           atomic_load(&outputBuffer.underflow_frames));
+
+    if (proc.recorder) {
+        stream_recorder_stop(&recorder);
+        printf(GET_COLOR(BRIGHT_BLACK)"[GERÇEK ZAMANLI] %.1f sn %d dosyaya kaydedildi, sonuncusu %s; yavaş kodlayıcı yüzünden düşürülen örnek: %llu\n"RESET,
+               (double)recorder.frames_written / settings.sample_rate, recorder.files, recorder.current,
+               stream_recorder_dropped(&recorder));
+        if (recorder.error[0]) fprintf(stderr, GET_COLOR(BRIGHT_RED)"[HATA] Kayıt: %s\n"RESET, recorder.error);
+    }
+
 cleanup_realtime:
-    destroy_realtime_buffer(&inputBuffer);
-    destroy_realtime_buffer(&outputBuffer);
+    if (proc.recorder) stream_recorder_stop(&recorder);
+    rb_destroy(&inputBuffer);
+    rb_destroy(&outputBuffer);
+    latency_free(&latency);
+    for (int ch = 0; ch < ready; ++ch) dsp_free(&proc.dsp[ch]);
+    free(proc.dsp);
+    free(proc.block);
+    if (memory_locked) rt_unlock_memory();
 }
 
 
@@ -0,0 +1,247 @@
+#ifndef VAD_H
+#define VAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "fft.h"
+#include "noise.h"
+
+// ==================
+// Voice Activity Detection
+// ==================
+// Decides per block whether anyone is speaking, so dsp_process() can skip the
+// pitch stage on silence. A block is speech when its energy is above
+// threshold_db (dBFS), or within VAD_UNVOICED_MARGIN dB of it with the high
+// zero-crossing rate of unvoiced consonants (s, f, sh), which are quiet but
+// busy. With flatness on, a block that passes but whose spectrum is nearly
+// flat (fans, hiss, other broadband noise) counts as silence after all.
+//
+// After speech the detector holds its decision for a hangover, at least the
+// pitch stage's delay, so word endings and the shifter's delayed output are
+// never cut off.
+//
+// Energy and zero crossings come from one pass over the block by an AVX2,
+// SSE2 or scalar kernel picked at init like noise.h's. Flatness costs one
+// VAD_FFT_SIZE-point FFT of the block's last frames, and only for blocks that
+// passed on energy.
+
+#define VAD_THRESHOLD_DB     -50.0f // default speech threshold, dBFS RMS
+#define VAD_UNVOICED_MARGIN  10.0f  // dB below the threshold that busy blocks may sit
+#define VAD_UNVOICED_ZCR     0.25f  // crossings per frame of an unvoiced consonant
+#define VAD_FLATNESS_NOISE   0.5f   // spectral flatness above which a block is noise
+#define VAD_HANGOVER_SECONDS 0.2
+#define VAD_FFT_SIZE         512
+
+// What a silent block turns into. The input is never passed through: below
+// the threshold it may still carry other people's voices.
+typedef enum {
+    VAD_OFF,      // every block runs the whole chain
+    VAD_NOISE,    // comfort noise from the chain's noise stage (silence without one)
+    VAD_SILENCE   // digital silence
+} VadMode;
+
+typedef struct {
+    VadMode mode;
+    float threshold_db;
+    bool flatness;       // also require a non-flat spectrum
+} VadConfig;
+
+#define VAD_CONFIG_DEFAULT { VAD_OFF, VAD_THRESHOLD_DB, false }
+
+// Sum of squares of x[0 .. n) and the number of sign changes between
+// neighbours.
+typedef void (*vad_stats_fn)(const float *x, long n, float *energy, long *crossings);
+
+typedef struct {
+    VadConfig config;
+    float threshold;           // mean square of threshold_db
+    float unvoiced_threshold;  // ... of threshold_db - VAD_UNVOICED_MARGIN
+    long hangover;             // frames speech is held after the last speech block
+    long hold;                 // hangover frames left
+    vad_stats_fn stats;
+    const char *kernel_name;
+    FftPlan fft;               // flatness only
+    float *window;             // flatness: Hann, NULL when off
+    float *frame, *re, *im;    // flatness scratch
+} Vad;
+
+// Returns false for an unknown name.
+static inline bool vad_mode_from_name(const char *name, VadMode *mode) {
+    if (strcmp(name, "off") == 0) *mode = VAD_OFF;
+    else if (strcmp(name, "noise") == 0) *mode = VAD_NOISE;
+    else if (strcmp(name, "silence") == 0) *mode = VAD_SILENCE;
+    else return false;
+    return true;
+}
+
+static inline const char *vad_mode_name(VadMode mode) {
+    return mode == VAD_NOISE ? "noise" : mode == VAD_SILENCE ? "silence" : "off";
+}
+
+// ------------------
+// Energy and zero-crossing kernels
+// ------------------
+static inline uint32_t vad_sign(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits >> 31;
+}
+
+// Energy of x[start .. n) and the crossings into each of those frames.
+static inline void vad_stats_from(const float *x, long start, long n, float *energy, long *crossings) {
+    float e0 = 0.0f, e1 = 0.0f, e2 = 0.0f, e3 = 0.0f;
+    long i = start, zc = 0;
+    for (; i + 4 <= n; i += 4) {
+        e0 += x[i] * x[i];
+        e1 += x[i + 1] * x[i + 1];
+        e2 += x[i + 2] * x[i + 2];
+        e3 += x[i + 3] * x[i + 3];
+    }
+    for (; i < n; ++i) e0 += x[i] * x[i];
+    for (i = start > 0 ? start : 1; i < n; ++i) zc += vad_sign(x[i]) ^ vad_sign(x[i - 1]);
+    *energy = (e0 + e1) + (e2 + e3);
+    *crossings = zc;
+}
+
+static void vad_stats_scalar(const float *x, long n, float *energy, long *crossings) {
+    vad_stats_from(x, 0, n, energy, crossings);
+}
+
+#ifdef NOISE_X86
+// Each step compares x[i ..] with x[i - 1 ..]: the sign bits of their XOR are
+// the crossings.
+__attribute__((target("sse2")))
+static void vad_stats_sse2(const float *x, long n, float *energy, long *crossings) {
+    __m128 e0 = _mm_setzero_ps(), e1 = _mm_setzero_ps();
+    long i = 1, zc = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 a0 = _mm_loadu_ps(x + i), a1 = _mm_loadu_ps(x + i + 4);
+        e0 = _mm_add_ps(e0, _mm_mul_ps(a0, a0));
+        e1 = _mm_add_ps(e1, _mm_mul_ps(a1, a1));
+        zc += __builtin_popcount((unsigned)_mm_movemask_ps(_mm_xor_ps(a0, _mm_loadu_ps(x + i - 1))));
+        zc += __builtin_popcount((unsigned)_mm_movemask_ps(_mm_xor_ps(a1, _mm_loadu_ps(x + i + 3))));
+    }
+    float lanes[4], tail;
+    long tail_zc;
+    _mm_storeu_ps(lanes, _mm_add_ps(e0, e1));
+    vad_stats_from(x, i, n, &tail, &tail_zc);
+    *energy = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + tail + (n > 0 ? x[0] * x[0] : 0.0f);
+    *crossings = zc + tail_zc;
+}
+
+__attribute__((target("avx2,popcnt")))
+static void vad_stats_avx2(const float *x, long n, float *energy, long *crossings) {
+    __m256 e = _mm256_setzero_ps();
+    long i = 1, zc = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(x + i);
+        e = _mm256_add_ps(e, _mm256_mul_ps(a, a));
+        zc += __builtin_popcount((unsigned)_mm256_movemask_ps(_mm256_xor_ps(a, _mm256_loadu_ps(x + i - 1))));
+    }
+    __m128 q = _mm_add_ps(_mm256_castps256_ps128(e), _mm256_extractf128_ps(e, 1));
+    float lanes[4], tail;
+    long tail_zc;
+    _mm_storeu_ps(lanes, q);
+    _mm256_zeroupper();
+    vad_stats_from(x, i, n, &tail, &tail_zc);
+    *energy = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + tail + (n > 0 ? x[0] * x[0] : 0.0f);
+    *crossings = zc + tail_zc;
+}
+#endif // NOISE_X86
+
+// Picks the widest kernel the running CPU supports.
+static inline vad_stats_fn vad_select_kernel(const char **name) {
+#ifdef NOISE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        if (name) *name = "avx2";
+        return vad_stats_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        if (name) *name = "sse2";
+        return vad_stats_sse2;
+    }
+#endif
+    if (name) *name = "scalar";
+    return vad_stats_scalar;
+}
+
+// ------------------
+// Detector
+// ------------------
+static inline void vad_free(Vad *vad) {
+    if (vad->window) fft_plan_free(&vad->fft);
+    free(vad->window);
+    vad->window = vad->frame = vad->re = vad->im = NULL;
+}
+
+// `min_hangover` is the delay of the chain in frames; the hangover is at least
+// twice that. Returns false if the flatness scratch cannot be allocated.
+static inline bool vad_init(Vad *vad, const VadConfig *config, int sample_rate, long min_hangover) {
+    memset(vad, 0, sizeof(*vad));
+    vad->config = *config;
+    vad->threshold = powf(10.0f, config->threshold_db / 10.0f);
+    vad->unvoiced_threshold = powf(10.0f, (config->threshold_db - VAD_UNVOICED_MARGIN) / 10.0f);
+    vad->hangover = (long)(VAD_HANGOVER_SECONDS * sample_rate);
+    if (vad->hangover < 2 * min_hangover) vad->hangover = 2 * min_hangover;
+    vad->hold = vad->hangover; // the stream starts as speech, the chain primes as usual
+    vad->stats = vad_select_kernel(&vad->kernel_name);
+    if (!config->flatness) return true;
+
+    // window, frame, then re and im with half + 1 bins each
+    vad->window = (float*) calloc(VAD_FFT_SIZE * 3 + 2, sizeof(float));
+    if (!vad->window || !fft_plan_init(&vad->fft, VAD_FFT_SIZE)) {
+        free(vad->window);
+        vad->window = NULL;
+        return false;
+    }
+    vad->frame = vad->window + VAD_FFT_SIZE;
+    vad->re = vad->frame + VAD_FFT_SIZE;
+    vad->im = vad->re + VAD_FFT_SIZE / 2 + 1;
+    for (int i = 0; i < VAD_FFT_SIZE; ++i) vad->window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / VAD_FFT_SIZE);
+    return true;
+}
+
+// Geometric over arithmetic mean of the power spectrum of the block's last
+// VAD_FFT_SIZE frames (zeros in front of shorter blocks), without DC: about
+// 0.56 for white noise, near 0 for voiced speech.
+static inline float vad_flatness(Vad *vad, const float *x, long n) {
+    const int size = VAD_FFT_SIZE, half = size / 2;
+    const long pad = n < size ? size - n : 0;
+    const float *tail = x + n - (size - pad);
+    memset(vad->frame, 0, (size_t)pad * sizeof(float));
+    for (long i = pad; i < size; ++i) vad->frame[i] = tail[i - pad] * vad->window[i];
+    fft_forward(&vad->fft, vad->frame, vad->re, vad->im);
+    double log_sum = 0.0, sum = 0.0;
+    for (int k = 1; k < half; ++k) {
+        double p = (double)vad->re[k] * vad->re[k] + (double)vad->im[k] * vad->im[k] + 1e-20;
+        log_sum += log(p);
+        sum += p;
+    }
+    return (float)(exp(log_sum / (half - 1)) / (sum / (half - 1)));
+}
+
+// True when the chain should process this block: speech, or within the
+// hangover after it.
+static inline bool vad_is_speech(Vad *vad, const float *x, long n) {
+    if (n <= 0) return vad->hold > 0;
+    float energy;
+    long crossings;
+    vad->stats(x, n, &energy, &crossings);
+    const float mean = energy / (float)n;
+    bool speech = mean >= vad->threshold ||
+                  (mean >= vad->unvoiced_threshold && crossings >= VAD_UNVOICED_ZCR * (float)n);
+    if (speech && vad->window && vad_flatness(vad, x, n) > VAD_FLATNESS_NOISE) speech = false;
+    if (speech) {
+        vad->hold = vad->hangover;
+        return true;
+    }
+    if (vad->hold <= 0) return false;
+    vad->hold -= n;
+    return true;
+}
+
+#endif // VAD_H
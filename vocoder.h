@@ -0,0 +1,389 @@
+#ifndef VOCODER_H
+#define VOCODER_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "fft.h"
+#include "lpc.h"
+
+// ==================
+// Phase Vocoder Pitch Shifter
+// ==================
+// Duration-preserving pitch shift in the frequency domain, the same kind of
+// processing librosa.effects.pitch_shift does in eng.py / tr.py. Every `hop`
+// input frames a Hann-windowed frame of `size` frames is transformed, each
+// spectral peak is moved to `ratio` times its measured frequency, and the
+// frame is transformed back and overlap-added.
+//
+// Peaks keep their neighbourhoods (phase locking, after Laroche and Dolson):
+// the bins between two peaks move with the nearer one, by the same whole
+// number of bins, and keep their phase relative to it. Only the peak's phase
+// is advanced from the previous frame, at the shifted frequency, so the
+// partials stay coherent instead of smearing ("phasiness").
+//
+// The FFT plan and both windows depend only on (size, hop); they are built
+// once per configuration and shared by every channel, stream and thread
+// (vocoder_plan_acquire()). Per-channel state is allocated in
+// phase_vocoder_init(); phase_vocoder_process() never allocates, takes any
+// block length and returns as many frames as it consumes, and runs at most
+// ceil(n / hop) transforms per call. The latency is size - hop frames.
+//
+// With formants enabled (phase_vocoder_set_formants()) the spectral envelope
+// is taken out of the shifted partials and put back at its own ratio: every
+// bin moved from k to j is scaled by E(j / formant_ratio) / E(k), where E is
+// the frame's LPC envelope (lpc.h). A formant ratio equal to `ratio` gives
+// the plain shift; 1 keeps the speaker's formants under the new pitch; any
+// other value moves pitch and formants independently. The gain is capped at
+// VOCODER_FORMANT_MAX_GAIN so noise in deep envelope valleys is not blown up.
+// The envelope is smooth, so it is evaluated on a grid VOCODER_ENVELOPE_STEP
+// times coarser than the frame's bins and interpolated. The stage adds about
+// 2 * hop * (order + 1) multiply-adds, an order^2 recursion and one small FFT
+// per frame, roughly 10 us at 48 kHz. With it the vocoder still needs about
+// 0.1 ms per 512-frame block (10.7 ms of audio), under 1% of one core per
+// channel; `bench --filter pitch` shows both variants side by side.
+
+#define VOCODER_FRAME_SECONDS 0.04 // rounded up to a power of two: 2048 frames at 44.1/48 kHz
+#define VOCODER_OVERLAP       4    // hop = size / VOCODER_OVERLAP
+#define VOCODER_MAX_PLANS     8
+#define VOCODER_PEAK_FLOOR    1e-4f // peaks below this share of the frame's loudest bin are ignored
+#define VOCODER_FORMANT_MAX_GAIN 8.0f // per-bin envelope correction cap (+18 dB)
+#define VOCODER_ENVELOPE_STEP 4    // frame bins per envelope grid point
+
+typedef struct {
+    int size;          // frame length, power of two
+    int hop;
+    FftPlan fft;
+    FftPlan envelope_fft; // size / VOCODER_ENVELOPE_STEP points
+    float *window;     // analysis: periodic Hann
+    float *synthesis;  // Hann scaled for unity overlap-add gain and the FFT's factor
+    int refs;          // users; an unused plan stays cached until its slot is needed
+} VocoderPlan;
+
+typedef struct {
+    VocoderPlan *plan;
+    float ratio;       // output/input frequency ratio, 2^(steps/12)
+    int rover;         // write position in in_fifo, from size - hop to size
+    float *in_fifo;    // last `size` input frames
+    float *out_fifo;   // `hop` finished output frames
+    float *accum;      // overlap-add accumulator, `size` frames
+    float *frame;      // windowed frame / synthesized frame
+    float *re, *im;    // this frame's spectrum, half + 1 bins each
+    float *power;
+    float *prev_re, *prev_im;   // previous frame's spectrum: measured frequencies
+    float *out_re, *out_im;     // shifted spectrum being built
+    float *synth_re, *synth_im; // previous shifted spectrum: phase continuity
+    int *peaks;        // bins of this frame's peaks
+    int *region_end;   // last bin that moves with each peak
+    LpcEstimator *lpc; // formant stage only, NULL when off
+    float formant_ratio;
+    float *absa;       // |A| of this frame: 1 / source envelope, half + 1 bins
+    float *target;     // envelope moved by formant_ratio, half + 1 bins
+    float *grid_absa, *grid_envelope; // the same on the envelope grid
+} PhaseVocoder;
+
+static VocoderPlan vocoder_plans[VOCODER_MAX_PLANS];
+static pthread_mutex_t vocoder_plan_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int vocoder_frame_size(int sample_rate) {
+    int size = 64;
+    while (size < sample_rate * VOCODER_FRAME_SECONDS) size <<= 1;
+    return size;
+}
+
+static inline void vocoder_plan_clear(VocoderPlan *plan) {
+    fft_plan_free(&plan->fft);
+    fft_plan_free(&plan->envelope_fft);
+    free(plan->window);
+    free(plan->synthesis);
+    memset(plan, 0, sizeof(*plan));
+}
+
+static inline bool vocoder_plan_build(VocoderPlan *plan, int size, int hop) {
+    memset(plan, 0, sizeof(*plan));
+    plan->window = (float*) malloc((size_t)size * sizeof(float));
+    plan->synthesis = (float*) malloc((size_t)size * sizeof(float));
+    const int grid = size / VOCODER_ENVELOPE_STEP > 2 * (LPC_MAX_ORDER + 1) ? size / VOCODER_ENVELOPE_STEP : size;
+    if (!plan->window || !plan->synthesis || !fft_plan_init(&plan->fft, size) ||
+        !fft_plan_init(&plan->envelope_fft, grid)) {
+        fft_plan_free(&plan->fft);
+        free(plan->window);
+        free(plan->synthesis);
+        plan->window = plan->synthesis = NULL;
+        return false;
+    }
+    for (int i = 0; i < size; ++i) plan->window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / size));
+    // Analysis times synthesis window summed over the overlapping frames; the
+    // same for every offset when hop divides size.
+    double gain = 0.0;
+    for (int i = 0; i < size; i += hop) gain += (double)plan->window[i] * plan->window[i];
+    gain = gain > 0.0 ? gain : 1.0;
+    for (int i = 0; i < size; ++i) plan->synthesis[i] = (float)(plan->window[i] / (gain * (size / 2)));
+    plan->size = size;
+    plan->hop = hop;
+    return true;
+}
+
+// Returns the shared plan for (size, hop), building it on first use; NULL if
+// it cannot be allocated or every slot holds a plan in use.
+static inline VocoderPlan *vocoder_plan_acquire(int size, int hop) {
+    VocoderPlan *plan = NULL, *unused = NULL, *empty = NULL;
+    pthread_mutex_lock(&vocoder_plan_mutex);
+    for (int i = 0; i < VOCODER_MAX_PLANS; ++i) {
+        VocoderPlan *p = &vocoder_plans[i];
+        if (p->size == size && p->hop == hop) plan = p;
+        else if (p->size == 0 && !empty) empty = p;
+        else if (p->size != 0 && p->refs == 0 && !unused) unused = p;
+    }
+    if (!plan) {
+        plan = empty ? empty : unused;
+        if (plan) {
+            if (plan->size) vocoder_plan_clear(plan);
+            if (!vocoder_plan_build(plan, size, hop)) plan = NULL;
+        }
+    }
+    if (plan) plan->refs++;
+    pthread_mutex_unlock(&vocoder_plan_mutex);
+    return plan;
+}
+
+static inline void vocoder_plan_release(VocoderPlan *plan) {
+    pthread_mutex_lock(&vocoder_plan_mutex);
+    plan->refs--;
+    pthread_mutex_unlock(&vocoder_plan_mutex);
+}
+
+static inline void phase_vocoder_free(PhaseVocoder *pv) {
+    if (!pv->plan) return;
+    vocoder_plan_release(pv->plan);
+    free(pv->in_fifo);
+    free(pv->peaks);
+    free(pv->region_end);
+    free(pv->lpc);
+    pv->lpc = NULL;
+    pv->plan = NULL;
+}
+
+static inline bool phase_vocoder_init(PhaseVocoder *pv, int sample_rate, int n_steps) {
+    memset(pv, 0, sizeof(*pv));
+    const int size = vocoder_frame_size(sample_rate);
+    const int hop = size / VOCODER_OVERLAP;
+    const int bins = size / 2 + 1;
+    pv->plan = vocoder_plan_acquire(size, hop);
+    if (!pv->plan) return false;
+    pv->ratio = (float)pow(2.0, (double)n_steps / 12.0);
+    pv->rover = size - hop;
+
+    // One block for all float state: fifos, accumulator, frame, then the bins.
+    size_t floats = (size_t)size * 3 + hop + (size_t)bins * 9;
+    pv->in_fifo = (float*) calloc(floats, sizeof(float));
+    pv->peaks = (int*) calloc(bins, sizeof(int));
+    pv->region_end = (int*) calloc(bins, sizeof(int));
+    if (!pv->in_fifo || !pv->peaks || !pv->region_end) {
+        phase_vocoder_free(pv);
+        return false;
+    }
+    pv->accum = pv->in_fifo + size;
+    pv->frame = pv->accum + size;
+    pv->out_fifo = pv->frame + size;
+    pv->re = pv->out_fifo + hop;
+    pv->im = pv->re + bins;
+    pv->power = pv->im + bins;
+    pv->prev_re = pv->power + bins;
+    pv->prev_im = pv->prev_re + bins;
+    pv->out_re = pv->prev_im + bins;
+    pv->out_im = pv->out_re + bins;
+    pv->synth_re = pv->out_im + bins;
+    pv->synth_im = pv->synth_re + bins;
+    return true;
+}
+
+// Enables the formant stage: the envelope moves by 2^(formant_steps / 12)
+// instead of with the pitch. Call after phase_vocoder_init(), before the first
+// block. Returns false on allocation failure; the vocoder then keeps the
+// plain shift.
+static inline bool phase_vocoder_set_formants(PhaseVocoder *pv, int sample_rate, float formant_steps) {
+    const int bins = pv->plan->size / 2 + 1;
+    const int grid_bins = pv->plan->envelope_fft.half + 1;
+    // The estimator and all four arrays in one block.
+    size_t bytes = sizeof(LpcEstimator) + ((size_t)bins + grid_bins) * 2 * sizeof(float);
+    LpcEstimator *lpc = (LpcEstimator*) malloc(bytes);
+    if (!lpc) return false;
+    lpc_init(lpc, sample_rate, pv->plan->size);
+    pv->absa = (float*)(lpc + 1);
+    pv->target = pv->absa + bins;
+    pv->grid_absa = pv->target + bins;
+    pv->grid_envelope = pv->grid_absa + grid_bins;
+    for (int k = 0; k < bins; ++k) pv->absa[k] = pv->target[k] = 1.0f;
+    pv->formant_ratio = (float)pow(2.0, formant_steps / 12.0);
+    pv->lpc = lpc;
+    return true;
+}
+
+// Linear interpolation of `grid` (last index `end`) at fractional index `pos`.
+static inline float vocoder_grid_at(const float *grid, int end, float pos) {
+    int k = (int)pos;
+    return k >= end ? grid[end] : grid[k] + (pos - k) * (grid[k + 1] - grid[k]);
+}
+
+// Envelope of the frame in in_fifo: absa from LPC, target the envelope read at
+// j / formant_ratio. Uses out_re/out_im and frame as scratch.
+static inline void phase_vocoder_envelope(PhaseVocoder *pv) {
+    const VocoderPlan *plan = pv->plan;
+    const int half = plan->size / 2, grid_end = plan->envelope_fft.half;
+    lpc_enter(pv->lpc, pv->in_fifo, plan->hop);
+    lpc_solve(pv->lpc);
+    lpc_inverse_envelope(pv->lpc, &plan->envelope_fft, pv->frame, pv->out_re, pv->out_im, pv->grid_absa);
+    for (int g = 0; g <= grid_end; ++g) pv->grid_envelope[g] = 1.0f / (pv->grid_absa[g] + 1e-9f);
+    const float scale = (float)grid_end / half, warp = scale / pv->formant_ratio;
+    for (int k = 0; k <= half; ++k) {
+        pv->absa[k] = vocoder_grid_at(pv->grid_absa, grid_end, k * scale);
+        pv->target[k] = vocoder_grid_at(pv->grid_envelope, grid_end, k * warp);
+    }
+}
+
+static inline long phase_vocoder_latency(const PhaseVocoder *pv) {
+    return pv->plan->size - pv->plan->hop;
+}
+
+static inline float vocoder_wrap(float phase) {
+    return phase - 2.0f * (float)M_PI * floorf((phase + (float)M_PI) * (float)(0.5 / M_PI));
+}
+
+// Analyses in_fifo, shifts the peaks and overlap-adds the result into accum.
+// Only the peaks need angles (three atan2f and one sincosf each); every other
+// bin is rotated by its peak's phasor, so the per-bin work is a complex
+// multiply-add.
+static inline void phase_vocoder_frame(PhaseVocoder *pv) {
+    const VocoderPlan *plan = pv->plan;
+    const int size = plan->size, hop = plan->hop, half = size / 2;
+    const float expected = 2.0f * (float)M_PI * hop / size; // phase advance of bin 1 per hop
+    float *re = pv->re, *im = pv->im, *power = pv->power;
+    float loudest = 0.0f;
+
+    for (int i = 0; i < size; ++i) pv->frame[i] = pv->in_fifo[i] * plan->window[i];
+    fft_forward(&plan->fft, pv->frame, re, im);
+    if (pv->lpc) phase_vocoder_envelope(pv);
+    for (int k = 0; k <= half; ++k) {
+        power[k] = re[k] * re[k] + im[k] * im[k];
+        if (power[k] > loudest) loudest = power[k];
+    }
+
+    // Peaks, and the region of bins each one carries along: the boundary
+    // between two peaks is the quietest bin between them.
+    int n_peaks = 0;
+    const float floor_power = loudest * VOCODER_PEAK_FLOOR * VOCODER_PEAK_FLOOR;
+    for (int k = 1; k < half; ++k) {
+        if (power[k] > floor_power && power[k] > power[k - 1] && power[k] >= power[k + 1]) pv->peaks[n_peaks++] = k;
+    }
+    for (int p = 0; p < n_peaks; ++p) {
+        int end = half;
+        if (p + 1 < n_peaks) {
+            end = pv->peaks[p] + 1;
+            for (int k = end + 1; k < pv->peaks[p + 1]; ++k) if (power[k] < power[end]) end = k;
+        }
+        pv->region_end[p] = end;
+    }
+
+    // Move every region with its peak. The peak's phase continues from the
+    // previous output frame at ratio times the measured frequency; the rest
+    // of the region keeps its phase relative to the peak.
+    memset(pv->out_re, 0, (size_t)(half + 1) * sizeof(float));
+    memset(pv->out_im, 0, (size_t)(half + 1) * sizeof(float));
+    int lo = 0;
+    for (int p = 0; p < n_peaks; ++p) {
+        const int peak = pv->peaks[p];
+        const int hi = pv->region_end[p];
+        const int target = (int)lrintf(peak * pv->ratio);
+        const int shift = target - peak;
+        if (target >= 1 && target < half) {
+            // Phase advance since the previous frame, unwrapped around the bin's centre frequency.
+            float dr = re[peak] * pv->prev_re[peak] + im[peak] * pv->prev_im[peak];
+            float di = im[peak] * pv->prev_re[peak] - re[peak] * pv->prev_im[peak];
+            float advance = peak * expected + vocoder_wrap(atan2f(di, dr) - peak * expected);
+            float peak_phase = atan2f(pv->synth_im[target], pv->synth_re[target]) + advance * pv->ratio;
+            float rotate = peak_phase - atan2f(im[peak], re[peak]);
+            float c = cosf(rotate), s = sinf(rotate);
+            int from = lo + shift < 0 ? -shift : lo;
+            int to = hi + shift > half ? half - shift : hi;
+            if (pv->lpc) {
+                const float *absa = pv->absa, *target = pv->target + shift;
+                for (int k = from; k <= to; ++k) {
+                    float g = target[k] * absa[k];
+                    g = g < VOCODER_FORMANT_MAX_GAIN ? g : VOCODER_FORMANT_MAX_GAIN;
+                    pv->out_re[k + shift] += g * (re[k] * c - im[k] * s);
+                    pv->out_im[k + shift] += g * (re[k] * s + im[k] * c);
+                }
+            } else {
+                for (int k = from; k <= to; ++k) {
+                    pv->out_re[k + shift] += re[k] * c - im[k] * s;
+                    pv->out_im[k + shift] += re[k] * s + im[k] * c;
+                }
+            }
+        }
+        lo = hi + 1;
+    }
+    pv->out_im[0] = pv->out_im[half] = 0.0f;
+    memcpy(pv->prev_re, re, (size_t)(half + 1) * sizeof(float));
+    memcpy(pv->prev_im, im, (size_t)(half + 1) * sizeof(float));
+    memcpy(pv->synth_re, pv->out_re, (size_t)(half + 1) * sizeof(float));
+    memcpy(pv->synth_im, pv->out_im, (size_t)(half + 1) * sizeof(float));
+
+    fft_inverse(&plan->fft, pv->out_re, pv->out_im, pv->frame);
+    for (int i = 0; i < size; ++i) pv->accum[i] += pv->frame[i] * plan->synthesis[i];
+    memcpy(pv->out_fifo, pv->accum, (size_t)hop * sizeof(float));
+    memmove(pv->accum, pv->accum + hop, (size_t)(size - hop) * sizeof(float));
+    memset(pv->accum + size - hop, 0, (size_t)hop * sizeof(float));
+    if (pv->lpc) lpc_leave(pv->lpc, pv->in_fifo, hop);
+    memmove(pv->in_fifo, pv->in_fifo + hop, (size_t)(size - hop) * sizeof(float));
+}
+
+// Takes `n` frames of input without producing output, for blocks whose output
+// is not needed. The input still moves through in_fifo, so the first frame
+// after a skip analyses real audio. Each skipped frame leaves the spectral
+// history and the accumulator as a frame of digital silence would, and makes
+// the formant stage rebuild its sums.
+static inline void phase_vocoder_skip(PhaseVocoder *pv, const float *in, long n) {
+    const int size = pv->plan->size, hop = pv->plan->hop, latency = size - hop, bins = size / 2 + 1;
+    long done = 0;
+    while (done < n) {
+        long m = size - pv->rover;
+        if (m > n - done) m = n - done;
+        memcpy(pv->in_fifo + pv->rover, in + done, (size_t)m * sizeof(float));
+        pv->rover += (int)m;
+        done += m;
+        if (pv->rover >= size) {
+            pv->rover = latency;
+            memset(pv->prev_re, 0, (size_t)bins * sizeof(float));
+            memset(pv->prev_im, 0, (size_t)bins * sizeof(float));
+            memset(pv->synth_re, 0, (size_t)bins * sizeof(float));
+            memset(pv->synth_im, 0, (size_t)bins * sizeof(float));
+            memset(pv->accum, 0, (size_t)size * sizeof(float));
+            memset(pv->out_fifo, 0, (size_t)hop * sizeof(float));
+            if (pv->lpc) pv->lpc->frames = LPC_REFRESH_FRAMES;
+            memmove(pv->in_fifo, pv->in_fifo + hop, (size_t)(size - hop) * sizeof(float));
+        }
+    }
+}
+
+// Shifts `n` frames from `in` into `out`. `in` and `out` may be the same buffer.
+static inline void phase_vocoder_process(PhaseVocoder *pv, const float *in, float *out, long n) {
+    const int size = pv->plan->size, latency = size - pv->plan->hop;
+    long done = 0;
+    while (done < n) {
+        long m = size - pv->rover;
+        if (m > n - done) m = n - done;
+        memcpy(pv->in_fifo + pv->rover, in + done, (size_t)m * sizeof(float));
+        memcpy(out + done, pv->out_fifo + (pv->rover - latency), (size_t)m * sizeof(float));
+        pv->rover += (int)m;
+        done += m;
+        if (pv->rover >= size) {
+            pv->rover = latency;
+            phase_vocoder_frame(pv);
+        }
+    }
+}
+
+#endif // VOCODER_H
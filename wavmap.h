@@ -0,0 +1,295 @@
+#ifndef WAVMAP_H
+#define WAVMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ==================
+// Memory-Mapped WAV
+// ==================
+// Fast path for the most common archive format: little-endian RIFF/WAVE with
+// 16/24/32-bit integer PCM or 32-bit float samples. The input file is mapped
+// read-only and its data chunk is used in place; the output file is created
+// at its final size (ftruncate + posix_fallocate, so a full disk is reported
+// here and not as SIGBUS later) and mapped writable. Float data is handed to
+// the DSP chain straight from one mapping to the other; integer data goes
+// through a small float buffer with the same scaling libsndfile uses, so both
+// paths give the same samples.
+//
+// wavmap_open() returns false for anything else (WAVE_FORMAT_EXTENSIBLE with
+// another subtype, 8-bit, 64-bit float, RF64, big-endian hosts, ...) and the
+// caller falls back to libsndfile. Truncating a file while it is mapped makes
+// the next access raise SIGBUS; the offline tools never do that to their own
+// files.
+
+typedef enum {
+    WAV_PCM16,
+    WAV_PCM24,
+    WAV_PCM32,
+    WAV_FLOAT
+} WavSampleFormat;
+
+typedef struct {
+    int fd;
+    unsigned char *base;   // whole file
+    size_t size;
+    unsigned char *data;   // first sample of the data chunk
+    long long frames;
+    int sample_rate;
+    int channels;
+    WavSampleFormat format;
+    int sample_bytes;
+} WavMap;
+
+static inline uint16_t wavmap_u16(const unsigned char *p) { return (uint16_t)(p[0] | p[1] << 8); }
+static inline uint32_t wavmap_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static inline void wavmap_put16(unsigned char *p, uint32_t v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); }
+static inline void wavmap_put32(unsigned char *p, uint32_t v) {
+    wavmap_put16(p, v);
+    wavmap_put16(p + 2, v >> 16);
+}
+
+// True when the samples can be used as a float array without conversion.
+static inline bool wavmap_is_float(const WavMap *map) {
+    return map->format == WAV_FLOAT && ((uintptr_t)map->data % sizeof(float)) == 0;
+}
+
+static inline float *wavmap_frames(const WavMap *map, long long first) {
+    return (float*)(map->data + (size_t)first * map->channels * map->sample_bytes);
+}
+
+// Asks the kernel to read frames [first, first + count) ahead. madvise()
+// takes page-aligned addresses only, so the range is widened to whole pages
+// of the mapping.
+static inline void wavmap_willneed(const WavMap *map, long long first, long long count) {
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = (uintptr_t)wavmap_frames(map, first) / page * page;
+    const uintptr_t end = (uintptr_t)wavmap_frames(map, first + count);
+    if (count > 0) madvise((void*)begin, end - begin, MADV_WILLNEED);
+}
+
+static inline void wavmap_close(WavMap *map) {
+    if (map->base) munmap(map->base, map->size);
+    if (map->fd >= 0) close(map->fd);
+    map->base = map->data = NULL;
+    map->fd = -1;
+}
+
+static inline bool wavmap_parse_fmt(WavMap *map, const unsigned char *fmt, uint32_t size) {
+    if (size < 16) return false;
+    uint16_t tag = wavmap_u16(fmt);
+    uint16_t bits = wavmap_u16(fmt + 14);
+    if (tag == 0xFFFE) {
+        // WAVE_FORMAT_EXTENSIBLE: the real tag is the first two bytes of the subtype GUID
+        if (size < 40) return false;
+        tag = wavmap_u16(fmt + 24);
+    }
+    map->channels = wavmap_u16(fmt + 2);
+    map->sample_rate = (int)wavmap_u32(fmt + 4);
+    if (map->channels < 1 || map->sample_rate < 1 || wavmap_u16(fmt + 12) != map->channels * bits / 8) return false;
+    if (tag == 1 && bits == 16) map->format = WAV_PCM16;
+    else if (tag == 1 && bits == 24) map->format = WAV_PCM24;
+    else if (tag == 1 && bits == 32) map->format = WAV_PCM32;
+    else if (tag == 3 && bits == 32) map->format = WAV_FLOAT;
+    else return false;
+    map->sample_bytes = bits / 8;
+    return true;
+}
+
+// Maps `path` if it is a WAV file this reader handles. `error` is only set
+// when the file could not be opened or mapped; for an unsupported layout the
+// function just returns false.
+static inline bool wavmap_open(WavMap *map, const char *path, char *error, size_t error_size) {
+    struct stat st;
+    memset(map, 0, sizeof(*map));
+    map->fd = -1;
+    error[0] = '\0';
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    (void)path;
+    (void)error_size;
+    return false;
+#else
+    map->fd = open(path, O_RDONLY);
+    if (map->fd < 0 || fstat(map->fd, &st) != 0) {
+        snprintf(error, error_size, "%s: %s", path, strerror(errno));
+        wavmap_close(map);
+        return false;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_size < 44) {
+        wavmap_close(map);
+        return false;
+    }
+    map->size = (size_t)st.st_size;
+    map->base = (unsigned char*) mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, map->fd, 0);
+    if (map->base == MAP_FAILED) {
+        snprintf(error, error_size, "%s: %s", path, strerror(errno));
+        map->base = NULL;
+        wavmap_close(map);
+        return false;
+    }
+    if (memcmp(map->base, "RIFF", 4) != 0 || memcmp(map->base + 8, "WAVE", 4) != 0) {
+        wavmap_close(map);
+        return false;
+    }
+
+    bool have_fmt = false;
+    size_t pos = 12;
+    while (pos + 8 <= map->size) {
+        const unsigned char *chunk = map->base + pos;
+        uint32_t size = wavmap_u32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (pos + 8 + size > map->size || !wavmap_parse_fmt(map, chunk + 8, size)) break;
+            have_fmt = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_fmt) break;
+            // A header left at 0 or 0xFFFFFFFF by an interrupted writer: take what is there.
+            size_t bytes = map->size - pos - 8;
+            if (size != 0 && size < bytes) bytes = size;
+            map->data = map->base + pos + 8;
+            map->frames = (long long)(bytes / ((size_t)map->channels * map->sample_bytes));
+            madvise(map->base, map->size, MADV_SEQUENTIAL);
+            return true;
+        }
+        pos += 8 + (size_t)size + (size & 1);
+    }
+    wavmap_close(map);
+    return false;
+#endif
+}
+
+// Creates `path` with room for `frames` frames in `format` and maps it.
+static inline bool wavmap_create(WavMap *map, const char *path, int sample_rate, int channels,
+                                 WavSampleFormat format, long long frames, char *error, size_t error_size) {
+    const int sample_bytes = format == WAV_PCM16 ? 2 : format == WAV_PCM24 ? 3 : 4;
+    const size_t header = format == WAV_FLOAT ? 56 : 44; // float adds the fact chunk non-PCM data needs
+    const uint64_t bytes = (uint64_t)frames * channels * sample_bytes;
+    memset(map, 0, sizeof(*map));
+    map->fd = -1;
+    if (bytes + header - 8 > UINT32_MAX) {
+        snprintf(error, error_size, "%s: too large for a WAV file", path);
+        return false;
+    }
+    map->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (map->fd < 0) {
+        snprintf(error, error_size, "%s: %s", path, strerror(errno));
+        return false;
+    }
+    map->size = header + (size_t)bytes;
+    int err = ftruncate(map->fd, (off_t)map->size) == 0 ? 0 : errno;
+    if (err == 0) {
+        err = posix_fallocate(map->fd, 0, (off_t)map->size);
+        if (err == EINVAL || err == EOPNOTSUPP) err = 0; // the file system cannot reserve; carry on sparse
+    }
+    if (err == 0) {
+        map->base = (unsigned char*) mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+        if (map->base == MAP_FAILED) {
+            err = errno;
+            map->base = NULL;
+        }
+    }
+    if (err != 0) {
+        snprintf(error, error_size, "%s: %s", path, strerror(err));
+        wavmap_close(map);
+        return false;
+    }
+
+    unsigned char *h = map->base;
+    const uint32_t block_align = (uint32_t)(channels * sample_bytes);
+    memcpy(h, "RIFF", 4);
+    wavmap_put32(h + 4, (uint32_t)(map->size - 8));
+    memcpy(h + 8, "WAVEfmt ", 8);
+    wavmap_put32(h + 16, 16);
+    wavmap_put16(h + 20, format == WAV_FLOAT ? 3 : 1);
+    wavmap_put16(h + 22, (uint32_t)channels);
+    wavmap_put32(h + 24, (uint32_t)sample_rate);
+    wavmap_put32(h + 28, (uint32_t)sample_rate * block_align);
+    wavmap_put16(h + 32, block_align);
+    wavmap_put16(h + 34, (uint32_t)sample_bytes * 8);
+    if (format == WAV_FLOAT) {
+        memcpy(h + 36, "fact", 4);
+        wavmap_put32(h + 40, 4);
+        wavmap_put32(h + 44, (uint32_t)frames);
+    }
+    memcpy(h + header - 8, "data", 4);
+    wavmap_put32(h + header - 4, (uint32_t)bytes);
+
+    map->data = h + header;
+    map->frames = frames;
+    map->sample_rate = sample_rate;
+    map->channels = channels;
+    map->format = format;
+    map->sample_bytes = sample_bytes;
+    madvise(map->base, map->size, MADV_SEQUENTIAL);
+    return true;
+}
+
+// Converts `n` frames starting at `first` to float, scaled as libsndfile does.
+static inline void wavmap_read_float(const WavMap *map, long long first, long n, float *out) {
+    const unsigned char *p = map->data + (size_t)first * map->channels * map->sample_bytes;
+    const long count = n * map->channels;
+    switch (map->format) {
+    case WAV_PCM16:
+        for (long i = 0; i < count; ++i) out[i] = (float)(int16_t)wavmap_u16(p + 2 * i) * (1.0f / 0x8000);
+        break;
+    case WAV_PCM24:
+        for (long i = 0; i < count; ++i) {
+            int32_t v = (int32_t)((uint32_t)p[3 * i] << 8 | (uint32_t)p[3 * i + 1] << 16 | (uint32_t)p[3 * i + 2] << 24);
+            out[i] = (float)(v >> 8) * (1.0f / 0x800000);
+        }
+        break;
+    case WAV_PCM32:
+        for (long i = 0; i < count; ++i) out[i] = (float)(int32_t)wavmap_u32(p + 4 * i) * (1.0f / 0x80000000u);
+        break;
+    case WAV_FLOAT:
+        memcpy(out, p, (size_t)count * sizeof(float));
+        break;
+    }
+}
+
+// Stores `n` float frames at frame `first`, rounded and saturated.
+static inline void wavmap_write_float(WavMap *map, long long first, const float *in, long n) {
+    unsigned char *p = map->data + (size_t)first * map->channels * map->sample_bytes;
+    const long count = n * map->channels;
+    switch (map->format) {
+    case WAV_PCM16:
+        for (long i = 0; i < count; ++i) {
+            float v = in[i] * 0x7FFF;
+            v = v < -0x8000 ? -0x8000 : v > 0x7FFF ? 0x7FFF : v;
+            wavmap_put16(p + 2 * i, (uint32_t)(int32_t)lrintf(v));
+        }
+        break;
+    case WAV_PCM24:
+        for (long i = 0; i < count; ++i) {
+            float v = in[i] * 0x7FFFFF;
+            v = v < -0x800000 ? -0x800000 : v > 0x7FFFFF ? 0x7FFFFF : v;
+            uint32_t s = (uint32_t)(int32_t)lrintf(v);
+            p[3 * i] = (unsigned char)s;
+            p[3 * i + 1] = (unsigned char)(s >> 8);
+            p[3 * i + 2] = (unsigned char)(s >> 16);
+        }
+        break;
+    case WAV_PCM32:
+        for (long i = 0; i < count; ++i) {
+            // 0x7FFFFFFF rounds to 2^31 as a float; anything at or above it saturates.
+            float v = in[i] * (float)0x7FFFFFFF;
+            int32_t s = v >= 2147483648.0f ? INT32_MAX : v <= -2147483648.0f ? INT32_MIN : (int32_t)lrintf(v);
+            wavmap_put32(p + 4 * i, (uint32_t)s);
+        }
+        break;
+    case WAV_FLOAT:
+        memcpy(p, in, (size_t)count * sizeof(float));
+        break;
+    }
+}
+
+#endif // WAVMAP_H